@@ -0,0 +1,130 @@
+// ===============================================================================================================
+// Microbenchmark of the queues of Server/concurrent_queue.h against the locked queue they replaced (a std::queue behind
+// a read_write_lock). P producer threads and P consumer threads move elements_amount ints through a single queue,
+// for P = 1, 4, 16 and 64. Prints the time per element (ns/op) of every queue.
+// It is not a part of the solution, build it from the repository directory:
+//     g++ -std=c++20 -O2 -pthread -I Server Benchmarks/concurrent_queue_benchmark.cpp -o concurrent_queue_benchmark
+//     cl /std:c++latest /O2 /EHsc /I Server Benchmarks\concurrent_queue_benchmark.cpp
+// Usage: concurrent_queue_benchmark [elements_amount = 2000000]
+// ===============================================================================================================
+
+#include <iostream>
+#include <iomanip>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include "concurrent_utility.h"
+#include "concurrent_queue.h"
+
+// The concurrent_queue of the server before the lock-free queues
+template <typename T>
+class locked_queue {
+public:
+    inline bool pop(T& value) {
+        write_lock w_lock(rw_lock);
+
+        if (queue_impl.empty()) {
+            return false;
+        }
+
+        value = std::move(queue_impl.front());
+        queue_impl.pop();
+        return true;
+    }
+
+    template <typename... arguments>
+    inline void emplace(arguments&&... parameters) {
+        write_lock w_lock(rw_lock);
+        queue_impl.emplace(std::forward<arguments>(parameters)...);
+    }
+
+private:
+    read_write_lock rw_lock;
+    std::queue<T> queue_impl;
+};
+
+// Returns the time per element in nanoseconds
+template <typename queue_type, typename push_function_type>
+inline double run_benchmark(std::size_t pairs_amount, std::size_t elements_amount, push_function_type push) {
+    queue_type queue;
+
+    std::size_t elements_per_producer = elements_amount / pairs_amount;
+    std::size_t total_elements = elements_per_producer * pairs_amount;
+
+    std::atomic<bool> started = false;
+    std::atomic<std::size_t> popped_amount = 0;
+
+    std::vector<std::thread> threads;
+    threads.reserve(pairs_amount * 2);
+
+    for (std::size_t producer_idx = 0; producer_idx < pairs_amount; ++producer_idx) {
+        threads.emplace_back([&] {
+            while (!started) {
+                std::this_thread::yield();
+            }
+
+            for (std::size_t element_idx = 0; element_idx < elements_per_producer; ++element_idx) {
+                push(queue, static_cast<int>(element_idx));
+            }
+        });
+    }
+
+    for (std::size_t consumer_idx = 0; consumer_idx < pairs_amount; ++consumer_idx) {
+        threads.emplace_back([&] {
+            while (!started) {
+                std::this_thread::yield();
+            }
+
+            int value;
+            while (popped_amount < total_elements) {
+                if (queue.pop(value)) {
+                    ++popped_amount;
+                }
+                else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    started = true;
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return static_cast<double>(time.count()) / total_elements;
+}
+
+int main(int argc, char* argv[]) {
+    std::size_t elements_amount = argc > 1 ? std::stoull(argv[1]) : 2'000'000;
+
+    std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << ", elements: " << elements_amount << "\n";
+    std::cout << "  pairs   locked (ns/op)   ring (ns/op)   segmented (ns/op)\n";
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (std::size_t pairs_amount : { 1, 4, 16, 64 }) {
+        double locked_time = run_benchmark<locked_queue<int>>(pairs_amount, elements_amount, [](auto& queue, int value) {
+            queue.emplace(value);
+        });
+        // The ring is bounded, a producer waits while it is full
+        double ring_time = run_benchmark<concurrent_queue<int>>(pairs_amount, elements_amount, [](auto& queue, int value) {
+            while (!queue.emplace(value)) {
+                std::this_thread::yield();
+            }
+        });
+        double segmented_time = run_benchmark<segmented_concurrent_queue<int>>(pairs_amount, elements_amount, [](auto& queue, int value) {
+            queue.emplace(value);
+        });
+
+        std::cout << std::setw(7) << pairs_amount << std::setw(17) << locked_time << std::setw(15) << ring_time << std::setw(20) << segmented_time << "\n";
+    }
+
+    return 0;
+}
@@ -143,6 +143,8 @@ private:
         { response::operation_is_not_processed, "operation is not processed" },
         { response::operation_is_in_progress, "operation is in progress" },
         { response::write_task_id_not_found, "error: write task ID not found" },
+        { response::could_not_save_index, "error: could not save the index" },
+        { response::could_not_log_operation, "error: could not log the operation, it is lost on a restart" },
     };
 };
 
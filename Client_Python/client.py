@@ -5,6 +5,27 @@ from project_types import *
 from network_codes import *
 from word_entry import *
 
+class payload_reader:
+    # Reads the values of a response payload in the order they would be received from a single-shot connection.
+    # Raises struct.error if the payload ended too early
+    def __init__(self, payload):
+        self.payload = payload
+        self.offset = 0
+
+    def read_integer_value(self, fmt):
+        value = struct.unpack_from(fmt, self.payload, self.offset)[0]
+        self.offset += struct.calcsize(fmt)
+        return value
+
+    def read_size_and_string(self):
+        byte_size_string = self.read_integer_value('>H')
+        if self.offset + byte_size_string > len(self.payload):
+            raise struct.error("The payload ended in the middle of a string.")
+
+        out_string = self.payload[self.offset : self.offset + byte_size_string].decode('utf-8')
+        self.offset += byte_size_string
+        return out_string
+
 class client:
     def __init__(self, ip_address, port):
         self.ip_address = ip_address
@@ -36,7 +57,7 @@ class client:
             # Receive results
             _, response_code = self.recv_response_code(self.sock)
             if response_code != response.OK:
-                self.close_connection(self.sock)
+                self.close_connection()
                 return False, response_code
 
             found_files_amount = self.recv_integer_value(self.sock, id_type)
@@ -51,11 +72,11 @@ class client:
                 position = self.recv_integer_value(self.sock, id_type)
                 out_word_entries.update({file_id, position})
 
-            self.close_connection(self.sock)
+            self.close_connection()
             return False, response_code
 
         except ConnectionError:
-            self.close_connection(self.sock)
+            self.close_connection()
             return True, response.ERROR_RECEIVING_COMMAND
 
 
@@ -100,6 +121,179 @@ class client:
             return True, response.ERROR_RECEIVING_COMMAND
 
 
+    # Persistent connection with request pipelining (command.OPEN_SESSION): requests are sent back to back
+    # without waiting for the answers, every one is tagged with a request id and the responses may come back in any order.
+    # send_session_* return (error, request_id), the received payloads are decoded with the parse_* methods.
+
+    def open_session(self):
+        try:
+            self.session_sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            self.session_sock.connect((self.ip_address, self.port))
+            self.session_sock.sendall(struct.pack(code_type, command.OPEN_SESSION))
+            self.next_request_id = 0
+            return False
+
+        except ConnectionError:
+            self.close_session()
+            return True
+
+    def close_session(self):
+        self.session_sock.close()
+
+    def send_session_search(self, word_set, files_only):
+        payload = bytearray(struct.pack(code_type, command.SEARCH))
+        payload += struct.pack('B', files_only)
+        payload += struct.pack('>H', len(word_set))
+
+        for word in word_set:
+            encoded_word = word.encode('utf-8')
+            payload += struct.pack('>H', len(encoded_word)) + encoded_word
+
+        return self.send_session_request(payload)
+
+    # The words of the phrase must follow each other in the given order
+    def send_session_phrase_search(self, phrase, files_only):
+        payload = bytearray(struct.pack(code_type, command.PHRASE_SEARCH))
+        payload += struct.pack('B', files_only)
+        payload += struct.pack('>H', len(phrase))
+
+        for word in phrase:
+            encoded_word = word.encode('utf-8')
+            payload += struct.pack('>H', len(encoded_word)) + encoded_word
+
+        return self.send_session_request(payload)
+
+    # Every word must occur within max_distance positions of the others
+    def send_session_near_search(self, word_set, max_distance, files_only):
+        payload = bytearray(struct.pack(code_type, command.NEAR_SEARCH))
+        payload += struct.pack('B', files_only)
+        payload += struct.pack('>H', max_distance)
+        payload += struct.pack('>H', len(word_set))
+
+        for word in word_set:
+            encoded_word = word.encode('utf-8')
+            payload += struct.pack('>H', len(encoded_word)) + encoded_word
+
+        return self.send_session_request(payload)
+
+    # The top_k files by BM25 score that contain any of the words, see parse_ranked_search_response
+    def send_session_ranked_search(self, word_set, top_k):
+        payload = bytearray(struct.pack(code_type, command.RANKED_SEARCH))
+        payload += struct.pack('>H', top_k)
+        payload += struct.pack('>H', len(word_set))
+
+        for word in word_set:
+            encoded_word = word.encode('utf-8')
+            payload += struct.pack('>H', len(encoded_word)) + encoded_word
+
+        return self.send_session_request(payload)
+
+    def send_session_has_file(self, filename):
+        encoded_filename = filename.encode('utf-8')
+
+        payload = bytearray(struct.pack(code_type, command.HAS_FILE))
+        payload += struct.pack('>H', len(encoded_filename)) + encoded_filename
+
+        return self.send_session_request(payload)
+
+    def send_session_request(self, payload):
+        try:
+            request_id = self.next_request_id
+            self.next_request_id = (self.next_request_id + 1) % (2 ** 32)
+
+            frame_size = struct.calcsize(request_id_type) + len(payload)
+            header = struct.pack(frame_size_type, frame_size) + struct.pack(request_id_type, request_id)
+
+            self.session_sock.sendall(header + payload)
+            return False, request_id
+
+        except ConnectionError:
+            self.close_session()
+            return True, None
+
+    # Returns (error, request_id, payload) of the next response, whichever request it answers
+    def recv_session_response(self):
+        try:
+            header = self.recv_exactly(self.session_sock, struct.calcsize(frame_size_type) + struct.calcsize(request_id_type))
+            frame_size = struct.unpack_from(frame_size_type, header)[0]
+            request_id = struct.unpack_from(request_id_type, header, struct.calcsize(frame_size_type))[0]
+
+            payload = self.recv_exactly(self.session_sock, frame_size - struct.calcsize(request_id_type))
+            return False, request_id, payload
+
+        except ConnectionError:
+            self.close_session()
+            return True, None, None
+
+    # The parse_* methods return (malformed, response_code)
+
+    def parse_has_file_response(self, payload):
+        try:
+            return False, payload_reader(payload).read_integer_value(code_type)
+        except struct.error:
+            return True, response.ERROR_RECEIVING_DATA
+
+    def parse_search_response(self, payload, out_word_entries, out_file_table):
+        try:
+            reader = payload_reader(payload)
+
+            response_code = reader.read_integer_value(code_type)
+            if response_code != response.OK:
+                return False, response_code
+
+            found_files_amount = reader.read_integer_value(id_type)
+            for _ in range(found_files_amount):
+                file_id = reader.read_integer_value(id_type)
+                out_file_table[file_id] = reader.read_size_and_string()
+
+            entries_amount = reader.read_integer_value('>Q')
+            for _ in range(entries_amount):
+                file_id = reader.read_integer_value(id_type)
+                position = reader.read_integer_value(id_type)
+                out_word_entries.append(word_entry(file_id, position))
+
+            return False, response_code
+
+        except struct.error:
+            return True, response.ERROR_RECEIVING_DATA
+
+    def parse_search_files_only_response(self, payload, out_file_table):
+        try:
+            reader = payload_reader(payload)
+
+            response_code = reader.read_integer_value(code_type)
+            if response_code != response.OK:
+                return False, response_code
+
+            found_files_amount = reader.read_integer_value(id_type)
+            for _ in range(found_files_amount):
+                out_file_table.append(reader.read_size_and_string())
+
+            return False, response_code
+
+        except struct.error:
+            return True, response.ERROR_RECEIVING_DATA
+
+    # Appends (file path, score) pairs to out_ranked_files, best file first
+    def parse_ranked_search_response(self, payload, out_ranked_files):
+        try:
+            reader = payload_reader(payload)
+
+            response_code = reader.read_integer_value(code_type)
+            if response_code != response.OK:
+                return False, response_code
+
+            found_files_amount = reader.read_integer_value(id_type)
+            for _ in range(found_files_amount):
+                score = reader.read_integer_value('>f')
+                out_ranked_files.append((reader.read_size_and_string(), score))
+
+            return False, response_code
+
+        except struct.error:
+            return True, response.ERROR_RECEIVING_DATA
+
+
     def connect_to_server(self):
         self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
         self.sock.connect((self.ip_address, self.port))
@@ -108,6 +302,17 @@ class client:
         self.sock.close()
 
 
+    def recv_exactly(self, sock, size):
+        received_data = bytearray()
+
+        while len(received_data) < size:
+            chunk = sock.recv(min(65536, size - len(received_data)))
+            if not chunk:
+                raise ConnectionError("The connection was closed before the entire data was received.")
+            received_data.extend(chunk)
+
+        return bytes(received_data)
+
     def recv_integer_value(self, sock, fmt):
         size = struct.calcsize(fmt)
         value_buffer = sock.recv(size)
@@ -1,6 +1,11 @@
 from enum import IntEnum
 
 class command(IntEnum):
+    SAVE_INDEX = 240
+    RANKED_SEARCH = 241
+    NEAR_SEARCH = 242
+    PHRASE_SEARCH = 243
+    OPEN_SESSION = 244
     SET_NEW_WRITER_DURATION = 245
     SET_NEW_READER_DURATION = 246
     GET_WRITER_DURATION = 247
@@ -25,4 +30,6 @@ class response(IntEnum):
     NEW_DURATION_IS_WAY_TOO_SMALL = 8
     OPERATION_IS_NOT_PROCESSED = 9
     OPERATION_IS_IN_PROGRESS = 10
-    WRITE_TASK_ID_NOT_FOUND = 11
\ No newline at end of file
+    WRITE_TASK_ID_NOT_FOUND = 11
+    COULD_NOT_SAVE_INDEX = 12
+    COULD_NOT_LOG_OPERATION = 13
\ No newline at end of file
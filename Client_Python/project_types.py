@@ -10,5 +10,9 @@ big_id_type = '>Q'
 
 code_type = 'B'
 
+# Persistent connection frames (see session_protocol.h)
+request_id_type = '>I'
+frame_size_type = '>I'
+
 # A wide string type used for processing file contents, working with words and file names anywhere in the program
 string_type = str
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <filesystem>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif // WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+
+#ifdef max
+#undef max
+#endif // max
+
+#ifdef min
+#undef min
+#endif // min
+
+#else // POSIX
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+#endif // _WIN32
+
+// A file that is only ever appended to (or cut short), with the writes made durable explicitly: append() leaves
+// the bytes in the page cache, where they survive a crash of the process but not of the machine, sync() waits
+// until they are on the disk
+class append_only_file {
+public:
+    inline append_only_file() = default;
+    inline ~append_only_file() { close(); }
+
+    inline append_only_file(const append_only_file& other) = delete;
+    inline append_only_file& operator=(const append_only_file& rhs) = delete;
+
+    inline append_only_file(append_only_file&& other) noexcept { *this = std::move(other); }
+    inline append_only_file& operator=(append_only_file&& rhs) noexcept;
+
+public:
+    // Opens the file for appending, creating it if there's none. Returns false if the file can't be opened
+    inline bool open(const std::filesystem::path& file_path);
+    inline void close();
+
+    inline bool is_open() const;
+
+    // The functions below return false if the operation failed
+    inline bool append(const void* p_bytes, std::size_t bytes_amount);
+    inline bool sync();
+    inline bool truncate(std::uint64_t new_size);
+    inline bool get_size(std::uint64_t& out_size) const;
+
+    // Make the already written contents of a file durable, for the files written through other means (a stream)
+    inline static bool sync_file(const std::filesystem::path& file_path);
+
+private:
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+#else
+    int file_descriptor = -1;
+#endif // _WIN32
+};
+
+// operator=
+inline append_only_file& append_only_file::operator=(append_only_file&& rhs) noexcept {
+    if (this != &rhs) {
+        close();
+#ifdef _WIN32
+        file_handle = std::exchange(rhs.file_handle, INVALID_HANDLE_VALUE);
+#else
+        file_descriptor = std::exchange(rhs.file_descriptor, -1);
+#endif // _WIN32
+    }
+    return *this;
+}
+
+// open
+inline bool append_only_file::open(const std::filesystem::path& file_path) {
+    close();
+
+#ifdef _WIN32
+    file_handle = CreateFileW(file_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+    file_descriptor = ::open(file_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif // _WIN32
+
+    return is_open();
+}
+
+// close
+inline void append_only_file::close() {
+#ifdef _WIN32
+    if (file_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_handle);
+        file_handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (file_descriptor != -1) {
+        ::close(file_descriptor);
+        file_descriptor = -1;
+    }
+#endif // _WIN32
+}
+
+// is_open
+inline bool append_only_file::is_open() const {
+#ifdef _WIN32
+    return file_handle != INVALID_HANDLE_VALUE;
+#else
+    return file_descriptor != -1;
+#endif // _WIN32
+}
+
+// append
+inline bool append_only_file::append(const void* p_bytes, std::size_t bytes_amount) {
+    if (!is_open()) {
+        return false;
+    }
+
+    const char* p_current = static_cast<const char*>(p_bytes);
+
+#ifdef _WIN32
+    LARGE_INTEGER zero_distance{};
+    if (!SetFilePointerEx(file_handle, zero_distance, nullptr, FILE_END)) {
+        return false;
+    }
+
+    while (bytes_amount > 0) {
+        DWORD to_write = static_cast<DWORD>(std::min<std::size_t>(bytes_amount, 1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(file_handle, p_current, to_write, &written, nullptr)) {
+            return false;
+        }
+        p_current += written;
+        bytes_amount -= written;
+    }
+#else
+    while (bytes_amount > 0) {
+        ssize_t written = ::write(file_descriptor, p_current, bytes_amount);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p_current += written;
+        bytes_amount -= static_cast<std::size_t>(written);
+    }
+#endif // _WIN32
+
+    return true;
+}
+
+// sync
+inline bool append_only_file::sync() {
+    if (!is_open()) {
+        return false;
+    }
+
+#ifdef _WIN32
+    return FlushFileBuffers(file_handle) != 0;
+#else
+    return ::fsync(file_descriptor) == 0;
+#endif // _WIN32
+}
+
+// truncate
+inline bool append_only_file::truncate(std::uint64_t new_size) {
+    if (!is_open()) {
+        return false;
+    }
+
+#ifdef _WIN32
+    LARGE_INTEGER distance;
+    distance.QuadPart = static_cast<LONGLONG>(new_size);
+    return SetFilePointerEx(file_handle, distance, nullptr, FILE_BEGIN) && SetEndOfFile(file_handle);
+#else
+    return ::ftruncate(file_descriptor, static_cast<off_t>(new_size)) == 0;
+#endif // _WIN32
+}
+
+// get_size
+inline bool append_only_file::get_size(std::uint64_t& out_size) const {
+    if (!is_open()) {
+        return false;
+    }
+
+#ifdef _WIN32
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size)) {
+        return false;
+    }
+    out_size = static_cast<std::uint64_t>(file_size.QuadPart);
+#else
+    struct stat file_status;
+    if (::fstat(file_descriptor, &file_status) == -1) {
+        return false;
+    }
+    out_size = static_cast<std::uint64_t>(file_status.st_size);
+#endif // _WIN32
+
+    return true;
+}
+
+// sync_file
+inline bool append_only_file::sync_file(const std::filesystem::path& file_path) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileW(file_path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool synced = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return synced;
+#else
+    int descriptor = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor == -1) {
+        return false;
+    }
+    bool synced = ::fsync(descriptor) == 0;
+    ::close(descriptor);
+    return synced;
+#endif // _WIN32
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <climits>
+#include <mutex>
+#include "network_platform.h"
+
+// The client side of a single request, as seen by the server command handlers.
+// In blocking mode every recv/send goes straight to the socket (classic accept() loop).
+// In buffered mode the whole request has already been received by the event loop:
+// recv reads from the request bytes and send appends to the response, which the event loop transmits afterwards.
+class client_connection {
+public:
+    inline explicit client_connection(SOCKET socket);
+    inline explicit client_connection(std::string&& request);
+    inline ~client_connection() = default;
+
+    inline client_connection(const client_connection& other) = delete;
+    inline client_connection(client_connection&& other) = delete;
+    inline client_connection& operator=(const client_connection& rhs) = delete;
+    inline client_connection& operator=(client_connection&& rhs) = delete;
+
+public:
+    // Same return value semantics as recv/send: amount of bytes, 0 if there's nothing left, negative on errors
+    inline int recv(char* buffer, int size);
+    inline int send(const char* buffer, int size);
+
+    // In blocking mode closes the socket, in buffered mode only marks the response as complete
+    inline void close();
+
+    inline bool is_buffered() const;
+    inline bool is_closed() const;
+
+    inline std::string& get_response();
+
+private:
+    SOCKET socket = INVALID_SOCKET;
+    bool buffered = false;
+    bool closed = false;
+
+    std::string request;
+    std::size_t request_offset = 0;
+    std::string response;
+};
+
+
+inline client_connection::client_connection(SOCKET socket)
+    : socket(socket), buffered(false) {}
+
+inline client_connection::client_connection(std::string&& request)
+    : buffered(true), request(std::move(request)) {}
+
+inline int client_connection::recv(char* buffer, int size) {
+    if (closed) {
+        return SOCKET_ERROR;
+    }
+
+    if (!buffered) {
+        return ::recv(socket, buffer, size, 0);
+    }
+
+    std::size_t bytes_to_copy = std::min<std::size_t>(size, request.size() - request_offset);
+    std::memcpy(buffer, request.data() + request_offset, bytes_to_copy);
+    request_offset += bytes_to_copy;
+
+    return static_cast<int>(bytes_to_copy);
+}
+
+inline int client_connection::send(const char* buffer, int size) {
+    if (closed) {
+        return SOCKET_ERROR;
+    }
+
+    if (!buffered) {
+        return ::send(socket, buffer, size, socket_send_flags);
+    }
+
+    response.append(buffer, size);
+    return size;
+}
+
+inline void client_connection::close() {
+    if (closed) {
+        return;
+    }
+    closed = true;
+
+    if (!buffered) {
+        closesocket(socket);
+    }
+}
+
+inline bool client_connection::is_buffered() const {
+    return buffered;
+}
+
+inline bool client_connection::is_closed() const {
+    return closed;
+}
+
+inline std::string& client_connection::get_response() {
+    return response;
+}
+
+
+// A connection served by the classic accept() loop: a single request (see server::receive_request) or a persistent connection
+// (see server::serve_session). Shared by the network threads and the reader tasks: the socket is closed when the last of them is done
+class session_socket {
+public:
+    inline explicit session_socket(SOCKET socket) : socket(socket) {}
+    inline ~session_socket() { closesocket(socket); }
+
+    inline session_socket(const session_socket& other) = delete;
+    inline session_socket(session_socket&& other) = delete;
+    inline session_socket& operator=(const session_socket& rhs) = delete;
+    inline session_socket& operator=(session_socket&& rhs) = delete;
+
+public:
+    // Returns true if the connection was closed or failed before all the bytes were received
+    inline bool recv_all(char* buffer, std::size_t size);
+    // Same return value semantics as recv
+    inline int recv_some(char* buffer, std::size_t size);
+    // Thread-safe, whole frames are never interleaved. Returns true if the connection failed
+    inline bool send_all(const std::string& data);
+
+    // Wakes up the threads blocked on the socket, their recv and send fail from now on
+    inline void shutdown();
+
+private:
+    SOCKET socket;
+    std::mutex send_mutex;
+};
+
+
+inline bool session_socket::recv_all(char* buffer, std::size_t size) {
+    std::size_t total_received = 0;
+    while (total_received < size) {
+        int bytes_to_receive = static_cast<int>(std::min<std::size_t>(size - total_received, INT_MAX));
+
+        int recv_size = ::recv(socket, buffer + total_received, bytes_to_receive, 0);
+        if (recv_size <= 0) {
+            return true;
+        }
+        total_received += recv_size;
+    }
+    return false;
+}
+
+inline int session_socket::recv_some(char* buffer, std::size_t size) {
+    return ::recv(socket, buffer, static_cast<int>(std::min<std::size_t>(size, INT_MAX)), 0);
+}
+
+inline bool session_socket::send_all(const std::string& data) {
+    std::lock_guard lock(send_mutex);
+
+    std::size_t total_sent = 0;
+    while (total_sent < data.size()) {
+        int bytes_to_send = static_cast<int>(std::min<std::size_t>(data.size() - total_sent, INT_MAX));
+
+        int send_size = ::send(socket, data.data() + total_sent, bytes_to_send, socket_send_flags);
+        if (send_size <= 0) {
+            return true;
+        }
+        total_sent += send_size;
+    }
+    return false;
+}
+
+inline void session_socket::shutdown() {
+    ::shutdown(socket, SD_BOTH);
+}
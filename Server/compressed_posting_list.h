@@ -0,0 +1,556 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include "posting_codec.h"
+#include "posting_list.h"
+#include "project_types.h"
+#include "word_entry.h"
+
+// Same interface as posting_list (except the direct access to its vectors), with everything stored compressed
+// by posting_codec.h in blocks of posting_block_size:
+//     files     - the delta of every file ID against the previous one and the amount of positions in the file;
+//                 every packed block has a skip header with its last file ID, so file_cursor::advance_to
+//                 steps over whole blocks without decoding them;
+//     positions - the delta of every position against the previous position in the same file (the first one against 0),
+//                 all the files back to back; every packed block has a header with its offset.
+// The values after the last full block are variable-byte encoded, the last file stays open (not encoded at all),
+// so that indexing a file (appending the newest file and its positions) never re-encodes anything.
+// Other modifications decode the whole list and encode it again, which is O(list) just like for posting_list.
+class compressed_posting_list {
+public:
+    class file_cursor;
+    class const_iterator;
+
+    inline compressed_posting_list() = default;
+
+public:
+    inline bool empty() const;
+
+    // Get the amount of word entries
+    inline std::size_t size() const;
+
+    // Get the amount of files that contain the word
+    inline std::size_t file_count() const;
+
+    inline void clear();
+
+    // Append a single word entry (see posting_list::add)
+    inline void add(const word_entry& single_word_entry);
+
+    // Add all the positions of the word inside file_id at once. file_positions must be sorted in ascending order
+    inline void add_file(id_type file_id, const std::vector<id_type>& file_positions);
+
+    // Delete all the word entries with the specified file_id. Returns true if there were any
+    inline bool erase_file(id_type file_id);
+
+    // Delete the word entries of every file for which is_erased(file_id) is true. Returns the amount of the erased files
+    template <typename predicate_type>
+    inline std::size_t erase_files_if(predicate_type&& is_erased);
+
+    // Give back the memory the erased entries left behind (a rewrite keeps the capacity of the old encoding)
+    inline void shrink_to_fit();
+
+    // Cursor over the files that contain the word, in ascending file ID order
+    inline file_cursor get_file_cursor() const;
+
+    // Iteration over all the word entries in (file_id, position) order
+    inline const_iterator begin() const;
+    inline const_iterator end() const;
+
+private:
+    struct file_block_header {
+        id_type last_file_id;       // Skip header: the block is stepped over while looking for a larger file ID
+        id_type first_position_idx; // Index of the first position of the first file of the block
+        std::uint32_t byte_offset;  // Where the packed file ID deltas and then the packed position amounts start in file_bytes
+        std::uint8_t file_ids_bit_width;
+        std::uint8_t amounts_bit_width;
+    };
+
+    struct position_block_header {
+        std::uint32_t byte_offset;  // Where the packed position deltas start in position_bytes
+        std::uint8_t bit_width;
+    };
+
+    // Decode the files of the block block_idx into out_file_ids and out_positions_amounts, returns the amount of files.
+    // block_idx == file_blocks.size() is the variable-byte tail together with the open file
+    inline std::size_t decode_file_block(std::size_t block_idx, id_type* out_file_ids, id_type* out_positions_amounts) const;
+    // Decode the deltas of the position block block_idx (the variable-byte tail if block_idx == position_blocks.size())
+    inline void decode_position_block(std::size_t block_idx, id_type* out_deltas) const;
+
+    // Call function(position) for file_positions_amount positions of a file starting from the position index first_position_idx
+    template <typename function_type>
+    inline void for_each_position(std::size_t first_position_idx, std::size_t file_positions_amount, function_type&& function) const;
+
+    // Append the positions of a file with an ID larger than all the present ones
+    inline void append_file(id_type file_id, const id_type* file_positions, std::size_t file_positions_amount);
+    inline void close_open_file();
+    inline void append_position_delta(id_type delta);
+
+    inline std::size_t get_files_tail_offset() const;
+    inline std::size_t get_positions_tail_offset() const;
+
+    inline posting_list decode() const;
+    inline void assign(const posting_list& plain);
+
+private:
+    std::vector<file_block_header> file_blocks;
+    std::vector<std::uint8_t> file_bytes; // Packed blocks, then the variable-byte (file ID delta, positions amount) pairs
+    id_type last_closed_file_id = 0;
+    id_type files_tail_first_position_idx = 0;
+    id_type open_file_id = 0;
+    id_type open_file_positions_amount = 0;
+    std::size_t files_amount = 0;
+
+    std::vector<position_block_header> position_blocks;
+    std::vector<std::uint8_t> position_bytes; // Packed blocks, then the variable-byte position deltas
+    id_type last_position = 0;
+    std::size_t positions_amount = 0;
+};
+
+class compressed_posting_list::file_cursor {
+public:
+    inline file_cursor() = default;
+    inline explicit file_cursor(const compressed_posting_list* list) : list(list) {
+        if (list->files_amount != 0) {
+            load_block(0);
+        }
+    }
+
+    inline bool at_end() const { return list == nullptr || file_idx >= list->files_amount; }
+    inline id_type file_id() const { return file_ids[block_file_idx]; }
+    inline std::size_t positions_amount() const { return positions_amounts[block_file_idx]; }
+
+    inline void next() {
+        position_idx += positions_amounts[block_file_idx];
+        ++file_idx;
+        if (++block_file_idx == block_files_amount && !at_end()) {
+            load_block(block_idx + 1);
+        }
+    }
+
+    // Move to the first file with an ID not less than target_file_id (or to the end)
+    inline void advance_to(id_type target_file_id) {
+        if (at_end() || file_id() >= target_file_id) {
+            return;
+        }
+
+        // Whole blocks that end before target_file_id are skipped by their headers, galloping from the current block
+        const auto& blocks = list->file_blocks;
+        auto target_block = galloping_partition_point(std::begin(blocks) + std::min(block_idx, blocks.size()), std::end(blocks),
+            [target_file_id](const file_block_header& header) { return header.last_file_id < target_file_id; });
+
+        std::size_t target_block_idx = target_block - std::begin(blocks);
+        if (target_block_idx != block_idx) {
+            load_block(target_block_idx);
+        }
+
+        while (!at_end() && file_id() < target_file_id) {
+            next();
+        }
+    }
+
+    // Call function(position) for every position of the word inside the current file, in ascending order
+    template <typename function_type>
+    inline void for_each_position(function_type&& function) const {
+        list->for_each_position(position_idx, positions_amounts[block_file_idx], std::forward<function_type>(function));
+    }
+
+private:
+    inline void load_block(std::size_t new_block_idx) {
+        block_idx = new_block_idx;
+        block_file_idx = 0;
+        file_idx = block_idx * posting_block_size;
+        block_files_amount = list->decode_file_block(block_idx, file_ids, positions_amounts);
+        position_idx = block_idx < list->file_blocks.size() ? list->file_blocks[block_idx].first_position_idx : list->files_tail_first_position_idx;
+    }
+
+    const compressed_posting_list* list = nullptr;
+    std::size_t file_idx = 0;
+    std::size_t position_idx = 0;
+
+    std::size_t block_idx = 0;
+    std::size_t block_file_idx = 0;
+    std::size_t block_files_amount = 0;
+    id_type file_ids[posting_block_size];
+    id_type positions_amounts[posting_block_size];
+};
+
+class compressed_posting_list::const_iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = word_entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = word_entry;
+
+    inline const_iterator() = default;
+    inline const_iterator(const compressed_posting_list* list, std::size_t position_idx)
+        : list(list), position_idx(position_idx) {
+        if (position_idx < list->size()) {
+            files = list->get_file_cursor();
+            file_end_idx = files.positions_amount();
+            position = get_delta();
+        }
+    }
+
+    inline word_entry operator*() const {
+        return word_entry(files.file_id(), position);
+    }
+
+    inline const_iterator& operator++() {
+        bool next_file = ++position_idx == file_end_idx;
+        if (next_file && position_idx < list->size()) {
+            files.next();
+            file_end_idx += files.positions_amount();
+        }
+
+        if (position_idx < list->size()) {
+            id_type delta = get_delta();
+            position = next_file ? delta : position + delta;
+        }
+        return *this;
+    }
+
+    inline const_iterator operator++(int) {
+        const_iterator old = *this;
+        ++(*this);
+        return old;
+    }
+
+    inline bool operator==(const const_iterator& rhs) const { return position_idx == rhs.position_idx; }
+    inline bool operator!=(const const_iterator& rhs) const { return position_idx != rhs.position_idx; }
+
+private:
+    inline id_type get_delta() {
+        std::size_t block_idx = position_idx / posting_block_size;
+        if (block_idx != decoded_block_idx) {
+            list->decode_position_block(block_idx, deltas);
+            decoded_block_idx = block_idx;
+        }
+        return deltas[position_idx % posting_block_size];
+    }
+
+    const compressed_posting_list* list = nullptr;
+    file_cursor files;
+    std::size_t file_end_idx = 0;
+    std::size_t position_idx = 0;
+    id_type position = 0;
+
+    std::size_t decoded_block_idx = static_cast<std::size_t>(-1);
+    id_type deltas[posting_block_size];
+};
+
+// empty
+inline bool compressed_posting_list::empty() const {
+    return positions_amount == 0;
+}
+
+// size
+inline std::size_t compressed_posting_list::size() const {
+    return positions_amount;
+}
+
+// file_count
+inline std::size_t compressed_posting_list::file_count() const {
+    return files_amount;
+}
+
+// clear
+inline void compressed_posting_list::clear() {
+    file_blocks.clear();
+    file_bytes.clear();
+    last_closed_file_id = 0;
+    files_tail_first_position_idx = 0;
+    open_file_id = 0;
+    open_file_positions_amount = 0;
+    files_amount = 0;
+
+    position_blocks.clear();
+    position_bytes.clear();
+    last_position = 0;
+    positions_amount = 0;
+}
+
+// add
+inline void compressed_posting_list::add(const word_entry& single_word_entry) {
+    if (files_amount == 0 || single_word_entry.file_id > open_file_id) {
+        append_file(single_word_entry.file_id, &single_word_entry.position, 1);
+        return;
+    }
+
+    if (single_word_entry.file_id == open_file_id && single_word_entry.position > last_position) {
+        ++open_file_positions_amount;
+        append_position_delta(single_word_entry.position - last_position);
+        last_position = single_word_entry.position;
+        return;
+    }
+
+    posting_list plain = decode();
+    plain.add(single_word_entry);
+    assign(plain);
+}
+
+// add_file
+inline void compressed_posting_list::add_file(id_type file_id, const std::vector<id_type>& file_positions) {
+    if (file_positions.empty()) {
+        return;
+    }
+
+    if (files_amount == 0 || file_id > open_file_id) {
+        append_file(file_id, file_positions.data(), file_positions.size());
+        return;
+    }
+
+    posting_list plain = decode();
+    plain.add_file(file_id, file_positions);
+    assign(plain);
+}
+
+// erase_file
+inline bool compressed_posting_list::erase_file(id_type file_id) {
+    file_cursor files = get_file_cursor();
+    files.advance_to(file_id);
+    if (files.at_end() || files.file_id() != file_id) {
+        return false;
+    }
+
+    posting_list plain = decode();
+    plain.erase_file(file_id);
+    assign(plain);
+
+    return true;
+}
+
+// erase_files_if
+template <typename predicate_type>
+inline std::size_t compressed_posting_list::erase_files_if(predicate_type&& is_erased) {
+    posting_list plain = decode();
+    std::size_t erased_amount = plain.erase_files_if(std::forward<predicate_type>(is_erased));
+    if (erased_amount != 0) {
+        assign(plain);
+    }
+
+    return erased_amount;
+}
+
+// shrink_to_fit
+inline void compressed_posting_list::shrink_to_fit() {
+    file_blocks.shrink_to_fit();
+    file_bytes.shrink_to_fit();
+    position_blocks.shrink_to_fit();
+    position_bytes.shrink_to_fit();
+}
+
+// get_file_cursor
+inline compressed_posting_list::file_cursor compressed_posting_list::get_file_cursor() const {
+    return file_cursor(this);
+}
+
+// begin / end
+inline compressed_posting_list::const_iterator compressed_posting_list::begin() const {
+    return const_iterator(this, 0);
+}
+
+inline compressed_posting_list::const_iterator compressed_posting_list::end() const {
+    return const_iterator(this, size());
+}
+
+// decode_file_block
+inline std::size_t compressed_posting_list::decode_file_block(std::size_t block_idx, id_type* out_file_ids, id_type* out_positions_amounts) const {
+    id_type file_id = block_idx == 0 ? 0 : file_blocks[block_idx - 1].last_file_id;
+
+    if (block_idx < file_blocks.size()) {
+        const file_block_header& header = file_blocks[block_idx];
+        const std::uint8_t* data = file_bytes.data() + header.byte_offset;
+
+        unpack_block(data, header.file_ids_bit_width, out_file_ids);
+        unpack_block(data + get_packed_block_size(header.file_ids_bit_width), header.amounts_bit_width, out_positions_amounts);
+
+        for (std::size_t idx = 0; idx < posting_block_size; ++idx) {
+            file_id += out_file_ids[idx];
+            out_file_ids[idx] = file_id;
+        }
+        return posting_block_size;
+    }
+
+    if (files_amount == 0) {
+        return 0;
+    }
+
+    std::size_t closed_files_amount = files_amount - 1 - file_blocks.size() * posting_block_size;
+    const std::uint8_t* data = file_bytes.data() + get_files_tail_offset();
+    for (std::size_t idx = 0; idx < closed_files_amount; ++idx) {
+        file_id += read_varbyte(data);
+        out_file_ids[idx] = file_id;
+        out_positions_amounts[idx] = read_varbyte(data);
+    }
+
+    out_file_ids[closed_files_amount] = open_file_id;
+    out_positions_amounts[closed_files_amount] = open_file_positions_amount;
+    return closed_files_amount + 1;
+}
+
+// decode_position_block
+inline void compressed_posting_list::decode_position_block(std::size_t block_idx, id_type* out_deltas) const {
+    if (block_idx < position_blocks.size()) {
+        const position_block_header& header = position_blocks[block_idx];
+        unpack_block(position_bytes.data() + header.byte_offset, header.bit_width, out_deltas);
+        return;
+    }
+
+    std::size_t tail_amount = positions_amount - position_blocks.size() * posting_block_size;
+    const std::uint8_t* data = position_bytes.data() + get_positions_tail_offset();
+    for (std::size_t idx = 0; idx < tail_amount; ++idx) {
+        out_deltas[idx] = read_varbyte(data);
+    }
+}
+
+// for_each_position
+template <typename function_type>
+inline void compressed_posting_list::for_each_position(std::size_t first_position_idx, std::size_t file_positions_amount, function_type&& function) const {
+    std::size_t positions_end = first_position_idx + file_positions_amount;
+
+    id_type deltas[posting_block_size];
+    id_type position = 0;
+
+    for (std::size_t block_idx = first_position_idx / posting_block_size; block_idx * posting_block_size < positions_end; ++block_idx) {
+        decode_position_block(block_idx, deltas);
+
+        std::size_t block_begin = block_idx * posting_block_size;
+        std::size_t delta_idx = std::max(first_position_idx, block_begin) - block_begin;
+        std::size_t delta_end = std::min(positions_end, block_begin + posting_block_size) - block_begin;
+
+        for (; delta_idx < delta_end; ++delta_idx) {
+            position += deltas[delta_idx];
+            function(position);
+        }
+    }
+}
+
+// append_file
+inline void compressed_posting_list::append_file(id_type file_id, const id_type* file_positions, std::size_t file_positions_amount) {
+    if (file_positions_amount == 0) {
+        return;
+    }
+
+    if (files_amount != 0) {
+        close_open_file();
+    }
+
+    open_file_id = file_id;
+    open_file_positions_amount = static_cast<id_type>(file_positions_amount);
+    ++files_amount;
+
+    id_type previous_position = 0;
+    for (std::size_t idx = 0; idx < file_positions_amount; ++idx) {
+        append_position_delta(file_positions[idx] - previous_position);
+        previous_position = file_positions[idx];
+    }
+    last_position = previous_position;
+}
+
+// close_open_file
+inline void compressed_posting_list::close_open_file() {
+    write_varbyte(open_file_id - last_closed_file_id, file_bytes);
+    write_varbyte(open_file_positions_amount, file_bytes);
+    last_closed_file_id = open_file_id;
+
+    // Every file is closed at the moment, so the tail became a full block: pack it
+    if (files_amount % posting_block_size == 0) {
+        id_type file_ids[posting_block_size];
+        id_type positions_amounts[posting_block_size];
+
+        std::size_t tail_offset = get_files_tail_offset();
+
+        // The packed blocks keep the same file ID deltas as the tail
+        const std::uint8_t* data = file_bytes.data() + tail_offset;
+        id_type block_positions_amount = 0;
+        for (std::size_t idx = 0; idx < posting_block_size; ++idx) {
+            file_ids[idx] = read_varbyte(data);
+            positions_amounts[idx] = read_varbyte(data);
+            block_positions_amount += positions_amounts[idx];
+        }
+
+        file_block_header header;
+        header.last_file_id = open_file_id;
+        header.first_position_idx = files_tail_first_position_idx;
+        header.byte_offset = static_cast<std::uint32_t>(tail_offset);
+        header.file_ids_bit_width = get_required_bit_width(file_ids, posting_block_size);
+        header.amounts_bit_width = get_required_bit_width(positions_amounts, posting_block_size);
+
+        file_bytes.resize(tail_offset);
+        pack_block(file_ids, header.file_ids_bit_width, file_bytes);
+        pack_block(positions_amounts, header.amounts_bit_width, file_bytes);
+        file_blocks.push_back(header);
+
+        files_tail_first_position_idx += block_positions_amount;
+    }
+}
+
+// append_position_delta
+inline void compressed_posting_list::append_position_delta(id_type delta) {
+    write_varbyte(delta, position_bytes);
+
+    // The tail became a full block: pack it
+    if (++positions_amount % posting_block_size == 0) {
+        id_type deltas[posting_block_size];
+        decode_position_block(position_blocks.size(), deltas);
+
+        std::size_t tail_offset = get_positions_tail_offset();
+        std::uint8_t bit_width = get_required_bit_width(deltas, posting_block_size);
+
+        position_bytes.resize(tail_offset);
+        pack_block(deltas, bit_width, position_bytes);
+        position_blocks.push_back({ static_cast<std::uint32_t>(tail_offset), bit_width });
+    }
+}
+
+// get_files_tail_offset
+inline std::size_t compressed_posting_list::get_files_tail_offset() const {
+    if (file_blocks.empty()) {
+        return 0;
+    }
+
+    const file_block_header& header = file_blocks.back();
+    return header.byte_offset + get_packed_block_size(header.file_ids_bit_width) + get_packed_block_size(header.amounts_bit_width);
+}
+
+// get_positions_tail_offset
+inline std::size_t compressed_posting_list::get_positions_tail_offset() const {
+    if (position_blocks.empty()) {
+        return 0;
+    }
+
+    const position_block_header& header = position_blocks.back();
+    return header.byte_offset + get_packed_block_size(header.bit_width);
+}
+
+// decode
+inline posting_list compressed_posting_list::decode() const {
+    posting_list plain;
+
+    std::vector<id_type> file_positions;
+    for (file_cursor files = get_file_cursor(); !files.at_end(); files.next()) {
+        file_positions.clear();
+        files.for_each_position([&file_positions](id_type position) {
+            file_positions.push_back(position);
+        });
+        plain.add_file(files.file_id(), file_positions);
+    }
+
+    return plain;
+}
+
+// assign
+inline void compressed_posting_list::assign(const posting_list& plain) {
+    clear();
+
+    const auto& plain_file_ids = plain.get_file_ids();
+    for (std::size_t file_idx = 0; file_idx < plain_file_ids.size(); ++file_idx) {
+        auto file_positions = plain.get_positions(file_idx);
+        append_file(plain_file_ids[file_idx], file_positions.data(), file_positions.size());
+    }
+}
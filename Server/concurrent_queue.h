@@ -1,14 +1,39 @@
 #pragma once
 
-#include <queue>
-#include <thread>
-#include <shared_mutex>
-#include "concurrent_utility.h"
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+
+// ===============================================================================================================
+// Lock-free multi-producer multi-consumer queues of the sequenced cells of D. Vyukov. Every cell holds a sequence number
+// that tells the threads whose turn it is: a producer claims the cell of position pos once its sequence is pos, stores
+// the element and sets it to pos + 1; a consumer claims it once it is pos + 1. The claim moves the enqueue or the dequeue
+// position forward, each on its own cache line, so the producers and the consumers only contend among themselves.
+//     - concurrent_queue is bounded: a ring of cells, the consumer hands the cell back to the next lap of the producers.
+//       emplace() returns false when it is full;
+//     - segmented_concurrent_queue is unbounded: a linked list of segments, each a row of cells used once. A full segment
+//       gets a successor and an exhausted one is unlinked and freed with epoch-based reclamation (the operations pin
+//       the epoch they start in, a segment is freed once no operation that may still see it is pinned).
+// A pop() may return false while the oldest producer is still storing its element, even if newer ones are done
+// ===============================================================================================================
+
+template <typename T>
+struct sequenced_cell {
+    std::atomic<std::size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    inline T* get() { return std::launder(reinterpret_cast<T*>(storage)); }
+};
+
 
 template <typename T>
 class concurrent_queue {
 public:
-    inline concurrent_queue() = default;
+    // The capacity is rounded up to a power of two
+    inline explicit concurrent_queue(std::size_t capacity = 1024);
     inline ~concurrent_queue() { clear(); }
 
     inline concurrent_queue(const concurrent_queue& other) = delete;
@@ -17,6 +42,45 @@ public:
     inline concurrent_queue& operator=(concurrent_queue&& rhs) = delete;
 
 public:
+    // Approximate while the queue is in use
+    inline bool empty() const;
+    inline std::size_t size() const;
+    inline std::size_t capacity() const;
+
+    inline void clear();
+    inline bool pop(T& value);
+    inline bool pop();
+
+    // Return false if the queue is full
+    template <typename... arguments>
+    inline bool emplace(arguments&&... parameters);
+
+private:
+    template <typename consumer_type>
+    inline bool do_pop(consumer_type&& consumer);
+
+private:
+    std::size_t mask;
+    std::unique_ptr<sequenced_cell<T>[]> cells;
+
+    alignas(64) std::atomic<std::size_t> enqueue_pos = 0;
+    alignas(64) std::atomic<std::size_t> dequeue_pos = 0;
+};
+
+
+template <typename T>
+class segmented_concurrent_queue {
+public:
+    inline explicit segmented_concurrent_queue(std::size_t segment_capacity = 1024);
+    inline ~segmented_concurrent_queue();
+
+    inline segmented_concurrent_queue(const segmented_concurrent_queue& other) = delete;
+    inline segmented_concurrent_queue(segmented_concurrent_queue&& other) = delete;
+    inline segmented_concurrent_queue& operator=(const segmented_concurrent_queue& rhs) = delete;
+    inline segmented_concurrent_queue& operator=(segmented_concurrent_queue&& rhs) = delete;
+
+public:
+    // Approximate while the queue is in use
     inline bool empty() const;
     inline std::size_t size() const;
 
@@ -28,64 +92,351 @@ public:
     inline void emplace(arguments&&... parameters);
 
 private:
-    using concurrent_queue_implementation = std::queue<T>;
+    struct segment {
+        inline segment(std::size_t capacity, std::size_t base);
+
+        const std::size_t base; // Position of the first cell in the whole queue
+        std::unique_ptr<sequenced_cell<T>[]> cells;
+
+        std::atomic<segment*> next = nullptr;
+        segment* next_retired = nullptr;
+
+        alignas(64) std::atomic<std::size_t> enqueue_pos = 0; // Goes past the capacity, by one for every producer that found the segment full
+        alignas(64) std::atomic<std::size_t> dequeue_pos = 0;
+    };
+
+    struct alignas(64) epoch_pins {
+        std::atomic<std::size_t> operations = 0;
+    };
+
+    static constexpr std::size_t epochs_amount = 3;
 
-    mutable read_write_lock rw_lock;
-    concurrent_queue_implementation queue_impl;
+    // Pins the current epoch for the lifetime of an operation
+    class epoch_guard {
+    public:
+        inline explicit epoch_guard(const segmented_concurrent_queue& queue);
+        inline ~epoch_guard() { queue.pins[pinned_epoch % epochs_amount].operations.fetch_sub(1); }
+
+        inline epoch_guard(const epoch_guard& other) = delete;
+        inline epoch_guard& operator=(const epoch_guard& rhs) = delete;
+
+    private:
+        const segmented_concurrent_queue& queue;
+        std::size_t pinned_epoch;
+    };
+
+    template <typename consumer_type>
+    inline bool do_pop(consumer_type&& consumer);
+
+    // The segment must be unlinked already, and the calling operation pinned
+    inline void retire(segment* retired_segment);
+    inline void try_advance_epoch();
+
+private:
+    const std::size_t segment_capacity;
+
+    alignas(64) std::atomic<segment*> head;
+    alignas(64) std::atomic<segment*> tail;
+
+    alignas(64) std::atomic<std::size_t> epoch = 0;
+    mutable epoch_pins pins[epochs_amount];
+    std::atomic<segment*> retired[epochs_amount] = {};
 };
 
 
+// concurrent_queue
+template <typename T>
+inline concurrent_queue<T>::concurrent_queue(std::size_t capacity) {
+    std::size_t rounded_capacity = 2;
+    while (rounded_capacity < capacity) {
+        rounded_capacity <<= 1;
+    }
+
+    mask = rounded_capacity - 1;
+    cells.reset(new sequenced_cell<T>[rounded_capacity]);
+    for (std::size_t pos = 0; pos < rounded_capacity; ++pos) {
+        cells[pos].sequence.store(pos, std::memory_order_relaxed);
+    }
+}
+
 template <typename T>
 inline bool concurrent_queue<T>::empty() const {
-    read_lock r_lock(rw_lock);
-    return queue_impl.empty();
+    return size() == 0;
 }
 
 template <typename T>
 inline std::size_t concurrent_queue<T>::size() const {
-    read_lock r_lock(rw_lock);
-    return queue_impl.size();
+    std::size_t first_pos = dequeue_pos.load(std::memory_order_relaxed);
+    std::size_t last_pos = enqueue_pos.load(std::memory_order_relaxed);
+    return last_pos > first_pos ? last_pos - first_pos : 0;
+}
+
+template <typename T>
+inline std::size_t concurrent_queue<T>::capacity() const {
+    return mask + 1;
 }
 
 template <typename T>
 inline void concurrent_queue<T>::clear() {
-    write_lock w_lock(rw_lock);
-    queue_impl = concurrent_queue_implementation();
-    //while (!queue_impl.empty()) {
-    //	queue_impl.pop();
-    //}
+    while (pop()) {}
 }
 
 template <typename T>
 inline bool concurrent_queue<T>::pop(T& value) {
-    write_lock w_lock(rw_lock);
+    return do_pop([&value](T& element) { value = std::move(element); });
+}
+
+template <typename T>
+inline bool concurrent_queue<T>::pop() {
+    return do_pop([](T&) {});
+}
+
+template <typename T>
+template <typename... arguments>
+inline bool concurrent_queue<T>::emplace(arguments&&... parameters) {
+    std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    sequenced_cell<T>* cell;
+
+    while (true) {
+        cell = &cells[pos & mask];
+        std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t lap_difference = static_cast<std::ptrdiff_t>(sequence - pos);
+
+        if (lap_difference == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        // The cell still holds the element of the previous lap
+        else if (lap_difference < 0) {
+            return false;
+        }
+        else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    new (cell->storage) T(std::forward<arguments>(parameters)...);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+template <typename consumer_type>
+inline bool concurrent_queue<T>::do_pop(consumer_type&& consumer) {
+    std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    sequenced_cell<T>* cell;
+
+    while (true) {
+        cell = &cells[pos & mask];
+        std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t lap_difference = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
 
-    if (queue_impl.empty()) {
-        return false;
+        if (lap_difference == 0) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        // Not stored yet
+        else if (lap_difference < 0) {
+            return false;
+        }
+        else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
     }
-    else {
-        value = std::move(queue_impl.front());
-        queue_impl.pop();
-        return true;
+
+    T* element = cell->get();
+    consumer(*element);
+    element->~T();
+
+    // Free for the next lap of the producers
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+}
+
+// segmented_concurrent_queue
+template <typename T>
+inline segmented_concurrent_queue<T>::segment::segment(std::size_t capacity, std::size_t base)
+    : base(base), cells(new sequenced_cell<T>[capacity]) {
+    for (std::size_t pos = 0; pos < capacity; ++pos) {
+        cells[pos].sequence.store(pos, std::memory_order_relaxed);
     }
 }
 
 template <typename T>
-inline bool concurrent_queue<T>::pop() {
-    write_lock w_lock(rw_lock);
+inline segmented_concurrent_queue<T>::epoch_guard::epoch_guard(const segmented_concurrent_queue& queue) : queue(queue) {
+    // The epoch may have moved on between reading it and pinning it, then the pin doesn't count
+    while (true) {
+        pinned_epoch = queue.epoch.load();
+        queue.pins[pinned_epoch % epochs_amount].operations.fetch_add(1);
+
+        if (queue.epoch.load() == pinned_epoch) {
+            return;
+        }
+        queue.pins[pinned_epoch % epochs_amount].operations.fetch_sub(1);
+    }
+}
+
+template <typename T>
+inline segmented_concurrent_queue<T>::segmented_concurrent_queue(std::size_t segment_capacity)
+    : segment_capacity(segment_capacity > 0 ? segment_capacity : 1) {
+    segment* first_segment = new segment(this->segment_capacity, 0);
+    head.store(first_segment, std::memory_order_relaxed);
+    tail.store(first_segment, std::memory_order_relaxed);
+}
+
+template <typename T>
+inline segmented_concurrent_queue<T>::~segmented_concurrent_queue() {
+    clear();
 
-    if (queue_impl.empty()) {
-        return false;
+    segment* current_segment = head.load();
+    while (current_segment != nullptr) {
+        delete std::exchange(current_segment, current_segment->next.load());
     }
-    else {
-        queue_impl.pop();
-        return true;
+
+    for (std::atomic<segment*>& retired_list : retired) {
+        segment* retired_segment = retired_list.load();
+        while (retired_segment != nullptr) {
+            delete std::exchange(retired_segment, retired_segment->next_retired);
+        }
     }
 }
 
+template <typename T>
+inline bool segmented_concurrent_queue<T>::empty() const {
+    return size() == 0;
+}
+
+template <typename T>
+inline std::size_t segmented_concurrent_queue<T>::size() const {
+    epoch_guard guard(*this);
+
+    segment* head_segment = head.load();
+    segment* tail_segment = tail.load();
+
+    std::size_t first_pos = head_segment->base + std::min(head_segment->dequeue_pos.load(std::memory_order_relaxed), segment_capacity);
+    std::size_t last_pos = tail_segment->base + std::min(tail_segment->enqueue_pos.load(std::memory_order_relaxed), segment_capacity);
+    return last_pos > first_pos ? last_pos - first_pos : 0;
+}
+
+template <typename T>
+inline void segmented_concurrent_queue<T>::clear() {
+    while (pop()) {}
+}
+
+template <typename T>
+inline bool segmented_concurrent_queue<T>::pop(T& value) {
+    return do_pop([&value](T& element) { value = std::move(element); });
+}
+
+template <typename T>
+inline bool segmented_concurrent_queue<T>::pop() {
+    return do_pop([](T&) {});
+}
+
 template <typename T>
 template <typename... arguments>
-inline void concurrent_queue<T>::emplace(arguments&&... parameters) {
-    write_lock w_lock(rw_lock);
-    queue_impl.emplace(std::forward<arguments>(parameters)...);
+inline void segmented_concurrent_queue<T>::emplace(arguments&&... parameters) {
+    epoch_guard guard(*this);
+
+    while (true) {
+        segment* tail_segment = tail.load();
+
+        // The cells of a segment are used once, a producer can claim one without looking at it
+        std::size_t pos = tail_segment->enqueue_pos.fetch_add(1, std::memory_order_relaxed);
+        if (pos < segment_capacity) {
+            sequenced_cell<T>& cell = tail_segment->cells[pos];
+            new (cell.storage) T(std::forward<arguments>(parameters)...);
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            return;
+        }
+
+        // Full: link the next segment (or take the one another producer has linked) and move the tail there
+        segment* next_segment = tail_segment->next.load();
+        if (next_segment == nullptr) {
+            segment* new_segment = new segment(segment_capacity, tail_segment->base + segment_capacity);
+            if (tail_segment->next.compare_exchange_strong(next_segment, new_segment)) {
+                next_segment = new_segment;
+            }
+            else {
+                delete new_segment;
+            }
+        }
+
+        tail.compare_exchange_strong(tail_segment, next_segment);
+    }
+}
+
+template <typename T>
+template <typename consumer_type>
+inline bool segmented_concurrent_queue<T>::do_pop(consumer_type&& consumer) {
+    epoch_guard guard(*this);
+
+    while (true) {
+        segment* head_segment = head.load();
+        std::size_t pos = head_segment->dequeue_pos.load(std::memory_order_relaxed);
+
+        if (pos < segment_capacity) {
+            sequenced_cell<T>& cell = head_segment->cells[pos];
+
+            // Not stored yet
+            if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+                return false;
+            }
+
+            if (head_segment->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                T* element = cell.get();
+                consumer(*element);
+                element->~T();
+                return true;
+            }
+            continue;
+        }
+
+        // Exhausted: every cell has been claimed by a consumer, so every producer that claimed one is done with it
+        segment* next_segment = head_segment->next.load();
+        if (next_segment == nullptr) {
+            return false;
+        }
+
+        // Neither the head nor the tail may be left on a retired segment
+        segment* expected_tail = head_segment;
+        tail.compare_exchange_strong(expected_tail, next_segment);
+
+        if (head.compare_exchange_strong(head_segment, next_segment)) {
+            retire(head_segment);
+        }
+    }
+}
+
+template <typename T>
+inline void segmented_concurrent_queue<T>::retire(segment* retired_segment) {
+    std::atomic<segment*>& retired_list = retired[epoch.load() % epochs_amount];
+
+    retired_segment->next_retired = retired_list.load();
+    while (!retired_list.compare_exchange_weak(retired_segment->next_retired, retired_segment)) {}
+
+    try_advance_epoch();
+}
+
+template <typename T>
+inline void segmented_concurrent_queue<T>::try_advance_epoch() {
+    // An operation that may still see a segment retired in the previous epoch is pinned either in it or in an earlier one,
+    // and those have been checked for on the way here
+    std::size_t current_epoch = epoch.load();
+    if (pins[(current_epoch + epochs_amount - 1) % epochs_amount].operations.load() != 0) {
+        return;
+    }
+
+    if (!epoch.compare_exchange_strong(current_epoch, current_epoch + 1)) {
+        return;
+    }
+
+    // The list of the previous epoch. The retiring operations are pinned in the current epoch or a later one by now,
+    // so they only add to the other two lists
+    segment* reclaimable = retired[(current_epoch + epochs_amount - 1) % epochs_amount].exchange(nullptr);
+    while (reclaimable != nullptr) {
+        delete std::exchange(reclaimable, reclaimable->next_retired);
+    }
 }
@@ -2,6 +2,10 @@
 
 #include <shared_mutex>
 #include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
 
 class w_prioritized_shared_mutex {
 private:
@@ -42,3 +46,41 @@ public:
 using read_write_lock = std::shared_mutex;
 using read_lock = std::shared_lock<read_write_lock>;
 using write_lock = std::unique_lock<read_write_lock>;
+
+
+// Call function(thread_idx) on threads_amount threads (the calling one included) and wait for all of them
+template <typename function_type>
+inline void run_in_parallel(std::size_t threads_amount, function_type&& function) {
+    std::vector<std::thread> threads;
+    threads.reserve(threads_amount - 1);
+
+    for (std::size_t thread_idx = 1; thread_idx < threads_amount; ++thread_idx) {
+        threads.emplace_back(function, thread_idx);
+    }
+    function(0);
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Call function(task_idx) for every task_idx in [0, tasks_amount) and wait for all of them.
+// The tasks are taken in turn by as many threads as the hardware runs at once, the calling one included.
+// The threads are started for every call: the tasks of a thread pool use rw_scheduled_thread_pool::for_each_in_parallel instead
+template <typename function_type>
+inline void for_each_in_parallel(std::size_t tasks_amount, function_type&& function) {
+    std::size_t threads_amount = std::min<std::size_t>(tasks_amount, std::max(std::thread::hardware_concurrency(), 1u));
+    if (threads_amount <= 1) {
+        for (std::size_t task_idx = 0; task_idx < tasks_amount; ++task_idx) {
+            function(task_idx);
+        }
+        return;
+    }
+
+    std::atomic<std::size_t> next_task_idx = 0;
+    run_in_parallel(threads_amount, [&](std::size_t) {
+        for (std::size_t task_idx = next_task_idx++; task_idx < tasks_amount; task_idx = next_task_idx++) {
+            function(task_idx);
+        }
+    });
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+
+// ===============================================================================================================
+// Watches a directory tree with inotify and reports the changed files in batches.
+// Every directory of the tree gets a watch of its own (inotify isn't recursive). A directory that appears later
+// (created or moved in) is watched as soon as it is seen, and the files already in it are reported.
+// The events of a file are coalesced: it is reported once nothing has happened to it for the debounce window, as
+// written (closed after writing, or moved in) or as removed (deleted, or moved out), whichever was last. All the files
+// that are due at the same time go to the handler as a single batch, on the watcher thread.
+// When the kernel queue overflows, the events are lost: the whole tree is walked again and every file is reported as written.
+// A directory moved out of the tree is not walked (it's gone): its files are reconciled on the next start (see index_manager::load_index).
+// ===============================================================================================================
+
+class directory_watcher {
+public:
+    enum class change_type {
+        written,
+        removed
+    };
+
+    struct change {
+        std::filesystem::path file_path; // The root path followed by the path relative to it
+        change_type type = change_type::written;
+    };
+
+    using batch_handler = std::function<void(std::vector<change>&& batch)>;
+
+    inline directory_watcher() = default;
+    inline ~directory_watcher() { terminate(); }
+
+    inline directory_watcher(const directory_watcher& other) = delete;
+    inline directory_watcher(directory_watcher&& other) = delete;
+    inline directory_watcher& operator=(const directory_watcher& rhs) = delete;
+    inline directory_watcher& operator=(directory_watcher&& rhs) = delete;
+
+public:
+    // Start watching root_path. The files already there are not reported
+    inline void initialize(const std::filesystem::path& root_path, std::chrono::milliseconds debounce_window, batch_handler handler);
+    // Stop the watcher thread. The changes still waiting for their debounce window are dropped
+    inline void terminate();
+
+private:
+    struct pending_change {
+        change_type type = change_type::written;
+        std::chrono::steady_clock::time_point due_time;
+    };
+
+    inline void routine();
+
+    // Watch the directory and every directory under it. If report_files, the files found there are reported as written
+    inline void watch_tree(const std::filesystem::path& directory_path, bool report_files);
+    inline void handle_event(const inotify_event& event);
+    inline void add_pending(const std::filesystem::path& file_path, change_type type);
+    // Hands the due changes to the handler. Returns the time until the next one is due (-1 if there's none), for poll
+    inline int flush_due_changes();
+
+private:
+    static constexpr std::uint32_t watched_events = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_DELETE_SELF;
+
+    std::filesystem::path root;
+    std::chrono::milliseconds debounce;
+    batch_handler on_batch;
+
+    int inotify_fd = -1;
+    int wake_fd = -1; // eventfd, terminate() wakes the thread through it
+    std::thread watcher_thread;
+
+    // Only the watcher thread touches these after initialize()
+    std::unordered_map<int, std::filesystem::path> watched_directories; // Watch descriptor -> directory
+    std::unordered_map<std::string, pending_change> pending_changes;    // File path -> its last change
+};
+
+// initialize
+inline void directory_watcher::initialize(const std::filesystem::path& root_path, std::chrono::milliseconds debounce_window, batch_handler handler) {
+    if (watcher_thread.joinable()) {
+        return;
+    }
+
+    root = root_path;
+    debounce = debounce_window;
+    on_batch = std::move(handler);
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        throw std::runtime_error("directory_watcher: inotify_init1 failed.");
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+        throw std::runtime_error("directory_watcher: eventfd failed.");
+    }
+
+    watch_tree(root, false);
+
+    watcher_thread = std::thread(&directory_watcher::routine, this);
+}
+
+// terminate
+inline void directory_watcher::terminate() {
+    if (!watcher_thread.joinable()) {
+        return;
+    }
+
+    std::uint64_t one = 1;
+    [[maybe_unused]] auto written = write(wake_fd, &one, sizeof(one));
+    watcher_thread.join();
+
+    close(inotify_fd);
+    close(wake_fd);
+    inotify_fd = -1;
+    wake_fd = -1;
+
+    watched_directories.clear();
+    pending_changes.clear();
+}
+
+// routine
+inline void directory_watcher::routine() {
+    // Big enough for many events at once, aligned as the events inside it are
+    alignas(inotify_event) char buffer[64 * 1024];
+
+    int timeout_ms = -1;
+    while (true) {
+        pollfd poll_fds[2] = {
+            { inotify_fd, POLLIN, 0 },
+            { wake_fd, POLLIN, 0 },
+        };
+
+        int ready = poll(poll_fds, 2, timeout_ms);
+        if (ready == -1 && errno != EINTR) {
+            return;
+        }
+
+        if (poll_fds[1].revents & POLLIN) {
+            return;
+        }
+
+        if (poll_fds[0].revents & POLLIN) {
+            while (true) {
+                ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+                if (length <= 0) {
+                    break; // EAGAIN: everything is read
+                }
+
+                for (ssize_t offset = 0; offset < length;) {
+                    const inotify_event& event = *reinterpret_cast<const inotify_event*>(buffer + offset);
+                    handle_event(event);
+                    offset += sizeof(inotify_event) + event.len;
+                }
+            }
+        }
+
+        timeout_ms = flush_due_changes();
+    }
+}
+
+// watch_tree
+inline void directory_watcher::watch_tree(const std::filesystem::path& directory_path, bool report_files) {
+    auto watch_directory = [this](const std::filesystem::path& path) {
+        int watch_descriptor = inotify_add_watch(inotify_fd, path.c_str(), watched_events);
+        if (watch_descriptor != -1) {
+            watched_directories[watch_descriptor] = path;
+        }
+    };
+
+    watch_directory(directory_path);
+
+    std::error_code error;
+    for (auto it = std::filesystem::recursive_directory_iterator(directory_path, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        const std::filesystem::path& path = it->path(); // directory_path followed by the relative path, as the events build it
+
+        if (it->is_directory(error)) {
+            watch_directory(path);
+        }
+        else if (report_files && it->is_regular_file(error)) {
+            add_pending(path, change_type::written);
+        }
+    }
+}
+
+// handle_event
+inline void directory_watcher::handle_event(const inotify_event& event) {
+    if (event.mask & IN_Q_OVERFLOW) {
+        // The events in between are lost: walk the whole tree again
+        for (const auto& [watch_descriptor, path] : watched_directories) {
+            inotify_rm_watch(inotify_fd, watch_descriptor);
+        }
+        watched_directories.clear();
+        watch_tree(root, true);
+        return;
+    }
+
+    auto directory_it = watched_directories.find(event.wd);
+    if (directory_it == watched_directories.end()) {
+        return;
+    }
+
+    if (event.mask & (IN_DELETE_SELF | IN_IGNORED)) {
+        watched_directories.erase(directory_it);
+        return;
+    }
+
+    if (event.len == 0) {
+        return;
+    }
+
+    std::filesystem::path path = directory_it->second / event.name;
+
+    if (event.mask & IN_ISDIR) {
+        // A new directory: files may have been written into it before its watch was added
+        if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+            watch_tree(path, true);
+        }
+        return;
+    }
+
+    if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        add_pending(path, change_type::written);
+    }
+    else if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+        add_pending(path, change_type::removed);
+    }
+}
+
+// add_pending
+inline void directory_watcher::add_pending(const std::filesystem::path& file_path, change_type type) {
+    pending_change& pending = pending_changes[file_path.string()];
+    pending.type = type;
+    pending.due_time = std::chrono::steady_clock::now() + debounce;
+}
+
+// flush_due_changes
+inline int directory_watcher::flush_due_changes() {
+    auto now = std::chrono::steady_clock::now();
+    auto next_due_time = std::chrono::steady_clock::time_point::max();
+
+    std::vector<change> batch;
+    for (auto it = pending_changes.begin(); it != pending_changes.end();) {
+        if (it->second.due_time <= now) {
+            batch.push_back({ std::filesystem::path(it->first), it->second.type });
+            it = pending_changes.erase(it);
+        }
+        else {
+            next_due_time = std::min(next_due_time, it->second.due_time);
+            ++it;
+        }
+    }
+
+    if (!batch.empty()) {
+        on_batch(std::move(batch));
+    }
+
+    if (pending_changes.empty()) {
+        return -1;
+    }
+
+    auto wait_time = std::chrono::ceil<std::chrono::milliseconds>(next_due_time - now);
+    return static_cast<int>(std::max<std::chrono::milliseconds::rep>(wait_time.count(), 1));
+}
+
+#endif // __linux__
@@ -0,0 +1,560 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+#include <stdexcept>
+#include "network_platform.h"
+
+// Per-socket state of a connection owned by one of the epoll_reactor threads
+class reactor_connection {
+    friend class epoll_reactor;
+
+public:
+    inline reactor_connection() = default;
+    inline ~reactor_connection() = default;
+
+    inline reactor_connection(const reactor_connection& other) = delete;
+    inline reactor_connection(reactor_connection&& other) = delete;
+    inline reactor_connection& operator=(const reactor_connection& rhs) = delete;
+    inline reactor_connection& operator=(reactor_connection&& rhs) = delete;
+
+private:
+    SOCKET socket = INVALID_SOCKET;
+    int epoll_fd = -1;
+
+    std::mutex mutex;
+
+    std::string in_buffer;
+    std::string out_buffer;
+    std::size_t out_offset = 0;
+
+    bool keep_alive = false;        // Persistent connection: requests keep coming until the peer closes its side
+    bool read_closed = false;       // No more requests are read from the connection
+    std::size_t in_flight = 0;      // Requests handed to the workers and not answered yet
+    bool throttled = false;         // Complete requests wait in in_buffer until some of the in-flight ones are answered
+    bool closed = false;
+};
+
+// A small number of threads, each with its own epoll set, doing non-blocking accept/recv/send.
+// Only complete requests (as decided by the request_framer) leave the reactor,
+// so idle or slow clients never occupy a worker thread.
+// A connection is either single-shot (one request, one response, close) or kept alive:
+// then it carries any number of requests, several of them can be in the workers at once.
+class epoll_reactor {
+public:
+    // What the framer found at the start of the received data
+    struct request_frame {
+        bool complete = false;      // false - more bytes are needed
+        std::size_t skip = 0;       // Framing bytes in front of the request, not passed to the handler
+        std::size_t size = 0;       // Request bytes passed to the handler. Nothing is dispatched if 0
+        bool keep_alive = false;    // The connection keeps reading requests after this one
+    };
+
+    // keep_alive - whether an earlier frame of the connection has already made it persistent
+    using request_framer = std::function<request_frame(const char* data, std::size_t size, bool keep_alive)>;
+    // Every dispatched request must be answered with exactly one send_response call (the response may be empty)
+    using request_handler = std::function<void(const std::shared_ptr<reactor_connection>& connection, std::string&& request, bool keep_alive)>;
+
+    inline epoll_reactor() = default;
+    inline ~epoll_reactor() { terminate(); }
+
+    inline epoll_reactor(const epoll_reactor& other) = delete;
+    inline epoll_reactor(epoll_reactor&& other) = delete;
+    inline epoll_reactor& operator=(const epoll_reactor& rhs) = delete;
+    inline epoll_reactor& operator=(epoll_reactor&& rhs) = delete;
+
+public:
+    inline void initialize(SOCKET listen_socket, std::size_t reactor_count, request_framer framer, request_handler handler);
+    // Returns once the reactor threads are joined and the connections are closed, also if another thread is terminating the reactor
+    inline void terminate();
+
+    // Blocks the calling thread until the reactor is fully terminated (see terminate)
+    inline void wait();
+
+    inline bool working() const;
+
+    // Thread-safe. Hands the response for a dispatched request back to the reactor.
+    // A single-shot connection is closed as soon as the whole response is sent,
+    // a persistent one - once the peer stopped sending and every request is answered.
+    // If everything was sent right away, response gets the memory of the sent bytes back (empty), for the next response
+    inline void send_response(const std::shared_ptr<reactor_connection>& connection, std::string&& response);
+
+private:
+    struct reactor_thread {
+        int epoll_fd = -1;
+        int wake_fd = -1;
+        std::thread thread;
+
+        // Connections are only ever added and erased by the owning reactor thread
+        std::unordered_map<reactor_connection*, std::shared_ptr<reactor_connection>> connections;
+    };
+
+    inline void routine(reactor_thread& self);
+
+    inline void accept_connections(reactor_thread& self);
+    inline void on_readable(reactor_thread& self, const std::shared_ptr<reactor_connection>& connection);
+    inline void on_writable(reactor_thread& self, const std::shared_ptr<reactor_connection>& connection);
+
+    using request_list = std::vector<std::pair<std::string, bool>>;
+    // Cuts the complete requests out of in_buffer, as many as max_in_flight allows.
+    // Returns false if the connection has to be closed due to errors
+    inline bool take_requests_unsafe(reactor_connection& connection, request_list& out_requests);
+    // Hands the requests taken from the connection to the handler. Call it without holding the connection mutex
+    inline void dispatch_requests(const std::shared_ptr<reactor_connection>& connection, request_list& requests);
+
+    inline static void close_connection_unsafe(reactor_connection& connection);
+    // Returns false if the connection has to be closed due to errors
+    inline static bool flush_unsafe(reactor_connection& connection);
+    // Re-enables the events the connection is currently interested in (all sockets are EPOLLONESHOT)
+    inline static void rearm_unsafe(reactor_connection& connection);
+    // Nothing is left to read, to answer or to send
+    inline static bool finished_unsafe(const reactor_connection& connection);
+
+private:
+    std::vector<std::unique_ptr<reactor_thread>> reactors;
+
+    SOCKET listen_socket = INVALID_SOCKET;
+    request_framer framer;
+    request_handler handler;
+
+    std::mutex state_mutex;
+    std::condition_variable cv_terminated;
+    std::atomic<bool> terminated = false;
+    bool initialized = false;   // Stays true until terminate() is done
+    bool terminating = false;
+
+    static constexpr int max_events = 256;
+    static constexpr std::size_t recv_chunk_size = 16 * 1024;
+    static constexpr std::size_t max_request_size = 16 * 1024 * 1024;
+    // A persistent connection stops being read while that many of its requests are in the workers
+    static constexpr std::size_t max_in_flight = 128;
+};
+
+
+inline void epoll_reactor::initialize(SOCKET listen_socket, std::size_t reactor_count, request_framer framer, request_handler handler) {
+    std::lock_guard lock(state_mutex);
+
+    if (initialized || reactor_count == 0) {
+        return;
+    }
+
+    if (!set_socket_non_blocking(listen_socket)) {
+        throw std::runtime_error("REACTOR: Failed to make the listening socket non-blocking: " + std::string(std::strerror(errno)) + ".");
+    }
+
+    this->listen_socket = listen_socket;
+    this->framer = std::move(framer);
+    this->handler = std::move(handler);
+    terminated = false;
+
+    reactors.reserve(reactor_count);
+    for (std::size_t id = 0; id < reactor_count; ++id) {
+        auto& self = *reactors.emplace_back(std::make_unique<reactor_thread>());
+
+        self.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        self.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (self.epoll_fd == -1 || self.wake_fd == -1) {
+            throw std::runtime_error("REACTOR: Failed to create epoll/eventfd: " + std::string(std::strerror(errno)) + ".");
+        }
+
+        // data.ptr: the reactor itself - wake up, nullptr - listening socket, anything else - reactor_connection
+        epoll_event wake_event{};
+        wake_event.events = EPOLLIN;
+        wake_event.data.ptr = &self;
+        epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, self.wake_fd, &wake_event);
+
+        // Every reactor accepts by itself, EPOLLEXCLUSIVE avoids waking all of them for a single connection
+        epoll_event listen_event{};
+        listen_event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        listen_event.data.ptr = nullptr;
+        if (epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, listen_socket, &listen_event) == -1) {
+            throw std::runtime_error("REACTOR: Failed to watch the listening socket: " + std::string(std::strerror(errno)) + ".");
+        }
+    }
+
+    for (auto& reactor : reactors) {
+        reactor->thread = std::thread(&epoll_reactor::routine, this, std::ref(*reactor));
+    }
+
+    initialized = true;
+}
+
+inline void epoll_reactor::terminate() {
+    {
+        std::unique_lock lock(state_mutex);
+
+        if (terminating) {
+            cv_terminated.wait(lock, [this] { return !terminating; });
+            return;
+        }
+        if (!initialized) {
+            return;
+        }
+        terminating = true;
+        terminated = true;
+    }
+
+    for (auto& reactor : reactors) {
+        std::uint64_t wake_value = 1;
+        [[maybe_unused]] auto written = ::write(reactor->wake_fd, &wake_value, sizeof(wake_value));
+    }
+
+    for (auto& reactor : reactors) {
+        if (reactor->thread.joinable()) {
+            reactor->thread.join();
+        }
+
+        for (auto& [connection_ptr, connection] : reactor->connections) {
+            std::lock_guard connection_lock(connection->mutex);
+            close_connection_unsafe(*connection);
+        }
+        reactor->connections.clear();
+
+        ::close(reactor->epoll_fd);
+        ::close(reactor->wake_fd);
+    }
+    reactors.clear();
+
+    // Notified under the lock: a waiter can't return, and destroy the reactor, before this thread is done with it
+    std::lock_guard lock(state_mutex);
+    initialized = false;
+    terminating = false;
+    cv_terminated.notify_all();
+}
+
+inline void epoll_reactor::wait() {
+    std::unique_lock lock(state_mutex);
+    cv_terminated.wait(lock, [this] { return !initialized; });
+}
+
+inline bool epoll_reactor::working() const {
+    return !terminated.load(std::memory_order_acquire);
+}
+
+inline void epoll_reactor::routine(reactor_thread& self) {
+    epoll_event events[max_events];
+
+    // Connections closed while handling a batch stay alive until the batch is over,
+    // so the remaining events of that batch never point to freed memory
+    std::vector<std::shared_ptr<reactor_connection>> closed_connections;
+
+    while (!terminated.load(std::memory_order_acquire)) {
+        int events_count = epoll_wait(self.epoll_fd, events, max_events, -1);
+        if (events_count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        for (int event_idx = 0; event_idx < events_count; ++event_idx) {
+            const epoll_event& event = events[event_idx];
+
+            if (event.data.ptr == nullptr) {
+                accept_connections(self);
+                continue;
+            }
+            if (event.data.ptr == &self) {
+                std::uint64_t wake_value;
+                [[maybe_unused]] auto read = ::read(self.wake_fd, &wake_value, sizeof(wake_value));
+                continue;
+            }
+
+            auto it = self.connections.find(static_cast<reactor_connection*>(event.data.ptr));
+            if (it == self.connections.end()) {
+                continue;
+            }
+            std::shared_ptr<reactor_connection> connection = it->second;
+
+            if (event.events & EPOLLIN) {
+                on_readable(self, connection);
+            }
+            if (event.events & EPOLLOUT) {
+                on_writable(self, connection);
+            }
+            if ((event.events & EPOLLERR) || ((event.events & EPOLLHUP) && !(event.events & (EPOLLIN | EPOLLOUT)))) {
+                std::lock_guard connection_lock(connection->mutex);
+                close_connection_unsafe(*connection);
+            }
+
+            bool closed = false;
+            {
+                std::lock_guard connection_lock(connection->mutex);
+                closed = connection->closed;
+            }
+            if (closed) {
+                self.connections.erase(it);
+                closed_connections.emplace_back(std::move(connection));
+            }
+        }
+
+        closed_connections.clear();
+    }
+}
+
+inline void epoll_reactor::accept_connections(reactor_thread& self) {
+    while (true) {
+        SOCKET client_socket = accept4(listen_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket == INVALID_SOCKET) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // EAGAIN - no more pending connections (or out of descriptors - try again on the next event)
+        }
+
+        int no_delay = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+        auto connection = std::make_shared<reactor_connection>();
+        connection->socket = client_socket;
+        connection->epoll_fd = self.epoll_fd;
+
+        epoll_event client_event{};
+        client_event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        client_event.data.ptr = connection.get();
+        if (epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, client_socket, &client_event) == -1) {
+            closesocket(client_socket);
+            continue;
+        }
+
+        self.connections.emplace(connection.get(), std::move(connection));
+    }
+}
+
+inline void epoll_reactor::on_readable([[maybe_unused]] reactor_thread& self, const std::shared_ptr<reactor_connection>& connection) {
+    std::unique_lock connection_lock(connection->mutex);
+
+    if (connection->closed || connection->read_closed) {
+        return;
+    }
+
+    auto& in_buffer = connection->in_buffer;
+    bool peer_closed = false;
+
+    // Drain the socket: it is not reported again until re-armed.
+    // Past max_request_size the rest is left in the socket until the received requests are dispatched
+    while (in_buffer.size() < max_request_size) {
+        std::size_t old_size = in_buffer.size();
+        in_buffer.resize(old_size + recv_chunk_size);
+
+        ssize_t recv_size = ::recv(connection->socket, &in_buffer[old_size], recv_chunk_size, 0);
+        in_buffer.resize(old_size + std::max<ssize_t>(recv_size, 0));
+
+        if (recv_size > 0) {
+            continue;
+        }
+        if (recv_size == 0) {
+            peer_closed = true;
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+
+        close_connection_unsafe(*connection);
+        return;
+    }
+
+    if (peer_closed) {
+        connection->read_closed = true;
+    }
+
+    request_list requests;
+    if (!take_requests_unsafe(*connection, requests)) {
+        close_connection_unsafe(*connection);
+        return;
+    }
+
+    if (finished_unsafe(*connection)) {
+        close_connection_unsafe(*connection);
+        return;
+    }
+    rearm_unsafe(*connection);
+
+    connection_lock.unlock();
+
+    dispatch_requests(connection, requests);
+}
+
+inline void epoll_reactor::on_writable([[maybe_unused]] reactor_thread& self, const std::shared_ptr<reactor_connection>& connection) {
+    std::unique_lock connection_lock(connection->mutex);
+
+    if (connection->closed) {
+        return;
+    }
+
+    // The requests held back by max_in_flight are already received: the socket won't report them again
+    request_list requests;
+    if (connection->throttled && !take_requests_unsafe(*connection, requests)) {
+        close_connection_unsafe(*connection);
+        return;
+    }
+
+    if (!flush_unsafe(*connection) || finished_unsafe(*connection)) {
+        close_connection_unsafe(*connection);
+        return;
+    }
+    rearm_unsafe(*connection);
+
+    connection_lock.unlock();
+
+    dispatch_requests(connection, requests);
+}
+
+inline bool epoll_reactor::take_requests_unsafe(reactor_connection& connection, request_list& out_requests) {
+    auto& in_buffer = connection.in_buffer;
+
+    std::size_t offset = 0;
+    bool incomplete = false;
+    connection.throttled = false;
+
+    while (true) {
+        if (connection.in_flight + out_requests.size() >= max_in_flight) {
+            connection.throttled = true;
+            break;
+        }
+
+        request_frame frame = framer(in_buffer.data() + offset, in_buffer.size() - offset, connection.keep_alive);
+        if (!frame.complete) {
+            incomplete = true;
+            break;
+        }
+
+        if (frame.size > 0) {
+            out_requests.emplace_back(in_buffer.substr(offset + frame.skip, frame.size), frame.keep_alive);
+        }
+        offset += frame.skip + frame.size;
+
+        // A single-shot connection ignores anything after its request
+        connection.keep_alive = frame.keep_alive;
+        if (!frame.keep_alive) {
+            connection.read_closed = true;
+            connection.throttled = false;
+            in_buffer = std::string();
+            offset = 0;
+            break;
+        }
+    }
+
+    in_buffer.erase(0, offset);
+    connection.in_flight += out_requests.size();
+
+    // A request that can never be completed
+    return !(incomplete && in_buffer.size() >= max_request_size);
+}
+
+inline void epoll_reactor::dispatch_requests(const std::shared_ptr<reactor_connection>& connection, request_list& requests) {
+    for (auto& [request, keep_alive] : requests) {
+        handler(connection, std::move(request), keep_alive);
+    }
+}
+
+inline void epoll_reactor::send_response(const std::shared_ptr<reactor_connection>& connection, std::string&& response) {
+    std::lock_guard connection_lock(connection->mutex);
+
+    if (connection->closed) {
+        return;
+    }
+
+    if (connection->in_flight > 0) {
+        --connection->in_flight;
+    }
+
+    if (connection->out_offset == connection->out_buffer.size()) {
+        connection->out_buffer = std::move(response);
+        connection->out_offset = 0;
+    }
+    else {
+        connection->out_buffer.erase(0, connection->out_offset);
+        connection->out_offset = 0;
+        connection->out_buffer.append(response);
+    }
+
+    // Most responses fit into the socket buffer right away, send them from the worker.
+    // Closing is always left to the reactor thread that owns the connection: it gets EPOLLOUT immediately.
+    flush_unsafe(*connection);
+
+    if (connection->out_offset == connection->out_buffer.size()) {
+        response.clear();
+        connection->out_buffer.clear();
+        connection->out_offset = 0;
+        response.swap(connection->out_buffer);
+    }
+
+    rearm_unsafe(*connection);
+}
+
+inline void epoll_reactor::close_connection_unsafe(reactor_connection& connection) {
+    if (connection.closed) {
+        return;
+    }
+    connection.closed = true;
+
+    // Closing the descriptor also removes it from the epoll set
+    closesocket(connection.socket);
+    connection.socket = INVALID_SOCKET;
+
+    connection.in_buffer = std::string();
+    connection.out_buffer = std::string();
+}
+
+inline bool epoll_reactor::flush_unsafe(reactor_connection& connection) {
+    auto& out_buffer = connection.out_buffer;
+
+    while (connection.out_offset < out_buffer.size()) {
+        ssize_t send_size = ::send(connection.socket, out_buffer.data() + connection.out_offset, out_buffer.size() - connection.out_offset, socket_send_flags);
+
+        if (send_size > 0) {
+            connection.out_offset += send_size;
+            continue;
+        }
+        if (send_size == -1 && errno == EINTR) {
+            continue;
+        }
+        if (send_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+inline void epoll_reactor::rearm_unsafe(reactor_connection& connection) {
+    epoll_event client_event{};
+    client_event.events = EPOLLRDHUP | EPOLLONESHOT;
+    client_event.data.ptr = &connection;
+
+    if (!connection.read_closed && connection.in_flight < max_in_flight) {
+        client_event.events |= EPOLLIN;
+    }
+    // EPOLLOUT fires right away on a writable socket: the owning reactor thread closes finished connections
+    // and resumes the throttled ones this way
+    bool resume_throttled = connection.throttled && connection.in_flight < max_in_flight;
+    if (connection.out_offset < connection.out_buffer.size() || finished_unsafe(connection) || resume_throttled) {
+        client_event.events |= EPOLLOUT;
+    }
+
+    epoll_ctl(connection.epoll_fd, EPOLL_CTL_MOD, connection.socket, &client_event);
+}
+
+inline bool epoll_reactor::finished_unsafe(const reactor_connection& connection) {
+    return connection.read_closed && !connection.throttled && connection.in_flight == 0 && connection.out_offset == connection.out_buffer.size();
+}
+
+#endif // __linux__
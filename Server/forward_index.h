@@ -51,21 +51,44 @@ public:
     inline void clear_file(id_type file_id);
     inline void clear_file_unsafe(id_type file_id);
 
+    // Move the word IDs of the file out and delete the file (as delete_file does)
+    inline std::unordered_set<id_type> extract_word_id_set(id_type file_id);
+    inline std::unordered_set<id_type> extract_word_id_set_unsafe(id_type file_id);
+
     inline std::unordered_set<id_type> get_word_id_set(id_type file_id) const;
     inline std::unordered_set<id_type> get_word_id_set_unsafe(id_type file_id) const;
 
-    inline const std::unordered_set<id_type>& get_word_id_set_ref(id_type file_id) const;
-    inline const std::unordered_set<id_type>& get_word_id_set_ref_unsafe(id_type file_id) const;
+    inline const std::unordered_set<id_type>& get_word_id_set_cref(id_type file_id) const;
+    inline const std::unordered_set<id_type>& get_word_id_set_cref_unsafe(id_type file_id) const;
 
     inline bool has_id(id_type file_id) const;
     inline bool has_id_unsafe(id_type file_id) const;
 
+    // Get the length of the file in words (0 for a file without words)
+    inline id_type get_file_length(id_type file_id) const;
+    inline id_type get_file_length_unsafe(id_type file_id) const;
+
+    inline void set_file_length(id_type file_id, id_type file_length);
+    inline void set_file_length_unsafe(id_type file_id, id_type file_length);
+
+    // Get the sum of the lengths of all the files
+    inline big_id_type get_total_length() const;
+    inline big_id_type get_total_length_unsafe() const;
+
+    // Get the amount of files with a non-zero length
+    inline std::size_t size_nonempty_files() const;
+    inline std::size_t size_nonempty_files_unsafe() const;
+
 private:
     // key - file ID, value - un_set of word IDs
     using forward_map = std::unordered_map<id_type, std::unordered_set<id_type>>;
+    // key - file ID, value - length of the file in words (only for the files with a non-zero length)
+    using length_map = std::unordered_map<id_type, id_type>;
 
     mutable read_write_lock rw_lock;
     forward_map file_map;
+    length_map file_length_map;
+    big_id_type total_length = 0;
 };
 
 // empty
@@ -110,6 +133,8 @@ inline void forward_index::clear() {
 
 inline void forward_index::clear_unsafe() {
     file_map.clear();
+    file_length_map.clear();
+    total_length = 0;
 }
 
 // add_word_id
@@ -154,6 +179,7 @@ inline void forward_index::delete_file_unsafe(id_type file_id) {
     }
 
     file_map.erase(it);
+    set_file_length_unsafe(file_id, 0);
 }
 
 // clear_file
@@ -169,23 +195,43 @@ inline void forward_index::clear_file_unsafe(id_type file_id) {
     }
 
     file_map[file_id].clear();
+    set_file_length_unsafe(file_id, 0);
+}
+
+// extract_word_id_set
+inline std::unordered_set<id_type> forward_index::extract_word_id_set(id_type file_id) {
+    write_lock w_lock(rw_lock);
+    return extract_word_id_set_unsafe(file_id);
+}
+
+inline std::unordered_set<id_type> forward_index::extract_word_id_set_unsafe(id_type file_id) {
+    auto it = file_map.find(file_id);
+    if (it == file_map.end()) {
+        throw std::out_of_range("File ID not found.");
+    }
+
+    std::unordered_set<id_type> word_ids = std::move(it->second);
+    file_map.erase(it);
+    set_file_length_unsafe(file_id, 0);
+
+    return word_ids;
 }
 
 // get_word_id_set
 inline std::unordered_set<id_type> forward_index::get_word_id_set(id_type file_id) const {
-    return get_word_id_set_ref(file_id);
+    return get_word_id_set_cref(file_id);
 }
 
 inline std::unordered_set<id_type> forward_index::get_word_id_set_unsafe(id_type file_id) const {
-    return get_word_id_set_ref_unsafe(file_id);
+    return get_word_id_set_cref_unsafe(file_id);
 }
 
-inline const std::unordered_set<id_type>& forward_index::get_word_id_set_ref(id_type file_id) const {
+inline const std::unordered_set<id_type>& forward_index::get_word_id_set_cref(id_type file_id) const {
     read_lock r_lock(rw_lock);
-    return get_word_id_set_ref_unsafe(file_id);
+    return get_word_id_set_cref_unsafe(file_id);
 }
 
-inline const std::unordered_set<id_type>& forward_index::get_word_id_set_ref_unsafe(id_type file_id) const {
+inline const std::unordered_set<id_type>& forward_index::get_word_id_set_cref_unsafe(id_type file_id) const {
     auto it = file_map.find(file_id);
     if (it == file_map.end()) {
         throw std::out_of_range("File ID not found.");
@@ -202,3 +248,52 @@ inline bool forward_index::has_id(id_type file_id) const {
 inline bool forward_index::has_id_unsafe(id_type file_id) const {
     return file_map.find(file_id) != file_map.end();
 }
+
+// get_file_length
+inline id_type forward_index::get_file_length(id_type file_id) const {
+    read_lock r_lock(rw_lock);
+    return get_file_length_unsafe(file_id);
+}
+
+inline id_type forward_index::get_file_length_unsafe(id_type file_id) const {
+    auto it = file_length_map.find(file_id);
+    return it != file_length_map.end() ? it->second : 0;
+}
+
+// set_file_length
+inline void forward_index::set_file_length(id_type file_id, id_type file_length) {
+    write_lock w_lock(rw_lock);
+    set_file_length_unsafe(file_id, file_length);
+}
+
+inline void forward_index::set_file_length_unsafe(id_type file_id, id_type file_length) {
+    total_length -= get_file_length_unsafe(file_id);
+    total_length += file_length;
+
+    if (file_length != 0) {
+        file_length_map[file_id] = file_length;
+    }
+    else {
+        file_length_map.erase(file_id);
+    }
+}
+
+// get_total_length
+inline big_id_type forward_index::get_total_length() const {
+    read_lock r_lock(rw_lock);
+    return get_total_length_unsafe();
+}
+
+inline big_id_type forward_index::get_total_length_unsafe() const {
+    return total_length;
+}
+
+// size_nonempty_files
+inline std::size_t forward_index::size_nonempty_files() const {
+    read_lock r_lock(rw_lock);
+    return size_nonempty_files_unsafe();
+}
+
+inline std::size_t forward_index::size_nonempty_files_unsafe() const {
+    return file_length_map.size();
+}
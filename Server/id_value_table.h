@@ -36,8 +36,8 @@ public:
     inline value_type get_value(id_type value_id) const;
     inline value_type get_value_unsafe(id_type value_id) const;
 
-    inline const value_type& get_value_ref(id_type value_id) const;
-    inline const value_type& get_value_ref_unsafe(id_type value_id) const;
+    inline const value_type& get_value_cref(id_type value_id) const;
+    inline const value_type& get_value_cref_unsafe(id_type value_id) const;
 
     template <bool T = double_sided, typename = std::enable_if_t<T>>
     inline id_type get_value_id(const value_type& value_target) const;
@@ -58,6 +58,14 @@ public:
     template <bool T = double_sided, typename = std::enable_if_t<T>>
     inline bool has_value_unsafe(const value_type& value_target) const;
 
+    // Get the amount of values
+    inline std::size_t size() const;
+    inline std::size_t size_unsafe() const;
+
+    // Get the ID the next added value will get. The IDs of the removed values are not reused, so every ID in the table is below it
+    inline id_type get_next_id() const;
+    inline id_type get_next_id_unsafe() const;
+
     inline void clear();
     inline void clear_unsafe();
 
@@ -202,22 +210,22 @@ inline void id_value_table<id_type, value_type, double_sided>::remove_by_value_u
 // get_value
 template <typename id_type, typename value_type, bool double_sided>
 inline value_type id_value_table<id_type, value_type, double_sided>::get_value(id_type value_id) const {
-    return get_value_ref(value_id);
+    return get_value_cref(value_id);
 }
 
 template <typename id_type, typename value_type, bool double_sided>
 inline value_type id_value_table<id_type, value_type, double_sided>::get_value_unsafe(id_type value_id) const {
-    return get_value_ref_unsafe(value_id);
+    return get_value_cref_unsafe(value_id);
 }
 
 template <typename id_type, typename value_type, bool double_sided>
-inline const value_type& id_value_table<id_type, value_type, double_sided>::get_value_ref(id_type value_id) const {
+inline const value_type& id_value_table<id_type, value_type, double_sided>::get_value_cref(id_type value_id) const {
     read_lock r_lock(rw_lock);
-    return get_value_ref_unsafe(value_id);
+    return get_value_cref_unsafe(value_id);
 }
 
 template <typename id_type, typename value_type, bool double_sided>
-inline const value_type& id_value_table<id_type, value_type, double_sided>::get_value_ref_unsafe(id_type value_id) const {
+inline const value_type& id_value_table<id_type, value_type, double_sided>::get_value_cref_unsafe(id_type value_id) const {
     auto it = id_to_value.find(value_id);
     if (it == id_to_value.end()) {
         throw std::out_of_range("Value ID not found.");
@@ -287,6 +295,30 @@ inline bool id_value_table<id_type, value_type, double_sided>::has_value_unsafe(
     return value_to_id.find(value_target) != value_to_id.end();
 }
 
+// size
+template <typename id_type, typename value_type, bool double_sided>
+inline std::size_t id_value_table<id_type, value_type, double_sided>::size() const {
+    read_lock r_lock(rw_lock);
+    return size_unsafe();
+}
+
+template <typename id_type, typename value_type, bool double_sided>
+inline std::size_t id_value_table<id_type, value_type, double_sided>::size_unsafe() const {
+    return id_to_value.size();
+}
+
+// get_next_id
+template <typename id_type, typename value_type, bool double_sided>
+inline id_type id_value_table<id_type, value_type, double_sided>::get_next_id() const {
+    read_lock r_lock(rw_lock);
+    return get_next_id_unsafe();
+}
+
+template <typename id_type, typename value_type, bool double_sided>
+inline id_type id_value_table<id_type, value_type, double_sided>::get_next_id_unsafe() const {
+    return next_id;
+}
+
 // clear
 template <typename id_type, typename value_type, bool double_sided>
 inline void id_value_table<id_type, value_type, double_sided>::clear() {
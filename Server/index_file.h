@@ -0,0 +1,432 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "index_version.h"
+#include "append_only_file.h"
+#include "mapped_file.h"
+#include "utility.h"
+#include "project_types.h"
+
+// ===============================================================================================================
+// The binary index file: a whole index version, saved so that the server starts without tokenizing the corpus.
+// Header, then the sections, every one of them 8-byte aligned, integers in the byte order of the host:
+//     words         - u64 offsets[words + 1] into the UTF-8 bytes of the words (the word i has the ID i + 1);
+//     files         - the same for the paths of the present files (the file i has the ID i + 1),
+//                     then for the paths of the removed ones;
+//     file manifest - u32 length (in words), then u64 size, i64 last write time and u64 content hash of every present file
+//                     as it was when its words were read (see index_version::file_stamp), then u64 size and i64 last write time
+//                     of every removed file as it was when it was removed;
+//     posting lists - u64 offsets[words + 1] into the postings, u32 file ID of every posting,
+//                     u64 offsets[postings + 1] into the positions, u32 positions.
+// The file is loaded through a read-only mapping, straight into a bulk_index (see index_version.h).
+// A file that is shorter than the header says, of another format version or written on another kind of host is not loaded.
+// ===============================================================================================================
+
+template <typename string_type>
+class index_file {
+public:
+    using version_type = index_version<string_type>;
+    using bulk_index = typename version_type::bulk_index;
+
+    using file_stamp = typename version_type::file_stamp;
+
+    static constexpr std::uint32_t format_version = 3;
+
+    // Save the version into index_path. The file is written next to it first and then replaces it,
+    // so a failed save keeps the previous index file. Returns false if the file could not be written
+    inline static bool save(const std::filesystem::path& index_path, const version_type& version);
+
+    // Returns false if the file is missing, damaged or of another format
+    inline static bool load(const std::filesystem::path& index_path, bulk_index& out_bulk);
+
+private:
+    struct file_header {
+        char magic[8];
+        std::uint32_t format_version;
+        std::uint32_t byte_order_mark;
+        std::uint32_t id_size;
+        std::uint32_t reserved;
+        std::uint64_t file_size; // Of the whole index file
+        std::uint64_t words_amount;
+        std::uint64_t files_amount;
+        std::uint64_t removed_files_amount;
+        std::uint64_t postings_amount; // (word, file) pairs
+        std::uint64_t positions_amount;
+    };
+
+    static constexpr char magic[8] = { 'P', 'C', 'I', 'N', 'D', 'E', 'X', '\0' };
+    static constexpr std::uint32_t byte_order_mark = 0x01020304;
+    static constexpr std::size_t section_alignment = 8;
+
+    class section_writer;
+    class section_reader;
+
+    inline static void write_strings(section_writer& writer, const std::vector<const string_type*>& strings);
+    // Returns false if the section is damaged
+    inline static bool read_strings(section_reader& reader, std::uint64_t strings_amount, std::vector<string_type>& out_strings);
+};
+
+template <typename string_type>
+class index_file<string_type>::section_writer {
+public:
+    inline explicit section_writer(std::ofstream& file) : file(file) {}
+
+    template <typename T>
+    inline void write_value(T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write_bytes(&value, sizeof(value));
+    }
+
+    inline void write_bytes(const void* p_bytes, std::size_t bytes_amount) {
+        file.write(static_cast<const char*>(p_bytes), static_cast<std::streamsize>(bytes_amount));
+        offset += bytes_amount;
+    }
+
+    // Pad with zeros up to the next section
+    inline void align() {
+        constexpr char zeros[section_alignment] = {};
+        write_bytes(zeros, (section_alignment - offset % section_alignment) % section_alignment);
+    }
+
+    inline std::uint64_t get_offset() const { return offset; }
+
+private:
+    std::ofstream& file;
+    std::uint64_t offset = 0;
+};
+
+template <typename string_type>
+class index_file<string_type>::section_reader {
+public:
+    inline section_reader(const std::byte* p_data, std::size_t data_size) : p_data(p_data), data_size(data_size) {}
+
+    // The next amount values of type T, or nullptr if the file ends before them
+    template <typename T>
+    inline const T* take(std::uint64_t amount) {
+        if (amount > (data_size - offset) / sizeof(T)) {
+            return nullptr;
+        }
+
+        const T* p_values = reinterpret_cast<const T*>(p_data + offset);
+        offset += amount * sizeof(T);
+        return p_values;
+    }
+
+    inline void align() {
+        offset = std::min(data_size, offset + (section_alignment - offset % section_alignment) % section_alignment);
+    }
+
+private:
+    const std::byte* p_data;
+    std::size_t data_size;
+    std::size_t offset = 0;
+};
+
+// save
+template <typename string_type>
+inline bool index_file<string_type>::save(const std::filesystem::path& index_path, const version_type& version) {
+    // Words get the IDs 1.. in their order. The words no present file has are skipped: those that are forgotten already
+    // (see index_version::apply_merge), and those that only removed files still have in some segment.
+    // Present files get the IDs 1.. in their present order, the removed ones follow them
+    std::vector<const string_type*> words;
+    std::vector<id_type> word_ids; // Of the saved words, in this version
+    std::vector<const string_type*> file_paths;
+    std::vector<const string_type*> removed_file_paths;
+    std::vector<id_type> saved_file_ids(version.files_table.size_unsafe() + 1, 0);
+    std::vector<id_type> present_file_ids;
+    std::vector<id_type> removed_file_ids;
+
+    try {
+        version.for_each_word_unsafe([&](id_type word_id, const string_type& word) {
+            if (version.inverted.size_file_set(word_id) != 0) {
+                words.push_back(&word);
+                word_ids.push_back(word_id);
+            }
+        });
+
+        for (id_type file_id = 1; file_id <= version.files_table.size_unsafe(); ++file_id) {
+            if (version.files_present_table.get_value_unsafe(file_id)) {
+                file_paths.push_back(&version.files_table.get_value_cref_unsafe(file_id));
+                present_file_ids.push_back(file_id);
+                saved_file_ids[file_id] = static_cast<id_type>(file_paths.size());
+            }
+            else {
+                removed_file_paths.push_back(&version.files_table.get_value_cref_unsafe(file_id));
+                removed_file_ids.push_back(file_id);
+            }
+        }
+    }
+    catch (std::exception&) {
+        return false; // The IDs of the files table are not 1..size()
+    }
+
+    // The files of a word from all the segments, in ascending file ID order. The erased files that are not purged yet are skipped:
+    // they are not present, so they have no saved ID
+    auto for_each_saved_file = [&version](id_type word_id, auto&& function) {
+        version.inverted.for_each_file(word_id, function);
+    };
+
+    file_header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.format_version = format_version;
+    header.byte_order_mark = byte_order_mark;
+    header.id_size = sizeof(id_type);
+    header.words_amount = words.size();
+    header.files_amount = file_paths.size();
+    header.removed_files_amount = removed_file_paths.size();
+    for (const auto word_id : word_ids) {
+        for_each_saved_file(word_id, [&header](const auto& files) {
+            ++header.postings_amount;
+            header.positions_amount += files.positions_amount();
+        });
+    }
+
+    std::filesystem::path temporary_path = index_path;
+    temporary_path += ".tmp";
+
+    std::ofstream file(temporary_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    section_writer writer(file);
+    writer.write_value(header);
+
+    write_strings(writer, words);
+    write_strings(writer, file_paths);
+    write_strings(writer, removed_file_paths);
+
+    for (const auto file_id : present_file_ids) {
+        writer.write_value(version.forward.get_file_length_unsafe(file_id));
+    }
+    writer.align();
+
+    std::vector<const file_stamp*> file_stamps;
+    file_stamps.reserve(present_file_ids.size());
+    for (const auto file_id : present_file_ids) {
+        file_stamps.push_back(&version.files_stamp_table.get_value_cref_unsafe(file_id));
+    }
+    for (const auto* p_stamp : file_stamps) {
+        writer.write_value(p_stamp->size);
+    }
+    for (const auto* p_stamp : file_stamps) {
+        writer.write_value(p_stamp->last_write_time);
+    }
+    for (const auto* p_stamp : file_stamps) {
+        writer.write_value(p_stamp->content_hash);
+    }
+
+    std::vector<const file_stamp*> removed_file_stamps;
+    removed_file_stamps.reserve(removed_file_ids.size());
+    for (const auto file_id : removed_file_ids) {
+        removed_file_stamps.push_back(&version.files_stamp_table.get_value_cref_unsafe(file_id));
+    }
+    for (const auto* p_stamp : removed_file_stamps) {
+        writer.write_value(p_stamp->size);
+    }
+    for (const auto* p_stamp : removed_file_stamps) {
+        writer.write_value(p_stamp->last_write_time);
+    }
+
+    // Posting lists: the offsets first, then the file IDs, the offsets of their positions and the positions themselves
+    std::uint64_t postings_offset = 0;
+    writer.write_value(postings_offset);
+    for (const auto word_id : word_ids) {
+        for_each_saved_file(word_id, [&postings_offset](const auto&) { ++postings_offset; });
+        writer.write_value(postings_offset);
+    }
+
+    for (const auto word_id : word_ids) {
+        for_each_saved_file(word_id, [&](const auto& files) { writer.write_value(saved_file_ids[files.file_id()]); });
+    }
+    writer.align();
+
+    std::uint64_t positions_offset = 0;
+    writer.write_value(positions_offset);
+    for (const auto word_id : word_ids) {
+        for_each_saved_file(word_id, [&](const auto& files) {
+            positions_offset += files.positions_amount();
+            writer.write_value(positions_offset);
+        });
+    }
+
+    for (const auto word_id : word_ids) {
+        for_each_saved_file(word_id, [&writer](const auto& files) {
+            files.for_each_position([&writer](id_type position) { writer.write_value(position); });
+        });
+    }
+    writer.align();
+
+    // The size is known only now
+    header.file_size = writer.get_offset();
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // The write-ahead log is emptied once the index is saved, so the file must be on the disk before it replaces the old one
+    file.close();
+    if (!file || !append_only_file::sync_file(temporary_path)) {
+        std::error_code error;
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary_path, index_path, error);
+    return !error;
+}
+
+// load
+template <typename string_type>
+inline bool index_file<string_type>::load(const std::filesystem::path& index_path, bulk_index& out_bulk) {
+    mapped_file file;
+    if (!file.open(index_path)) {
+        return false;
+    }
+
+    section_reader reader(file.data(), file.size());
+
+    const file_header* p_header = reader.take<file_header>(1);
+    if (p_header == nullptr
+        || std::memcmp(p_header->magic, magic, sizeof(magic)) != 0
+        || p_header->format_version != format_version
+        || p_header->byte_order_mark != byte_order_mark
+        || p_header->id_size != sizeof(id_type)
+        || p_header->file_size != file.size()) {
+        return false;
+    }
+
+    const file_header& header = *p_header;
+
+    bulk_index bulk;
+    if (!read_strings(reader, header.words_amount, bulk.words)
+        || !read_strings(reader, header.files_amount, bulk.file_paths)
+        || !read_strings(reader, header.removed_files_amount, bulk.removed_file_paths)) {
+        return false;
+    }
+
+    const id_type* p_file_lengths = reader.take<id_type>(header.files_amount);
+    reader.align();
+    const std::uint64_t* p_file_sizes = reader.take<std::uint64_t>(header.files_amount);
+    const std::int64_t* p_file_write_times = reader.take<std::int64_t>(header.files_amount);
+    const std::uint64_t* p_file_content_hashes = reader.take<std::uint64_t>(header.files_amount);
+    const std::uint64_t* p_removed_file_sizes = reader.take<std::uint64_t>(header.removed_files_amount);
+    const std::int64_t* p_removed_file_write_times = reader.take<std::int64_t>(header.removed_files_amount);
+
+    const std::uint64_t* p_postings_offsets = reader.take<std::uint64_t>(header.words_amount + 1);
+    const id_type* p_posting_file_ids = reader.take<id_type>(header.postings_amount);
+    reader.align();
+    const std::uint64_t* p_positions_offsets = reader.take<std::uint64_t>(header.postings_amount + 1);
+    const id_type* p_positions = reader.take<id_type>(header.positions_amount);
+
+    if (p_file_lengths == nullptr || p_file_sizes == nullptr || p_file_write_times == nullptr || p_file_content_hashes == nullptr
+        || p_removed_file_sizes == nullptr || p_removed_file_write_times == nullptr
+        || p_postings_offsets == nullptr || p_posting_file_ids == nullptr || p_positions_offsets == nullptr || p_positions == nullptr
+        || p_postings_offsets[header.words_amount] != header.postings_amount
+        || p_positions_offsets[header.postings_amount] != header.positions_amount) {
+        return false;
+    }
+
+    bulk.file_lengths.assign(p_file_lengths, p_file_lengths + header.files_amount);
+    bulk.file_word_ids.resize(header.files_amount);
+
+    bulk.file_stamps.resize(header.files_amount);
+    for (std::size_t file_idx = 0; file_idx < header.files_amount; ++file_idx) {
+        bulk.file_stamps[file_idx] = { p_file_sizes[file_idx], p_file_write_times[file_idx], p_file_content_hashes[file_idx] };
+    }
+
+    bulk.removed_file_stamps.resize(header.removed_files_amount);
+    for (std::size_t file_idx = 0; file_idx < header.removed_files_amount; ++file_idx) {
+        bulk.removed_file_stamps[file_idx] = { p_removed_file_sizes[file_idx], p_removed_file_write_times[file_idx], 0 };
+    }
+
+    // The posting lists are rebuilt one file at a time: the files of every word come in ascending order, so it's only appending
+    bulk.posting_lists.resize(header.words_amount);
+    std::vector<id_type> file_positions;
+
+    for (std::size_t word_idx = 0; word_idx < header.words_amount; ++word_idx) {
+        std::uint64_t postings_begin = p_postings_offsets[word_idx];
+        std::uint64_t postings_end = p_postings_offsets[word_idx + 1];
+        if (postings_begin > postings_end || postings_end > header.postings_amount) {
+            return false;
+        }
+
+        id_type previous_file_id = 0;
+        for (std::uint64_t posting_idx = postings_begin; posting_idx < postings_end; ++posting_idx) {
+            id_type file_id = p_posting_file_ids[posting_idx];
+            std::uint64_t positions_begin = p_positions_offsets[posting_idx];
+            std::uint64_t positions_end = p_positions_offsets[posting_idx + 1];
+            if (file_id <= previous_file_id || file_id > header.files_amount
+                || positions_begin >= positions_end || positions_end > header.positions_amount) {
+                return false;
+            }
+            previous_file_id = file_id;
+
+            file_positions.assign(p_positions + positions_begin, p_positions + positions_end);
+            bulk.posting_lists[word_idx].add_file(file_id, file_positions);
+            bulk.file_word_ids[file_id - 1].push_back(static_cast<id_type>(word_idx + 1));
+        }
+    }
+
+    out_bulk = std::move(bulk);
+    return true;
+}
+
+// write_strings
+template <typename string_type>
+inline void index_file<string_type>::write_strings(section_writer& writer, const std::vector<const string_type*>& strings) {
+    std::vector<std::string> utf8_strings;
+    utf8_strings.reserve(strings.size());
+
+    std::uint64_t bytes_offset = 0;
+    writer.write_value(bytes_offset);
+    for (const auto* p_string : strings) {
+        utf8_strings.push_back(to_utf8(*p_string));
+        bytes_offset += utf8_strings.back().size();
+        writer.write_value(bytes_offset);
+    }
+
+    for (const auto& utf8_string : utf8_strings) {
+        writer.write_bytes(utf8_string.data(), utf8_string.size());
+    }
+    writer.align();
+}
+
+// read_strings
+template <typename string_type>
+inline bool index_file<string_type>::read_strings(section_reader& reader, std::uint64_t strings_amount, std::vector<string_type>& out_strings) {
+    const std::uint64_t* p_offsets = reader.take<std::uint64_t>(strings_amount + 1);
+    if (p_offsets == nullptr) {
+        return false;
+    }
+
+    const char* p_bytes = reader.take<char>(p_offsets[strings_amount]);
+    if (p_bytes == nullptr) {
+        return false;
+    }
+    reader.align();
+
+    out_strings.clear();
+    out_strings.reserve(strings_amount);
+
+    try {
+        for (std::size_t string_idx = 0; string_idx < strings_amount; ++string_idx) {
+            if (p_offsets[string_idx] > p_offsets[string_idx + 1] || p_offsets[string_idx + 1] > p_offsets[strings_amount]) {
+                return false;
+            }
+            out_strings.push_back(from_utf8<string_type>(std::string_view(p_bytes + p_offsets[string_idx], p_offsets[string_idx + 1] - p_offsets[string_idx])));
+        }
+    }
+    catch (std::exception&) {
+        return false; // Not UTF-8
+    }
+
+    return true;
+}
@@ -2,14 +2,27 @@
 
 #include <fstream>
 #include <filesystem>
-#include "inverted_index.h"
-#include "forward_index.h"
-#include "id_value_table.h"
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <barrier>
+#include <string_view>
+#include <cstring>
+#include "index_version.h"
+#include "index_file.h"
+#include "left_right.h"
 #include "concurrent_utility.h"
 #include "utility.h"
 #include "project_types.h"
 #include "word_entry.h"
 
+// The index shared by all the server threads: two index versions kept equal with left-right concurrency control (see left_right.h).
+// Searches run on a pinned snapshot: they never take a lock and never wait for the writers.
+// The writers read and parse their files before they touch the index, and the index is modified by a single writer at a time
 template <typename string_type>
 class index_manager {
 public:
@@ -22,16 +35,46 @@ public:
     inline index_manager& operator=(index_manager&& rhs) = delete;
 
 public:
+    using version_type = index_version<string_type>;
+    using file_stamp = typename version_type::file_stamp;
+
+    // Found files in ascending file ID order, with their paths
+    using found_files_table = typename version_type::found_files_table;
+
+    // A pinned version of the index, all the queries of index_version are called through it. Everything they return
+    // (posting lists, paths in found_files_table) stays valid and unchanged while the snapshot lives.
+    // A writer waits for the snapshots of the version it replaces, so release it as soon as the results are serialized
+    using snapshot = typename left_right<version_type>::read_guard;
+
+    inline snapshot get_snapshot() const;
+
     // Returns pair where .first is true if the file is actually present, false otherwise
     inline std::pair<bool, id_type> has_file(const string_type& file_path);
     inline std::pair<bool, id_type> has_file(string_type&& file_path);
 
+    // Returns true if the file is present and has the size and the last write time it had when its words were read
+    inline bool is_file_unchanged(string_type file_path);
+
     // Add method for getting ALL the files?
 
     inline bool get_file_content_utf8(const string_type& file_path, std::string& out_file_content);
 
     inline bool add_file(const string_type& file_path);
     inline bool add_file(string_type&& file_path);
+
+    // Durations of the phases of add_files
+    struct build_statistics {
+        std::size_t added_files_amount = 0;
+        std::chrono::nanoseconds parse_time{};          // Reading and parsing the files into the partial indexes of the threads
+        std::chrono::nanoseconds merge_words_time{};    // Merging the word dictionaries of the partial indexes
+        std::chrono::nanoseconds merge_postings_time{}; // Building the posting lists and the forward index of the batch
+        std::chrono::nanoseconds publish_time{};        // Adding the batch to both index versions
+    };
+
+    // Bulk add: threads_amount threads read and parse the files into partial indexes of their own, with their own word dictionaries,
+    // the partial indexes are merged into a single batch in parallel, and the batch is added to the index as a single modification.
+    // Files that can't be read or are already present are skipped. Returns the amount of the added files
+    inline std::size_t add_files(const std::vector<string_type>& file_paths, std::size_t threads_amount, build_statistics* p_out_statistics = nullptr);
     inline bool add_create_file(const string_type& file_path, const string_type& file_content);
     inline bool add_create_file(string_type&& file_path, string_type&& file_content);
 
@@ -43,60 +86,95 @@ public:
 
     inline void clear_all();
 
-    inline std::pair<bool, id_type> get_word_entry_set_for_word(const string_type& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline std::pair<bool, id_type> get_word_entry_set_for_word(string_type&& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline std::pair<bool, id_type> get_word_entry_set_for_lowered_word(const string_type& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline std::pair<bool, id_type> get_word_entry_set_for_lowered_word(string_type&& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-
-    inline bool get_word_entry_set_for_word_set(const std::unordered_set<string_type>& word_set, std::unordered_set<word_entry>& out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline bool get_word_entry_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::unordered_set<word_entry>& out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-
-    inline std::pair<bool, id_type> get_file_set_for_word(const string_type& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline std::pair<bool, id_type> get_file_set_for_word(string_type&& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline std::pair<bool, id_type> get_file_set_for_lowered_word(const string_type& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline std::pair<bool, id_type> get_file_set_for_lowered_word(string_type&& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-
-    inline bool get_file_set_for_word_set(const std::unordered_set<string_type>& word_set, std::unordered_set<id_type>& out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline bool get_file_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::unordered_set<id_type>& out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const;
+    // Merges of the segments of the inverted index (see segmented_index)
+    using segment_merge = typename version_type::segment_merge;
+    inline bool needs_merge() const;
+    // Plan a merge on a snapshot and build it, without blocking the writers. Returns false if there's nothing to merge
+    inline bool build_merge(segment_merge& out_merge) const;
+    // Put a built merge in place of its inputs in both versions. Returns false if they changed in the meantime
+    // (another merge took them, or the index was cleared): the merge is just dropped
+    inline bool apply_merge(const segment_merge& built_merge);
+
+    // Save the whole index into index_path (see index_file.h). The searches go on meanwhile, the writers wait for the end.
+    // Returns false if the file could not be written
+    inline bool save_index(const std::filesystem::path& index_path) const;
+
+    // What load_index found on disk, compared to the saved index
+    struct reindex_statistics {
+        std::size_t unchanged_files_amount = 0;
+        std::size_t added_files_amount = 0;
+        std::size_t modified_files_amount = 0;
+        std::size_t removed_files_amount = 0;
+    };
+
+    // Add the index saved into index_path and bring it up to date with the disk, reading only the files that changed since.
+    // A present file with the size and the last write time of its stamp is unchanged. One with other ones is read and hashed,
+    // and indexed again if its content is not the same. A present file that is gone is removed. The files of file_paths
+    // the index doesn't know are added (see add_files, with threads_amount threads). A removed file stays removed while it is
+    // the same file it was when it was removed (e.g. by a client), and is added if it changed or came back since (e.g. after it was deleted).
+    // Returns false if nothing was loaded: the file is missing, damaged or of another format (the files have to be indexed then)
+    inline bool load_index(const std::filesystem::path& index_path, const std::vector<string_type>& file_paths, std::size_t threads_amount, reindex_statistics* p_out_statistics = nullptr);
 
 private:
     inline std::pair<bool, id_type> do_has_file(string_type&& file_path);
-    inline std::pair<bool, id_type> do_has_file_lowered(string_type&& file_path);
-    inline std::pair<bool, id_type> do_has_file_lowered_unsafe(string_type&& file_path);
 
     inline bool do_add_file(string_type&& file_path);
     inline bool do_add_create_file(string_type&& file_path, string_type&& file_content);
-    inline bool add_words_from_file_to_index(std::vector<string_type>&& words, id_type file_id, string_type&& file_path);
-
     inline bool do_remove_file(string_type&& file_path);
     inline bool do_modify_file(string_type&& file_path);
 
-    inline std::pair<bool, id_type> do_get_word_entry_set_for_lowered_word(string_type&& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-    inline std::pair<bool, id_type> do_get_file_set_for_lowered_word(string_type&& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const;
-
-    inline std::pair<bool, id_type> get_word_entry_set_for_word_unsafe(const string_type& word, const std::unordered_set<word_entry>*& cp_out_word_entries) const;
-    inline std::pair<bool, id_type> get_file_set_for_word_unsafe(const string_type& word, const std::unordered_set<id_type>*& cp_out_file_ids) const;
+    // The files parsed by a single thread of add_files, with the local word IDs of the thread.
+    // Every word belongs to one of the reducers of add_files, by its hash: the words and the word IDs of the files are grouped
+    // by reducer while parsing, so that a reducer only goes over its own words
+    struct partial_index {
+        struct parsed_file {
+            std::size_t path_idx = 0;    // Index in the file paths given to add_files
+            id_type length = 0;
+            file_stamp stamp;
+            std::vector<id_type> word_ids; // Local IDs of the distinct words of the file, in the order of their first occurrence
+            std::vector<id_type> offsets;  // offsets[i] .. offsets[i + 1] is the range of the positions of word_ids[i]
+            std::vector<id_type> positions;
+            // reducer_word_indices[reducer_offsets[r] .. reducer_offsets[r + 1]) are the indices in word_ids of the words of reducer r
+            std::vector<id_type> reducer_offsets;
+            std::vector<id_type> reducer_word_indices;
+        };
+
+        inline explicit partial_index(std::size_t reducers_amount = 1) : reducer_words(reducers_amount) {}
+
+        std::unordered_map<string_type, id_type> word_ids; // Local word dictionary: the word words[i] has the local ID i
+        std::vector<string_type> words;
+        std::vector<std::size_t> word_reducers;            // The reducer of every local word
+        std::vector<std::vector<id_type>> reducer_words;   // Local IDs of the words of every reducer
+        std::vector<parsed_file> files;
+    };
+
+    inline void parse_file_into_partial_index(std::size_t path_idx, const file_stamp& stamp, std::vector<string_type>&& words, partial_index& partial) const;
 
     inline string_type read_file(const string_type& file_path) const;
+    // Reads the file and stamps it (see index_version::file_stamp). The size and the last write time are taken before the reading:
+    // a file that changes meanwhile gets a stamp that doesn't match it, and its content hash is checked on the next start
+    inline string_type read_file_and_stamp(const string_type& file_path, file_stamp& out_stamp) const;
     inline std::string read_file_as_utf8(const string_type& file_path) const;
+    inline static string_type utf8_to_string_type(std::string&& content);
+    // MurmurHash64A of the UTF-8 bytes of a file
+    inline static std::uint64_t get_content_hash(std::string_view utf8_content);
+    // File paths are compared case-insensitively only where the file system does so too (Windows)
+    inline static void normalize_file_path(string_type& file_path);
     inline std::vector<string_type> parse_and_normalize_words(string_type&& content) const;
     inline std::vector<string_type> parse_and_normalize_words_ss(string_type&& content) const; // using stringstream (x1.5-3 times slower)
 
 private:
     using char_type = string_type::value_type;
-    using string_table = id_value_table<id_type, string_type>;
-    using presence_table = id_value_table<id_type, bool, false>;
-
-    mutable read_write_lock rw_lock;
 
-    inverted_index inverted;
-    forward_index forward;
-
-    string_table words_table;
-    string_table files_table;
-    presence_table files_present_table;
+    left_right<version_type> versions;
 };
 
+// get_snapshot
+template <typename string_type>
+inline typename index_manager<string_type>::snapshot index_manager<string_type>::get_snapshot() const {
+    return versions.read();
+}
+
 // has_file
 template <typename string_type>
 inline std::pair<bool, id_type> index_manager<string_type>::has_file(const string_type& file_path) {
@@ -111,30 +189,22 @@ inline std::pair<bool, id_type> index_manager<string_type>::has_file(string_type
 
 template <typename string_type>
 inline std::pair<bool, id_type> index_manager<string_type>::do_has_file(string_type&& file_path) {
-    text_normalizer<char_type>::to_lower(file_path);
-    return do_has_file_lowered(std::move(file_path));
+    normalize_file_path(file_path);
+    return get_snapshot()->has_file(file_path);
 }
 
+// is_file_unchanged
 template <typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::do_has_file_lowered(string_type&& file_path) {
-    id_type file_id = 0;
-    bool file_present = false;
-    {
-        read_lock r_lock(rw_lock);
+inline bool index_manager<string_type>::is_file_unchanged(string_type file_path) {
+    normalize_file_path(file_path);
 
-        file_id = files_table.get_value_id_always_unsafe(file_path);
-        file_present = file_id != 0 ? files_present_table.get_value_unsafe(file_id) : false;
+    file_stamp indexed_stamp;
+    if (!get_snapshot()->get_file_stamp(file_path, indexed_stamp)) {
+        return false;
     }
 
-    return { file_present, file_id };
-}
-
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::do_has_file_lowered_unsafe(string_type&& file_path) {
-    id_type file_id = files_table.get_value_id_always_unsafe(file_path);
-    bool file_present = file_id != 0 ? files_present_table.get_value_unsafe(file_id) : false;
-
-    return { file_present, file_id };
+    file_stamp current_stamp = file_stamp::of(file_path);
+    return current_stamp.size == indexed_stamp.size && current_stamp.last_write_time == indexed_stamp.last_write_time;
 }
 
 // get_file_content_utf8
@@ -176,15 +246,15 @@ inline bool index_manager<string_type>::add_create_file(string_type&& file_path,
 
 template <typename string_type>
 inline bool index_manager<string_type>::do_add_file(string_type&& file_path) {
-    text_normalizer<char_type>::to_lower(file_path);
-    auto file_found = do_has_file_lowered(std::move(file_path)); // Does not actually move - not a bag, file_path remains valid
-    if (file_found.first == true) {
+    normalize_file_path(file_path);
+    if (get_snapshot()->has_file(file_path).first == true) {
         return false;
     }
 
+    file_stamp stamp;
     string_type file_content;
     try {
-        file_content = read_file(file_path);
+        file_content = read_file_and_stamp(file_path, stamp);
     }
     catch(std::exception&) {
         return false;
@@ -192,15 +262,16 @@ inline bool index_manager<string_type>::do_add_file(string_type&& file_path) {
 
     std::vector<string_type> words = parse_and_normalize_words(std::move(file_content));
 
-    id_type file_id = file_found.second;
-    return add_words_from_file_to_index(std::move(words), file_id, std::move(file_path));
+    // The file may have been added in the meantime: the version checks it again
+    return versions.modify([&](version_type& version) {
+        return version.add_file(file_path, words, stamp);
+    });
 }
 
 template<typename string_type>
 inline bool index_manager<string_type>::do_add_create_file(string_type&& file_path, string_type&& file_content) {
-    text_normalizer<char_type>::to_lower(file_path);
-    auto file_found = do_has_file_lowered(std::move(file_path));
-    if (file_found.first == true) {
+    normalize_file_path(file_path);
+    if (get_snapshot()->has_file(file_path).first == true) {
         return false;
     }
 
@@ -216,449 +287,491 @@ inline bool index_manager<string_type>::do_add_create_file(string_type&& file_pa
 
     std::ofstream file;
 
-    if constexpr (std::is_same<char_type, char16_t>::value || std::is_same<char_type, char32_t>::value) {
-        std::filesystem::path converted_file_path(file_path);
-        file.open(converted_file_path.generic_wstring(), std::ios::out | std::ios::binary);
-    }
-    else {
-        file.open(file_path, std::ios::out | std::ios::binary);
-    }
+    // Opening through std::filesystem::path works for every char_type on every platform
+    file.open(file_path_actual, std::ios::out | std::ios::binary);
 
     if (!file) {
         return false;
     }
 
+    std::string utf8_file_content;
     if constexpr (std::is_same_v<string_type, std::string>) {
-        file << file_content;
+        utf8_file_content = file_content;
     }
     else if constexpr (std::is_same_v<string_type, std::u8string>) {
-        std::string utf8_file_content(reinterpret_cast<const char*>(file_content.data()), file_content.size());
-        file << utf8_file_content;
+        utf8_file_content.assign(reinterpret_cast<const char*>(file_content.data()), file_content.size());
     }
     else {
-        std::string utf8_file_content = utf_converter<char_type>::string_type_to_utf8(file_content);
-        file << utf8_file_content;
+        utf8_file_content = utf_converter<char_type>::string_type_to_utf8(file_content);
     }
+    file << utf8_file_content;
     file.close();
 
+    file_stamp stamp = file_stamp::of(file_path_actual);
+    stamp.content_hash = get_content_hash(utf8_file_content);
+
     std::vector<string_type> words = parse_and_normalize_words(std::move(file_content));
 
-    id_type file_id = file_found.second;
-    return add_words_from_file_to_index(std::move(words), file_id, std::move(file_path));
+    return versions.modify([&](version_type& version) {
+        return version.add_file(file_path, words, stamp);
+    });
 }
 
-template<typename string_type>
-inline bool index_manager<string_type>::add_words_from_file_to_index(std::vector<string_type>&& words, id_type file_id, string_type&& file_path) {
-    std::unordered_set<id_type> word_ids;
-    word_ids.reserve(words.size());
+// add_files
+template <typename string_type>
+inline std::size_t index_manager<string_type>::add_files(const std::vector<string_type>& file_paths, std::size_t threads_amount, build_statistics* p_out_statistics) {
+    using clock = std::chrono::steady_clock;
+    threads_amount = std::max<std::size_t>(threads_amount, 1);
+
+    // 1. Every thread takes the next file, reads and parses it into its own partial index
+    auto parse_start = clock::now();
+
+    std::vector<string_type> normalized_paths(file_paths);
+    std::vector<partial_index> partials(threads_amount, partial_index(threads_amount));
+    std::atomic<std::size_t> next_path_idx = 0;
+
+    run_in_parallel(threads_amount, [&](std::size_t thread_idx) {
+        partial_index& partial = partials[thread_idx];
+
+        for (std::size_t path_idx = next_path_idx++; path_idx < normalized_paths.size(); path_idx = next_path_idx++) {
+            string_type& file_path = normalized_paths[path_idx];
+            normalize_file_path(file_path);
+            if (get_snapshot()->has_file(file_path).first == true) {
+                continue;
+            }
+
+            file_stamp stamp;
+            string_type file_content;
+            try {
+                file_content = read_file_and_stamp(file_path, stamp);
+            }
+            catch(std::exception&) {
+                continue;
+            }
+
+            parse_file_into_partial_index(path_idx, stamp, parse_and_normalize_words(std::move(file_content)), partial);
+        }
 
-    write_lock w_lock(rw_lock);
+        partial.word_ids.clear();
+    });
 
-    if (file_id == 0) {
-        file_id = files_table.add_value_unsafe(std::move(file_path));
-        files_present_table.add_value_unsafe(true);
-    }
-    else {
-        files_present_table.modify_by_id_unsafe(file_id, true);
-    }
+    // 2. The files get the batch IDs in the order of file_paths
+    auto merge_words_start = clock::now();
 
-    id_type position = 1;
-    for (auto& word : words) {
-        id_type word_id = words_table.get_value_id_always_unsafe(word);
-        if (word_id == 0) { word_id = words_table.add_value_unsafe(std::move(word)); }
+    typename version_type::bulk_index bulk;
 
-        inverted.add_word_entry_unsafe(word_id, word_entry(file_id, position++));
-        word_ids.insert(word_id);
-    }
-    forward.add_word_id_set_unsafe(file_id, std::move(word_ids));
+    // Batch file ID - 1 -> (partial index, file in it)
+    std::vector<std::pair<std::size_t, std::size_t>> batch_files;
+    {
+        std::vector<std::pair<std::size_t, std::size_t>> path_files(normalized_paths.size(), { threads_amount, 0 });
+        for (std::size_t partial_idx = 0; partial_idx < threads_amount; ++partial_idx) {
+            for (std::size_t file_idx = 0; file_idx < partials[partial_idx].files.size(); ++file_idx) {
+                path_files[partials[partial_idx].files[file_idx].path_idx] = { partial_idx, file_idx };
+            }
+        }
 
-    return true;
-}
+        std::unordered_map<string_type, id_type> batch_file_ids;
+        for (std::size_t path_idx = 0; path_idx < normalized_paths.size(); ++path_idx) {
+            if (path_files[path_idx].first == threads_amount) {
+                continue;
+            }
 
-// remove_file
-template <typename string_type>
-inline bool index_manager<string_type>::remove_file(const string_type& file_path) {
-    string_type to_lower_file_path(file_path);
-    return do_remove_file(std::move(to_lower_file_path));
-}
+            // The same file given twice is indexed once
+            if (!batch_file_ids.emplace(normalized_paths[path_idx], static_cast<id_type>(bulk.file_paths.size() + 1)).second) {
+                continue;
+            }
 
-template <typename string_type>
-inline bool index_manager<string_type>::remove_file(string_type&& file_path) {
-    return do_remove_file(std::move(file_path));
-}
+            bulk.file_paths.push_back(std::move(normalized_paths[path_idx]));
+            bulk.file_stamps.push_back(partials[path_files[path_idx].first].files[path_files[path_idx].second].stamp);
+            batch_files.push_back(path_files[path_idx]);
+        }
+    }
 
-template <typename string_type>
-inline bool index_manager<string_type>::do_remove_file(string_type&& file_path) {
-    text_normalizer<char_type>::to_lower(file_path);
+    // 3. Parallel reduce, thread thread_idx is the reducer of the words with the hash of thread_idx (see partial_index).
+    // First it merges the local dictionaries of its words, giving them reducer indices. Once every reducer knows the amount
+    // of its words, the words get the batch IDs reducer by reducer, and it builds their posting lists going over the files
+    // in ascending batch file ID order (so every posting list is only appended to). Once every word has its batch ID,
+    // it builds the forward index of the files with batch_file_idx % threads_amount == thread_idx
+    clock::time_point merge_postings_start;
 
-    auto file_found = do_has_file_lowered(std::move(file_path));
-    if (file_found.first == false) {
-        return false;
+    // Local word ID -> reducer index, then batch word ID, for every partial index. Every slot is written by the reducer of its word
+    std::vector<std::vector<id_type>> batch_word_ids(threads_amount);
+    for (std::size_t partial_idx = 0; partial_idx < threads_amount; ++partial_idx) {
+        batch_word_ids[partial_idx].resize(partials[partial_idx].words.size());
     }
 
-    write_lock w_lock(rw_lock);
+    std::vector<std::vector<string_type>> reducer_words(threads_amount);
+    std::vector<std::size_t> reducer_first_word_idxs(threads_amount, 0);
 
-    id_type file_id = file_found.second;
-    
-    const auto& del_word_ids = forward.get_word_id_set_ref_unsafe(file_id);
-    for (const auto& del_word_id : del_word_ids) {
-        inverted.clear_for_word_and_file_unsafe(del_word_id, file_id);
-    }
-    forward.clear_file_unsafe(file_id);
+    std::barrier dictionaries_merged(static_cast<std::ptrdiff_t>(threads_amount), [&]() noexcept {
+        std::size_t words_amount = 0;
+        for (std::size_t reducer_idx = 0; reducer_idx < threads_amount; ++reducer_idx) {
+            reducer_first_word_idxs[reducer_idx] = words_amount;
+            words_amount += reducer_words[reducer_idx].size();
+        }
 
-    files_present_table.modify_by_id_unsafe(file_id, false);
+        bulk.words.resize(words_amount);
+        bulk.posting_lists.resize(words_amount);
+        bulk.file_word_ids.resize(bulk.file_paths.size());
+        bulk.file_lengths.resize(bulk.file_paths.size());
 
-    return true;
-}
+        merge_postings_start = clock::now();
+    });
+    std::barrier postings_built(static_cast<std::ptrdiff_t>(threads_amount));
+
+    run_in_parallel(threads_amount, [&](std::size_t thread_idx) {
+        std::vector<string_type>& words = reducer_words[thread_idx];
+        {
+            std::unordered_map<string_type, id_type> dictionary;
+            for (std::size_t partial_idx = 0; partial_idx < threads_amount; ++partial_idx) {
+                partial_index& partial = partials[partial_idx];
+
+                for (const auto local_word_id : partial.reducer_words[thread_idx]) {
+                    string_type& word = partial.words[local_word_id];
+
+                    auto [it, inserted] = dictionary.try_emplace(word, static_cast<id_type>(words.size()));
+                    if (inserted) {
+                        words.push_back(std::move(word));
+                    }
+                    batch_word_ids[partial_idx][local_word_id] = it->second;
+                }
+            }
+        }
 
-// modify_file
-template <typename string_type>
-inline bool index_manager<string_type>::modify_file(const string_type& file_path) {
-    string_type to_lower_file_path(file_path);
-    return do_modify_file(std::move(to_lower_file_path));
-}
+        dictionaries_merged.arrive_and_wait();
 
-template <typename string_type>
-inline bool index_manager<string_type>::modify_file(string_type&& file_path) {
-    return do_modify_file(std::move(file_path));
-}
+        std::size_t first_word_idx = reducer_first_word_idxs[thread_idx];
+        std::move(std::begin(words), std::end(words), std::begin(bulk.words) + first_word_idx);
 
-template <typename string_type>
-inline bool index_manager<string_type>::do_modify_file(string_type&& file_path) {
-    text_normalizer<char_type>::to_lower(file_path);
-    auto file_found = do_has_file_lowered(std::move(file_path));
-    if (file_found.first == false) {
-        return false;
-    }
+        for (std::size_t partial_idx = 0; partial_idx < threads_amount; ++partial_idx) {
+            for (const auto local_word_id : partials[partial_idx].reducer_words[thread_idx]) {
+                batch_word_ids[partial_idx][local_word_id] += static_cast<id_type>(first_word_idx + 1);
+            }
+        }
 
-    id_type file_id = file_found.second;
+        std::vector<id_type> file_positions;
 
-    std::vector<string_type> words = parse_and_normalize_words(read_file(file_path));
-    std::unordered_set<id_type> word_ids;
-    word_ids.reserve(words.size());
+        for (std::size_t batch_file_idx = 0; batch_file_idx < batch_files.size(); ++batch_file_idx) {
+            auto [partial_idx, file_idx] = batch_files[batch_file_idx];
+            const auto& file = partials[partial_idx].files[file_idx];
+            const auto& word_ids = batch_word_ids[partial_idx];
+            id_type batch_file_id = static_cast<id_type>(batch_file_idx + 1);
 
-    write_lock w_lock(rw_lock);
+            for (std::size_t idx = file.reducer_offsets[thread_idx]; idx < file.reducer_offsets[thread_idx + 1]; ++idx) {
+                id_type word_idx = file.reducer_word_indices[idx];
+                id_type batch_word_id = word_ids[file.word_ids[word_idx]];
 
-    const auto& del_word_ids = forward.get_word_id_set_ref_unsafe(file_id);
-    for (const auto& del_word_id : del_word_ids) {
-        inverted.clear_for_word_and_file_unsafe(del_word_id, file_id);
-    }
-    forward.clear_file_unsafe(file_id);
+                file_positions.assign(std::begin(file.positions) + file.offsets[word_idx], std::begin(file.positions) + file.offsets[word_idx + 1]);
+                bulk.posting_lists[batch_word_id - 1].add_file(batch_file_id, file_positions);
+            }
+        }
 
-    id_type position = 1;
-    for (const auto& word : words) {
-        id_type word_id = words_table.get_value_id_always_unsafe(word);
-        if (word_id == 0) { word_id = words_table.add_value_unsafe(word); }
+        postings_built.arrive_and_wait();
 
-        inverted.add_word_entry_unsafe(word_id, word_entry(file_id, position++));
-        word_ids.insert(word_id);
-    }
-    forward.add_word_id_set_unsafe(file_id, std::move(word_ids));
+        for (std::size_t batch_file_idx = thread_idx; batch_file_idx < batch_files.size(); batch_file_idx += threads_amount) {
+            auto [partial_idx, file_idx] = batch_files[batch_file_idx];
+            const auto& file = partials[partial_idx].files[file_idx];
+            const auto& word_ids = batch_word_ids[partial_idx];
 
-    return true;
-}
+            auto& file_word_ids = bulk.file_word_ids[batch_file_idx];
+            file_word_ids.reserve(file.word_ids.size());
+            for (const auto local_word_id : file.word_ids) {
+                file_word_ids.push_back(word_ids[local_word_id]);
+            }
+            bulk.file_lengths[batch_file_idx] = file.length;
+        }
+    });
 
-// clear_all
-template <typename string_type>
-inline void index_manager<string_type>::clear_all() {
-    write_lock w_lock(rw_lock);
+    partials.clear();
 
-    inverted.clear_unsafe();
-    forward.clear_unsafe();
-    words_table.clear_unsafe();
-    files_table.clear_unsafe();
-    files_present_table.clear_unsafe();
-}
+    // 4. A single modification of the index. The files added since the parsing are skipped by the versions themselves
+    auto publish_start = clock::now();
 
-// get_word_entry_set_for_word
-template <typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_word_entry_set_for_word(const string_type& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    string_type to_lower_word(word);
-    text_normalizer<char_type>::to_lower(to_lower_word);
-    return do_get_word_entry_set_for_lowered_word(std::move(to_lower_word), cp_out_word_entries, out_files_table);
-}
+    std::size_t added_files_amount = versions.modify([&](version_type& version) {
+        return version.add_bulk(bulk);
+    });
 
-template <typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_word_entry_set_for_word(string_type&& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    text_normalizer<char_type>::to_lower(word);
-    return do_get_word_entry_set_for_lowered_word(std::move(word), cp_out_word_entries, out_files_table);
-}
+    auto publish_end = clock::now();
 
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_word_entry_set_for_lowered_word(const string_type& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    string_type lowered_word(word);
-    return do_get_word_entry_set_for_lowered_word(std::move(lowered_word), cp_out_word_entries, out_files_table);
-}
+    if (p_out_statistics != nullptr) {
+        p_out_statistics->added_files_amount = added_files_amount;
+        p_out_statistics->parse_time = merge_words_start - parse_start;
+        p_out_statistics->merge_words_time = merge_postings_start - merge_words_start;
+        p_out_statistics->merge_postings_time = publish_start - merge_postings_start;
+        p_out_statistics->publish_time = publish_end - publish_start;
+    }
 
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_word_entry_set_for_lowered_word(string_type&& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    return do_get_word_entry_set_for_lowered_word(std::move(word), cp_out_word_entries, out_files_table);
+    return added_files_amount;
 }
 
+// parse_file_into_partial_index
 template <typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::do_get_word_entry_set_for_lowered_word(string_type&& word, const std::unordered_set<word_entry>*& cp_out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    read_lock r_lock(rw_lock);
+inline void index_manager<string_type>::parse_file_into_partial_index(std::size_t path_idx, const file_stamp& stamp, std::vector<string_type>&& words, partial_index& partial) const {
+    typename partial_index::parsed_file file;
+    file.path_idx = path_idx;
+    file.length = static_cast<id_type>(words.size());
+    file.stamp = stamp;
 
-    id_type word_id = words_table.get_value_id_always_unsafe(word);
-    if (word_id == 0) {
-        return { false, word_id };
-    }
-
-    cp_out_word_entries = inverted.get_word_entry_set_cp_unsafe(word_id);
+    // Index in file.word_ids of the word at every position, then the positions are grouped per word with a counting sort
+    std::vector<id_type> position_word_indices;
+    position_word_indices.reserve(words.size());
 
-    const auto& file_set_cref = inverted.get_file_set_cref_unsafe(word_id);
-    out_files_table.reserve(file_set_cref.size());
+    std::unordered_map<id_type, id_type> file_word_indices; // Local word ID -> index in file.word_ids
+    for (auto& word : words) {
+        auto [word_it, new_word] = partial.word_ids.try_emplace(word, static_cast<id_type>(partial.words.size()));
+        if (new_word) {
+            std::size_t reducer_idx = std::hash<string_type>{}(word) % partial.reducer_words.size();
+            partial.word_reducers.push_back(reducer_idx);
+            partial.reducer_words[reducer_idx].push_back(word_it->second);
+            partial.words.push_back(std::move(word));
+        }
 
-    for (const auto file_id : file_set_cref) {
-        out_files_table.emplace(file_id, files_table.get_value_ref_unsafe(file_id));
+        auto [index_it, new_file_word] = file_word_indices.try_emplace(word_it->second, static_cast<id_type>(file.word_ids.size()));
+        if (new_file_word) {
+            file.word_ids.push_back(word_it->second);
+        }
+        position_word_indices.push_back(index_it->second);
     }
 
-    return { !cp_out_word_entries->empty(), word_id};
-}
-
-// get_word_entry_set_for_word_unsafe
-template <typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_word_entry_set_for_word_unsafe(const string_type& word, const std::unordered_set<word_entry>*& cp_out_word_entries) const {
-    id_type word_id = words_table.get_value_id_always_unsafe(word);
-    if (word_id == 0) {
-        return { false, word_id };
+    file.offsets.assign(file.word_ids.size() + 1, 0);
+    for (const auto word_idx : position_word_indices) {
+        ++file.offsets[word_idx + 1];
     }
-
-    cp_out_word_entries = inverted.get_word_entry_set_cp_unsafe(word_id);
-    return { !cp_out_word_entries->empty(), word_id };
-}
-
-// get_word_entry_set_for_word_set
-template <typename string_type>
-inline bool index_manager<string_type>::get_word_entry_set_for_word_set(const std::unordered_set<string_type>& word_set, std::unordered_set<word_entry>& out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    if (word_set.empty()) {
-        return false;
+    for (std::size_t word_idx = 1; word_idx < file.offsets.size(); ++word_idx) {
+        file.offsets[word_idx] += file.offsets[word_idx - 1];
     }
 
-    std::unordered_map<id_type, std::unordered_set<word_entry>> file_entries_map;
-    const std::unordered_set<word_entry>* p_word_entries;
-    std::unordered_map<id_type, std::size_t> file_words_map;
-    const std::unordered_set<id_type>* p_files;
-
-    std::unordered_set<string_type> lowered_word_set;
-    lowered_word_set.reserve(word_set.size());
+    std::vector<id_type> next_offsets(std::begin(file.offsets), std::end(file.offsets) - 1);
+    file.positions.resize(position_word_indices.size());
 
-    for (auto& word : word_set) {
-        string_type lowered_word(word);
-        text_normalizer<char_type>::to_lower(lowered_word);
-        lowered_word_set.emplace(std::move(lowered_word));
+    id_type position = 1;
+    for (const auto word_idx : position_word_indices) {
+        file.positions[next_offsets[word_idx]++] = position++;
     }
 
-    read_lock r_lock(rw_lock);
+    // The same counting sort groups the words of the file by reducer
+    std::size_t reducers_amount = partial.reducer_words.size();
+    file.reducer_offsets.assign(reducers_amount + 1, 0);
+    for (const auto local_word_id : file.word_ids) {
+        ++file.reducer_offsets[partial.word_reducers[local_word_id] + 1];
+    }
+    for (std::size_t reducer_idx = 1; reducer_idx <= reducers_amount; ++reducer_idx) {
+        file.reducer_offsets[reducer_idx] += file.reducer_offsets[reducer_idx - 1];
+    }
 
-    for (auto& word : lowered_word_set) {
-        std::pair<bool, id_type> word_result_files = get_file_set_for_word_unsafe(word, p_files);
-        std::pair<bool, id_type> word_result = get_word_entry_set_for_word_unsafe(word, p_word_entries);
-        
-        if (word_result.first == false) {
-            return false; // If at least one word has no occurrences, the intersection is empty.
-        }
-        for (const auto& entry : *p_word_entries) {
-            file_entries_map[entry.file_id].emplace(entry);
-        }
-        for (const auto file_id : *p_files) {
-            ++file_words_map[file_id];
-        }
+    std::vector<id_type> next_reducer_offsets(std::begin(file.reducer_offsets), std::end(file.reducer_offsets) - 1);
+    file.reducer_word_indices.resize(file.word_ids.size());
+    for (std::size_t word_idx = 0; word_idx < file.word_ids.size(); ++word_idx) {
+        file.reducer_word_indices[next_reducer_offsets[partial.word_reducers[file.word_ids[word_idx]]]++] = static_cast<id_type>(word_idx);
     }
 
-    std::size_t expected_count = lowered_word_set.size();
-    for (const auto& [file_id, words_count] : file_words_map) {
-        if (words_count == expected_count) {
-            auto& entries = file_entries_map[file_id];
-            out_word_entries.merge(std::move(entries));
+    partial.files.push_back(std::move(file));
+}
 
-            out_files_table.emplace(file_id, files_table.get_value_ref_unsafe(file_id));
-        }
-    }
+// remove_file
+template <typename string_type>
+inline bool index_manager<string_type>::remove_file(const string_type& file_path) {
+    string_type to_lower_file_path(file_path);
+    return do_remove_file(std::move(to_lower_file_path));
+}
 
-    return !out_word_entries.empty();
+template <typename string_type>
+inline bool index_manager<string_type>::remove_file(string_type&& file_path) {
+    return do_remove_file(std::move(file_path));
 }
 
-// get_word_entry_set_for_lowered_word_set
 template <typename string_type>
-inline bool index_manager<string_type>::get_word_entry_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::unordered_set<word_entry>& out_word_entries, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    if (word_set.empty()) {
+inline bool index_manager<string_type>::do_remove_file(string_type&& file_path) {
+    normalize_file_path(file_path);
+    if (get_snapshot()->has_file(file_path).first == false) {
         return false;
     }
 
-    std::unordered_map<id_type, std::unordered_set<word_entry>> file_entries_map;
-    const std::unordered_set<word_entry>* p_word_entries;
-    std::unordered_map<id_type, std::size_t> file_words_map;
-    const std::unordered_set<id_type>* p_files;
+    file_stamp stamp = file_stamp::of(file_path);
+    return versions.modify([&](version_type& version) {
+        return version.remove_file(file_path, stamp);
+    });
+}
 
-    read_lock r_lock(rw_lock);
+// modify_file
+template <typename string_type>
+inline bool index_manager<string_type>::modify_file(const string_type& file_path) {
+    string_type to_lower_file_path(file_path);
+    return do_modify_file(std::move(to_lower_file_path));
+}
 
-    for (auto& word : word_set) {
-        std::pair<bool, id_type> word_result_files = get_file_set_for_word_unsafe(word, p_files);
-        std::pair<bool, id_type> word_result = get_word_entry_set_for_word_unsafe(word, p_word_entries);
+template <typename string_type>
+inline bool index_manager<string_type>::modify_file(string_type&& file_path) {
+    return do_modify_file(std::move(file_path));
+}
 
-        if (word_result.first == false) {
-            return false; // If at least one word has no occurrences, the intersection is empty.
-        }
-        for (const auto& entry : *p_word_entries) {
-            file_entries_map[entry.file_id].emplace(entry);
-        }
-        for (const auto file_id : *p_files) {
-            ++file_words_map[file_id];
-        }
+template <typename string_type>
+inline bool index_manager<string_type>::do_modify_file(string_type&& file_path) {
+    normalize_file_path(file_path);
+    if (get_snapshot()->has_file(file_path).first == false) {
+        return false;
     }
 
-    std::size_t expected_count = word_set.size();
-    for (const auto& [file_id, words_count] : file_words_map) {
-        if (words_count == expected_count) {
-            auto& entries = file_entries_map[file_id];
-            out_word_entries.merge(std::move(entries));
-
-            out_files_table.emplace(file_id, files_table.get_value_ref_unsafe(file_id));
-        }
+    file_stamp stamp;
+    string_type file_content;
+    try {
+        file_content = read_file_and_stamp(file_path, stamp);
+    }
+    catch(std::exception&) {
+        return false;
     }
 
-    return !out_word_entries.empty();
-}
-
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_file_set_for_word(const string_type& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    string_type to_lower_word(word);
-    text_normalizer<char_type>::to_lower(to_lower_word);
-    return do_get_file_set_for_lowered_word(std::move(to_lower_word), cp_out_file_ids, out_files_table);
-}
+    // Everything but the delta against the present postings of the file is done before the writer takes the versions
+    auto word_positions = version_type::group_word_positions(parse_and_normalize_words(std::move(file_content)));
 
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_file_set_for_word(string_type&& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    text_normalizer<char_type>::to_lower(word);
-    return do_get_file_set_for_lowered_word(std::move(word), cp_out_file_ids, out_files_table);
+    return versions.modify([&](version_type& version) {
+        return version.modify_file(file_path, word_positions, stamp);
+    });
 }
 
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_file_set_for_lowered_word(const string_type& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    string_type lowered_word(word);
-    return do_get_file_set_for_lowered_word(std::move(lowered_word), cp_out_file_ids, out_files_table);
+// clear_all
+template <typename string_type>
+inline void index_manager<string_type>::clear_all() {
+    versions.modify([](version_type& version) {
+        version.clear_all();
+    });
 }
 
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_file_set_for_lowered_word(string_type&& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    return do_get_file_set_for_lowered_word(std::move(word), cp_out_file_ids, out_files_table);
+// needs_merge
+template <typename string_type>
+inline bool index_manager<string_type>::needs_merge() const {
+    return get_snapshot()->needs_merge();
 }
 
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::do_get_file_set_for_lowered_word(string_type&& word, const std::unordered_set<id_type>*& cp_out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    read_lock r_lock(rw_lock);
-
-    id_type word_id = words_table.get_value_id_always_unsafe(word);
-    if (word_id == 0) {
-        return { false, word_id };
-    }
-
-    cp_out_file_ids = inverted.get_file_set_cp_unsafe(word_id);
-    out_files_table.reserve(cp_out_file_ids->size());
-
-    for (const auto file_id : *cp_out_file_ids) {
-        out_files_table.emplace(file_id, files_table.get_value_ref_unsafe(file_id));
+// build_merge
+template <typename string_type>
+inline bool index_manager<string_type>::build_merge(segment_merge& out_merge) const {
+    if (!get_snapshot()->plan_merge(out_merge)) {
+        return false;
     }
 
-    return { !cp_out_file_ids->empty(), word_id };
+    // The plan holds the frozen postings it merges, the snapshot is not needed anymore
+    segmented_index::merge(out_merge);
+    return true;
 }
 
-template<typename string_type>
-inline std::pair<bool, id_type> index_manager<string_type>::get_file_set_for_word_unsafe(const string_type& word, const std::unordered_set<id_type>*& cp_out_file_ids) const {
-    id_type word_id = words_table.get_value_id_always_unsafe(word);
-    if (word_id == 0) {
-        return { false, word_id };
-    }
+// apply_merge
+template <typename string_type>
+inline bool index_manager<string_type>::apply_merge(const segment_merge& built_merge) {
+    return versions.modify([&built_merge](version_type& version) {
+        return version.apply_merge(built_merge);
+    });
+}
 
-    cp_out_file_ids = inverted.get_file_set_cp_unsafe(word_id);
-    return { !cp_out_file_ids->empty(), word_id };
+// save_index
+template <typename string_type>
+inline bool index_manager<string_type>::save_index(const std::filesystem::path& index_path) const {
+    return index_file<string_type>::save(index_path, *get_snapshot());
 }
 
-template<typename string_type>
-inline bool index_manager<string_type>::get_file_set_for_word_set(const std::unordered_set<string_type>& word_set, std::unordered_set<id_type>& out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    if (word_set.empty()) {
+// load_index
+template <typename string_type>
+inline bool index_manager<string_type>::load_index(const std::filesystem::path& index_path, const std::vector<string_type>& file_paths, std::size_t threads_amount, reindex_statistics* p_out_statistics) {
+    typename version_type::bulk_index bulk;
+    if (!index_file<string_type>::load(index_path, bulk)) {
         return false;
     }
 
-    std::unordered_map<id_type, std::size_t> file_words_map;
-    const std::unordered_set<id_type>* p_files;
-
-    std::unordered_set<string_type> lowered_word_set;
-    lowered_word_set.reserve(word_set.size());
+    // 1. The saved stamps against the files as they are now: only the files with another size or last write time are read
+    std::vector<string_type> modified_file_paths;
+    std::vector<string_type> removed_file_paths;
+    for (std::size_t file_idx = 0; file_idx < bulk.file_paths.size(); ++file_idx) {
+        const string_type& file_path = bulk.file_paths[file_idx];
+        file_stamp& saved_stamp = bulk.file_stamps[file_idx];
 
-    for (auto& word : word_set) {
-        string_type lowered_word(word);
-        text_normalizer<char_type>::to_lower(lowered_word);
-        lowered_word_set.emplace(std::move(lowered_word));
-    }
-
-    read_lock r_lock(rw_lock);
+        file_stamp current_stamp = file_stamp::of(file_path);
+        if (current_stamp.size == saved_stamp.size && current_stamp.last_write_time == saved_stamp.last_write_time) {
+            continue;
+        }
 
-    for (auto& word : lowered_word_set) {
-        std::pair<bool, id_type> word_result = get_file_set_for_word_unsafe(word, p_files);
+        try {
+            current_stamp.content_hash = get_content_hash(read_file_as_utf8(file_path));
+        }
+        catch (std::exception&) {
+            removed_file_paths.push_back(file_path);
+            continue;
+        }
 
-        if (word_result.first == false) {
-            return false; // If at least one word has no occurrences, the intersection is empty.
+        if (current_stamp.content_hash == saved_stamp.content_hash) {
+            saved_stamp = current_stamp; // Touched, but the same: it's not read again on the next start
         }
-        for (const auto file_id : *p_files) {
-            ++file_words_map[file_id];
+        else {
+            modified_file_paths.push_back(file_path);
         }
     }
 
-    std::size_t expected_count = lowered_word_set.size();
-    for (const auto& [file_id, words_count] : file_words_map) {
-        if (words_count == expected_count) {
-            out_file_ids.emplace(file_id);
+    // 2. The files the saved index doesn't know. A removed file that is on the disk as it was when it was removed stays removed,
+    // the others are known only by their IDs: they are added again
+    std::unordered_set<string_type> known_file_paths(std::begin(bulk.file_paths), std::end(bulk.file_paths));
+    for (std::size_t file_idx = 0; file_idx < bulk.removed_file_paths.size(); ++file_idx) {
+        const file_stamp& removed_stamp = bulk.removed_file_stamps[file_idx];
 
-            out_files_table.emplace(file_id, files_table.get_value_ref_unsafe(file_id));
+        file_stamp current_stamp = file_stamp::of(bulk.removed_file_paths[file_idx]);
+        if (current_stamp.size == removed_stamp.size && current_stamp.last_write_time == removed_stamp.last_write_time) {
+            known_file_paths.insert(bulk.removed_file_paths[file_idx]);
         }
     }
 
-    return !out_file_ids.empty();
-}
-
-template<typename string_type>
-inline bool index_manager<string_type>::get_file_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::unordered_set<id_type>& out_file_ids, std::unordered_map<id_type, const string_type&>& out_files_table) const {
-    if (word_set.empty()) {
-        return false;
+    std::vector<string_type> added_file_paths;
+    for (auto file_path : file_paths) {
+        normalize_file_path(file_path);
+        if (known_file_paths.find(file_path) == known_file_paths.end()) {
+            added_file_paths.push_back(std::move(file_path));
+        }
     }
 
-    std::unordered_map<id_type, std::size_t> file_words_map;
-    const std::unordered_set<id_type>* p_files;
-
-    read_lock r_lock(rw_lock);
+    // 3. The saved index as it is, then only the changes
+    versions.modify([&](version_type& version) {
+        version.add_bulk(bulk);
+    });
 
-    for (auto& word : word_set) {
-        std::pair<bool, id_type> word_result = get_file_set_for_word_unsafe(word, p_files);
+    reindex_statistics statistics;
+    statistics.unchanged_files_amount = bulk.file_paths.size() - modified_file_paths.size() - removed_file_paths.size();
 
-        if (word_result.first == false) {
-            return false; // If at least one word has no occurrences, the intersection is empty.
-        }
-        for (const auto file_id : *p_files) {
-            ++file_words_map[file_id];
-        }
+    for (auto& file_path : removed_file_paths) {
+        statistics.removed_files_amount += do_remove_file(std::move(file_path)) ? 1 : 0;
+    }
+    for (auto& file_path : modified_file_paths) {
+        statistics.modified_files_amount += do_modify_file(std::move(file_path)) ? 1 : 0;
+    }
+    if (!added_file_paths.empty()) {
+        statistics.added_files_amount = add_files(added_file_paths, threads_amount);
     }
 
-    std::size_t expected_count = word_set.size();
-    for (const auto& [file_id, words_count] : file_words_map) {
-        if (words_count == expected_count) {
-            out_file_ids.emplace(file_id);
-
-            out_files_table.emplace(file_id, files_table.get_value_ref_unsafe(file_id));
-        }
+    if (p_out_statistics != nullptr) {
+        *p_out_statistics = statistics;
     }
 
-    return !out_file_ids.empty();
+    return true;
 }
 
 // read_file
 template <typename string_type>
 inline string_type index_manager<string_type>::read_file(const string_type& file_path) const {
+    return utf8_to_string_type(read_file_as_utf8(file_path));
+}
+
+// read_file_and_stamp
+template <typename string_type>
+inline string_type index_manager<string_type>::read_file_and_stamp(const string_type& file_path, file_stamp& out_stamp) const {
+    out_stamp = file_stamp::of(file_path);
+
     std::string content = read_file_as_utf8(file_path);
+    out_stamp.content_hash = get_content_hash(content);
 
+    return utf8_to_string_type(std::move(content));
+}
+
+// utf8_to_string_type
+template <typename string_type>
+inline string_type index_manager<string_type>::utf8_to_string_type(std::string&& content) {
     if constexpr (std::is_same_v<string_type, std::string>) {
-        return content;
+        return std::move(content);
     }
     else if constexpr (std::is_same_v<string_type, std::u8string>) {
         return string_type(reinterpret_cast<const char8_t*>(content.data()), content.size());
@@ -670,17 +783,48 @@ inline string_type index_manager<string_type>::read_file(const string_type& file
     }
 }
 
+// get_content_hash
+template <typename string_type>
+inline std::uint64_t index_manager<string_type>::get_content_hash(std::string_view utf8_content) {
+    constexpr std::uint64_t multiplier = 0xc6a4a7935bd1e995ull;
+    constexpr int shift = 47;
+
+    std::uint64_t hash = 0x5bd1e9955bd1e995ull ^ (utf8_content.size() * multiplier);
+
+    // 8 bytes at a time, the tail is padded with zeros
+    const char* p_current = utf8_content.data();
+    const char* p_blocks_end = p_current + utf8_content.size() / 8 * 8;
+    for (; p_current != p_blocks_end; p_current += 8) {
+        std::uint64_t block;
+        std::memcpy(&block, p_current, sizeof(block));
+
+        block *= multiplier;
+        block ^= block >> shift;
+        block *= multiplier;
+
+        hash ^= block;
+        hash *= multiplier;
+    }
+
+    if (std::size_t tail_size = utf8_content.size() % 8; tail_size > 0) {
+        std::uint64_t tail = 0;
+        std::memcpy(&tail, p_current, tail_size);
+        hash ^= tail;
+        hash *= multiplier;
+    }
+
+    hash ^= hash >> shift;
+    hash *= multiplier;
+    hash ^= hash >> shift;
+    return hash;
+}
+
 template<typename string_type>
 inline std::string index_manager<string_type>::read_file_as_utf8(const string_type& file_path) const {
     std::ifstream file;
 
-    if constexpr (std::is_same<char_type, char16_t>::value || std::is_same<char_type, char32_t>::value) {
-        std::filesystem::path converted_file_path(file_path);
-        file.open(converted_file_path.generic_wstring(), std::ios::binary | std::ios::ate);
-    }
-    else {
-        file.open(file_path, std::ios::binary | std::ios::ate);
-    }
+    // Opening through std::filesystem::path works for every char_type on every platform
+    file.open(std::filesystem::path(file_path), std::ios::binary | std::ios::ate);
 
     if (!file) {
         throw std::runtime_error("Failed to open the file");
@@ -698,6 +842,14 @@ inline std::string index_manager<string_type>::read_file_as_utf8(const string_ty
     return content;
 }
 
+// normalize_file_path
+template <typename string_type>
+inline void index_manager<string_type>::normalize_file_path([[maybe_unused]] string_type& file_path) {
+#ifdef _WIN32
+    text_normalizer<char_type>::to_lower(file_path);
+#endif // _WIN32
+}
+
 // parse_and_normalize_words
 template <typename string_type>
 inline std::vector<string_type> index_manager<string_type>::parse_and_normalize_words(string_type&& content) const {
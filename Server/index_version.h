@@ -0,0 +1,1372 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <cstdint>
+#include <iterator>
+#include <array>
+#include <functional>
+#include <cmath>
+#include "segmented_index.h"
+#include "forward_index.h"
+#include "id_value_table.h"
+#include "utility.h"
+#include "project_types.h"
+#include "word_entry.h"
+
+// A single version of the whole index: the inverted (segmented) and forward indexes with the tables of words and files.
+// The dictionary of words is split into shards by word hash, like the posting lists (see segmented_index::word_shards_amount),
+// so a batch of files is added shard by shard in parallel (see rw_scheduled_thread_pool::for_each_in_parallel).
+// It takes no locks of its own. index_manager keeps two of them equal with left-right concurrency control (see left_right.h):
+// the queries run on a pinned version no writer touches, every modification is deterministic and is applied to both versions in turn
+template <typename string_type>
+class index_version {
+    // Saves a version to disk and loads it back as a bulk_index (see index_file.h)
+    template <typename> friend class index_file;
+
+public:
+    inline index_version() = default;
+    inline ~index_version() = default;
+
+    inline index_version(const index_version& other) = delete;
+    inline index_version(index_version&& other) = delete;
+    inline index_version& operator=(const index_version& rhs) = delete;
+    inline index_version& operator=(index_version&& rhs) = delete;
+
+public:
+    // The file paths must already be normalized (see index_manager::normalize_file_path)
+
+    // What a file was like when its words were read: the size and the last write time that tell a restart the file is unchanged,
+    // and the hash of the content that was read, for when they don't (see index_manager::load_index)
+    struct file_stamp {
+        std::uint64_t size = UINT64_MAX;
+        std::int64_t last_write_time = INT64_MIN;
+        std::uint64_t content_hash = 0;
+
+        inline bool operator==(const file_stamp& rhs) const = default;
+
+        // The size and the last write time of the file as it is now, without the hash.
+        // A file that can't be examined gets a stamp that matches no real file
+        inline static file_stamp of(const std::filesystem::path& file_path);
+    };
+
+    // Returns pair where .first is true if the file is actually present, false otherwise
+    inline std::pair<bool, id_type> has_file(const string_type& file_path) const;
+    // Returns false if the file is not present
+    inline bool get_file_stamp(const string_type& file_path, file_stamp& out_stamp) const;
+
+    // Index the words of a file. Returns false if the file is already present
+    inline bool add_file(const string_type& file_path, const std::vector<string_type>& words, const file_stamp& stamp);
+    // The postings of a removed file are only erased (see segmented_index::erase_file), a merge or a freeze purges them later.
+    // The stamp is of the file on the disk as it is removed (see index_manager::load_index). Returns false if the file is not present
+    inline bool remove_file(const string_type& file_path, const file_stamp& stamp);
+    // The positions of every distinct word of a file, the words in the order they first occur in.
+    // Grouped apart from any version, so that modify_file looks every distinct word up only once
+    using file_word_positions = std::vector<std::pair<string_type, std::vector<id_type>>>;
+    inline static file_word_positions group_word_positions(const std::vector<string_type>& words);
+
+    // Replace all the words of a present file with the grouped ones. If the file is in the mutable segment, only the posting lists
+    // of the words that left the file, came into it or moved inside it are touched. Otherwise the file is erased from its frozen segment
+    // and indexed anew into the mutable one. Returns false if the file is not present
+    inline bool modify_file(const string_type& file_path, const file_word_positions& word_positions, const file_stamp& stamp);
+
+    inline void clear_all();
+
+    // Merges of the segments of the inverted index (see segmented_index). A merge is planned on a snapshot, built apart from
+    // any version with segmented_index::merge, then applied to both versions
+    using segment_merge = segmented_index::segment_merge;
+    inline bool needs_merge() const;
+    inline bool plan_merge(segment_merge& out_merge) const;
+    // Put the merged segment in place of its inputs, and forget the words that no file has anymore.
+    // Their IDs are not reused: a word that comes back gets a new one. Returns false if the inputs are not there anymore
+    inline bool apply_merge(const segment_merge& built_merge);
+
+    // Files read, parsed and indexed apart from any version (see index_manager::add_files), merged into a version at once.
+    // The IDs are local to the batch: the word words[i] has the ID i + 1, the file file_paths[i] has the ID i + 1
+    struct bulk_index {
+        std::vector<string_type> words;
+        std::vector<posting_list_type> posting_lists; // Of every word, with the batch file IDs
+
+        std::vector<string_type> file_paths;          // Normalized, without duplicates
+        std::vector<std::vector<id_type>> file_word_ids; // Batch IDs of the words of every file, without duplicates
+        std::vector<id_type> file_lengths;
+        std::vector<file_stamp> file_stamps;
+
+        // Files the index knows, but which are not present: they keep their IDs for when they are added again
+        std::vector<string_type> removed_file_paths;
+        std::vector<file_stamp> removed_file_stamps; // As they were on the disk when they were removed
+    };
+
+    // Index all the files of the batch that are not present yet. Returns the amount of the added files.
+    // Into a version that has no posting lists the batch goes as it is, the posting lists are copied whole.
+    // The removed files of the batch become known to the version if they are not yet
+    inline std::size_t add_bulk(const bulk_index& bulk);
+
+    // Found files in ascending file ID order, with their paths
+    using found_files_table = std::vector<std::pair<id_type, const string_type&>>;
+
+    // Word entries of a single word in (file_id, position) order. If they are all in a single posting list without removed files,
+    // cp_out_word_entries points to it and nothing is copied. Otherwise it is nullptr, and they are added to out_word_entries
+    inline std::pair<bool, id_type> get_word_entry_set_for_word(const string_type& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+    inline std::pair<bool, id_type> get_word_entry_set_for_word(string_type&& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+    inline std::pair<bool, id_type> get_word_entry_set_for_lowered_word(const string_type& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+    inline std::pair<bool, id_type> get_word_entry_set_for_lowered_word(string_type&& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+
+    // Word entries of all the words in the files that contain every word, in (file_id, position) order
+    inline bool get_word_entry_set_for_word_set(const std::unordered_set<string_type>& word_set, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+    inline bool get_word_entry_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+
+    // Sorted IDs of the files that contain the word
+    inline std::pair<bool, id_type> get_file_set_for_word(const string_type& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+    inline std::pair<bool, id_type> get_file_set_for_word(string_type&& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+    inline std::pair<bool, id_type> get_file_set_for_lowered_word(const string_type& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+    inline std::pair<bool, id_type> get_file_set_for_lowered_word(string_type&& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+
+    // Sorted IDs of the files that contain every word
+    inline bool get_file_set_for_word_set(const std::unordered_set<string_type>& word_set, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+    inline bool get_file_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+
+    // Phrase query: the words follow each other at consecutive positions, in the given order.
+    // Word entries of all the words of every occurrence of the phrase, in (file_id, position) order
+    inline bool get_word_entry_set_for_phrase(const std::vector<string_type>& phrase, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+    inline bool get_word_entry_set_for_lowered_phrase(const std::vector<string_type>& phrase, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+
+    // Sorted IDs of the files that contain the phrase
+    inline bool get_file_set_for_phrase(const std::vector<string_type>& phrase, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+    inline bool get_file_set_for_lowered_phrase(const std::vector<string_type>& phrase, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+
+    // NEAR/max_distance query: every word occurs, in any order, within max_distance positions of the others.
+    // Word entries of the words inside every such window, in (file_id, position) order
+    inline bool get_word_entry_set_for_near_words(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+    inline bool get_word_entry_set_for_lowered_near_words(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+
+    // Sorted IDs of the files with at least one such window
+    inline bool get_file_set_for_near_words(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+    inline bool get_file_set_for_lowered_near_words(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+
+    // Ranked query: the top_k files with the best BM25 score that contain at least one of the words.
+    // The best file goes first, out_scores[i] is the score of out_files_table[i]
+    inline bool get_ranked_file_set_for_word_set(const std::unordered_set<string_type>& word_set, std::size_t top_k, std::vector<float>& out_scores, found_files_table& out_files_table) const;
+    inline bool get_ranked_file_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::size_t top_k, std::vector<float>& out_scores, found_files_table& out_files_table) const;
+
+    // BM25 parameters: term frequency saturation and document length normalization
+    static constexpr float bm25_k1 = 1.2f;
+    static constexpr float bm25_b = 0.75f;
+
+private:
+    // A word is in the dictionary shard of its hash, with a word ID of that shard (see segmented_index::get_word_id)
+    inline static std::size_t get_word_shard_idx(const string_type& word);
+    // Returns 0 if the word is unknown
+    inline id_type get_word_id_unsafe(const string_type& word) const;
+    // Adds the word if it is unknown. shard_idx is the shard of the word
+    inline id_type add_word_unsafe(std::size_t shard_idx, const string_type& word);
+    inline id_type add_word_unsafe(const string_type& word);
+    inline void remove_word_unsafe(id_type word_id);
+    // Calls function(word_id, word) for every word of the dictionary
+    template <typename function_type>
+    inline void for_each_word_unsafe(function_type&& function) const;
+
+    inline void add_words_to_index_unsafe(const std::vector<string_type>& words, id_type file_id);
+    // After every modification that indexes files: the words a freeze leaves without posting lists are forgotten
+    inline void freeze_mutable_segment_if_full_unsafe();
+
+    inline std::pair<bool, id_type> do_get_word_entry_set_for_lowered_word(string_type&& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const;
+    inline std::pair<bool, id_type> do_get_file_set_for_lowered_word(string_type&& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const;
+
+    // Returns false if at least one word has no occurrences
+    template <typename word_container_type>
+    inline bool get_word_ids_unsafe(const word_container_type& words, std::vector<id_type>& out_word_ids) const;
+    // The files that contain every word, in ascending file ID order, with the index of the segment that holds each of them.
+    // out_segment_postings[segment index] are the posting lists of the words in that segment, empty if it misses any of the words
+    inline void intersect_file_sets_unsafe(const std::vector<id_type>& word_ids, std::vector<std::vector<const posting_list_type*>>& out_segment_postings, std::vector<std::pair<id_type, std::size_t>>& out_files) const;
+    // Sorted IDs of the files of a single segment that contain every word, without its erased files: an AND of the file bitmaps
+    // if every word has one, otherwise the files of the rarest word, probed against the bitmaps and the galloping posting list cursors of the rest
+    inline static void intersect_segment_file_sets(const segmented_index::segment& word_segment, const std::vector<id_type>& word_ids, const std::vector<const posting_list_type*>& word_postings, std::vector<id_type>& out_file_ids);
+    inline static std::vector<std::vector<posting_list_type::file_cursor>> get_file_cursors(const std::vector<std::vector<const posting_list_type*>>& segment_postings);
+    // Calls on_common_file(file_id, word_positions) in ascending file ID order for every file that contains all the words,
+    // word_positions[i] being the sorted positions of words[i] inside the file. Returns false if at least one word has no occurrences
+    template <typename function_type>
+    inline bool for_each_common_file_unsafe(const std::vector<string_type>& words, function_type&& on_common_file) const;
+
+    // Files with at least one match of the phrase / of the NEAR window. The positions of the matched words
+    // are added to out_word_entries if p_out_word_entries is not nullptr
+    inline void match_phrase_unsafe(const std::vector<string_type>& phrase, std::vector<id_type>& out_file_ids, std::vector<word_entry>* p_out_word_entries) const;
+    inline void match_near_words_unsafe(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<id_type>& out_file_ids, std::vector<word_entry>* p_out_word_entries) const;
+
+    // Positional merge-join inside a single file: ascending positions of the words of every occurrence of the phrase,
+    // phrase_words[i] being the index in word_positions of the i-th word of the phrase
+    inline static void find_phrase_positions(const std::vector<std::vector<id_type>>& word_positions, const std::vector<std::size_t>& phrase_words, std::vector<id_type>& out_positions);
+    // Sliding window inside a single file: ascending positions of the words inside every window
+    // of max_distance + 1 positions that contains all the words
+    inline static void find_near_positions(const std::vector<std::vector<id_type>>& word_positions, id_type max_distance, std::vector<id_type>& out_positions);
+
+    // WAND top-k retrieval over every segment in turn: (score, file ID) of the best top_k files, best first
+    inline void rank_files_unsafe(const std::vector<id_type>& word_ids, std::size_t top_k, std::vector<std::pair<float, id_type>>& out_ranked_files) const;
+
+    inline void fill_files_table_unsafe(const posting_list_type& word_postings, found_files_table& out_files_table) const;
+    inline void fill_files_table_unsafe(const std::vector<id_type>& file_ids, found_files_table& out_files_table) const;
+    inline static std::unordered_set<string_type> to_lower_word_set(const std::unordered_set<string_type>& word_set);
+    inline static std::vector<string_type> to_lower_words(const std::vector<string_type>& words);
+
+
+private:
+    using char_type = string_type::value_type;
+    using file_cursor = posting_list_type::file_cursor;
+    using string_table = id_value_table<id_type, string_type>;
+    using presence_table = id_value_table<id_type, bool, false>;
+    using stamp_table = id_value_table<id_type, file_stamp, false>;
+
+    segmented_index inverted;
+    forward_index forward;
+
+    std::array<string_table, segmented_index::word_shards_amount> words_tables; // Local word IDs of every shard
+    string_table files_table;
+    presence_table files_present_table;
+    stamp_table files_stamp_table; // Of the present files, of the removed ones as they were when they were removed
+};
+
+// file_stamp::of
+template <typename string_type>
+inline typename index_version<string_type>::file_stamp index_version<string_type>::file_stamp::of(const std::filesystem::path& file_path) {
+    std::error_code error;
+
+    auto file_size = std::filesystem::file_size(file_path, error);
+    if (error) {
+        return {};
+    }
+
+    auto last_write_time = std::filesystem::last_write_time(file_path, error);
+    if (error) {
+        return {};
+    }
+
+    return { static_cast<std::uint64_t>(file_size), static_cast<std::int64_t>(last_write_time.time_since_epoch().count()), 0 };
+}
+
+// has_file
+template <typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::has_file(const string_type& file_path) const {
+    id_type file_id = files_table.get_value_id_always_unsafe(file_path);
+    bool file_present = file_id != 0 ? files_present_table.get_value_unsafe(file_id) : false;
+
+    return { file_present, file_id };
+}
+
+// get_file_stamp
+template <typename string_type>
+inline bool index_version<string_type>::get_file_stamp(const string_type& file_path, file_stamp& out_stamp) const {
+    auto [file_present, file_id] = has_file(file_path);
+    if (!file_present) {
+        return false;
+    }
+
+    out_stamp = files_stamp_table.get_value_cref_unsafe(file_id);
+    return true;
+}
+
+// add_file
+template <typename string_type>
+inline bool index_version<string_type>::add_file(const string_type& file_path, const std::vector<string_type>& words, const file_stamp& stamp) {
+    auto [file_present, file_id] = has_file(file_path);
+    if (file_present) {
+        return false;
+    }
+
+    if (file_id == 0) {
+        file_id = files_table.add_value_unsafe(file_path);
+        files_present_table.add_value_unsafe(true);
+        files_stamp_table.add_value_unsafe(stamp);
+    }
+    else {
+        files_present_table.modify_by_id_unsafe(file_id, true);
+        files_stamp_table.modify_by_id_unsafe(file_id, stamp);
+        inverted.purge_file(file_id); // The postings it had when it was removed, if they are still in the mutable segment
+    }
+
+    add_words_to_index_unsafe(words, file_id);
+    freeze_mutable_segment_if_full_unsafe();
+
+    return true;
+}
+
+// add_bulk
+template <typename string_type>
+inline std::size_t index_version<string_type>::add_bulk(const bulk_index& bulk) {
+    bool posting_lists_as_they_are = inverted.empty();
+
+    // Batch indexes of the words of every shard
+    std::vector<std::vector<std::size_t>> shard_word_indexes(segmented_index::word_shards_amount);
+    for (std::size_t word_idx = 0; word_idx < bulk.words.size(); ++word_idx) {
+        shard_word_indexes[get_word_shard_idx(bulk.words[word_idx])].push_back(word_idx);
+    }
+
+    // Batch ID - 1 -> ID in this version (0 for the files that are already present)
+    std::vector<id_type> word_ids(bulk.words.size());
+    rw_scheduled_thread_pool::for_each_in_parallel(segmented_index::word_shards_amount, [&](std::size_t shard_idx) {
+        for (const auto word_idx : shard_word_indexes[shard_idx]) {
+            word_ids[word_idx] = add_word_unsafe(shard_idx, bulk.words[word_idx]);
+        }
+    });
+
+    std::size_t added_files_amount = 0;
+    std::vector<id_type> file_ids(bulk.file_paths.size());
+    for (std::size_t file_idx = 0; file_idx < bulk.file_paths.size(); ++file_idx) {
+        auto [file_present, file_id] = has_file(bulk.file_paths[file_idx]);
+        if (file_present) {
+            posting_lists_as_they_are = false;
+            continue;
+        }
+
+        if (file_id == 0) {
+            file_id = files_table.add_value_unsafe(bulk.file_paths[file_idx]);
+            files_present_table.add_value_unsafe(true);
+            files_stamp_table.add_value_unsafe(bulk.file_stamps[file_idx]);
+        }
+        else {
+            files_present_table.modify_by_id_unsafe(file_id, true);
+            files_stamp_table.modify_by_id_unsafe(file_id, bulk.file_stamps[file_idx]);
+            inverted.purge_file(file_id);
+        }
+
+        file_ids[file_idx] = file_id;
+        posting_lists_as_they_are = posting_lists_as_they_are && file_id == file_idx + 1;
+        ++added_files_amount;
+
+        std::unordered_set<id_type> file_word_ids;
+        file_word_ids.reserve(bulk.file_word_ids[file_idx].size());
+        for (const auto batch_word_id : bulk.file_word_ids[file_idx]) {
+            file_word_ids.insert(word_ids[batch_word_id - 1]);
+        }
+        forward.add_word_id_set_unsafe(file_id, std::move(file_word_ids));
+        forward.set_file_length_unsafe(file_id, bulk.file_lengths[file_idx]);
+    }
+
+    for (std::size_t file_idx = 0; file_idx < bulk.removed_file_paths.size(); ++file_idx) {
+        const string_type& removed_file_path = bulk.removed_file_paths[file_idx];
+        if (files_table.get_value_id_always_unsafe(removed_file_path) == 0) {
+            files_table.add_value_unsafe(removed_file_path);
+            files_present_table.add_value_unsafe(false);
+            files_stamp_table.add_value_unsafe(bulk.removed_file_stamps[file_idx]);
+        }
+    }
+
+    inverted.add_to_shards_in_parallel([&](std::size_t shard_idx, segmented_index::shard_writer& writer) {
+        if (posting_lists_as_they_are) {
+            for (const auto word_idx : shard_word_indexes[shard_idx]) {
+                writer.add_posting_list(word_ids[word_idx], bulk.posting_lists[word_idx]);
+            }
+            return;
+        }
+
+        // Otherwise every file of every posting list is added on its own, with the IDs of this version
+        std::vector<id_type> file_positions;
+        for (const auto word_idx : shard_word_indexes[shard_idx]) {
+            for (auto files = bulk.posting_lists[word_idx].get_file_cursor(); !files.at_end(); files.next()) {
+                id_type file_id = file_ids[files.file_id() - 1];
+                if (file_id == 0) {
+                    continue;
+                }
+
+                file_positions.clear();
+                files.for_each_position([&file_positions](id_type position) { file_positions.push_back(position); });
+                writer.add_file_positions(word_ids[word_idx], file_id, file_positions);
+            }
+        }
+    });
+    freeze_mutable_segment_if_full_unsafe();
+
+    return added_files_amount;
+}
+
+// get_word_shard_idx
+template <typename string_type>
+inline std::size_t index_version<string_type>::get_word_shard_idx(const string_type& word) {
+    return std::hash<string_type>{}(word) % segmented_index::word_shards_amount;
+}
+
+// get_word_id_unsafe
+template <typename string_type>
+inline id_type index_version<string_type>::get_word_id_unsafe(const string_type& word) const {
+    std::size_t shard_idx = get_word_shard_idx(word);
+
+    id_type local_word_id = words_tables[shard_idx].get_value_id_always_unsafe(word);
+    return local_word_id != 0 ? segmented_index::get_word_id(shard_idx, local_word_id) : 0;
+}
+
+// add_word_unsafe
+template <typename string_type>
+inline id_type index_version<string_type>::add_word_unsafe(std::size_t shard_idx, const string_type& word) {
+    string_table& words_table = words_tables[shard_idx];
+
+    id_type local_word_id = words_table.get_value_id_always_unsafe(word);
+    if (local_word_id == 0) { local_word_id = words_table.add_value_unsafe(word); }
+
+    return segmented_index::get_word_id(shard_idx, local_word_id);
+}
+
+template <typename string_type>
+inline id_type index_version<string_type>::add_word_unsafe(const string_type& word) {
+    return add_word_unsafe(get_word_shard_idx(word), word);
+}
+
+// remove_word_unsafe
+template <typename string_type>
+inline void index_version<string_type>::remove_word_unsafe(id_type word_id) {
+    words_tables[segmented_index::get_word_shard_idx(word_id)].remove_by_id_unsafe(segmented_index::get_local_word_id(word_id));
+}
+
+// for_each_word_unsafe
+template <typename string_type>
+template <typename function_type>
+inline void index_version<string_type>::for_each_word_unsafe(function_type&& function) const {
+    for (std::size_t shard_idx = 0; shard_idx < words_tables.size(); ++shard_idx) {
+        const string_table& words_table = words_tables[shard_idx];
+
+        for (id_type local_word_id = 1; local_word_id < words_table.get_next_id_unsafe(); ++local_word_id) {
+            if (words_table.has_id_unsafe(local_word_id)) {
+                function(segmented_index::get_word_id(shard_idx, local_word_id), words_table.get_value_cref_unsafe(local_word_id));
+            }
+        }
+    }
+}
+
+// add_words_to_index_unsafe
+template<typename string_type>
+inline void index_version<string_type>::add_words_to_index_unsafe(const std::vector<string_type>& words, id_type file_id) {
+    // Positions are grouped per word first, so every posting list gets the whole file in a single insertion
+    std::unordered_map<id_type, std::vector<id_type>> word_positions;
+    word_positions.reserve(words.size());
+
+    id_type position = 1;
+    for (const auto& word : words) {
+        word_positions[add_word_unsafe(word)].push_back(position++);
+    }
+
+    std::unordered_set<id_type> word_ids;
+    word_ids.reserve(word_positions.size());
+
+    for (const auto& [word_id, file_positions] : word_positions) {
+        inverted.add_file_positions(word_id, file_id, file_positions);
+        word_ids.insert(word_id);
+    }
+    forward.add_word_id_set_unsafe(file_id, std::move(word_ids));
+    forward.set_file_length_unsafe(file_id, static_cast<id_type>(words.size()));
+}
+
+// freeze_mutable_segment_if_full_unsafe
+template<typename string_type>
+inline void index_version<string_type>::freeze_mutable_segment_if_full_unsafe() {
+    for (const auto word_id : inverted.freeze_mutable_segment_if_full()) {
+        remove_word_unsafe(word_id);
+    }
+}
+
+// remove_file
+template <typename string_type>
+inline bool index_version<string_type>::remove_file(const string_type& file_path, const file_stamp& stamp) {
+    auto [file_present, file_id] = has_file(file_path);
+    if (!file_present) {
+        return false;
+    }
+
+    std::size_t positions_amount = forward.get_file_length_unsafe(file_id);
+    inverted.erase_file(file_id, forward.extract_word_id_set_unsafe(file_id), positions_amount);
+    files_present_table.modify_by_id_unsafe(file_id, false);
+    files_stamp_table.modify_by_id_unsafe(file_id, stamp);
+
+    return true;
+}
+
+// needs_merge
+template <typename string_type>
+inline bool index_version<string_type>::needs_merge() const {
+    return inverted.needs_merge();
+}
+
+// plan_merge
+template <typename string_type>
+inline bool index_version<string_type>::plan_merge(segment_merge& out_merge) const {
+    return inverted.plan_merge(out_merge);
+}
+
+// apply_merge
+template <typename string_type>
+inline bool index_version<string_type>::apply_merge(const segment_merge& built_merge) {
+    std::vector<id_type> forgotten_word_ids;
+    if (!inverted.apply_merge(built_merge, forgotten_word_ids)) {
+        return false;
+    }
+
+    for (const auto word_id : forgotten_word_ids) {
+        remove_word_unsafe(word_id);
+    }
+    return true;
+}
+
+// group_word_positions
+template <typename string_type>
+inline typename index_version<string_type>::file_word_positions index_version<string_type>::group_word_positions(const std::vector<string_type>& words) {
+    file_word_positions word_positions;
+    std::unordered_map<string_type, std::size_t> word_indexes; // Word -> its index in word_positions
+    word_indexes.reserve(words.size());
+
+    id_type position = 1;
+    for (const auto& word : words) {
+        auto [it, inserted] = word_indexes.try_emplace(word, word_positions.size());
+        if (inserted) {
+            word_positions.emplace_back(word, std::vector<id_type>());
+        }
+
+        word_positions[it->second].second.push_back(position++);
+    }
+
+    return word_positions;
+}
+
+// modify_file
+template <typename string_type>
+inline bool index_version<string_type>::modify_file(const string_type& file_path, const file_word_positions& word_positions, const file_stamp& stamp) {
+    auto [file_present, file_id] = has_file(file_path);
+    if (!file_present) {
+        return false;
+    }
+
+    std::vector<id_type> new_word_ids;
+    new_word_ids.reserve(word_positions.size());
+    std::unordered_set<id_type> word_ids;
+    word_ids.reserve(word_positions.size());
+
+    id_type file_length = 0;
+    for (const auto& [word, file_positions] : word_positions) {
+        id_type word_id = add_word_unsafe(word);
+
+        new_word_ids.push_back(word_id);
+        word_ids.insert(word_id);
+        file_length += static_cast<id_type>(file_positions.size());
+    }
+
+    if (!inverted.is_in_mutable_segment(file_id)) {
+        // A frozen segment is never modified
+        std::size_t positions_amount = forward.get_file_length_unsafe(file_id);
+        inverted.erase_file(file_id, forward.extract_word_id_set_unsafe(file_id), positions_amount);
+
+        for (std::size_t word_idx = 0; word_idx < word_positions.size(); ++word_idx) {
+            inverted.add_file_positions(new_word_ids[word_idx], file_id, word_positions[word_idx].second);
+        }
+    }
+    else {
+        // The words that left the file
+        const auto& old_word_ids = forward.get_word_id_set_cref_unsafe(file_id);
+        for (const auto old_word_id : old_word_ids) {
+            if (!word_ids.contains(old_word_id)) {
+                inverted.clear_for_word_and_file(old_word_id, file_id);
+            }
+        }
+
+        // The words that came into the file or moved inside it. An edit that changes the amount of words shifts the positions after it:
+        // the words that only occur before the first edit keep theirs
+        for (std::size_t word_idx = 0; word_idx < word_positions.size(); ++word_idx) {
+            id_type word_id = new_word_ids[word_idx];
+            const auto& file_positions = word_positions[word_idx].second;
+
+            if (old_word_ids.contains(word_id)) {
+                if (inverted.has_file_positions(word_id, file_id, file_positions)) {
+                    continue;
+                }
+                inverted.clear_for_word_and_file(word_id, file_id);
+            }
+            inverted.add_file_positions(word_id, file_id, file_positions);
+        }
+
+        forward.clear_file_unsafe(file_id);
+    }
+
+    forward.add_word_id_set_unsafe(file_id, std::move(word_ids));
+    forward.set_file_length_unsafe(file_id, file_length);
+    files_stamp_table.modify_by_id_unsafe(file_id, stamp);
+    freeze_mutable_segment_if_full_unsafe();
+
+    return true;
+}
+
+// clear_all
+template <typename string_type>
+inline void index_version<string_type>::clear_all() {
+    inverted.clear();
+    forward.clear_unsafe();
+    for (auto& words_table : words_tables) {
+        words_table.clear_unsafe();
+    }
+    files_table.clear_unsafe();
+    files_present_table.clear_unsafe();
+    files_stamp_table.clear_unsafe();
+}
+
+// get_word_entry_set_for_word
+template <typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::get_word_entry_set_for_word(const string_type& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    string_type to_lower_word(word);
+    text_normalizer<char_type>::to_lower(to_lower_word);
+    return do_get_word_entry_set_for_lowered_word(std::move(to_lower_word), cp_out_word_entries, out_word_entries, out_files_table);
+}
+
+template <typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::get_word_entry_set_for_word(string_type&& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    text_normalizer<char_type>::to_lower(word);
+    return do_get_word_entry_set_for_lowered_word(std::move(word), cp_out_word_entries, out_word_entries, out_files_table);
+}
+
+template<typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::get_word_entry_set_for_lowered_word(const string_type& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    string_type lowered_word(word);
+    return do_get_word_entry_set_for_lowered_word(std::move(lowered_word), cp_out_word_entries, out_word_entries, out_files_table);
+}
+
+template<typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::get_word_entry_set_for_lowered_word(string_type&& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    return do_get_word_entry_set_for_lowered_word(std::move(word), cp_out_word_entries, out_word_entries, out_files_table);
+}
+
+template <typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::do_get_word_entry_set_for_lowered_word(string_type&& word, const posting_list_type*& cp_out_word_entries, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    id_type word_id = get_word_id_unsafe(word);
+    if (word_id == 0) {
+        return { false, word_id };
+    }
+
+    const segmented_index::segment* p_word_segment = nullptr;
+    std::size_t word_segments_amount = 0;
+    for (const auto& word_segment : inverted.get_segments()) {
+        if (word_segment.get_posting_list_cp(word_id) != nullptr) {
+            p_word_segment = &word_segment;
+            ++word_segments_amount;
+        }
+    }
+
+    cp_out_word_entries = nullptr;
+    if (word_segments_amount == 1 && !p_word_segment->has_erased_files(word_id)) {
+        cp_out_word_entries = p_word_segment->get_posting_list_cp(word_id);
+        fill_files_table_unsafe(*cp_out_word_entries, out_files_table);
+        return { cp_out_word_entries->file_count() != 0, word_id };
+    }
+
+    std::size_t files_amount = out_files_table.size();
+    inverted.for_each_file(word_id, [&](const file_cursor& files) {
+        id_type file_id = files.file_id();
+        out_files_table.emplace_back(file_id, files_table.get_value_cref_unsafe(file_id));
+        files.for_each_position([&out_word_entries, file_id](id_type position) {
+            out_word_entries.emplace_back(file_id, position);
+        });
+    });
+
+    return { out_files_table.size() != files_amount, word_id };
+}
+
+// get_word_entry_set_for_word_set
+template <typename string_type>
+inline bool index_version<string_type>::get_word_entry_set_for_word_set(const std::unordered_set<string_type>& word_set, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    return get_word_entry_set_for_lowered_word_set(to_lower_word_set(word_set), out_word_entries, out_files_table);
+}
+
+// get_word_entry_set_for_lowered_word_set
+template <typename string_type>
+inline bool index_version<string_type>::get_word_entry_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    if (word_set.empty()) {
+        return false;
+    }
+
+    std::vector<id_type> word_ids;
+    std::vector<std::vector<const posting_list_type*>> segment_postings;
+    std::vector<std::pair<id_type, std::size_t>> common_files;
+
+    if (!get_word_ids_unsafe(word_set, word_ids)) {
+        return false; // If at least one word has no occurrences, the intersection is empty.
+    }
+    intersect_file_sets_unsafe(word_ids, segment_postings, common_files);
+
+    // Positions are only decoded for the files that contain every word
+    std::vector<std::vector<file_cursor>> segment_cursors = get_file_cursors(segment_postings);
+
+    out_files_table.reserve(out_files_table.size() + common_files.size());
+    for (const auto& [file_id, segment_idx] : common_files) {
+        std::size_t file_entries_begin = out_word_entries.size();
+
+        for (auto& files : segment_cursors[segment_idx]) {
+            files.advance_to(file_id);
+            files.for_each_position([&out_word_entries, file_id](id_type position) {
+                out_word_entries.emplace_back(file_id, position);
+            });
+        }
+        std::sort(std::begin(out_word_entries) + file_entries_begin, std::end(out_word_entries));
+
+        out_files_table.emplace_back(file_id, files_table.get_value_cref_unsafe(file_id));
+    }
+
+    return !out_word_entries.empty();
+}
+
+template<typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::get_file_set_for_word(const string_type& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    string_type to_lower_word(word);
+    text_normalizer<char_type>::to_lower(to_lower_word);
+    return do_get_file_set_for_lowered_word(std::move(to_lower_word), out_file_ids, out_files_table);
+}
+
+template<typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::get_file_set_for_word(string_type&& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    text_normalizer<char_type>::to_lower(word);
+    return do_get_file_set_for_lowered_word(std::move(word), out_file_ids, out_files_table);
+}
+
+template<typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::get_file_set_for_lowered_word(const string_type& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    string_type lowered_word(word);
+    return do_get_file_set_for_lowered_word(std::move(lowered_word), out_file_ids, out_files_table);
+}
+
+template<typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::get_file_set_for_lowered_word(string_type&& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    return do_get_file_set_for_lowered_word(std::move(word), out_file_ids, out_files_table);
+}
+
+template<typename string_type>
+inline std::pair<bool, id_type> index_version<string_type>::do_get_file_set_for_lowered_word(string_type&& word, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    id_type word_id = get_word_id_unsafe(word);
+    if (word_id == 0) {
+        return { false, word_id };
+    }
+
+    inverted.for_each_file(word_id, [&out_file_ids](const file_cursor& files) {
+        out_file_ids.push_back(files.file_id());
+    });
+    fill_files_table_unsafe(out_file_ids, out_files_table);
+
+    return { !out_file_ids.empty(), word_id };
+}
+
+template<typename string_type>
+inline bool index_version<string_type>::get_file_set_for_word_set(const std::unordered_set<string_type>& word_set, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    return get_file_set_for_lowered_word_set(to_lower_word_set(word_set), out_file_ids, out_files_table);
+}
+
+template<typename string_type>
+inline bool index_version<string_type>::get_file_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    if (word_set.empty()) {
+        return false;
+    }
+
+    std::vector<id_type> word_ids;
+    std::vector<std::vector<const posting_list_type*>> segment_postings;
+    std::vector<std::pair<id_type, std::size_t>> common_files;
+
+    if (!get_word_ids_unsafe(word_set, word_ids)) {
+        return false; // If at least one word has no occurrences, the intersection is empty.
+    }
+    intersect_file_sets_unsafe(word_ids, segment_postings, common_files);
+
+    out_file_ids.reserve(out_file_ids.size() + common_files.size());
+    for (const auto& [file_id, segment_idx] : common_files) {
+        out_file_ids.push_back(file_id);
+    }
+
+    fill_files_table_unsafe(out_file_ids, out_files_table);
+    return !out_file_ids.empty();
+}
+
+// get_word_entry_set_for_phrase
+template<typename string_type>
+inline bool index_version<string_type>::get_word_entry_set_for_phrase(const std::vector<string_type>& phrase, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    return get_word_entry_set_for_lowered_phrase(to_lower_words(phrase), out_word_entries, out_files_table);
+}
+
+template<typename string_type>
+inline bool index_version<string_type>::get_word_entry_set_for_lowered_phrase(const std::vector<string_type>& phrase, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    if (phrase.empty()) {
+        return false;
+    }
+
+    std::vector<id_type> file_ids;
+
+    match_phrase_unsafe(phrase, file_ids, &out_word_entries);
+
+    fill_files_table_unsafe(file_ids, out_files_table);
+    return !out_word_entries.empty();
+}
+
+// get_file_set_for_phrase
+template<typename string_type>
+inline bool index_version<string_type>::get_file_set_for_phrase(const std::vector<string_type>& phrase, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    return get_file_set_for_lowered_phrase(to_lower_words(phrase), out_file_ids, out_files_table);
+}
+
+template<typename string_type>
+inline bool index_version<string_type>::get_file_set_for_lowered_phrase(const std::vector<string_type>& phrase, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    if (phrase.empty()) {
+        return false;
+    }
+
+    match_phrase_unsafe(phrase, out_file_ids, nullptr);
+
+    fill_files_table_unsafe(out_file_ids, out_files_table);
+    return !out_file_ids.empty();
+}
+
+// get_word_entry_set_for_near_words
+template<typename string_type>
+inline bool index_version<string_type>::get_word_entry_set_for_near_words(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    return get_word_entry_set_for_lowered_near_words(to_lower_word_set(word_set), max_distance, out_word_entries, out_files_table);
+}
+
+template<typename string_type>
+inline bool index_version<string_type>::get_word_entry_set_for_lowered_near_words(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<word_entry>& out_word_entries, found_files_table& out_files_table) const {
+    if (word_set.empty()) {
+        return false;
+    }
+
+    std::vector<id_type> file_ids;
+
+    match_near_words_unsafe(word_set, max_distance, file_ids, &out_word_entries);
+
+    fill_files_table_unsafe(file_ids, out_files_table);
+    return !out_word_entries.empty();
+}
+
+// get_file_set_for_near_words
+template<typename string_type>
+inline bool index_version<string_type>::get_file_set_for_near_words(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    return get_file_set_for_lowered_near_words(to_lower_word_set(word_set), max_distance, out_file_ids, out_files_table);
+}
+
+template<typename string_type>
+inline bool index_version<string_type>::get_file_set_for_lowered_near_words(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<id_type>& out_file_ids, found_files_table& out_files_table) const {
+    if (word_set.empty()) {
+        return false;
+    }
+
+    match_near_words_unsafe(word_set, max_distance, out_file_ids, nullptr);
+
+    fill_files_table_unsafe(out_file_ids, out_files_table);
+    return !out_file_ids.empty();
+}
+
+// get_ranked_file_set_for_word_set
+template<typename string_type>
+inline bool index_version<string_type>::get_ranked_file_set_for_word_set(const std::unordered_set<string_type>& word_set, std::size_t top_k, std::vector<float>& out_scores, found_files_table& out_files_table) const {
+    return get_ranked_file_set_for_lowered_word_set(to_lower_word_set(word_set), top_k, out_scores, out_files_table);
+}
+
+template<typename string_type>
+inline bool index_version<string_type>::get_ranked_file_set_for_lowered_word_set(const std::unordered_set<string_type>& word_set, std::size_t top_k, std::vector<float>& out_scores, found_files_table& out_files_table) const {
+    if (word_set.empty() || top_k == 0) {
+        return false;
+    }
+
+    std::vector<id_type> word_ids;
+    std::vector<std::pair<float, id_type>> ranked_files;
+
+    // Any of the words is enough, the missing ones just add nothing to the scores
+    for (auto& word : word_set) {
+        id_type word_id = get_word_id_unsafe(word);
+        if (word_id != 0 && inverted.size_file_set(word_id) != 0) {
+            word_ids.push_back(word_id);
+        }
+    }
+
+    rank_files_unsafe(word_ids, top_k, ranked_files);
+
+    out_scores.reserve(out_scores.size() + ranked_files.size());
+    out_files_table.reserve(out_files_table.size() + ranked_files.size());
+    for (const auto& [score, file_id] : ranked_files) {
+        out_scores.push_back(score);
+        out_files_table.emplace_back(file_id, files_table.get_value_cref_unsafe(file_id));
+    }
+
+    return !ranked_files.empty();
+}
+
+// get_word_ids_unsafe
+template<typename string_type>
+template <typename word_container_type>
+inline bool index_version<string_type>::get_word_ids_unsafe(const word_container_type& words, std::vector<id_type>& out_word_ids) const {
+    out_word_ids.reserve(words.size());
+
+    for (auto& word : words) {
+        id_type word_id = get_word_id_unsafe(word);
+        if (word_id == 0 || inverted.size_file_set(word_id) == 0) {
+            return false;
+        }
+        out_word_ids.push_back(word_id);
+    }
+
+    return true;
+}
+
+// intersect_file_sets_unsafe
+template<typename string_type>
+inline void index_version<string_type>::intersect_file_sets_unsafe(const std::vector<id_type>& word_ids, std::vector<std::vector<const posting_list_type*>>& out_segment_postings, std::vector<std::pair<id_type, std::size_t>>& out_files) const {
+    const auto& segments = inverted.get_segments();
+    out_segment_postings.assign(segments.size(), {});
+
+    std::vector<id_type> segment_file_ids;
+    std::size_t found_segments_amount = 0;
+
+    for (std::size_t segment_idx = 0; segment_idx < segments.size(); ++segment_idx) {
+        auto& word_postings = out_segment_postings[segment_idx];
+        for (const auto word_id : word_ids) {
+            const posting_list_type* p_word_entries = segments[segment_idx].get_posting_list_cp(word_id);
+            if (p_word_entries == nullptr) {
+                word_postings.clear();
+                break;
+            }
+            word_postings.push_back(p_word_entries);
+        }
+        if (word_postings.empty()) {
+            continue;
+        }
+
+        segment_file_ids.clear();
+        intersect_segment_file_sets(segments[segment_idx], word_ids, word_postings, segment_file_ids);
+        if (segment_file_ids.empty()) {
+            continue;
+        }
+
+        ++found_segments_amount;
+        for (const auto file_id : segment_file_ids) {
+            out_files.emplace_back(file_id, segment_idx);
+        }
+    }
+
+    // Every segment's files are sorted, but the file IDs of different segments interleave
+    if (found_segments_amount > 1) {
+        std::sort(std::begin(out_files), std::end(out_files));
+    }
+}
+
+// intersect_segment_file_sets
+template<typename string_type>
+inline void index_version<string_type>::intersect_segment_file_sets(const segmented_index::segment& word_segment, const std::vector<id_type>& word_ids, const std::vector<const posting_list_type*>& word_postings, std::vector<id_type>& out_file_ids) {
+    // Words in ascending document frequency order: the rarest word drives the intersection, the others are probed
+    // from the rarest to the most common, so most of the candidates are rejected by the cheapest probes
+    std::vector<std::size_t> word_order(word_ids.size());
+    std::vector<std::size_t> word_frequencies(word_ids.size());
+    for (std::size_t word_idx = 0; word_idx < word_ids.size(); ++word_idx) {
+        word_order[word_idx] = word_idx;
+        word_frequencies[word_idx] = word_segment.size_file_set(word_ids[word_idx]);
+    }
+    std::sort(std::begin(word_order), std::end(word_order), [&word_frequencies](std::size_t lhs, std::size_t rhs) {
+        return word_frequencies[lhs] < word_frequencies[rhs];
+    });
+
+    std::vector<const roaring_bitmap*> file_bitmaps;
+    for (const auto word_idx : word_order) {
+        file_bitmaps.push_back(word_segment.get_file_set_bitmap_cp(word_ids[word_idx]));
+    }
+
+    // Only common words: AND of their bitmaps, starting from the smallest one
+    if (std::find(std::begin(file_bitmaps), std::end(file_bitmaps), nullptr) == std::end(file_bitmaps)) {
+        roaring_bitmap common_files = *file_bitmaps.front();
+        for (std::size_t bitmap_idx = 1; bitmap_idx < file_bitmaps.size() && !common_files.empty(); ++bitmap_idx) {
+            common_files &= *file_bitmaps[bitmap_idx];
+        }
+
+        // The bitmaps hold the erased files of the segment
+        common_files.to_vector(out_file_ids);
+        if (word_segment.has_erased_files()) {
+            std::erase_if(out_file_ids, [&word_segment](id_type file_id) { return word_segment.is_erased(file_id); });
+        }
+        return;
+    }
+
+    // Every file of the rarest word is a candidate. It is looked up in the bitmap of each common word,
+    // the cursors of the other rare words gallop forward to it. Whenever a cursor overshoots, the rarest word
+    // gallops to the file it stopped at, so the cost is O(rarest word * log) rather than O(most common word)
+    auto leading_files = word_postings[word_order.front()]->get_file_cursor();
+
+    std::vector<file_cursor> file_cursors(word_order.size());
+    for (std::size_t order_idx = 1; order_idx < word_order.size(); ++order_idx) {
+        if (file_bitmaps[order_idx] == nullptr) {
+            file_cursors[order_idx] = word_postings[word_order[order_idx]]->get_file_cursor();
+        }
+    }
+
+    while (!leading_files.at_end()) {
+        id_type candidate_file_id = leading_files.file_id();
+        if (word_segment.is_erased(candidate_file_id)) {
+            leading_files.next();
+            continue;
+        }
+
+        bool in_every_set = true;
+
+        for (std::size_t order_idx = 1; order_idx < word_order.size(); ++order_idx) {
+            if (file_bitmaps[order_idx] != nullptr) {
+                if (!file_bitmaps[order_idx]->contains(candidate_file_id)) {
+                    leading_files.next();
+                    in_every_set = false;
+                    break;
+                }
+                continue;
+            }
+
+            auto& files = file_cursors[order_idx];
+            files.advance_to(candidate_file_id);
+
+            if (files.at_end()) {
+                return;
+            }
+            if (files.file_id() != candidate_file_id) {
+                leading_files.advance_to(files.file_id());
+                in_every_set = false;
+                break;
+            }
+        }
+
+        if (in_every_set) {
+            out_file_ids.push_back(candidate_file_id);
+            leading_files.next();
+        }
+    }
+}
+
+// get_file_cursors
+template<typename string_type>
+inline std::vector<std::vector<posting_list_type::file_cursor>> index_version<string_type>::get_file_cursors(const std::vector<std::vector<const posting_list_type*>>& segment_postings) {
+    std::vector<std::vector<file_cursor>> segment_cursors(segment_postings.size());
+
+    for (std::size_t segment_idx = 0; segment_idx < segment_postings.size(); ++segment_idx) {
+        segment_cursors[segment_idx].reserve(segment_postings[segment_idx].size());
+        for (const auto* p_word_entries : segment_postings[segment_idx]) {
+            segment_cursors[segment_idx].push_back(p_word_entries->get_file_cursor());
+        }
+    }
+
+    return segment_cursors;
+}
+
+// for_each_common_file_unsafe
+template<typename string_type>
+template <typename function_type>
+inline bool index_version<string_type>::for_each_common_file_unsafe(const std::vector<string_type>& words, function_type&& on_common_file) const {
+    std::vector<id_type> word_ids;
+    std::vector<std::vector<const posting_list_type*>> segment_postings;
+    std::vector<std::pair<id_type, std::size_t>> common_files;
+
+    if (!get_word_ids_unsafe(words, word_ids)) {
+        return false;
+    }
+    intersect_file_sets_unsafe(word_ids, segment_postings, common_files);
+
+    std::vector<std::vector<file_cursor>> segment_cursors = get_file_cursors(segment_postings);
+
+    std::vector<std::vector<id_type>> word_positions(words.size());
+    for (const auto& [file_id, segment_idx] : common_files) {
+        auto& file_cursors = segment_cursors[segment_idx];
+        for (std::size_t word_idx = 0; word_idx < file_cursors.size(); ++word_idx) {
+            auto& positions = word_positions[word_idx];
+            positions.clear();
+
+            file_cursors[word_idx].advance_to(file_id);
+            file_cursors[word_idx].for_each_position([&positions](id_type position) {
+                positions.push_back(position);
+            });
+        }
+
+        on_common_file(file_id, word_positions);
+    }
+
+    return true;
+}
+
+// match_phrase_unsafe
+template<typename string_type>
+inline void index_version<string_type>::match_phrase_unsafe(const std::vector<string_type>& phrase, std::vector<id_type>& out_file_ids, std::vector<word_entry>* p_out_word_entries) const {
+    // A word may occur in the phrase more than once, its positions are fetched only once
+    std::vector<string_type> words;
+    std::vector<std::size_t> phrase_words;
+    phrase_words.reserve(phrase.size());
+
+    for (const auto& word : phrase) {
+        auto word_it = std::find(std::begin(words), std::end(words), word);
+        phrase_words.push_back(word_it - std::begin(words));
+        if (word_it == std::end(words)) {
+            words.push_back(word);
+        }
+    }
+
+    std::vector<id_type> matched_positions;
+    for_each_common_file_unsafe(words, [&](id_type file_id, const std::vector<std::vector<id_type>>& word_positions) {
+        matched_positions.clear();
+        find_phrase_positions(word_positions, phrase_words, matched_positions);
+        if (matched_positions.empty()) {
+            return;
+        }
+
+        out_file_ids.push_back(file_id);
+        if (p_out_word_entries != nullptr) {
+            for (const auto position : matched_positions) {
+                p_out_word_entries->emplace_back(file_id, position);
+            }
+        }
+    });
+}
+
+// match_near_words_unsafe
+template<typename string_type>
+inline void index_version<string_type>::match_near_words_unsafe(const std::unordered_set<string_type>& word_set, id_type max_distance, std::vector<id_type>& out_file_ids, std::vector<word_entry>* p_out_word_entries) const {
+    std::vector<string_type> words(std::begin(word_set), std::end(word_set));
+
+    std::vector<id_type> matched_positions;
+    for_each_common_file_unsafe(words, [&](id_type file_id, const std::vector<std::vector<id_type>>& word_positions) {
+        matched_positions.clear();
+        find_near_positions(word_positions, max_distance, matched_positions);
+        if (matched_positions.empty()) {
+            return;
+        }
+
+        out_file_ids.push_back(file_id);
+        if (p_out_word_entries != nullptr) {
+            for (const auto position : matched_positions) {
+                p_out_word_entries->emplace_back(file_id, position);
+            }
+        }
+    });
+}
+
+// find_phrase_positions
+template<typename string_type>
+inline void index_version<string_type>::find_phrase_positions(const std::vector<std::vector<id_type>>& word_positions, const std::vector<std::size_t>& phrase_words, std::vector<id_type>& out_positions) {
+    // The i-th word must be at start + i. The starts only grow, so every list is walked once, in order
+    std::vector<std::size_t> position_indices(phrase_words.size(), 0);
+
+    for (const auto start : word_positions[phrase_words.front()]) {
+        bool matched = true;
+
+        for (std::size_t phrase_idx = 1; phrase_idx < phrase_words.size(); ++phrase_idx) {
+            const auto& positions = word_positions[phrase_words[phrase_idx]];
+            auto& position_idx = position_indices[phrase_idx];
+            id_type target_position = start + static_cast<id_type>(phrase_idx);
+
+            while (position_idx < positions.size() && positions[position_idx] < target_position) {
+                ++position_idx;
+            }
+            if (position_idx == positions.size()) {
+                return; // No later start can match either
+            }
+            if (positions[position_idx] != target_position) {
+                matched = false;
+                break;
+            }
+        }
+
+        if (matched) {
+            // Occurrences may overlap ("a a" in "a a a"), a position is only added once
+            for (std::size_t phrase_idx = 0; phrase_idx < phrase_words.size(); ++phrase_idx) {
+                id_type position = start + static_cast<id_type>(phrase_idx);
+                if (out_positions.empty() || position > out_positions.back()) {
+                    out_positions.push_back(position);
+                }
+            }
+        }
+    }
+}
+
+// find_near_positions
+template<typename string_type>
+inline void index_version<string_type>::find_near_positions(const std::vector<std::vector<id_type>>& word_positions, id_type max_distance, std::vector<id_type>& out_positions) {
+    // All the positions of all the words in a single sorted sequence of (position, word index)
+    std::vector<std::pair<id_type, std::size_t>> file_positions;
+    for (std::size_t word_idx = 0; word_idx < word_positions.size(); ++word_idx) {
+        for (const auto position : word_positions[word_idx]) {
+            file_positions.emplace_back(position, word_idx);
+        }
+    }
+    std::sort(std::begin(file_positions), std::end(file_positions));
+
+    // The window ends at every position in turn and starts max_distance positions before it.
+    // Whenever it holds every word, all of its positions are matches
+    std::vector<std::size_t> window_word_amounts(word_positions.size(), 0);
+    std::size_t window_words = 0;
+    std::size_t window_begin = 0;
+    std::size_t matched_end = 0;
+
+    for (std::size_t window_end = 0; window_end < file_positions.size(); ++window_end) {
+        if (window_word_amounts[file_positions[window_end].second]++ == 0) {
+            ++window_words;
+        }
+
+        while (file_positions[window_end].first - file_positions[window_begin].first > max_distance) {
+            if (--window_word_amounts[file_positions[window_begin].second] == 0) {
+                --window_words;
+            }
+            ++window_begin;
+        }
+
+        if (window_words == word_positions.size()) {
+            for (std::size_t idx = std::max(window_begin, matched_end); idx <= window_end; ++idx) {
+                out_positions.push_back(file_positions[idx].first);
+            }
+            matched_end = window_end + 1;
+        }
+    }
+}
+
+// rank_files_unsafe
+template<typename string_type>
+inline void index_version<string_type>::rank_files_unsafe(const std::vector<id_type>& word_ids, std::size_t top_k, std::vector<std::pair<float, id_type>>& out_ranked_files) const {
+    std::size_t files_amount = forward.size_nonempty_files_unsafe();
+    if (files_amount == 0) {
+        return;
+    }
+    float average_length = static_cast<float>(forward.get_total_length_unsafe()) / files_amount;
+
+    // The document frequencies are those of all the segments together
+    std::vector<float> word_idfs;
+    word_idfs.reserve(word_ids.size());
+    for (const auto word_id : word_ids) {
+        float word_files_amount = static_cast<float>(inverted.size_file_set(word_id));
+        word_idfs.push_back(std::log(1.0f + (files_amount - word_files_amount + 0.5f) / (word_files_amount + 0.5f)));
+    }
+
+    struct ranked_word {
+        file_cursor files;
+        float idf;
+        float max_score; // The score of a file can't exceed idf * (k1 + 1), whatever its term frequency and length
+    };
+
+    // A min-heap of the best files so far: the worst of them is on top and its score is the threshold to beat.
+    // Equal scores are ordered by file ID. The segments are visited in turn, so a file may tie with the threshold and still get in
+    auto better = [](const std::pair<float, id_type>& lhs, const std::pair<float, id_type>& rhs) {
+        return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+    };
+    std::vector<std::pair<float, id_type>>& top_files = out_ranked_files;
+    top_files.clear();
+
+    std::vector<ranked_word> words;
+    for (const auto& word_segment : inverted.get_segments()) {
+        words.clear();
+        for (std::size_t word_idx = 0; word_idx < word_ids.size(); ++word_idx) {
+            const posting_list_type* p_word_entries = word_segment.get_posting_list_cp(word_ids[word_idx]);
+            if (p_word_entries != nullptr) {
+                words.push_back({ p_word_entries->get_file_cursor(), word_idfs[word_idx], word_idfs[word_idx] * (bm25_k1 + 1.0f) });
+            }
+        }
+
+        // WAND: with the words sorted by their current file, the pivot is the first word at which the sum of the maximal scores
+        // reaches the threshold. No file before the pivot's file can get into the top, so the words before the pivot jump straight to it
+        while (true) {
+            words.erase(std::remove_if(std::begin(words), std::end(words), [](const ranked_word& word) { return word.files.at_end(); }), std::end(words));
+            if (words.empty()) {
+                break;
+            }
+            std::sort(std::begin(words), std::end(words), [](const ranked_word& lhs, const ranked_word& rhs) {
+                return lhs.files.file_id() < rhs.files.file_id();
+            });
+
+            float threshold = top_files.size() < top_k ? 0.0f : top_files.front().first;
+
+            std::size_t pivot_idx = 0;
+            float max_score = 0.0f;
+            for (; pivot_idx < words.size(); ++pivot_idx) {
+                max_score += words[pivot_idx].max_score;
+                if (max_score >= threshold) {
+                    break;
+                }
+            }
+            if (pivot_idx == words.size()) {
+                break; // Even all the words together can't reach the threshold
+            }
+
+            id_type pivot_file_id = words[pivot_idx].files.file_id();
+            if (words.front().files.file_id() != pivot_file_id) {
+                for (std::size_t word_idx = 0; word_idx < pivot_idx; ++word_idx) {
+                    words[word_idx].files.advance_to(pivot_file_id);
+                }
+                continue;
+            }
+
+            // Every word up to the pivot is on the pivot's file: score it fully, unless the file is erased
+            if (word_segment.is_erased(pivot_file_id)) {
+                for (auto& word : words) {
+                    if (word.files.file_id() != pivot_file_id) {
+                        break;
+                    }
+                    word.files.next();
+                }
+                continue;
+            }
+
+            float file_length = static_cast<float>(forward.get_file_length_unsafe(pivot_file_id));
+            float length_norm = bm25_k1 * (1.0f - bm25_b + bm25_b * file_length / average_length);
+
+            float score = 0.0f;
+            for (auto& word : words) {
+                if (word.files.file_id() != pivot_file_id) {
+                    break;
+                }
+                float frequency = static_cast<float>(word.files.positions_amount());
+                score += word.idf * frequency * (bm25_k1 + 1.0f) / (frequency + length_norm);
+                word.files.next();
+            }
+
+            std::pair<float, id_type> scored_file(score, pivot_file_id);
+            if (top_files.size() < top_k) {
+                top_files.push_back(scored_file);
+                std::push_heap(std::begin(top_files), std::end(top_files), better);
+            }
+            else if (better(scored_file, top_files.front())) {
+                std::pop_heap(std::begin(top_files), std::end(top_files), better);
+                top_files.back() = scored_file;
+                std::push_heap(std::begin(top_files), std::end(top_files), better);
+            }
+        }
+    }
+
+    std::sort_heap(std::begin(top_files), std::end(top_files), better);
+}
+
+// fill_files_table_unsafe
+template<typename string_type>
+inline void index_version<string_type>::fill_files_table_unsafe(const posting_list_type& word_postings, found_files_table& out_files_table) const {
+    out_files_table.reserve(out_files_table.size() + word_postings.file_count());
+
+    for (auto files = word_postings.get_file_cursor(); !files.at_end(); files.next()) {
+        out_files_table.emplace_back(files.file_id(), files_table.get_value_cref_unsafe(files.file_id()));
+    }
+}
+
+template<typename string_type>
+inline void index_version<string_type>::fill_files_table_unsafe(const std::vector<id_type>& file_ids, found_files_table& out_files_table) const {
+    out_files_table.reserve(out_files_table.size() + file_ids.size());
+
+    for (const auto file_id : file_ids) {
+        out_files_table.emplace_back(file_id, files_table.get_value_cref_unsafe(file_id));
+    }
+}
+
+// to_lower_word_set
+template<typename string_type>
+inline std::unordered_set<string_type> index_version<string_type>::to_lower_word_set(const std::unordered_set<string_type>& word_set) {
+    std::unordered_set<string_type> lowered_word_set;
+    lowered_word_set.reserve(word_set.size());
+
+    for (auto& word : word_set) {
+        string_type lowered_word(word);
+        text_normalizer<char_type>::to_lower(lowered_word);
+        lowered_word_set.emplace(std::move(lowered_word));
+    }
+
+    return lowered_word_set;
+}
+
+// to_lower_words
+template<typename string_type>
+inline std::vector<string_type> index_version<string_type>::to_lower_words(const std::vector<string_type>& words) {
+    std::vector<string_type> lowered_words(words);
+
+    for (auto& word : lowered_words) {
+        text_normalizer<char_type>::to_lower(word);
+    }
+
+    return lowered_words;
+}
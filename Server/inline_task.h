@@ -0,0 +1,124 @@
+#pragma once
+
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+
+// ===============================================================================================================
+// A move-only void() callable, like std::move_only_function but with a known inline capacity: a callable (a lambda
+// and its captures) of up to inline_capacity bytes that is nothrow move constructible is stored in the task itself,
+// so creating, queueing and moving a task allocates nothing. A bigger one is allocated on the heap.
+// The task is two cache lines, the captures of the pool tasks of the server (a few pointers and strings) fit inline
+// ===============================================================================================================
+
+class inline_task {
+public:
+    static constexpr std::size_t inline_capacity = 2 * 64 - sizeof(void*);
+
+    inline inline_task() = default;
+    inline ~inline_task() { reset(); }
+
+    template <typename function_type, typename = std::enable_if_t<!std::is_same_v<std::decay_t<function_type>, inline_task>>>
+    inline inline_task(function_type&& function);
+
+    inline inline_task(const inline_task& other) = delete;
+    inline inline_task& operator=(const inline_task& rhs) = delete;
+
+    inline inline_task(inline_task&& other) noexcept;
+    inline inline_task& operator=(inline_task&& rhs) noexcept;
+
+public:
+    inline void operator()() { ops->invoke(storage); }
+    inline explicit operator bool() const { return ops != nullptr; }
+
+    // Destroy the callable, the task is empty afterwards
+    inline void reset();
+
+private:
+    struct operations {
+        void (*invoke)(void* storage);
+        void (*move_to)(void* from_storage, void* to_storage) noexcept; // Destroys the moved-from callable
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename function_type>
+    static constexpr bool fits_inline = sizeof(function_type) <= inline_capacity
+        && alignof(function_type) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<function_type>;
+
+    template <typename function_type>
+    struct inline_operations {
+        static inline function_type* get(void* storage) { return std::launder(reinterpret_cast<function_type*>(storage)); }
+
+        static inline void invoke(void* storage) { (*get(storage))(); }
+
+        static inline void move_to(void* from_storage, void* to_storage) noexcept {
+            new (to_storage) function_type(std::move(*get(from_storage)));
+            get(from_storage)->~function_type();
+        }
+
+        static inline void destroy(void* storage) noexcept { get(storage)->~function_type(); }
+
+        static constexpr operations table = { &invoke, &move_to, &destroy };
+    };
+
+    // The storage holds a pointer to the callable
+    template <typename function_type>
+    struct heap_operations {
+        static inline function_type*& get(void* storage) { return *std::launder(reinterpret_cast<function_type**>(storage)); }
+
+        static inline void invoke(void* storage) { (*get(storage))(); }
+
+        static inline void move_to(void* from_storage, void* to_storage) noexcept { new (to_storage) function_type*(get(from_storage)); }
+
+        static inline void destroy(void* storage) noexcept { delete get(storage); }
+
+        static constexpr operations table = { &invoke, &move_to, &destroy };
+    };
+
+private:
+    alignas(std::max_align_t) unsigned char storage[inline_capacity];
+    const operations* ops = nullptr;
+};
+
+
+template <typename function_type, typename>
+inline inline_task::inline_task(function_type&& function) {
+    using callable_type = std::decay_t<function_type>;
+
+    if constexpr (fits_inline<callable_type>) {
+        new (storage) callable_type(std::forward<function_type>(function));
+        ops = &inline_operations<callable_type>::table;
+    }
+    else {
+        new (storage) callable_type*(new callable_type(std::forward<function_type>(function)));
+        ops = &heap_operations<callable_type>::table;
+    }
+}
+
+inline inline_task::inline_task(inline_task&& other) noexcept {
+    if (other.ops != nullptr) {
+        other.ops->move_to(other.storage, storage);
+        ops = std::exchange(other.ops, nullptr);
+    }
+}
+
+inline inline_task& inline_task::operator=(inline_task&& rhs) noexcept {
+    if (this != &rhs) {
+        reset();
+
+        if (rhs.ops != nullptr) {
+            rhs.ops->move_to(rhs.storage, storage);
+            ops = std::exchange(rhs.ops, nullptr);
+        }
+    }
+    return *this;
+}
+
+inline void inline_task::reset() {
+    if (ops != nullptr) {
+        ops->destroy(storage);
+        ops = nullptr;
+    }
+}
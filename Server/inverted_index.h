@@ -2,12 +2,24 @@
 
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <stdexcept>
+#include "posting_list.h"
+#include "compressed_posting_list.h"
+#include "roaring_bitmap.h"
 #include "concurrent_utility.h"
 #include "utility.h"
 #include "project_types.h"
 #include "word_entry.h"
 
+// Define COMPRESSED_POSTINGS to keep the positions of every word delta-encoded and bit-packed (see compressed_posting_list.h):
+// the index takes several times less memory, searches decode the positions they return on the fly
+#ifdef COMPRESSED_POSTINGS
+using posting_list_type = compressed_posting_list;
+#else
+using posting_list_type = posting_list;
+#endif // COMPRESSED_POSTINGS
+
 class inverted_index {
 public:
     inline inverted_index() = default;
@@ -25,17 +37,13 @@ public:
     inline std::size_t size() const;
     inline std::size_t size_unsafe() const;
 
-    // Returns true if there's an empty existing set of word entries for the specified word_id
-    inline bool empty_word_entry_set(id_type word_id) const;
-    inline bool empty_word_entry_set_unsafe(id_type word_id) const;
-
-    // Returns true if there's an empty existing set of file IDs for the specified word_id
-    inline bool empty_file_set(id_type word_id) const;
-    inline bool empty_file_set_unsafe(id_type word_id) const;
+    // Returns true if there's an empty existing posting list for the specified word_id
+    inline bool empty_posting_list(id_type word_id) const;
+    inline bool empty_posting_list_unsafe(id_type word_id) const;
 
     // Get the amount of word entries for the specified word_id
-    inline std::size_t size_word_entry_set(id_type word_id) const;
-    inline std::size_t size_word_entry_set_unsafe(id_type word_id) const;
+    inline std::size_t size_posting_list(id_type word_id) const;
+    inline std::size_t size_posting_list_unsafe(id_type word_id) const;
 
     // Get the amount of file IDs for the specified word_id
     inline std::size_t size_file_set(id_type word_id) const;
@@ -47,43 +55,80 @@ public:
     inline void add_word_entry(id_type word_id, const word_entry& single_word_entry);
     inline void add_word_entry_unsafe(id_type word_id, const word_entry& single_word_entry);
 
-    inline void add_word_entry_set(id_type word_id, const std::unordered_set<word_entry>& word_entries);
-    inline void add_word_entry_set_unsafe(id_type word_id, const std::unordered_set<word_entry>& word_entries);
-    
-    inline void add_word_entry_set(id_type word_id, std::unordered_set<word_entry>&& word_entries);
-    inline void add_word_entry_set_unsafe(id_type word_id, std::unordered_set<word_entry>&& word_entries);
+    // Add all the positions of word_id inside file_id at once. file_positions must be sorted in ascending order
+    inline void add_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions);
+    inline void add_file_positions_unsafe(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions);
+
+    // Add the whole posting list of a word at once, together with its bitmap if the word is common enough.
+    // Replaces the present posting list of word_id, if any
+    inline void add_posting_list(id_type word_id, const posting_list_type& word_entries);
+    inline void add_posting_list_unsafe(id_type word_id, const posting_list_type& word_entries);
 
     // Delete all word entries for word_id with only the specified file_id, remaining word entries with other file IDs.
-    // Does NOT erases the set itself, even if it becomes empty
+    // Does NOT erases the posting list itself, even if it becomes empty
     inline void clear_for_word_and_file(id_type word_id, id_type file_id);
     inline void clear_for_word_and_file_unsafe(id_type word_id, id_type file_id);
 
-    inline std::unordered_set<word_entry> get_word_entry_set(id_type word_id) const;
-    inline std::unordered_set<word_entry> get_word_entry_set_unsafe(id_type word_id) const;
-    inline const std::unordered_set<word_entry>& get_word_entry_set_cref(id_type word_id) const;
-    inline const std::unordered_set<word_entry>& get_word_entry_set_cref_unsafe(id_type word_id) const;
-    inline const std::unordered_set<word_entry>* get_word_entry_set_cp(id_type word_id) const;
-    inline const std::unordered_set<word_entry>* get_word_entry_set_cp_unsafe(id_type word_id) const;
+    // Returns true if file_positions are exactly the positions of word_id inside file_id
+    inline bool has_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) const;
+    inline bool has_file_positions_unsafe(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) const;
+
+    // Delete the word entries of every file for which is_erased(file_id) is true from the posting list of word_id, at once.
+    // Does NOT erases the posting list itself, even if it becomes empty
+    template <typename predicate_type>
+    inline void erase_files_if(id_type word_id, predicate_type&& is_erased);
+    template <typename predicate_type>
+    inline void erase_files_if_unsafe(id_type word_id, predicate_type&& is_erased);
+
+    // Give back the memory the posting lists reserved to grow
+    inline void shrink_to_fit();
+    inline void shrink_to_fit_unsafe();
+
+    // Delete the posting lists (and the bitmaps) that became empty since the last call (an erase_files_if or a clear_for_word_and_file
+    // took their last file), if they are still empty. Returns the IDs of their words
+    inline std::vector<id_type> erase_empty_posting_lists();
+    inline std::vector<id_type> erase_empty_posting_lists_unsafe();
 
-    inline std::unordered_set<id_type> get_file_set(id_type word_id) const;
-    inline std::unordered_set<id_type> get_file_set_unsafe(id_type word_id) const;
-    inline const std::unordered_set<id_type>& get_file_set_cref(id_type word_id) const;
-    inline const std::unordered_set<id_type>& get_file_set_cref_unsafe(id_type word_id) const;
-    inline const std::unordered_set<id_type>* get_file_set_cp(id_type word_id) const;
-    inline const std::unordered_set<id_type>* get_file_set_cp_unsafe(id_type word_id) const;
+    inline const posting_list_type& get_posting_list_cref(id_type word_id) const;
+    inline const posting_list_type& get_posting_list_cref_unsafe(id_type word_id) const;
+    inline const posting_list_type* get_posting_list_cp(id_type word_id) const;
+    inline const posting_list_type* get_posting_list_cp_unsafe(id_type word_id) const;
+
+    // Sorted IDs of the files that contain word_id
+    inline std::vector<id_type> get_file_set(id_type word_id) const;
+    inline std::vector<id_type> get_file_set_unsafe(id_type word_id) const;
+
+    // Bitmap of the files that contain word_id, or nullptr if the word is in too few files to have one
+    inline const roaring_bitmap* get_file_set_bitmap_cp(id_type word_id) const;
+    inline const roaring_bitmap* get_file_set_bitmap_cp_unsafe(id_type word_id) const;
 
     inline bool has_id(id_type word_id) const;
     inline bool has_id_unsafe(id_type word_id) const;
 
+    // Calls function(word_id, word_entries) for every posting list, in no particular order
+    template <typename function_type>
+    inline void for_each_posting_list(function_type&& function) const;
+    template <typename function_type>
+    inline void for_each_posting_list_unsafe(function_type&& function) const;
+
+    // Words present in at least this amount of files get their file set mirrored as a bitmap:
+    // conjunctive searches over common words become bitmap ANDs, rare words are fast to merge as they are
+    static constexpr std::size_t min_files_for_bitmap = posting_block_size;
+
+private:
+    inline void add_file_to_bitmap_unsafe(id_type word_id, const posting_list_type& word_entries, id_type file_id);
+
 private:
-    // key - word ID, value - un_set of word entries
-    using inverted_map_entries = std::unordered_map<id_type, std::unordered_set<word_entry>>;
-    // key - word ID, value - un_set of file IDs
-    using inverted_map = std::unordered_map<id_type, std::unordered_set<id_type>>;
+    // key - word ID, value - posting list of the word (its word entries together with its sorted file IDs)
+    using inverted_map_entries = std::unordered_map<id_type, posting_list_type>;
+    // key - word ID, value - bitmap of file IDs (only for the words present in at least min_files_for_bitmap files)
+    using inverted_map = std::unordered_map<id_type, roaring_bitmap>;
 
     mutable read_write_lock rw_lock;
     inverted_map_entries word_entries_map;
     inverted_map word_map;
+
+    std::unordered_set<id_type> emptied_word_ids; // Words whose posting lists became empty since the last erase_empty_posting_lists
 };
 
 // empty
@@ -93,7 +138,7 @@ inline bool inverted_index::empty() const {
 }
 
 inline bool inverted_index::empty_unsafe() const {
-    return word_map.empty(); // same as word_entries_map.empty()
+    return word_entries_map.empty();
 }
 
 // size
@@ -103,49 +148,27 @@ inline std::size_t inverted_index::size() const {
 }
 
 inline std::size_t inverted_index::size_unsafe() const {
-    return word_map.size(); // same as word_entries_map.size()
+    return word_entries_map.size();
 }
 
-// empty_word_set
-inline bool inverted_index::empty_word_entry_set(id_type word_id) const {
+// empty_posting_list
+inline bool inverted_index::empty_posting_list(id_type word_id) const {
     read_lock r_lock(rw_lock);
-    return empty_word_entry_set_unsafe(word_id);
+    return empty_posting_list_unsafe(word_id);
 }
 
-inline bool inverted_index::empty_word_entry_set_unsafe(id_type word_id) const {
-    auto it = word_entries_map.find(word_id);
-    if (it == word_entries_map.end()) {
-        throw std::out_of_range("Word ID not found.");
-    }
-    return it->second.empty();
+inline bool inverted_index::empty_posting_list_unsafe(id_type word_id) const {
+    return get_posting_list_cref_unsafe(word_id).empty();
 }
 
-// empty_file_set
-inline bool inverted_index::empty_file_set(id_type word_id) const {
+// size_posting_list
+inline std::size_t inverted_index::size_posting_list(id_type word_id) const {
     read_lock r_lock(rw_lock);
-    return empty_file_set_unsafe(word_id);
+    return size_posting_list_unsafe(word_id);
 }
 
-inline bool inverted_index::empty_file_set_unsafe(id_type word_id) const {
-    auto it = word_map.find(word_id);
-    if (it == word_map.end()) {
-        throw std::out_of_range("Word ID not found.");
-    }
-    return it->second.empty();
-}
-
-// size_word_set
-inline std::size_t inverted_index::size_word_entry_set(id_type word_id) const {
-    read_lock r_lock(rw_lock);
-    return size_word_entry_set_unsafe(word_id);
-}
-
-inline std::size_t inverted_index::size_word_entry_set_unsafe(id_type word_id) const {
-    auto it = word_entries_map.find(word_id);
-    if (it == word_entries_map.end()) {
-        throw std::out_of_range("Word ID not found.");
-    }
-    return it->second.size();
+inline std::size_t inverted_index::size_posting_list_unsafe(id_type word_id) const {
+    return get_posting_list_cref_unsafe(word_id).size();
 }
 
 // size_file_set
@@ -155,11 +178,7 @@ inline std::size_t inverted_index::size_file_set(id_type word_id) const {
 }
 
 inline std::size_t inverted_index::size_file_set_unsafe(id_type word_id) const {
-    auto it = word_map.find(word_id);
-    if (it == word_map.end()) {
-        throw std::out_of_range("Word ID not found.");
-    }
-    return it->second.size();
+    return get_posting_list_cref_unsafe(word_id).file_count();
 }
 
 // clear
@@ -171,6 +190,7 @@ inline void inverted_index::clear() {
 inline void inverted_index::clear_unsafe() {
     word_entries_map.clear();
     word_map.clear();
+    emptied_word_ids.clear();
 }
 
 // add_word_entry
@@ -180,33 +200,50 @@ inline void inverted_index::add_word_entry(id_type word_id, const word_entry& si
 }
 
 inline void inverted_index::add_word_entry_unsafe(id_type word_id, const word_entry& single_word_entry) {
-    word_entries_map[word_id].insert(single_word_entry);
-    word_map[word_id].insert(single_word_entry.file_id);
+    auto& word_entries = word_entries_map[word_id];
+    std::size_t files_amount = word_entries.file_count();
+
+    word_entries.add(single_word_entry);
+    if (word_entries.file_count() != files_amount) {
+        add_file_to_bitmap_unsafe(word_id, word_entries, single_word_entry.file_id);
+    }
 }
 
-// add_word_entry_set
-inline void inverted_index::add_word_entry_set(id_type word_id, const std::unordered_set<word_entry>& word_entries) {
+// add_file_positions
+inline void inverted_index::add_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) {
     write_lock w_lock(rw_lock);
-    add_word_entry_set_unsafe(word_id, word_entries);
+    add_file_positions_unsafe(word_id, file_id, file_positions);
 }
 
-inline void inverted_index::add_word_entry_set_unsafe(id_type word_id, const std::unordered_set<word_entry>& word_entries) {
-    for (const auto& entry : word_entries) {
-        word_map[word_id].insert(entry.file_id);
+inline void inverted_index::add_file_positions_unsafe(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) {
+    auto& word_entries = word_entries_map[word_id];
+    std::size_t files_amount = word_entries.file_count();
+
+    word_entries.add_file(file_id, file_positions);
+    if (word_entries.file_count() != files_amount) {
+        add_file_to_bitmap_unsafe(word_id, word_entries, file_id);
     }
-    word_entries_map[word_id].insert(std::begin(word_entries), std::end(word_entries));
 }
 
-inline void inverted_index::add_word_entry_set(id_type word_id, std::unordered_set<word_entry>&& word_entries) {
+// add_posting_list
+inline void inverted_index::add_posting_list(id_type word_id, const posting_list_type& word_entries) {
     write_lock w_lock(rw_lock);
-    add_word_entry_set_unsafe(word_id, std::move(word_entries));
+    add_posting_list_unsafe(word_id, word_entries);
 }
 
-inline void inverted_index::add_word_entry_set_unsafe(id_type word_id, std::unordered_set<word_entry>&& word_entries) {
-    for (const auto& entry : word_entries) {
-        word_map[word_id].insert(entry.file_id);
+inline void inverted_index::add_posting_list_unsafe(id_type word_id, const posting_list_type& word_entries) {
+    word_entries_map[word_id] = word_entries;
+    word_map.erase(word_id);
+
+    if (word_entries.file_count() < min_files_for_bitmap) {
+        return;
+    }
+
+    roaring_bitmap& file_bitmap = word_map[word_id];
+    for (auto files = word_entries.get_file_cursor(); !files.at_end(); files.next()) {
+        file_bitmap.add(files.file_id());
     }
-    word_entries_map[word_id].merge(word_entries);
+    file_bitmap.run_optimize();
 }
 
 // clear_for_word_and_file
@@ -221,90 +258,209 @@ inline void inverted_index::clear_for_word_and_file_unsafe(id_type word_id, id_t
         throw std::out_of_range("Word ID not found.");
     }
 
-    auto& entry_set = it->second;
-    std::erase_if(entry_set, [file_id](const word_entry& entry) {
-        return entry.file_id == file_id;
-    });
+    if (it->second.erase_file(file_id)) {
+        // The bitmap is kept even if the word falls below min_files_for_bitmap
+        auto bitmap_it = word_map.find(word_id);
+        if (bitmap_it != word_map.end()) {
+            bitmap_it->second.remove(file_id);
+        }
+
+        if (it->second.empty()) {
+            emptied_word_ids.insert(word_id);
+        }
+    }
+}
+
+// erase_files_if
+template <typename predicate_type>
+inline void inverted_index::erase_files_if(id_type word_id, predicate_type&& is_erased) {
+    write_lock w_lock(rw_lock);
+    erase_files_if_unsafe(word_id, std::forward<predicate_type>(is_erased));
+}
+
+template <typename predicate_type>
+inline void inverted_index::erase_files_if_unsafe(id_type word_id, predicate_type&& is_erased) {
+    auto it = word_entries_map.find(word_id);
+    if (it == word_entries_map.end()) {
+        throw std::out_of_range("Word ID not found.");
+    }
+
+    auto bitmap_it = word_map.find(word_id);
+    it->second.erase_files_if([&](id_type file_id) {
+        if (!is_erased(file_id)) {
+            return false;
+        }
+
+        if (bitmap_it != word_map.end()) {
+            bitmap_it->second.remove(file_id);
+        }
+        return true;
+        }
+    );
+
+    if (it->second.empty()) {
+        emptied_word_ids.insert(word_id);
+    }
+}
 
-    word_map[word_id].erase(file_id);
+// shrink_to_fit
+inline void inverted_index::shrink_to_fit() {
+    write_lock w_lock(rw_lock);
+    shrink_to_fit_unsafe();
 }
 
-// get_word_entry_set
-inline std::unordered_set<word_entry> inverted_index::get_word_entry_set(id_type word_id) const {
-    return get_word_entry_set_cref(word_id);
+inline void inverted_index::shrink_to_fit_unsafe() {
+    for (auto& [word_id, word_entries] : word_entries_map) {
+        word_entries.shrink_to_fit();
+    }
 }
 
-inline std::unordered_set<word_entry> inverted_index::get_word_entry_set_unsafe(id_type word_id) const {
-    return get_word_entry_set_cref_unsafe(word_id);
+// erase_empty_posting_lists
+inline std::vector<id_type> inverted_index::erase_empty_posting_lists() {
+    write_lock w_lock(rw_lock);
+    return erase_empty_posting_lists_unsafe();
 }
 
-inline const std::unordered_set<word_entry>& inverted_index::get_word_entry_set_cref(id_type word_id) const {
+inline std::vector<id_type> inverted_index::erase_empty_posting_lists_unsafe() {
+    std::vector<id_type> erased_word_ids;
+
+    // A word may have got files again since its posting list became empty
+    for (const auto word_id : emptied_word_ids) {
+        auto it = word_entries_map.find(word_id);
+        if (it != word_entries_map.end() && it->second.empty()) {
+            word_entries_map.erase(it);
+            word_map.erase(word_id);
+            erased_word_ids.push_back(word_id);
+        }
+    }
+    emptied_word_ids.clear();
+
+    return erased_word_ids;
+}
+
+// has_file_positions
+inline bool inverted_index::has_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) const {
     read_lock r_lock(rw_lock);
-    return get_word_entry_set_cref_unsafe(word_id);
+    return has_file_positions_unsafe(word_id, file_id, file_positions);
 }
 
-inline const std::unordered_set<word_entry>& inverted_index::get_word_entry_set_cref_unsafe(id_type word_id) const {
+inline bool inverted_index::has_file_positions_unsafe(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) const {
     auto it = word_entries_map.find(word_id);
     if (it == word_entries_map.end()) {
-        throw std::out_of_range("Word ID not found.");
+        return false;
     }
-    return it->second;
+
+    auto files = it->second.get_file_cursor();
+    files.advance_to(file_id);
+    if (files.at_end() || files.file_id() != file_id || files.positions_amount() != file_positions.size()) {
+        return false;
+    }
+
+    std::size_t position_idx = 0;
+    bool same_positions = true;
+    files.for_each_position([&](id_type position) {
+        same_positions = same_positions && position == file_positions[position_idx++];
+        }
+    );
+    return same_positions;
 }
 
-inline const std::unordered_set<word_entry>* inverted_index::get_word_entry_set_cp(id_type word_id) const {
+// get_posting_list
+inline const posting_list_type& inverted_index::get_posting_list_cref(id_type word_id) const {
     read_lock r_lock(rw_lock);
-    return get_word_entry_set_cp_unsafe(word_id);
+    return get_posting_list_cref_unsafe(word_id);
 }
 
-inline const std::unordered_set<word_entry>* inverted_index::get_word_entry_set_cp_unsafe(id_type word_id) const {
+inline const posting_list_type& inverted_index::get_posting_list_cref_unsafe(id_type word_id) const {
     auto it = word_entries_map.find(word_id);
     if (it == word_entries_map.end()) {
         throw std::out_of_range("Word ID not found.");
     }
-    return &it->second;
+    return it->second;
 }
 
-// get_file_set
-inline std::unordered_set<id_type> inverted_index::get_file_set(id_type word_id) const {
-    return get_file_set_cref(word_id);
+inline const posting_list_type* inverted_index::get_posting_list_cp(id_type word_id) const {
+    read_lock r_lock(rw_lock);
+    return get_posting_list_cp_unsafe(word_id);
 }
 
-inline std::unordered_set<id_type> inverted_index::get_file_set_unsafe(id_type word_id) const {
-    return get_file_set_cref_unsafe(word_id);
+inline const posting_list_type* inverted_index::get_posting_list_cp_unsafe(id_type word_id) const {
+    return &get_posting_list_cref_unsafe(word_id);
 }
 
-inline const std::unordered_set<id_type>& inverted_index::get_file_set_cref(id_type word_id) const {
+// get_file_set
+inline std::vector<id_type> inverted_index::get_file_set(id_type word_id) const {
     read_lock r_lock(rw_lock);
-    return get_file_set_cref_unsafe(word_id);
+    return get_file_set_unsafe(word_id);
 }
 
-inline const std::unordered_set<id_type>& inverted_index::get_file_set_cref_unsafe(id_type word_id) const {
-    auto it = word_map.find(word_id);
-    if (it == word_map.end()) {
-        throw std::out_of_range("Word ID not found.");
+inline std::vector<id_type> inverted_index::get_file_set_unsafe(id_type word_id) const {
+    const posting_list_type& word_postings = get_posting_list_cref_unsafe(word_id);
+
+    std::vector<id_type> file_ids;
+    file_ids.reserve(word_postings.file_count());
+
+    for (auto files = word_postings.get_file_cursor(); !files.at_end(); files.next()) {
+        file_ids.push_back(files.file_id());
     }
-    return it->second;
+    return file_ids;
 }
 
-inline const std::unordered_set<id_type>* inverted_index::get_file_set_cp(id_type word_id) const {
+// get_file_set_bitmap
+inline const roaring_bitmap* inverted_index::get_file_set_bitmap_cp(id_type word_id) const {
     read_lock r_lock(rw_lock);
-    return get_file_set_cp_unsafe(word_id);
+    return get_file_set_bitmap_cp_unsafe(word_id);
 }
 
-inline const std::unordered_set<id_type>* inverted_index::get_file_set_cp_unsafe(id_type word_id) const {
+inline const roaring_bitmap* inverted_index::get_file_set_bitmap_cp_unsafe(id_type word_id) const {
     auto it = word_map.find(word_id);
-    if (it == word_map.end()) {
-        throw std::out_of_range("Word ID not found.");
-    }
-    return &it->second;
+    return it != word_map.end() ? &it->second : nullptr;
 }
 
 // has_id
 inline bool inverted_index::has_id(id_type word_id) const {
     read_lock r_lock(rw_lock);
-    has_id_unsafe(word_id);
+    return has_id_unsafe(word_id);
 }
 
 inline bool inverted_index::has_id_unsafe(id_type word_id) const {
-    return word_map.find(word_id) != word_map.end();
+    return word_entries_map.find(word_id) != word_entries_map.end();
+}
+
+// for_each_posting_list
+template <typename function_type>
+inline void inverted_index::for_each_posting_list(function_type&& function) const {
+    read_lock r_lock(rw_lock);
+    for_each_posting_list_unsafe(std::forward<function_type>(function));
+}
+
+template <typename function_type>
+inline void inverted_index::for_each_posting_list_unsafe(function_type&& function) const {
+    for (const auto& [word_id, word_entries] : word_entries_map) {
+        function(word_id, word_entries);
+    }
+}
+
+// add_file_to_bitmap_unsafe
+inline void inverted_index::add_file_to_bitmap_unsafe(id_type word_id, const posting_list_type& word_entries, id_type file_id) {
+    auto it = word_map.find(word_id);
+    if (it != word_map.end()) {
+        it->second.add(file_id);
+
+        // Files mostly come with consecutive IDs, so the containers are periodically compacted into runs
+        if (word_entries.file_count() % min_files_for_bitmap == 0) {
+            it->second.run_optimize();
+        }
+        return;
+    }
+
+    if (word_entries.file_count() < min_files_for_bitmap) {
+        return;
+    }
+
+    roaring_bitmap& file_bitmap = word_map[word_id];
+    for (auto files = word_entries.get_file_cursor(); !files.at_end(); files.next()) {
+        file_bitmap.add(files.file_id());
+    }
+    file_bitmap.run_optimize();
 }
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <condition_variable>
+
+#include "concurrent_utility.h"
+#include "inline_task.h"
+
+// Threads that do the blocking network I/O of the classic accept() loop, so the workers of rw_scheduled_thread_pool
+// only get the index work and never wait for a slow client. The server has two of them: one receives the whole requests
+// and the other sends the whole responses, so a response never waits behind the clients that are slow to send their requests.
+// The tasks are started in the order they are added
+class io_thread_pool {
+public:
+    inline io_thread_pool() = default;
+    inline ~io_thread_pool() { terminate(); }
+
+    inline io_thread_pool(const io_thread_pool& other) = delete;
+    inline io_thread_pool(io_thread_pool&& other) = delete;
+    inline io_thread_pool& operator=(const io_thread_pool& rhs) = delete;
+    inline io_thread_pool& operator=(io_thread_pool&& rhs) = delete;
+
+public:
+    inline void initialize(std::size_t thread_count);
+    // The tasks added before are done first
+    inline void terminate();
+
+    inline bool working() const;
+    inline bool working_unsafe() const;
+
+    // Returns false (and destroys the task) if the pool isn't working
+    template <typename task_t>
+    inline bool add_task(task_t&& task);
+
+private:
+    inline void routine();
+
+private:
+    mutable read_write_lock             rw_lock;
+    std::condition_variable_any         cv_task_waiter;
+    std::vector<std::thread>            threads;
+    std::queue<inline_task>             tasks;
+
+    bool initialized = false;
+    bool terminated = false;
+};
+
+
+inline void io_thread_pool::initialize(std::size_t thread_count) {
+    write_lock w_lock(rw_lock);
+
+    if (initialized || terminated || thread_count == 0) {
+        return;
+    }
+
+    threads.reserve(thread_count);
+    for (std::size_t id = 0; id < thread_count; ++id) {
+        threads.emplace_back(&io_thread_pool::routine, this);
+    }
+
+    initialized = true;
+}
+
+inline void io_thread_pool::terminate() {
+    {
+        write_lock w_lock(rw_lock);
+
+        if (!working_unsafe()) {
+            return;
+        }
+        terminated = true;
+    }
+
+    cv_task_waiter.notify_all();
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    write_lock w_lock(rw_lock);
+
+    threads.clear();
+
+    initialized = false;
+    terminated = false;
+}
+
+inline bool io_thread_pool::working() const {
+    read_lock r_lock(rw_lock);
+    return working_unsafe();
+}
+
+inline bool io_thread_pool::working_unsafe() const {
+    return initialized && !terminated;
+}
+
+template <typename task_t>
+inline bool io_thread_pool::add_task(task_t&& task) {
+    inline_task new_task(std::forward<task_t>(task));
+
+    {
+        write_lock w_lock(rw_lock);
+        if (!working_unsafe()) {
+            return false;
+        }
+
+        tasks.emplace(std::move(new_task));
+    }
+
+    cv_task_waiter.notify_one();
+    return true;
+}
+
+inline void io_thread_pool::routine() {
+    while (true) {
+        inline_task task;
+
+        {
+            write_lock w_lock(rw_lock);
+
+            // A terminated pool still does all the queued tasks
+            cv_task_waiter.wait(w_lock, [this] { return !tasks.empty() || terminated; });
+
+            if (tasks.empty()) {
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+
+        task();
+    }
+}
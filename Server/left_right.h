@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+
+// ===============================================================================================================
+// Left-right concurrency control: two instances of T, the readers use one of them while the writer modifies the other.
+// A reader never waits and never takes a lock: it marks itself in the read indicator of the current version
+// (a counter per thread slot, so readers on different threads don't share a cache line), reads which instance
+// is published and uses it until its read_guard is destroyed. A writer (the writers are serialized by a mutex):
+//     1. applies the modification to the instance that is not published;
+//     2. publishes it with a single atomic store, the new readers go there;
+//     3. waits until no reader can still be using the old instance (two read indicators that take turns,
+//        as in epoch-based reclamation, so that a steady stream of new readers can't starve the writer);
+//     4. applies the same modification to the old instance, the two are equal again.
+// The modification must be deterministic: applied to two equal instances, it must leave them equal.
+// The price is two copies of T and every modification applied twice, both out of the readers' way.
+// ===============================================================================================================
+
+template <typename T>
+class left_right {
+public:
+    class read_guard;
+
+    inline left_right() = default;
+    inline ~left_right() = default;
+
+    inline left_right(const left_right& other) = delete;
+    inline left_right(left_right&& other) = delete;
+    inline left_right& operator=(const left_right& rhs) = delete;
+    inline left_right& operator=(left_right&& rhs) = delete;
+
+public:
+    // Pin the published instance until the guard is destroyed. Never blocks
+    inline read_guard read() const;
+
+    // Apply function(T&) to both instances in turn, publishing the modified one in between.
+    // Returns the result of the first application. Blocks until the readers of the old instance are done with it,
+    // so it must not be called by a thread that holds a read_guard itself
+    template <typename function_type>
+    inline auto modify(function_type&& function) -> decltype(function(std::declval<T&>()));
+
+private:
+    static constexpr std::size_t reader_slots = 64;
+
+    struct alignas(64) reader_counter {
+        std::atomic<std::size_t> readers = 0;
+    };
+
+    struct read_indicator {
+        reader_counter slots[reader_slots];
+
+        inline void arrive(std::size_t slot) { slots[slot].readers.fetch_add(1); }
+        inline void depart(std::size_t slot) { slots[slot].readers.fetch_sub(1); }
+        inline bool empty() const;
+    };
+
+    // Slot of the calling thread in the read indicators, assigned round-robin on its first read
+    inline static std::size_t get_reader_slot();
+
+    inline void wait_for_readers(std::size_t indicator_idx) const;
+
+    T instances[2];
+    mutable read_indicator read_indicators[2];
+
+    std::atomic<std::size_t> published_instance_idx = 0;
+    std::atomic<std::size_t> current_indicator_idx = 0;
+
+    std::mutex writer_mutex;
+};
+
+template <typename T>
+class left_right<T>::read_guard {
+public:
+    inline read_guard() = default;
+    inline ~read_guard() { release(); }
+
+    inline read_guard(const read_guard& other) = delete;
+    inline read_guard& operator=(const read_guard& rhs) = delete;
+
+    inline read_guard(read_guard&& other) noexcept
+        : p_indicator(std::exchange(other.p_indicator, nullptr)), slot(other.slot), p_instance(std::exchange(other.p_instance, nullptr)) {}
+
+    inline read_guard& operator=(read_guard&& rhs) noexcept {
+        if (this != &rhs) {
+            release();
+            p_indicator = std::exchange(rhs.p_indicator, nullptr);
+            slot = rhs.slot;
+            p_instance = std::exchange(rhs.p_instance, nullptr);
+        }
+        return *this;
+    }
+
+    inline const T& operator*() const { return *p_instance; }
+    inline const T* operator->() const { return p_instance; }
+
+    // Unpin the instance before the guard is destroyed
+    inline void release() {
+        if (p_indicator != nullptr) {
+            p_indicator->depart(slot);
+            p_indicator = nullptr;
+            p_instance = nullptr;
+        }
+    }
+
+private:
+    friend class left_right<T>;
+
+    inline read_guard(read_indicator* p_indicator, std::size_t slot, const T* p_instance)
+        : p_indicator(p_indicator), slot(slot), p_instance(p_instance) {}
+
+    read_indicator* p_indicator = nullptr;
+    std::size_t slot = 0;
+    const T* p_instance = nullptr;
+};
+
+// read
+template <typename T>
+inline typename left_right<T>::read_guard left_right<T>::read() const {
+    std::size_t slot = get_reader_slot();
+
+    read_indicator* p_indicator = &read_indicators[current_indicator_idx.load()];
+    p_indicator->arrive(slot);
+
+    const T* p_instance = &instances[published_instance_idx.load()];
+    return read_guard(p_indicator, slot, p_instance);
+}
+
+// modify
+template <typename T>
+template <typename function_type>
+inline auto left_right<T>::modify(function_type&& function) -> decltype(function(std::declval<T&>())) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+
+    std::size_t old_instance_idx = published_instance_idx.load();
+    std::size_t new_instance_idx = 1 - old_instance_idx;
+
+    auto publish_and_catch_up = [&]() {
+        published_instance_idx.store(new_instance_idx);
+
+        // Readers that arrived at the old indicator may have seen the old instance. New readers are sent to the other indicator,
+        // once its stragglers from the previous modification are gone, and then the old indicator drains
+        std::size_t old_indicator_idx = current_indicator_idx.load();
+        std::size_t new_indicator_idx = 1 - old_indicator_idx;
+
+        wait_for_readers(new_indicator_idx);
+        current_indicator_idx.store(new_indicator_idx);
+        wait_for_readers(old_indicator_idx);
+
+        function(instances[old_instance_idx]);
+    };
+
+    if constexpr (std::is_void_v<decltype(function(std::declval<T&>()))>) {
+        function(instances[new_instance_idx]);
+        publish_and_catch_up();
+    }
+    else {
+        auto result = function(instances[new_instance_idx]);
+        publish_and_catch_up();
+        return result;
+    }
+}
+
+// read_indicator::empty
+template <typename T>
+inline bool left_right<T>::read_indicator::empty() const {
+    for (const auto& counter : slots) {
+        if (counter.readers.load() != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// get_reader_slot
+template <typename T>
+inline std::size_t left_right<T>::get_reader_slot() {
+    static std::atomic<std::size_t> next_slot = 0;
+    thread_local std::size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % reader_slots;
+    return slot;
+}
+
+// wait_for_readers
+template <typename T>
+inline void left_right<T>::wait_for_readers(std::size_t indicator_idx) const {
+    while (!read_indicators[indicator_idx].empty()) {
+        std::this_thread::yield();
+    }
+}
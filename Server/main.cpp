@@ -3,8 +3,23 @@
 #include <iostream>
 #include "server.h"
 #include <chrono>
+#ifdef __linux__
+#include <csignal>
+#include <pthread.h>
+#include <thread>
+#endif // __linux__
 int main(int argc, char* argv[]) {
     try {
+#ifdef __linux__
+        // SIGINT and SIGTERM stop the event loop, so that the server is destroyed properly (and saves its index).
+        // They are blocked before any thread starts: every thread inherits the mask, only the waiting thread receives them
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+#endif // __linux__
+
         server<string_type>::init_protocol();
         
         server<string_type> index_server;
@@ -16,6 +31,32 @@ int main(int argc, char* argv[]) {
 
         index_server.init_server(server_ip, server_port);
 
+#ifdef __linux__
+        // A few epoll threads do all the network I/O, the thread pool only gets complete requests
+        constexpr std::size_t reactor_threads = 2;
+
+        std::thread signal_thread([&index_server, stop_signals] {
+            int signal_number;
+            sigwait(&stop_signals, &signal_number);
+            index_server.terminate_event_loop();
+        });
+
+        // The signal thread is joined before the server is destroyed. If the event loop ended otherwise, a signal sent
+        // to the thread itself wakes it up (a thread that is already done just leaves it pending)
+        auto join_signal_thread = [&signal_thread] {
+            pthread_kill(signal_thread.native_handle(), SIGTERM);
+            signal_thread.join();
+        };
+
+        try {
+            index_server.run_event_loop(reactor_threads);
+        }
+        catch (...) {
+            join_signal_thread();
+            throw;
+        }
+        join_signal_thread();
+#else
         struct sockaddr_in client_address;
         int client_address_size = sizeof(client_address);
         SOCKET client_socket;
@@ -23,6 +64,7 @@ int main(int argc, char* argv[]) {
         while (client_socket = accept(index_server.get_socket(), (sockaddr*)&client_address, &client_address_size)) {
             index_server.on_client_accepted(client_socket);
         }
+#endif // __linux__
 
         server<string_type>::terminate_protocol();
     }
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <filesystem>
+#include <cstddef>
+#include <utility>
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif // WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+
+#ifdef max
+#undef max
+#endif // max
+
+#ifdef min
+#undef min
+#endif // min
+
+#else // POSIX
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#endif // _WIN32
+
+// A whole file mapped into memory read-only. Nothing is read up front: the pages come in from the page cache
+// (or the disk) on the first access to them, and untouched parts of the file cost nothing
+class mapped_file {
+public:
+    inline mapped_file() = default;
+    inline ~mapped_file() { close(); }
+
+    inline mapped_file(const mapped_file& other) = delete;
+    inline mapped_file& operator=(const mapped_file& rhs) = delete;
+
+    inline mapped_file(mapped_file&& other) noexcept { *this = std::move(other); }
+    inline mapped_file& operator=(mapped_file&& rhs) noexcept;
+
+public:
+    // Returns false if the file can't be opened or mapped (an empty file is never mapped)
+    inline bool open(const std::filesystem::path& file_path);
+    inline void close();
+
+    inline bool is_open() const { return p_data != nullptr; }
+
+    inline const std::byte* data() const { return p_data; }
+    inline std::size_t size() const { return data_size; }
+
+private:
+    const std::byte* p_data = nullptr;
+    std::size_t data_size = 0;
+
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif // _WIN32
+};
+
+// operator=
+inline mapped_file& mapped_file::operator=(mapped_file&& rhs) noexcept {
+    if (this != &rhs) {
+        close();
+        p_data = std::exchange(rhs.p_data, nullptr);
+        data_size = std::exchange(rhs.data_size, 0);
+#ifdef _WIN32
+        file_handle = std::exchange(rhs.file_handle, INVALID_HANDLE_VALUE);
+        mapping_handle = std::exchange(rhs.mapping_handle, nullptr);
+#endif // _WIN32
+    }
+    return *this;
+}
+
+// open
+inline bool mapped_file::open(const std::filesystem::path& file_path) {
+    close();
+
+#ifdef _WIN32
+    file_handle = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+        close();
+        return false;
+    }
+
+    mapping_handle = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle == nullptr) {
+        close();
+        return false;
+    }
+
+    p_data = static_cast<const std::byte*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (p_data == nullptr) {
+        close();
+        return false;
+    }
+    data_size = static_cast<std::size_t>(file_size.QuadPart);
+#else
+    int file_descriptor = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_descriptor == -1) {
+        return false;
+    }
+
+    struct stat file_status;
+    if (::fstat(file_descriptor, &file_status) == -1 || file_status.st_size == 0) {
+        ::close(file_descriptor);
+        return false;
+    }
+
+    void* p_mapping = ::mmap(nullptr, static_cast<std::size_t>(file_status.st_size), PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    ::close(file_descriptor); // The mapping keeps the file itself
+
+    if (p_mapping == MAP_FAILED) {
+        return false;
+    }
+
+    // The file is mostly read front to back: let the kernel read ahead
+    ::madvise(p_mapping, static_cast<std::size_t>(file_status.st_size), MADV_SEQUENTIAL);
+
+    p_data = static_cast<const std::byte*>(p_mapping);
+    data_size = static_cast<std::size_t>(file_status.st_size);
+#endif // _WIN32
+
+    return true;
+}
+
+// close
+inline void mapped_file::close() {
+#ifdef _WIN32
+    if (p_data != nullptr) {
+        UnmapViewOfFile(p_data);
+    }
+    if (mapping_handle != nullptr) {
+        CloseHandle(mapping_handle);
+        mapping_handle = nullptr;
+    }
+    if (file_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_handle);
+        file_handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (p_data != nullptr) {
+        ::munmap(const_cast<std::byte*>(p_data), data_size);
+    }
+#endif // _WIN32
+
+    p_data = nullptr;
+    data_size = 0;
+}
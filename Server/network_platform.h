@@ -0,0 +1,78 @@
+#pragma once
+
+// ==============================================================
+// Thin portability layer over WinSock2 and POSIX (BSD) sockets.
+// The rest of the server keeps using the WinSock names.
+// ==============================================================
+
+#ifdef _WIN32
+
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+
+#include <WinSock2.h>
+#include <WinBase.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+#ifdef max
+#undef max
+#endif // max
+
+#ifdef min
+#undef min
+#endif // min
+
+constexpr int socket_send_flags = 0;
+
+#else // POSIX
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+using SOCKET = int;
+
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int SOCKET_ERROR = -1;
+
+constexpr int SD_BOTH = SHUT_RDWR;
+
+// Don't let a client that closed its end early kill the whole process with SIGPIPE
+constexpr int socket_send_flags = MSG_NOSIGNAL;
+
+inline int closesocket(SOCKET socket) {
+    return ::close(socket);
+}
+
+// Returns true on success
+inline bool set_socket_non_blocking(SOCKET socket) {
+    int flags = ::fcntl(socket, F_GETFL, 0);
+    return flags != -1 && ::fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+#endif // _WIN32
+
+#include <chrono>
+
+// A recv or send on the socket that waits longer than its timeout fails. A zero timeout waits forever.
+// Returns true on success
+inline bool set_socket_timeouts(SOCKET socket, std::chrono::milliseconds receive_timeout, std::chrono::milliseconds send_timeout) {
+    auto set_timeout = [socket](int option, std::chrono::milliseconds timeout) {
+#ifdef _WIN32
+        DWORD timeout_value = static_cast<DWORD>(timeout.count());
+#else
+        struct timeval timeout_value;
+        timeout_value.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+        timeout_value.tv_usec = static_cast<suseconds_t>(timeout.count() % 1000 * 1000);
+#endif // _WIN32
+        return setsockopt(socket, SOL_SOCKET, option, reinterpret_cast<const char*>(&timeout_value), sizeof(timeout_value)) == 0;
+    };
+
+    return set_timeout(SO_RCVTIMEO, receive_timeout) && set_timeout(SO_SNDTIMEO, send_timeout);
+}
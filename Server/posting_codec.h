@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <bit>
+#include "project_types.h"
+
+// ===============================================================================================================
+// Integer codec for compressed posting lists.
+// Values are split into blocks of posting_block_size. A full block is bit-packed with the smallest bit width
+// that fits its largest value, in 4 interleaved lanes (value i goes to lane i % 4), so the unpacking loop does
+// the same shifts for 4 neighbouring 32-bit words at a time and is vectorized by the compiler (SSE2 / NEON).
+// The last, not yet full block is variable-byte encoded (7 bits per byte, the high bit marks continuation).
+// ===============================================================================================================
+
+constexpr std::size_t posting_block_size = 128;
+constexpr std::size_t posting_block_lanes = 4;
+
+// Bits needed for the largest of the values (0 if all of them are 0)
+inline std::uint8_t get_required_bit_width(const id_type* values, std::size_t count) {
+    id_type mask = 0;
+    for (std::size_t idx = 0; idx < count; ++idx) {
+        mask |= values[idx];
+    }
+    return static_cast<std::uint8_t>(std::bit_width(mask));
+}
+
+// Size of a packed block in bytes
+inline constexpr std::size_t get_packed_block_size(std::uint8_t bit_width) {
+    return bit_width * posting_block_size / 8;
+}
+
+// Append posting_block_size values packed with bit_width bits each to out
+inline void pack_block(const id_type* values, std::uint8_t bit_width, std::vector<std::uint8_t>& out) {
+    constexpr std::size_t lane_values = posting_block_size / posting_block_lanes;
+
+    std::uint32_t words[32 * posting_block_lanes] = {};
+    for (std::size_t value_idx = 0; value_idx < lane_values; ++value_idx) {
+        std::size_t bit = value_idx * bit_width;
+        std::size_t word_idx = bit / 32;
+        std::size_t shift = bit % 32;
+
+        for (std::size_t lane = 0; lane < posting_block_lanes; ++lane) {
+            std::uint32_t value = values[value_idx * posting_block_lanes + lane];
+            words[word_idx * posting_block_lanes + lane] |= value << shift;
+            if (shift + bit_width > 32) {
+                words[(word_idx + 1) * posting_block_lanes + lane] |= value >> (32 - shift);
+            }
+        }
+    }
+
+    std::size_t packed_size = get_packed_block_size(bit_width);
+    std::size_t old_size = out.size();
+    out.resize(old_size + packed_size);
+    std::memcpy(out.data() + old_size, words, packed_size);
+}
+
+// Unpack posting_block_size values packed with bit_width bits each into out_values
+inline void unpack_block(const std::uint8_t* data, std::uint8_t bit_width, id_type* out_values) {
+    constexpr std::size_t lane_values = posting_block_size / posting_block_lanes;
+
+    if (bit_width == 0) {
+        std::memset(out_values, 0, posting_block_size * sizeof(id_type));
+        return;
+    }
+
+    std::uint32_t words[32 * posting_block_lanes] = {};
+    std::memcpy(words, data, get_packed_block_size(bit_width));
+
+    const std::uint32_t mask = bit_width == 32 ? ~std::uint32_t(0) : (std::uint32_t(1) << bit_width) - 1;
+    for (std::size_t value_idx = 0; value_idx < lane_values; ++value_idx) {
+        std::size_t bit = value_idx * bit_width;
+        std::size_t word_idx = bit / 32;
+        std::size_t shift = bit % 32;
+        bool crosses_word = shift + bit_width > 32;
+
+        for (std::size_t lane = 0; lane < posting_block_lanes; ++lane) {
+            std::uint32_t value = words[word_idx * posting_block_lanes + lane] >> shift;
+            if (crosses_word) {
+                value |= words[(word_idx + 1) * posting_block_lanes + lane] << (32 - shift);
+            }
+            out_values[value_idx * posting_block_lanes + lane] = value & mask;
+        }
+    }
+}
+
+// Append a variable-byte encoded value to out
+inline void write_varbyte(id_type value, std::vector<std::uint8_t>& out) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+// Read a variable-byte encoded value, moving data past it
+inline id_type read_varbyte(const std::uint8_t*& data) {
+    id_type value = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        std::uint8_t byte = *data++;
+        value |= static_cast<id_type>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include "project_types.h"
+#include "word_entry.h"
+
+// Galloping (exponential) search: the first element of [first, last) for which predicate is false,
+// predicate being true for a prefix of the range. Probes first[0], first[1], first[3], first[7], ... and then
+// binary searches the last step, so an answer d elements away costs O(log d) instead of O(log(last - first))
+template <typename iterator_type, typename predicate_type>
+inline iterator_type galloping_partition_point(iterator_type first, iterator_type last, predicate_type&& predicate) {
+    const auto range_size = std::distance(first, last);
+
+    decltype(std::distance(first, last)) step_begin = 0;
+    decltype(std::distance(first, last)) step_end = 1;
+    while (step_end <= range_size && predicate(*std::next(first, step_end - 1))) {
+        step_begin = step_end;
+        step_end *= 2;
+    }
+
+    return std::partition_point(std::next(first, step_begin), std::next(first, std::min(step_end - 1, range_size)), predicate);
+}
+
+// All the word entries of a single word, stored as sorted (file_id, position) runs in contiguous vectors, grouped per file:
+//     file_ids  - ascending IDs of the files that contain the word;
+//     offsets   - offsets[i] .. offsets[i + 1] is the range of positions of file_ids[i] (offsets.size() == file_ids.size() + 1);
+//     positions - ascending positions of the word inside each file, all the files back to back.
+// A posting costs 4 bytes for its position plus 8 bytes per file (its ID and offset), i.e. 8 bytes or less per posting.
+class posting_list {
+public:
+    class file_cursor;
+    class const_iterator;
+
+    inline posting_list() : offsets(1, 0) {}
+
+public:
+    inline bool empty() const;
+
+    // Get the amount of word entries
+    inline std::size_t size() const;
+
+    // Get the amount of files that contain the word
+    inline std::size_t file_count() const;
+
+    inline void clear();
+
+    // Append a single word entry. This is a plain push_back when the entries come in ascending order
+    // (a newly indexed file gets the largest file ID, the positions in it grow), otherwise it is inserted in its place.
+    inline void add(const word_entry& single_word_entry);
+
+    // Add all the positions of the word inside file_id at once. file_positions must be sorted in ascending order.
+    // Costs a single insertion into the vectors (or a plain append for the newest file)
+    inline void add_file(id_type file_id, const std::vector<id_type>& file_positions);
+
+    // Delete all the word entries with the specified file_id. Returns true if there were any
+    inline bool erase_file(id_type file_id);
+
+    // Delete the word entries of every file for which is_erased(file_id) is true, in a single pass over the vectors.
+    // Returns the amount of the erased files
+    template <typename predicate_type>
+    inline std::size_t erase_files_if(predicate_type&& is_erased);
+
+    // Give back the memory the erased entries left behind
+    inline void shrink_to_fit();
+
+    // Sorted IDs of the files that contain the word
+    inline const std::vector<id_type>& get_file_ids() const;
+
+    // Sorted positions of the word inside the file with index file_idx in get_file_ids()
+    inline std::span<const id_type> get_positions(std::size_t file_idx) const;
+
+    // Call function(position) for every position of the word inside the file with index file_idx in get_file_ids(), in ascending order
+    template <typename function_type>
+    inline void for_each_position(std::size_t file_idx, function_type&& function) const;
+
+    // Returns the index of file_id in get_file_ids(), or file_count() if the word is not in the file
+    inline std::size_t find_file(id_type file_id) const;
+
+    // Cursor over the files that contain the word, in ascending file ID order
+    inline file_cursor get_file_cursor() const;
+
+    // Iteration over all the word entries in (file_id, position) order
+    inline const_iterator begin() const;
+    inline const_iterator end() const;
+
+private:
+    std::vector<id_type> file_ids;
+    std::vector<id_type> offsets;
+    std::vector<id_type> positions;
+};
+
+class posting_list::file_cursor {
+public:
+    inline file_cursor() = default;
+    inline explicit file_cursor(const posting_list* list) : list(list) {}
+
+    inline bool at_end() const { return list == nullptr || file_idx >= list->file_count(); }
+    inline id_type file_id() const { return list->file_ids[file_idx]; }
+    inline std::size_t positions_amount() const { return list->offsets[file_idx + 1] - list->offsets[file_idx]; }
+
+    inline void next() { ++file_idx; }
+
+    // Move to the first file with an ID not less than target_file_id (or to the end), galloping from the current file
+    inline void advance_to(id_type target_file_id) {
+        if (at_end() || file_id() >= target_file_id) {
+            return;
+        }
+
+        const auto& file_ids = list->file_ids;
+        auto target_file = galloping_partition_point(std::begin(file_ids) + file_idx, std::end(file_ids),
+            [target_file_id](id_type file_id) { return file_id < target_file_id; });
+        file_idx = target_file - std::begin(file_ids);
+    }
+
+    // Call function(position) for every position of the word inside the current file, in ascending order
+    template <typename function_type>
+    inline void for_each_position(function_type&& function) const {
+        list->for_each_position(file_idx, std::forward<function_type>(function));
+    }
+
+private:
+    const posting_list* list = nullptr;
+    std::size_t file_idx = 0;
+};
+
+class posting_list::const_iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = word_entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = word_entry;
+
+    inline const_iterator() = default;
+    inline const_iterator(const posting_list* list, std::size_t file_idx, std::size_t position_idx)
+        : list(list), file_idx(file_idx), position_idx(position_idx) {}
+
+    inline word_entry operator*() const {
+        return word_entry(list->file_ids[file_idx], list->positions[position_idx]);
+    }
+
+    inline const_iterator& operator++() {
+        if (++position_idx == list->offsets[file_idx + 1]) {
+            ++file_idx;
+        }
+        return *this;
+    }
+
+    inline const_iterator operator++(int) {
+        const_iterator old = *this;
+        ++(*this);
+        return old;
+    }
+
+    inline bool operator==(const const_iterator& rhs) const { return position_idx == rhs.position_idx; }
+    inline bool operator!=(const const_iterator& rhs) const { return position_idx != rhs.position_idx; }
+
+private:
+    const posting_list* list = nullptr;
+    std::size_t file_idx = 0;
+    std::size_t position_idx = 0;
+};
+
+// empty
+inline bool posting_list::empty() const {
+    return positions.empty();
+}
+
+// size
+inline std::size_t posting_list::size() const {
+    return positions.size();
+}
+
+// file_count
+inline std::size_t posting_list::file_count() const {
+    return file_ids.size();
+}
+
+// clear
+inline void posting_list::clear() {
+    file_ids.clear();
+    offsets.assign(1, 0);
+    positions.clear();
+}
+
+// add
+inline void posting_list::add(const word_entry& single_word_entry) {
+    if (file_ids.empty() || single_word_entry.file_id > file_ids.back()) {
+        file_ids.push_back(single_word_entry.file_id);
+        positions.push_back(single_word_entry.position);
+        offsets.push_back(static_cast<id_type>(positions.size()));
+        return;
+    }
+
+    if (single_word_entry.file_id == file_ids.back() && single_word_entry.position > positions.back()) {
+        positions.push_back(single_word_entry.position);
+        ++offsets.back();
+        return;
+    }
+
+    add_file(single_word_entry.file_id, { single_word_entry.position });
+}
+
+// add_file
+inline void posting_list::add_file(id_type file_id, const std::vector<id_type>& file_positions) {
+    if (file_positions.empty()) {
+        return;
+    }
+
+    auto file_it = std::lower_bound(std::begin(file_ids), std::end(file_ids), file_id);
+    std::size_t file_idx = file_it - std::begin(file_ids);
+
+    auto range_begin = std::begin(positions) + offsets[file_idx];
+    std::size_t added_amount = file_positions.size();
+
+    if (file_it != std::end(file_ids) && *file_it == file_id) {
+        // The file is already present: merge the positions, dropping the duplicates
+        auto range_end = std::begin(positions) + offsets[file_idx + 1];
+
+        std::vector<id_type> merged;
+        merged.reserve((range_end - range_begin) + file_positions.size());
+        std::set_union(range_begin, range_end, std::begin(file_positions), std::end(file_positions), std::back_inserter(merged));
+
+        added_amount = merged.size() - (range_end - range_begin);
+        range_begin = positions.erase(range_begin, range_end);
+        positions.insert(range_begin, std::begin(merged), std::end(merged));
+    }
+    else {
+        positions.insert(range_begin, std::begin(file_positions), std::end(file_positions));
+        id_type file_offset = offsets[file_idx];
+        file_ids.insert(file_it, file_id);
+        offsets.insert(std::begin(offsets) + file_idx + 1, file_offset);
+    }
+
+    for (std::size_t idx = file_idx + 1; idx < offsets.size(); ++idx) {
+        offsets[idx] += static_cast<id_type>(added_amount);
+    }
+}
+
+// erase_file
+inline bool posting_list::erase_file(id_type file_id) {
+    std::size_t file_idx = find_file(file_id);
+    if (file_idx == file_count()) {
+        return false;
+    }
+
+    id_type erased_amount = offsets[file_idx + 1] - offsets[file_idx];
+    positions.erase(std::begin(positions) + offsets[file_idx], std::begin(positions) + offsets[file_idx + 1]);
+    file_ids.erase(std::begin(file_ids) + file_idx);
+    offsets.erase(std::begin(offsets) + file_idx + 1);
+
+    for (std::size_t idx = file_idx + 1; idx < offsets.size(); ++idx) {
+        offsets[idx] -= erased_amount;
+    }
+
+    return true;
+}
+
+// erase_files_if
+template <typename predicate_type>
+inline std::size_t posting_list::erase_files_if(predicate_type&& is_erased) {
+    // The kept files move towards the front, so nothing is read after it was overwritten
+    std::size_t kept_amount = 0;
+    id_type kept_offset = 0;
+
+    for (std::size_t file_idx = 0; file_idx < file_ids.size(); ++file_idx) {
+        id_type range_begin = offsets[file_idx];
+        id_type range_end = offsets[file_idx + 1];
+        if (is_erased(file_ids[file_idx])) {
+            continue;
+        }
+
+        if (kept_offset != range_begin) {
+            std::copy(std::begin(positions) + range_begin, std::begin(positions) + range_end, std::begin(positions) + kept_offset);
+        }
+        file_ids[kept_amount] = file_ids[file_idx];
+        offsets[kept_amount] = kept_offset;
+        kept_offset += range_end - range_begin;
+        ++kept_amount;
+    }
+
+    std::size_t erased_amount = file_ids.size() - kept_amount;
+    file_ids.resize(kept_amount);
+    offsets.resize(kept_amount + 1);
+    offsets[kept_amount] = kept_offset;
+    positions.resize(kept_offset);
+
+    return erased_amount;
+}
+
+// shrink_to_fit
+inline void posting_list::shrink_to_fit() {
+    file_ids.shrink_to_fit();
+    offsets.shrink_to_fit();
+    positions.shrink_to_fit();
+}
+
+// get_file_ids
+inline const std::vector<id_type>& posting_list::get_file_ids() const {
+    return file_ids;
+}
+
+// get_positions
+inline std::span<const id_type> posting_list::get_positions(std::size_t file_idx) const {
+    return std::span<const id_type>(positions.data() + offsets[file_idx], offsets[file_idx + 1] - offsets[file_idx]);
+}
+
+// for_each_position
+template <typename function_type>
+inline void posting_list::for_each_position(std::size_t file_idx, function_type&& function) const {
+    for (const auto position : get_positions(file_idx)) {
+        function(position);
+    }
+}
+
+// find_file
+inline std::size_t posting_list::find_file(id_type file_id) const {
+    auto file_it = std::lower_bound(std::begin(file_ids), std::end(file_ids), file_id);
+    if (file_it == std::end(file_ids) || *file_it != file_id) {
+        return file_count();
+    }
+    return file_it - std::begin(file_ids);
+}
+
+// get_file_cursor
+inline posting_list::file_cursor posting_list::get_file_cursor() const {
+    return file_cursor(this);
+}
+
+// begin / end
+inline posting_list::const_iterator posting_list::begin() const {
+    return const_iterator(this, 0, 0);
+}
+
+inline posting_list::const_iterator posting_list::end() const {
+    return const_iterator(this, file_count(), size());
+}
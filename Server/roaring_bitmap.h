@@ -0,0 +1,724 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <bit>
+#include <utility>
+#include "project_types.h"
+
+// ===============================================================================================================
+// Compressed bitmap of id_type values (Roaring bitmap).
+// A value is split into its high 16 bits (the key of a container) and its low 16 bits (stored in the container).
+// Every container picks the smallest of three representations:
+//     array  - sorted low values, 2 bytes per value, while there are at most 4096 of them;
+//     bitmap - 65536 bits (8 KB) for the denser containers;
+//     run    - (start, length) pairs of consecutive values, 4 bytes per run (see run_optimize).
+// AND / OR / ANDNOT of two bitmaps only combine the containers with equal keys. Bitmap containers are combined
+// 64 bits at a time in plain loops over the words, which the compiler vectorizes, array containers are merged.
+// ===============================================================================================================
+
+class roaring_bitmap {
+public:
+    inline roaring_bitmap() = default;
+
+public:
+    inline bool empty() const;
+
+    // Get the amount of values in the bitmap
+    inline std::size_t cardinality() const;
+
+    inline void clear();
+
+    // Returns true if the value was not present before
+    inline bool add(id_type value);
+
+    // Returns true if the value was present
+    inline bool remove(id_type value);
+
+    inline bool contains(id_type value) const;
+
+    // Convert every container to the smallest of its representations, including runs.
+    // Only additions that extend or merge runs keep a run container, so call it after the bulk of additions
+    inline void run_optimize();
+
+    // AND: keep only the values also present in rhs
+    inline roaring_bitmap& operator&=(const roaring_bitmap& rhs);
+    // OR: add all the values of rhs
+    inline roaring_bitmap& operator|=(const roaring_bitmap& rhs);
+    // ANDNOT: remove all the values present in rhs
+    inline roaring_bitmap& and_not(const roaring_bitmap& rhs);
+
+    // Call function(value) for every value in ascending order
+    template <typename function_type>
+    inline void for_each(function_type&& function) const;
+
+    // Append all the values to out_values in ascending order
+    inline void to_vector(std::vector<id_type>& out_values) const;
+
+private:
+    class container;
+
+    // Index of the container with the key or the index where such container should be inserted
+    inline std::size_t find_container(std::uint16_t key) const;
+
+    std::vector<std::uint16_t> keys;
+    std::vector<container> containers;
+};
+
+inline roaring_bitmap operator&(const roaring_bitmap& lhs, const roaring_bitmap& rhs);
+inline roaring_bitmap operator|(const roaring_bitmap& lhs, const roaring_bitmap& rhs);
+
+class roaring_bitmap::container {
+public:
+    enum class container_type : std::uint8_t {
+        array,
+        bitmap,
+        run,
+    };
+
+    static constexpr std::size_t max_array_cardinality = 4096;
+    static constexpr std::size_t bitmap_words = 65536 / 64;
+    static constexpr std::size_t max_runs = 2048; // A run container of max_runs takes as much memory as a bitmap
+
+public:
+    inline bool empty() const { return cardinality == 0; }
+    inline std::size_t size() const { return cardinality; }
+
+    inline bool contains(std::uint16_t value) const;
+    inline bool add(std::uint16_t value);
+    inline bool remove(std::uint16_t value);
+
+    template <typename function_type>
+    inline void for_each(function_type&& function) const;
+
+    // Convert to the smallest representation
+    inline void optimize();
+
+    inline static container intersect(const container& lhs, const container& rhs);
+    inline static container unite(const container& lhs, const container& rhs);
+    inline static container subtract(const container& lhs, const container& rhs);
+
+private:
+    inline void to_array();
+    inline void to_bitmap();
+    inline void to_runs();
+    // After an operation on bitmaps: count the values and fall back to an array if there are few of them
+    inline void recount_bitmap();
+
+    inline std::size_t count_runs() const;
+    // Index of the last run that starts not after value, or the amount of runs if there's none
+    inline std::size_t find_run(std::uint16_t value) const;
+
+    inline std::uint16_t run_start(std::size_t run_idx) const { return values[2 * run_idx]; }
+    inline std::uint16_t run_length(std::size_t run_idx) const { return values[2 * run_idx + 1]; } // The run covers start .. start + length
+    inline std::size_t run_amount() const { return values.size() / 2; }
+
+    inline bool test_bit(std::uint16_t value) const { return (words[value / 64] >> (value % 64)) & 1; }
+
+private:
+    container_type type = container_type::array;
+    std::uint32_t cardinality = 0;
+    std::vector<std::uint16_t> values; // array: sorted values, run: (start, length) pairs
+    std::vector<std::uint64_t> words;  // bitmap
+};
+
+// container::contains
+inline bool roaring_bitmap::container::contains(std::uint16_t value) const {
+    switch (type) {
+    case container_type::array:
+        return std::binary_search(std::begin(values), std::end(values), value);
+    case container_type::bitmap:
+        return test_bit(value);
+    default: {
+        std::size_t run_idx = find_run(value);
+        return run_idx != run_amount() && value - run_start(run_idx) <= run_length(run_idx);
+    }
+    }
+}
+
+// container::add
+inline bool roaring_bitmap::container::add(std::uint16_t value) {
+    switch (type) {
+    case container_type::array: {
+        auto it = std::lower_bound(std::begin(values), std::end(values), value);
+        if (it != std::end(values) && *it == value) {
+            return false;
+        }
+
+        values.insert(it, value);
+        if (++cardinality > max_array_cardinality) {
+            to_bitmap();
+            optimize();
+        }
+        return true;
+    }
+    case container_type::bitmap: {
+        std::uint64_t bit = std::uint64_t(1) << (value % 64);
+        if (words[value / 64] & bit) {
+            return false;
+        }
+
+        words[value / 64] |= bit;
+        ++cardinality;
+        return true;
+    }
+    default: {
+        std::size_t run_idx = find_run(value);
+        std::size_t next_run_idx = run_idx == run_amount() ? 0 : run_idx + 1;
+
+        if (run_idx != run_amount()) {
+            std::uint32_t run_end = run_start(run_idx) + run_length(run_idx);
+            if (value <= run_end) {
+                return false;
+            }
+
+            if (value == run_end + 1) {
+                ++values[2 * run_idx + 1];
+                // The run now touches the next one: merge them
+                if (next_run_idx < run_amount() && run_start(next_run_idx) == value + 1) {
+                    values[2 * run_idx + 1] += run_length(next_run_idx) + 1;
+                    values.erase(std::begin(values) + 2 * next_run_idx, std::begin(values) + 2 * next_run_idx + 2);
+                }
+                ++cardinality;
+                return true;
+            }
+        }
+
+        if (next_run_idx < run_amount() && run_start(next_run_idx) == value + 1) {
+            --values[2 * next_run_idx];
+            ++values[2 * next_run_idx + 1];
+        }
+        else {
+            std::uint16_t run[2] = { value, 0 };
+            values.insert(std::begin(values) + 2 * next_run_idx, std::begin(run), std::end(run));
+        }
+
+        ++cardinality;
+        if (run_amount() > max_runs) {
+            to_bitmap();
+        }
+        return true;
+    }
+    }
+}
+
+// container::remove
+inline bool roaring_bitmap::container::remove(std::uint16_t value) {
+    switch (type) {
+    case container_type::array: {
+        auto it = std::lower_bound(std::begin(values), std::end(values), value);
+        if (it == std::end(values) || *it != value) {
+            return false;
+        }
+
+        values.erase(it);
+        --cardinality;
+        return true;
+    }
+    case container_type::bitmap: {
+        std::uint64_t bit = std::uint64_t(1) << (value % 64);
+        if ((words[value / 64] & bit) == 0) {
+            return false;
+        }
+
+        words[value / 64] &= ~bit;
+        if (--cardinality <= max_array_cardinality) {
+            to_array();
+        }
+        return true;
+    }
+    default: {
+        std::size_t run_idx = find_run(value);
+        if (run_idx == run_amount() || value - run_start(run_idx) > run_length(run_idx)) {
+            return false;
+        }
+
+        std::uint16_t start = run_start(run_idx);
+        std::uint16_t end = start + run_length(run_idx);
+
+        if (start == end) {
+            values.erase(std::begin(values) + 2 * run_idx, std::begin(values) + 2 * run_idx + 2);
+        }
+        else if (value == start) {
+            ++values[2 * run_idx];
+            --values[2 * run_idx + 1];
+        }
+        else if (value == end) {
+            --values[2 * run_idx + 1];
+        }
+        else {
+            // Split the run in two
+            values[2 * run_idx + 1] = value - start - 1;
+            std::uint16_t run[2] = { static_cast<std::uint16_t>(value + 1), static_cast<std::uint16_t>(end - value - 1) };
+            values.insert(std::begin(values) + 2 * run_idx + 2, std::begin(run), std::end(run));
+        }
+
+        --cardinality;
+        if (run_amount() > max_runs) {
+            to_bitmap();
+        }
+        return true;
+    }
+    }
+}
+
+// container::for_each
+template <typename function_type>
+inline void roaring_bitmap::container::for_each(function_type&& function) const {
+    switch (type) {
+    case container_type::array:
+        for (const auto value : values) {
+            function(value);
+        }
+        break;
+    case container_type::bitmap:
+        for (std::size_t word_idx = 0; word_idx < bitmap_words; ++word_idx) {
+            for (std::uint64_t word = words[word_idx]; word != 0; word &= word - 1) {
+                function(static_cast<std::uint16_t>(word_idx * 64 + std::countr_zero(word)));
+            }
+        }
+        break;
+    default:
+        for (std::size_t run_idx = 0; run_idx < run_amount(); ++run_idx) {
+            std::uint32_t run_end = run_start(run_idx) + run_length(run_idx);
+            for (std::uint32_t value = run_start(run_idx); value <= run_end; ++value) {
+                function(static_cast<std::uint16_t>(value));
+            }
+        }
+        break;
+    }
+}
+
+// container::optimize
+inline void roaring_bitmap::container::optimize() {
+    std::size_t array_bytes = cardinality <= max_array_cardinality ? cardinality * sizeof(std::uint16_t) : SIZE_MAX;
+    std::size_t bitmap_bytes = bitmap_words * sizeof(std::uint64_t);
+    std::size_t run_bytes = count_runs() * 2 * sizeof(std::uint16_t);
+
+    if (run_bytes < array_bytes && run_bytes < bitmap_bytes) {
+        to_runs();
+    }
+    else if (array_bytes <= bitmap_bytes) {
+        to_array();
+    }
+    else {
+        to_bitmap();
+    }
+}
+
+// container::intersect
+inline roaring_bitmap::container roaring_bitmap::container::intersect(const container& lhs, const container& rhs) {
+    container result;
+
+    if (lhs.type == container_type::array && rhs.type == container_type::array) {
+        const auto& smaller = lhs.cardinality <= rhs.cardinality ? lhs.values : rhs.values;
+        const auto& larger = lhs.cardinality <= rhs.cardinality ? rhs.values : lhs.values;
+
+        // Very different sizes: binary search the values of the smaller array in the larger one instead of merging
+        if (smaller.size() * 32 < larger.size()) {
+            auto from = std::begin(larger);
+            for (const auto value : smaller) {
+                from = std::lower_bound(from, std::end(larger), value);
+                if (from == std::end(larger)) {
+                    break;
+                }
+                if (*from == value) {
+                    result.values.push_back(value);
+                }
+            }
+        }
+        else {
+            std::set_intersection(std::begin(smaller), std::end(smaller), std::begin(larger), std::end(larger), std::back_inserter(result.values));
+        }
+
+        result.cardinality = static_cast<std::uint32_t>(result.values.size());
+        return result;
+    }
+
+    if (lhs.type == container_type::array || rhs.type == container_type::array) {
+        const container& array = lhs.type == container_type::array ? lhs : rhs;
+        const container& other = lhs.type == container_type::array ? rhs : lhs;
+
+        for (const auto value : array.values) {
+            if (other.contains(value)) {
+                result.values.push_back(value);
+            }
+        }
+
+        result.cardinality = static_cast<std::uint32_t>(result.values.size());
+        return result;
+    }
+
+    container lhs_bitmap = lhs;
+    container rhs_bitmap = rhs;
+    lhs_bitmap.to_bitmap();
+    rhs_bitmap.to_bitmap();
+
+    result.type = container_type::bitmap;
+    result.words.resize(bitmap_words);
+    for (std::size_t word_idx = 0; word_idx < bitmap_words; ++word_idx) {
+        result.words[word_idx] = lhs_bitmap.words[word_idx] & rhs_bitmap.words[word_idx];
+    }
+
+    result.recount_bitmap();
+    return result;
+}
+
+// container::unite
+inline roaring_bitmap::container roaring_bitmap::container::unite(const container& lhs, const container& rhs) {
+    container result;
+
+    if (lhs.type == container_type::array && rhs.type == container_type::array) {
+        std::set_union(std::begin(lhs.values), std::end(lhs.values), std::begin(rhs.values), std::end(rhs.values), std::back_inserter(result.values));
+        result.cardinality = static_cast<std::uint32_t>(result.values.size());
+
+        if (result.cardinality > max_array_cardinality) {
+            result.to_bitmap();
+        }
+        return result;
+    }
+
+    container rhs_bitmap = rhs;
+    result = lhs;
+    result.to_bitmap();
+    rhs_bitmap.to_bitmap();
+
+    for (std::size_t word_idx = 0; word_idx < bitmap_words; ++word_idx) {
+        result.words[word_idx] |= rhs_bitmap.words[word_idx];
+    }
+
+    result.recount_bitmap();
+    return result;
+}
+
+// container::subtract
+inline roaring_bitmap::container roaring_bitmap::container::subtract(const container& lhs, const container& rhs) {
+    container result;
+
+    if (lhs.type == container_type::array) {
+        for (const auto value : lhs.values) {
+            if (!rhs.contains(value)) {
+                result.values.push_back(value);
+            }
+        }
+
+        result.cardinality = static_cast<std::uint32_t>(result.values.size());
+        return result;
+    }
+
+    container rhs_bitmap = rhs;
+    result = lhs;
+    result.to_bitmap();
+    rhs_bitmap.to_bitmap();
+
+    for (std::size_t word_idx = 0; word_idx < bitmap_words; ++word_idx) {
+        result.words[word_idx] &= ~rhs_bitmap.words[word_idx];
+    }
+
+    result.recount_bitmap();
+    return result;
+}
+
+// container::to_array
+inline void roaring_bitmap::container::to_array() {
+    if (type == container_type::array) {
+        return;
+    }
+
+    std::vector<std::uint16_t> array_values;
+    array_values.reserve(cardinality);
+    for_each([&array_values](std::uint16_t value) {
+        array_values.push_back(value);
+    });
+
+    type = container_type::array;
+    values = std::move(array_values);
+    words = std::vector<std::uint64_t>();
+}
+
+// container::to_bitmap
+inline void roaring_bitmap::container::to_bitmap() {
+    if (type == container_type::bitmap) {
+        return;
+    }
+
+    std::vector<std::uint64_t> bitmap(bitmap_words, 0);
+    for_each([&bitmap](std::uint16_t value) {
+        bitmap[value / 64] |= std::uint64_t(1) << (value % 64);
+    });
+
+    type = container_type::bitmap;
+    words = std::move(bitmap);
+    values = std::vector<std::uint16_t>();
+}
+
+// container::to_runs
+inline void roaring_bitmap::container::to_runs() {
+    if (type == container_type::run) {
+        return;
+    }
+
+    std::vector<std::uint16_t> runs;
+    runs.reserve(count_runs() * 2);
+    for_each([&runs](std::uint16_t value) {
+        if (!runs.empty() && runs[runs.size() - 2] + runs.back() + 1 == value) {
+            ++runs.back();
+        }
+        else {
+            runs.push_back(value);
+            runs.push_back(0);
+        }
+    });
+
+    type = container_type::run;
+    values = std::move(runs);
+    words = std::vector<std::uint64_t>();
+}
+
+// container::recount_bitmap
+inline void roaring_bitmap::container::recount_bitmap() {
+    std::uint32_t bits = 0;
+    for (std::size_t word_idx = 0; word_idx < bitmap_words; ++word_idx) {
+        bits += std::popcount(words[word_idx]);
+    }
+
+    cardinality = bits;
+    if (cardinality <= max_array_cardinality) {
+        to_array();
+    }
+}
+
+// container::count_runs
+inline std::size_t roaring_bitmap::container::count_runs() const {
+    switch (type) {
+    case container_type::array: {
+        std::size_t runs = 0;
+        for (std::size_t idx = 0; idx < values.size(); ++idx) {
+            if (idx == 0 || values[idx] != values[idx - 1] + 1) {
+                ++runs;
+            }
+        }
+        return runs;
+    }
+    case container_type::bitmap: {
+        // A run starts at every set bit whose lower neighbour is not set
+        std::size_t runs = 0;
+        std::uint64_t carry = 0;
+        for (std::size_t word_idx = 0; word_idx < bitmap_words; ++word_idx) {
+            std::uint64_t word = words[word_idx];
+            runs += std::popcount(word & ~((word << 1) | carry));
+            carry = word >> 63;
+        }
+        return runs;
+    }
+    default:
+        return run_amount();
+    }
+}
+
+// container::find_run
+inline std::size_t roaring_bitmap::container::find_run(std::uint16_t value) const {
+    std::size_t low = 0;
+    std::size_t high = run_amount();
+    while (low < high) {
+        std::size_t middle = (low + high) / 2;
+        if (run_start(middle) <= value) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low == 0 ? run_amount() : low - 1;
+}
+
+// empty
+inline bool roaring_bitmap::empty() const {
+    return containers.empty();
+}
+
+// cardinality
+inline std::size_t roaring_bitmap::cardinality() const {
+    std::size_t values_amount = 0;
+    for (const auto& values_container : containers) {
+        values_amount += values_container.size();
+    }
+    return values_amount;
+}
+
+// clear
+inline void roaring_bitmap::clear() {
+    keys.clear();
+    containers.clear();
+}
+
+// add
+inline bool roaring_bitmap::add(id_type value) {
+    std::uint16_t key = static_cast<std::uint16_t>(value >> 16);
+    std::size_t container_idx = find_container(key);
+
+    if (container_idx == keys.size() || keys[container_idx] != key) {
+        keys.insert(std::begin(keys) + container_idx, key);
+        containers.insert(std::begin(containers) + container_idx, container());
+    }
+
+    return containers[container_idx].add(static_cast<std::uint16_t>(value));
+}
+
+// remove
+inline bool roaring_bitmap::remove(id_type value) {
+    std::uint16_t key = static_cast<std::uint16_t>(value >> 16);
+    std::size_t container_idx = find_container(key);
+
+    if (container_idx == keys.size() || keys[container_idx] != key) {
+        return false;
+    }
+
+    bool removed = containers[container_idx].remove(static_cast<std::uint16_t>(value));
+    if (containers[container_idx].empty()) {
+        keys.erase(std::begin(keys) + container_idx);
+        containers.erase(std::begin(containers) + container_idx);
+    }
+    return removed;
+}
+
+// contains
+inline bool roaring_bitmap::contains(id_type value) const {
+    std::uint16_t key = static_cast<std::uint16_t>(value >> 16);
+    std::size_t container_idx = find_container(key);
+
+    return container_idx != keys.size() && keys[container_idx] == key && containers[container_idx].contains(static_cast<std::uint16_t>(value));
+}
+
+// run_optimize
+inline void roaring_bitmap::run_optimize() {
+    for (auto& values_container : containers) {
+        values_container.optimize();
+    }
+}
+
+// operator&=
+inline roaring_bitmap& roaring_bitmap::operator&=(const roaring_bitmap& rhs) {
+    std::vector<std::uint16_t> result_keys;
+    std::vector<container> result_containers;
+
+    std::size_t lhs_idx = 0;
+    std::size_t rhs_idx = 0;
+    while (lhs_idx < keys.size() && rhs_idx < rhs.keys.size()) {
+        if (keys[lhs_idx] < rhs.keys[rhs_idx]) {
+            ++lhs_idx;
+        }
+        else if (keys[lhs_idx] > rhs.keys[rhs_idx]) {
+            ++rhs_idx;
+        }
+        else {
+            container intersection = container::intersect(containers[lhs_idx], rhs.containers[rhs_idx]);
+            if (!intersection.empty()) {
+                result_keys.push_back(keys[lhs_idx]);
+                result_containers.push_back(std::move(intersection));
+            }
+            ++lhs_idx;
+            ++rhs_idx;
+        }
+    }
+
+    keys = std::move(result_keys);
+    containers = std::move(result_containers);
+    return *this;
+}
+
+// operator|=
+inline roaring_bitmap& roaring_bitmap::operator|=(const roaring_bitmap& rhs) {
+    std::vector<std::uint16_t> result_keys;
+    std::vector<container> result_containers;
+
+    std::size_t lhs_idx = 0;
+    std::size_t rhs_idx = 0;
+    while (lhs_idx < keys.size() || rhs_idx < rhs.keys.size()) {
+        if (rhs_idx == rhs.keys.size() || (lhs_idx < keys.size() && keys[lhs_idx] < rhs.keys[rhs_idx])) {
+            result_keys.push_back(keys[lhs_idx]);
+            result_containers.push_back(std::move(containers[lhs_idx++]));
+        }
+        else if (lhs_idx == keys.size() || keys[lhs_idx] > rhs.keys[rhs_idx]) {
+            result_keys.push_back(rhs.keys[rhs_idx]);
+            result_containers.push_back(rhs.containers[rhs_idx++]);
+        }
+        else {
+            result_keys.push_back(keys[lhs_idx]);
+            result_containers.push_back(container::unite(containers[lhs_idx++], rhs.containers[rhs_idx++]));
+        }
+    }
+
+    keys = std::move(result_keys);
+    containers = std::move(result_containers);
+    return *this;
+}
+
+// and_not
+inline roaring_bitmap& roaring_bitmap::and_not(const roaring_bitmap& rhs) {
+    std::vector<std::uint16_t> result_keys;
+    std::vector<container> result_containers;
+
+    std::size_t rhs_idx = 0;
+    for (std::size_t lhs_idx = 0; lhs_idx < keys.size(); ++lhs_idx) {
+        while (rhs_idx < rhs.keys.size() && rhs.keys[rhs_idx] < keys[lhs_idx]) {
+            ++rhs_idx;
+        }
+
+        if (rhs_idx < rhs.keys.size() && rhs.keys[rhs_idx] == keys[lhs_idx]) {
+            container difference = container::subtract(containers[lhs_idx], rhs.containers[rhs_idx]);
+            if (!difference.empty()) {
+                result_keys.push_back(keys[lhs_idx]);
+                result_containers.push_back(std::move(difference));
+            }
+        }
+        else {
+            result_keys.push_back(keys[lhs_idx]);
+            result_containers.push_back(std::move(containers[lhs_idx]));
+        }
+    }
+
+    keys = std::move(result_keys);
+    containers = std::move(result_containers);
+    return *this;
+}
+
+// for_each
+template <typename function_type>
+inline void roaring_bitmap::for_each(function_type&& function) const {
+    for (std::size_t container_idx = 0; container_idx < keys.size(); ++container_idx) {
+        id_type high_bits = static_cast<id_type>(keys[container_idx]) << 16;
+        containers[container_idx].for_each([&function, high_bits](std::uint16_t low_bits) {
+            function(high_bits | low_bits);
+        });
+    }
+}
+
+// to_vector
+inline void roaring_bitmap::to_vector(std::vector<id_type>& out_values) const {
+    out_values.reserve(out_values.size() + cardinality());
+    for_each([&out_values](id_type value) {
+        out_values.push_back(value);
+    });
+}
+
+// find_container
+inline std::size_t roaring_bitmap::find_container(std::uint16_t key) const {
+    return std::lower_bound(std::begin(keys), std::end(keys), key) - std::begin(keys);
+}
+
+// operator&
+inline roaring_bitmap operator&(const roaring_bitmap& lhs, const roaring_bitmap& rhs) {
+    roaring_bitmap result = lhs;
+    result &= rhs;
+    return result;
+}
+
+// operator|
+inline roaring_bitmap operator|(const roaring_bitmap& lhs, const roaring_bitmap& rhs) {
+    roaring_bitmap result = lhs;
+    result |= rhs;
+    return result;
+}
@@ -1,10 +1,38 @@
 #pragma once
 
 #include <vector>
+#include <thread>
+#include <condition_variable>
+#include <memory>
 #include <functional>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
 
+#include "concurrent_utility.h"
 #include "concurrent_queue.h"
-
+#include "work_stealing_deque.h"
+#include "inline_task.h"
+
+// Runs the reader tasks and the writer tasks in turns, the phases. The workers only take the tasks of the current phase and,
+// unless can_interlap, only once the tasks of the other phase are done. The phases are switched by the scheduler thread,
+// which sleeps until something happens instead of for a fixed time. It switches to the other phase:
+//     - at once, if the current phase has no tasks queued and the other one has;
+//     - once the oldest queued task of the other phase has waited for the duration of the current phase. The durations are
+//       the staleness targets: the reader duration is how long the writer tasks may wait behind the readers, and the other way round.
+//       The deeper the queue of the other phase, the shorter the wait: the duration is divided by its amount of tasks per worker.
+//       The wait is counted from the start of the first task of the current phase at the earliest: a phase that still waits
+//       for the tasks of the previous one to finish is not switched away before any of its tasks ran
+//
+// Every worker has a work-stealing deque for each kind of task. A task added by a worker (a task spawned by a running one)
+// goes to its own deque and is most likely run next by the same worker; a task added by any other thread goes to the
+// injection queue of its kind. A worker without tasks of the current phase steals them from the deques of the others.
+// Neither adding nor taking a task locks the pool: the phase and the counters are atomics, the idle workers sleep on
+// an atomic epoch that is bumped for every task they may take. The lock of the pool only guards the settings and the scheduler.
+// A task is an inline_task, its captures are stored in the injection queue or in a deque node that the workers reuse,
+// so adding a task allocates nothing (unless its captures are too big to fit)
 class rw_scheduled_thread_pool {
 public:
     inline rw_scheduled_thread_pool() = default;
@@ -16,7 +44,8 @@ public:
     inline rw_scheduled_thread_pool& operator=(rw_scheduled_thread_pool&& rhs) = delete;
 
 public:
-    inline void initialize(std::size_t worker_count, float writer_duration = 0.5f, float reader_duration = 5.0f, bool can_rw_interlap = false, bool start_with_writers = false);
+    // The durations are in seconds
+    inline void initialize(std::size_t worker_count, float writer_duration = 0.05f, float reader_duration = 0.5f, bool can_rw_interlap = false, bool start_with_writers = false);
     inline void terminate(bool immediately = false);
 
     inline void set_paused(const bool paused);
@@ -25,51 +54,129 @@ public:
     inline bool working() const;
     inline bool working_unsafe() const;
 
+    // Return false if the new duration is less than min_duration
     inline bool set_reader_duration(float new_reader_duration);
     inline float get_reader_duration() const;
 
     inline bool set_writer_duration(float new_writer_duration);
     inline float get_writer_duration() const;
 
+    // Get the amount of the tasks waiting in the queues (not the running ones)
+    inline std::size_t size_reader_tasks() const;
+    inline std::size_t size_writer_tasks() const;
+
+    // The function is called by the scheduler thread at the end of every writer phase, once the writer tasks that ran are done:
+    // when the pool has switched to the readers, or when no writer tasks are left (the next ones start a new writer phase).
+    // It is called once more by terminate(), after the last tasks
+    inline void set_writer_phase_end_function(std::function<void()> function);
+
     template <typename task_t, typename... arguments>
     inline void add_reader_task(task_t&& task, arguments&&... parameters);
 
     template <typename task_t, typename... arguments>
     inline void add_writer_task(task_t&& task, arguments&&... parameters);
 
+    // Call function(task_idx) for every task_idx in [0, tasks_amount) and wait for all of them.
+    // Called by a task of a pool, the calls are shared with the other workers of that pool instead of new threads: helper tasks
+    // of the same kind as the calling one are added, each of them takes the next task_idx until none is left. The calling task
+    // takes them as well, so it only ever waits for the calls that a running helper has taken.
+    // Called by any other thread, it is the for_each_in_parallel of concurrent_utility.h
+    template <typename function_type>
+    static inline void for_each_in_parallel(std::size_t tasks_amount, function_type&& function);
+
+    static constexpr float min_duration = 0.01f;
+
 private:
+    using clock = std::chrono::steady_clock;
+    using task_type = inline_task;
+
+    // The tasks of one kind, readers or writers
+    struct task_class {
+        std::vector<std::unique_ptr<work_stealing_deque<task_type*>>> deques; // One per worker, of the nodes that hold the tasks
+        segmented_concurrent_queue<task_type> injected_tasks{ 256 };         // Added by the threads outside of the pool
+
+        alignas(64) std::atomic<std::size_t> queued = 0;  // In the deques and in injected_tasks, counted before they get there
+        alignas(64) std::atomic<std::size_t> running = 0; // The workers that run a task of the kind (or are about to take one)
+
+        // Since when the queued tasks have been waiting for their phase, clock::time_point::max() while it is the current one or has none
+        std::atomic<clock::time_point> waiting_since = clock::time_point::max();
+        // Since when a task of the kind has been running in the current phase, clock::time_point::max() until the first one starts
+        std::atomic<clock::time_point> running_since = clock::time_point::max();
+    };
+
+    // Of the worker that runs on the calling thread, if any (zero-initialized on the other threads)
+    struct worker_identity {
+        rw_scheduled_thread_pool* pool;
+        std::size_t idx;
+        bool is_writer; // The kind of the task it runs
+    };
+
+    static inline thread_local worker_identity this_worker;
+
+    // The nodes of the taken deque tasks, kept by the worker that took them for the next tasks it adds.
+    // Only the worker itself touches its spares
+    struct alignas(64) worker_spares {
+        std::vector<std::unique_ptr<task_type>> nodes;
+    };
+
+    static constexpr std::size_t max_spare_nodes = 256;
+
+    inline task_class& get_task_class(bool is_writer) { return is_writer ? writer_tasks : reader_tasks; }
+
     inline bool do_set_duration(float& target_duration, float new_duration);
 
     template <typename task_t, typename... arguments>
-    inline void do_add_task(concurrent_queue<std::function<void()>>& target_queue, task_t&& task, arguments&&... parameters);
+    inline void do_add_task(bool is_writer, task_t&& task, arguments&&... parameters);
 
-    inline void routine();
+    inline void routine(std::size_t worker_idx);
+    inline bool run_task(std::size_t worker_idx, bool is_writer);
+    inline bool take_task(std::size_t worker_idx, task_class& target_class, task_type& task);
+
+    inline task_type* make_task_node(std::size_t worker_idx, task_type&& task);
+    inline void take_task_from_node(std::size_t worker_idx, task_type* node, task_type& task);
+
+    template <typename task_t, typename... arguments>
+    static inline task_type make_task(task_t&& task, arguments&&... parameters);
+
+    inline void wake_worker();
+    inline void wake_all_workers();
+
+    inline void call_writer_phase_end_function();
 
 private:
     mutable read_write_lock                 rw_lock;
-    mutable std::condition_variable_any     cv_task_waiter;
     std::vector<std::thread>                workers;
 
-    concurrent_queue<std::function<void()>>	reader_tasks;
-    concurrent_queue<std::function<void()>>	writer_tasks;
+    task_class reader_tasks;
+    task_class writer_tasks;
+    std::vector<worker_spares> spare_task_nodes; // One per worker
+
+    // Bumped whenever there may be a task for the idle workers, they wait for it to change
+    alignas(64) std::atomic<std::uint32_t> wake_epoch = 0;
+    std::atomic<std::size_t> parked_workers = 0;
 
-    bool initialized = false;
-    bool terminated = false;
-    bool paused = false;
+    std::atomic<bool> initialized = false;
+    std::atomic<bool> terminated = false;
+    std::atomic<bool> paused = false;
+    std::atomic<bool> discarding = false; // terminate(true): the queued tasks are dropped instead of run
 
 private:
-    std::thread timer_thread;
-    std::condition_variable_any cv_timer_waiter;
+    std::thread scheduler_thread;
+    std::condition_variable_any cv_scheduler_waiter;
+    bool scheduler_notified = false;
 
-    bool can_interlap;
-    bool writer_flag;
-    std::size_t readers_counter = 0;
-    std::size_t writers_counter = 0;
+    bool can_interlap = false;
+    std::atomic<bool> writer_flag = false;
+    std::atomic<std::size_t> finished_writers_counter = 0; // Since the last end of a writer phase
 
-    float reader_duration;
-    float writer_duration;
+    float reader_duration = 0.5f;
+    float writer_duration = 0.05f;
 
-    inline void timer_function();
+    std::function<void()> writer_phase_end_function;
+
+    inline void scheduler_function();
+    inline void notify_scheduler();
+    inline void switch_phase_unsafe();
 };
 
 
@@ -80,21 +187,33 @@ inline void rw_scheduled_thread_pool::initialize(std::size_t worker_count, float
         return;
     }
 
-    workers.reserve(worker_count);
-    for (std::size_t id = 0; id < worker_count; ++id) {
-        workers.emplace_back(&rw_scheduled_thread_pool::routine, this);
+    if (worker_count == 0) {
+        return;
+    }
+
+    this->reader_duration = std::max(reader_duration, min_duration);
+    this->writer_duration = std::max(writer_duration, min_duration);
+    can_interlap = can_rw_interlap;
+    writer_flag = start_with_writers;
+    finished_writers_counter = 0;
+
+    for (task_class* target_class : { &reader_tasks, &writer_tasks }) {
+        target_class->waiting_since = clock::time_point::max();
+        target_class->running_since = clock::time_point::max();
+        for (std::size_t id = 0; id < worker_count; ++id) {
+            target_class->deques.push_back(std::make_unique<work_stealing_deque<task_type*>>());
+        }
     }
 
-    bool workers_not_empty = !workers.empty();
-    initialized = workers_not_empty;
+    spare_task_nodes.resize(worker_count);
 
-    if (workers_not_empty) {
-        timer_thread = std::thread(&rw_scheduled_thread_pool::timer_function, this);
-        this->reader_duration = reader_duration;
-        this->writer_duration = writer_duration;
-        can_interlap = can_rw_interlap;
-        writer_flag = start_with_writers;
+    workers.reserve(worker_count);
+    for (std::size_t id = 0; id < worker_count; ++id) {
+        workers.emplace_back(&rw_scheduled_thread_pool::routine, this, id);
     }
+    scheduler_thread = std::thread(&rw_scheduled_thread_pool::scheduler_function, this);
+
+    initialized = true;
 }
 
 inline void rw_scheduled_thread_pool::terminate(bool immediately) {
@@ -104,81 +223,193 @@ inline void rw_scheduled_thread_pool::terminate(bool immediately) {
         if (working_unsafe()) {
             terminated = true;
             paused = false;
-
-            if (immediately) {
-                reader_tasks.clear();
-                writer_tasks.clear();
-            }
+            discarding = immediately;
+            scheduler_notified = true;
         }
         else {
             return;
         }
     }
 
-    cv_task_waiter.notify_all();
+    wake_all_workers();
+    cv_scheduler_waiter.notify_one();
 
     for (std::thread& worker : workers) {
         worker.join();
     }
-    timer_thread.join();
+    scheduler_thread.join();
+
+    call_writer_phase_end_function();
 
     write_lock w_lock(rw_lock);
 
     workers.clear();
+    reader_tasks.deques.clear();
+    writer_tasks.deques.clear();
+    spare_task_nodes.clear();
 
-    terminated = false;
+    // The tasks added from now on are dropped until the next initialize()
     initialized = false;
+    terminated = false;
     paused = false;
+    discarding = false;
 }
 
-inline void rw_scheduled_thread_pool::routine() {
+inline void rw_scheduled_thread_pool::routine(std::size_t worker_idx) {
+    this_worker = { this, worker_idx, false };
+
     while (true) {
-        bool task_accquiered = false;
-        bool is_writer = false;
-        std::function<void()> task;
+        // Read before looking for a task: a task added after that bumps the epoch, and the wait below returns at once
+        std::uint32_t epoch = wake_epoch.load();
 
-        {
-            write_lock w_lock(rw_lock);
+        if (!paused) {
+            bool is_writer = writer_flag;
 
-            auto wait_condition = [this, &task_accquiered, &is_writer, &task] {
-                if (paused) {
-                    return false;
-                }
+            if (run_task(worker_idx, is_writer)) {
+                continue;
+            }
 
-                auto& target_queue = writer_flag ? writer_tasks : reader_tasks;
-                std::size_t& other_counter = !writer_flag ? writers_counter : readers_counter;
-                is_writer = writer_flag;
+            // A terminated pool still does all the queued tasks, with can_interlap without waiting for their phase
+            if (terminated && can_interlap && run_task(worker_idx, !is_writer)) {
+                continue;
+            }
 
-                if (can_interlap || other_counter == 0) {
-                    task_accquiered = target_queue.pop(task);
-                }
+            if (terminated && reader_tasks.queued == 0 && writer_tasks.queued == 0) {
+                break;
+            }
+        }
 
-                if (terminated && can_interlap && !task_accquiered) {
-                    auto& last_queue = !writer_flag ? writer_tasks : reader_tasks;
-                    task_accquiered = last_queue.pop(task);
-                }
-                return terminated || task_accquiered;
-            };
+        parked_workers.fetch_add(1);
+        wake_epoch.wait(epoch);
+        parked_workers.fetch_sub(1);
+    }
+
+    this_worker = {};
+}
 
-            cv_task_waiter.wait(w_lock, wait_condition);
+inline bool rw_scheduled_thread_pool::run_task(std::size_t worker_idx, bool is_writer) {
+    task_class& own_class = get_task_class(is_writer);
+    task_class& other_class = get_task_class(!is_writer);
 
-            if (terminated && !task_accquiered) {
-                return;
-            }
+    if (own_class.queued == 0) {
+        return false;
+    }
+
+    // Counted as running before looking at the other kind: of a reader and a writer that do this at the same time,
+    // at least one sees the other and backs off
+    own_class.running.fetch_add(1);
+
+    bool is_current_phase = writer_flag == is_writer || (can_interlap && terminated);
+    bool can_run = is_current_phase && (can_interlap || other_class.running == 0);
+
+    task_type task;
+    bool task_accquiered = can_run && take_task(worker_idx, own_class, task);
+
+    if (task_accquiered) {
+        // The first task of the phase: the other phase waits behind it from now on
+        clock::time_point not_running = clock::time_point::max();
+        if (own_class.running_since.load() == not_running && own_class.running_since.compare_exchange_strong(not_running, clock::now())
+            && other_class.queued > 0) {
+            notify_scheduler();
+        }
+
+        // The other phase may not have to wait anymore
+        if (own_class.queued.fetch_sub(1) == 1 && other_class.queued > 0) {
+            notify_scheduler();
+        }
 
-            std::size_t& counter = is_writer ? writers_counter : readers_counter;
-            ++counter;
+        if (!discarding) {
+            this_worker.is_writer = is_writer;
+            task();
         }
+        task.reset();
 
-        task();
+        if (is_writer) {
+            finished_writers_counter.fetch_add(1);
+        }
+    }
 
-        {
-            write_lock w_lock(rw_lock);
-            std::size_t& counter = is_writer ? writers_counter : readers_counter;
-            --counter;
+    if (own_class.running.fetch_sub(1) == 1) {
+        // The workers of the other phase may start
+        if (writer_flag != is_writer) {
+            wake_all_workers();
         }
 
-        cv_timer_waiter.notify_one();
+        // The writer phase may be over, a terminated pool may be done
+        if (is_writer || terminated) {
+            notify_scheduler();
+        }
+    }
+
+    return task_accquiered;
+}
+
+inline bool rw_scheduled_thread_pool::take_task(std::size_t worker_idx, task_class& target_class, task_type& task) {
+    task_type* node = nullptr;
+
+    // The newest own task first, it is likely still in the cache; then the oldest ones of the others
+    if (target_class.deques[worker_idx]->pop(node)) {
+        take_task_from_node(worker_idx, node, task);
+        return true;
+    }
+
+    if (target_class.injected_tasks.pop(task)) {
+        return true;
+    }
+
+    std::size_t workers_amount = target_class.deques.size();
+    for (std::size_t offset = 1; offset < workers_amount; ++offset) {
+        auto& victim = *target_class.deques[(worker_idx + offset) % workers_amount];
+
+        // A failed steal may only mean that another thief was first, try again while there is something left
+        while (!victim.empty()) {
+            if (victim.steal(node)) {
+                take_task_from_node(worker_idx, node, task);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+inline rw_scheduled_thread_pool::task_type* rw_scheduled_thread_pool::make_task_node(std::size_t worker_idx, task_type&& task) {
+    std::vector<std::unique_ptr<task_type>>& nodes = spare_task_nodes[worker_idx].nodes;
+
+    std::unique_ptr<task_type> node;
+    if (nodes.empty()) {
+        node = std::make_unique<task_type>();
+    }
+    else {
+        node = std::move(nodes.back());
+        nodes.pop_back();
+    }
+
+    *node = std::move(task);
+    return node.release();
+}
+
+inline void rw_scheduled_thread_pool::take_task_from_node(std::size_t worker_idx, task_type* node, task_type& task) {
+    std::unique_ptr<task_type> owned_node(node);
+    task = std::move(*owned_node);
+
+    std::vector<std::unique_ptr<task_type>>& nodes = spare_task_nodes[worker_idx].nodes;
+    if (nodes.size() < max_spare_nodes) {
+        nodes.push_back(std::move(owned_node));
+    }
+}
+
+inline void rw_scheduled_thread_pool::wake_worker() {
+    wake_epoch.fetch_add(1);
+    if (parked_workers > 0) {
+        wake_epoch.notify_one();
+    }
+}
+
+inline void rw_scheduled_thread_pool::wake_all_workers() {
+    wake_epoch.fetch_add(1);
+    if (parked_workers > 0) {
+        wake_epoch.notify_all();
     }
 }
 
@@ -189,7 +420,7 @@ inline void rw_scheduled_thread_pool::set_paused(const bool paused) {
         this->paused = paused;
 
         if (!paused) {
-            cv_task_waiter.notify_all();
+            wake_all_workers();
         }
     }
 }
@@ -217,11 +448,17 @@ inline bool rw_scheduled_thread_pool::set_writer_duration(float new_writer_durat
 }
 
 inline bool rw_scheduled_thread_pool::do_set_duration(float& target_duration, float new_duration) {
-    if (new_duration < 0.5 - 0.001) {
+    if (!(new_duration >= min_duration)) {
         return false;
     }
-    write_lock w_lock(rw_lock);
-    target_duration = new_duration;
+
+    {
+        write_lock w_lock(rw_lock);
+        target_duration = new_duration;
+        scheduler_notified = true;
+    }
+
+    cv_scheduler_waiter.notify_one();
     return true;
 }
 
@@ -235,96 +472,216 @@ inline float rw_scheduled_thread_pool::get_writer_duration() const {
     return writer_duration;
 }
 
+inline std::size_t rw_scheduled_thread_pool::size_reader_tasks() const {
+    return reader_tasks.queued;
+}
+
+inline std::size_t rw_scheduled_thread_pool::size_writer_tasks() const {
+    return writer_tasks.queued;
+}
+
+inline void rw_scheduled_thread_pool::set_writer_phase_end_function(std::function<void()> function) {
+    write_lock w_lock(rw_lock);
+    writer_phase_end_function = std::move(function);
+}
+
+inline void rw_scheduled_thread_pool::call_writer_phase_end_function() {
+    std::function<void()> function;
+    {
+        read_lock r_lock(rw_lock);
+        function = writer_phase_end_function;
+    }
+
+    if (function) {
+        function();
+    }
+}
+
 template <typename task_t, typename... arguments>
 inline void rw_scheduled_thread_pool::add_reader_task(task_t&& task, arguments&& ...parameters) {
-    do_add_task(reader_tasks, std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+    do_add_task(false, std::forward<task_t>(task), std::forward<arguments>(parameters)...);
 }
 
 template<typename task_t, typename ...arguments>
 inline void rw_scheduled_thread_pool::add_writer_task(task_t&& task, arguments&& ...parameters) {
-    do_add_task(writer_tasks, std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+    do_add_task(true, std::forward<task_t>(task), std::forward<arguments>(parameters)...);
 }
 
 template<typename task_t, typename ...arguments>
-inline void rw_scheduled_thread_pool::do_add_task(concurrent_queue<std::function<void()>>& target_queue, task_t&& task, arguments&& ...parameters) {
-    {
-        read_lock r_lock(rw_lock);
-        if (!working_unsafe()) {
-            return;
-        }
+inline void rw_scheduled_thread_pool::do_add_task(bool is_writer, task_t&& task, arguments&& ...parameters) {
+    task_type new_task = make_task(std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+    task_class& target_class = get_task_class(is_writer);
+
+    // Counted before checking the pool, so that terminate() waits for a task that got past the check
+    std::size_t queued_amount = target_class.queued.fetch_add(1) + 1;
+    if (!working_unsafe()) {
+        target_class.queued.fetch_sub(1);
+        return;
     }
 
-    auto bind = std::bind(std::forward<task_t>(task), std::forward<arguments>(parameters)...);
+    // Nothing of the pool but the atomics may be touched once the task is queued, terminate() may be done with it by then
+    std::size_t workers_amount = target_class.deques.size();
+    if (this_worker.pool == this) {
+        target_class.deques[this_worker.idx]->push(make_task_node(this_worker.idx, std::move(new_task)));
+    }
+    else {
+        target_class.injected_tasks.emplace(std::move(new_task));
+    }
+
+    if (is_writer == writer_flag) {
+        wake_worker();
+        return;
+    }
 
-    target_queue.emplace(bind);
-    cv_task_waiter.notify_one();
+    // A task for the other phase: the scheduler has to know when the phase starts waiting and when its queue gets deeper
+    clock::time_point none = clock::time_point::max();
+    bool started_waiting = target_class.waiting_since.compare_exchange_strong(none, clock::now());
+
+    if (started_waiting || queued_amount % workers_amount == 0) {
+        notify_scheduler();
+    }
 }
 
-inline void rw_scheduled_thread_pool::timer_function() {
-    while (true) {
-        if (can_interlap) {
-            float sleep_time = 1.0f;
-            {
-                read_lock r_lock(rw_lock);
-                sleep_time = writer_flag ? writer_duration : reader_duration; // read_lock because one of the durations might get changed from the outside
-            }
-            int sleep_time_ms = static_cast<int>(sleep_time * 1000.0f);
-            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time_ms));
+template <typename function_type>
+inline void rw_scheduled_thread_pool::for_each_in_parallel(std::size_t tasks_amount, function_type&& function) {
+    rw_scheduled_thread_pool* pool = this_worker.pool;
+    if (pool == nullptr) {
+        ::for_each_in_parallel(tasks_amount, std::forward<function_type>(function));
+        return;
+    }
 
-            {
-                write_lock w_lock(rw_lock);
-                if (terminated && writer_tasks.empty() && reader_tasks.empty()) {
-                    return;
-                }
-                // If there's no tasks in the other queue - continue executing tasks from the current queue
-                std::size_t other_tasks = !writer_flag ? writer_tasks.size() : reader_tasks.size();
-                if (other_tasks > 0) {
-                    writer_flag = !writer_flag;
+    // Shared with the helpers, a helper that starts after the calling task returned finds no task_idx left
+    // and never touches the function
+    struct shared_calls {
+        std::atomic<std::size_t> next_task_idx = 0;
+        std::atomic<std::size_t> done_amount = 0;
+        std::size_t tasks_amount = 0;
+        std::remove_reference_t<function_type>* p_function = nullptr;
+
+        inline void take_calls() {
+            for (std::size_t task_idx = next_task_idx++; task_idx < tasks_amount; task_idx = next_task_idx++) {
+                (*p_function)(task_idx);
+
+                if (done_amount.fetch_add(1) + 1 == tasks_amount) {
+                    done_amount.notify_all();
                 }
             }
+        }
+    };
+
+    auto calls = std::make_shared<shared_calls>();
+    calls->tasks_amount = tasks_amount;
+    calls->p_function = &function;
+
+    std::size_t helpers_amount = tasks_amount > 1 ? std::min(tasks_amount, pool->workers.size()) - 1 : 0;
+    for (std::size_t helper_idx = 0; helper_idx < helpers_amount; ++helper_idx) {
+        pool->do_add_task(this_worker.is_writer, [calls] { calls->take_calls(); });
+    }
+
+    calls->take_calls();
+
+    for (std::size_t done_amount = calls->done_amount; done_amount < tasks_amount; done_amount = calls->done_amount) {
+        calls->done_amount.wait(done_amount);
+    }
+}
+
+template <typename task_t, typename... arguments>
+inline rw_scheduled_thread_pool::task_type rw_scheduled_thread_pool::make_task(task_t&& task, arguments&&... parameters) {
+    if constexpr (sizeof...(arguments) == 0) {
+        return task_type(std::forward<task_t>(task));
+    }
+    else {
+        // The parameters are moved into the captures and passed to the task as lvalues, as std::bind does
+        return task_type([function = std::forward<task_t>(task), ...bound_parameters = std::forward<arguments>(parameters)]() mutable {
+            std::invoke(function, bound_parameters...);
+            }
+        );
+    }
+}
+
+inline void rw_scheduled_thread_pool::notify_scheduler() {
+    {
+        write_lock w_lock(rw_lock);
+        scheduler_notified = true;
+    }
 
-            cv_task_waiter.notify_all();
+    cv_scheduler_waiter.notify_one();
+}
+
+inline void rw_scheduled_thread_pool::scheduler_function() {
+    write_lock w_lock(rw_lock);
+
+    while (true) {
+        scheduler_notified = false;
+        clock::time_point switch_time = clock::time_point::max();
 
-            {
-                write_lock w_lock(rw_lock);
+        task_class& current_class = get_task_class(writer_flag);
+        task_class& other_class = get_task_class(!writer_flag);
 
-                // Wait until previous group finish all their tasks (counter == 0) to start the new cooldown:
-                // each group has time of AT LEAST their duration specially only for them
-                cv_timer_waiter.wait(w_lock, [this] {
-                    std::size_t& other_counter = !writer_flag ? writers_counter : readers_counter;
-                    return other_counter == 0;
-                });
+        std::size_t other_tasks_amount = other_class.queued;
+        if (other_tasks_amount > 0) {
+            clock::time_point now = clock::now();
+
+            // Set by the first task queued for the other phase. A task that raced with the last switch may have left it unset
+            clock::time_point other_waiting_since = clock::time_point::max();
+            if (other_class.waiting_since.compare_exchange_strong(other_waiting_since, now)) {
+                other_waiting_since = now;
             }
-        }
-        else {
-            float sleep_time = 1.0f;
-            {
-                read_lock r_lock(rw_lock);
-                sleep_time = writer_flag ? writer_duration : reader_duration; // read_lock because one of the durations might get changed from the outside
+
+            // No switch time until a task of the current phase has started, then counted from that at the earliest
+            clock::time_point current_running_since = current_class.running_since;
+            if (current_running_since != clock::time_point::max()) {
+                std::size_t tasks_per_worker = std::max<std::size_t>(other_tasks_amount / workers.size(), 1);
+                std::chrono::duration<float> staleness_target((writer_flag ? writer_duration : reader_duration) / tasks_per_worker);
+                switch_time = std::max(other_waiting_since, current_running_since) + std::chrono::duration_cast<clock::duration>(staleness_target);
             }
-            int sleep_time_ms = static_cast<int>(sleep_time * 1000.0f);
-            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time_ms));
-
-            {
-                write_lock w_lock(rw_lock);
-                // If there's no tasks in the other queue - continue executing tasks from the current queue
-                std::size_t other_tasks = !writer_flag ? writer_tasks.size() : reader_tasks.size();
-                if (other_tasks > 0) {
-                    writer_flag = !writer_flag;
-                }
-                else if (terminated) {
-                    return;
-                }
 
-                // Wait until previous group finish all their tasks (counter == 0) to start the new cooldown:
-                // Each group has time of AT LEAST their duration specially only for them
-                cv_timer_waiter.wait(w_lock, [this] {
-                    std::size_t& counter = !writer_flag ? writers_counter : readers_counter;
-                    return counter == 0;
-                });
+            if (current_class.queued == 0 || now >= switch_time) {
+                switch_phase_unsafe();
+                continue;
             }
+        }
+
+        // The writer phase is over once the writer tasks that ran are done and no more are going to run in it
+        bool writer_phase_ended = finished_writers_counter > 0 && writer_tasks.running == 0 && (!writer_flag || writer_tasks.queued == 0);
+        if (writer_phase_ended) {
+            finished_writers_counter = 0;
 
-            cv_task_waiter.notify_all();
+            w_lock.unlock();
+            call_writer_phase_end_function();
+            w_lock.lock();
+            continue;
+        }
+
+        if (terminated && reader_tasks.queued == 0 && writer_tasks.queued == 0 && reader_tasks.running == 0 && writer_tasks.running == 0) {
+            return;
         }
+
+        auto notified = [this] { return scheduler_notified; };
+        if (switch_time == clock::time_point::max()) {
+            cv_scheduler_waiter.wait(w_lock, notified);
+        }
+        else {
+            cv_scheduler_waiter.wait_until(w_lock, switch_time, notified);
+        }
+    }
+}
+
+inline void rw_scheduled_thread_pool::switch_phase_unsafe() {
+    task_class& ended_class = get_task_class(writer_flag);
+    task_class& started_class = get_task_class(!writer_flag);
+
+    // The tasks left in the queue of the ended phase start waiting for their next turn, unless they already wait for it
+    clock::time_point none = clock::time_point::max();
+    if (ended_class.queued > 0) {
+        ended_class.waiting_since.compare_exchange_strong(none, clock::now());
     }
+    else {
+        ended_class.waiting_since = clock::time_point::max();
+    }
+    started_class.waiting_since = clock::time_point::max();
+    started_class.running_since = clock::time_point::max();
+
+    writer_flag = !writer_flag;
+    wake_all_workers();
 }
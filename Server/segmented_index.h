@@ -0,0 +1,706 @@
+#pragma once
+
+#include <memory>
+#include <array>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <utility>
+#include "inverted_index.h"
+#include "roaring_bitmap.h"
+#include "rw_scheduled_thread_pool.h"
+#include "project_types.h"
+
+// ===============================================================================================================
+// The inverted index of a version, log-structured: a list of segments, and the postings of every file in a single one of them.
+// Files are indexed into the small mutable segment, the last one. Once it has max_mutable_positions positions it is frozen
+// and a new mutable segment is started: the postings of a frozen segment are never modified again.
+// A file removed (or modified) while its postings are in a frozen segment is only erased there, with a tombstone kept
+// by this version. The tombstones of the mutable segment are purged when it is frozen.
+// Frozen segments of about the same size are merged into one, without their erased files, so there are only O(log) of them:
+// the merge is planned on a snapshot and built apart from any version, without blocking the writers (see plan_merge and merge),
+// and only putting it in place of its inputs is a modification (see apply_merge). Both versions share the merged postings.
+// The postings of every segment are split into word shards by word ID. The shards share nothing, so the heavy work
+// (a batch of posting lists, a freeze, a merge) is done shard by shard in parallel, by the workers of the thread pool
+// when it is done by a task (see rw_scheduled_thread_pool::for_each_in_parallel).
+// Like index_version, it takes no locks of its own
+// ===============================================================================================================
+
+class segmented_index {
+public:
+    using file_cursor = posting_list_type::file_cursor;
+
+    // Word IDs are dealt out so that every ID tells its shard: the local ID l of the shard s is the word ID (l - 1) * word_shards_amount + s + 1.
+    // The dictionary of index_version is split the same way, a word goes to the shard of its hash
+    static constexpr std::size_t word_shards_amount = 16;
+
+    inline static std::size_t get_word_shard_idx(id_type word_id) { return (word_id - 1) % word_shards_amount; }
+    inline static id_type get_word_id(std::size_t shard_idx, id_type local_word_id) { return static_cast<id_type>((local_word_id - 1) * word_shards_amount + shard_idx + 1); }
+    inline static id_type get_local_word_id(id_type word_id) { return static_cast<id_type>((word_id - 1) / word_shards_amount + 1); }
+
+    // The postings of a segment, with the files that have any there
+    struct segment_postings {
+        std::array<inverted_index, word_shards_amount> shards;
+        roaring_bitmap file_ids;          // Erased or not
+        std::size_t positions_amount = 0; // Of all the files, erased or not
+
+        inline inverted_index& get_shard(id_type word_id) { return shards[get_word_shard_idx(word_id)]; }
+        inline const inverted_index& get_shard(id_type word_id) const { return shards[get_word_shard_idx(word_id)]; }
+    };
+
+    class segment {
+    public:
+        inline id_type get_id() const { return id; }
+
+        // nullptr if no file of the segment has word_id. The posting lists may hold erased files
+        inline const posting_list_type* get_posting_list_cp(id_type word_id) const;
+        // Bitmap of the files that contain word_id, or nullptr if the word is in too few files to have one.
+        // It may hold erased files
+        inline const roaring_bitmap* get_file_set_bitmap_cp(id_type word_id) const;
+        // Get the amount of the files that contain word_id, without the erased files
+        inline std::size_t size_file_set(id_type word_id) const;
+        // Returns true if any of the files that contain word_id is erased
+        inline bool has_erased_files(id_type word_id) const;
+        inline bool has_erased_files() const;
+        inline bool is_erased(id_type file_id) const;
+        // Returns true if the file has postings here and is not erased
+        inline bool holds_file(id_type file_id) const;
+        // Get the amount of positions of the files that are not erased
+        inline std::size_t size_positions() const;
+
+    private:
+        friend class segmented_index;
+
+        struct erased_file {
+            std::vector<id_type> word_ids;
+            std::size_t positions_amount = 0;
+        };
+
+        inline void erase_file(id_type file_id, std::vector<id_type>&& word_ids, std::size_t positions_amount);
+        inline void clear_erased_files();
+
+        id_type id = 0;
+        std::shared_ptr<segment_postings> postings;
+
+        roaring_bitmap erased_files;
+        std::unordered_map<id_type, erased_file> erased_files_map;      // key - file ID of an erased file
+        std::unordered_map<id_type, std::size_t> erased_files_per_word; // key - word ID, value - amount of the erased files in its posting list
+        std::size_t erased_positions_amount = 0;
+    };
+
+    // Adds the postings of the words of a single shard into the mutable segment, apart from the other shards (see add_to_shards_in_parallel)
+    class shard_writer {
+    public:
+        inline void add_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions);
+        // The files of word_entries must not be in any segment yet
+        inline void add_posting_list(id_type word_id, const posting_list_type& word_entries);
+
+    private:
+        friend class segmented_index;
+
+        inline explicit shard_writer(inverted_index& shard) : p_shard(&shard) {}
+
+        inverted_index* p_shard;
+        roaring_bitmap file_ids;          // Added to the segment once all the shards are done
+        std::size_t positions_amount = 0;
+    };
+
+    // A merge of frozen segments: planned on a snapshot, built apart from any version, applied to both versions
+    struct segment_merge {
+        std::vector<id_type> segment_ids;                              // Of the merged segments
+        std::vector<std::shared_ptr<const segment_postings>> inputs;   // Their postings
+        std::vector<roaring_bitmap> erased_files;                      // Their erased files when the merge was planned
+
+        std::shared_ptr<segment_postings> merged;                      // Without those erased files
+        std::vector<std::vector<id_type>> dropped_word_ids;            // Words that only those erased files had, of every shard
+    };
+
+    inline segmented_index() { add_mutable_segment(); }
+    inline ~segmented_index() = default;
+
+    inline segmented_index(const segmented_index& other) = delete;
+    inline segmented_index(segmented_index&& other) = delete;
+    inline segmented_index& operator=(const segmented_index& rhs) = delete;
+    inline segmented_index& operator=(segmented_index&& rhs) = delete;
+
+public:
+    // Returns true if no segment has any posting list
+    inline bool empty() const;
+    inline void clear();
+
+    // Oldest first, the mutable segment last
+    inline const std::vector<segment>& get_segments() const;
+
+    // Returns true if any segment has a posting list of word_id
+    inline bool has_id(id_type word_id) const;
+    // Get the amount of the files that contain word_id in all the segments, without the erased files
+    inline std::size_t size_file_set(id_type word_id) const;
+    // Calls function(files) for every file that contains word_id, without the erased files, in ascending file ID order:
+    // files is the cursor of the posting list of its segment, standing on it
+    template <typename function_type>
+    inline void for_each_file(id_type word_id, function_type&& function) const;
+
+    // Into the mutable segment
+    inline void add_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions);
+    // Calls function(shard_idx, writer) for every shard, the shards on parallel threads: the postings of the words of shard_idx
+    // are added into the mutable segment through writer, and only those
+    template <typename function_type>
+    inline void add_to_shards_in_parallel(function_type&& function);
+
+    // Returns true if the file has postings in the mutable segment and is not erased there
+    inline bool is_in_mutable_segment(id_type file_id) const;
+    // In the mutable segment (see inverted_index::clear_for_word_and_file and inverted_index::has_file_positions)
+    inline void clear_for_word_and_file(id_type word_id, id_type file_id);
+    inline bool has_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) const;
+
+    // Erase a file in the segment that has its postings. word_ids are the words of the file, positions_amount the amount of its positions
+    inline void erase_file(id_type file_id, std::unordered_set<id_type>&& word_ids, std::size_t positions_amount);
+    // Delete the postings of a file erased in the mutable segment for good, before it is indexed again.
+    // Returns false if the file is not erased there
+    inline bool purge_file(id_type file_id);
+
+    // Freeze the mutable segment once it has max_mutable_positions positions. Returns the IDs of the words that have no posting list anymore
+    inline std::vector<id_type> freeze_mutable_segment_if_full();
+
+    // Returns true if plan_merge would find frozen segments to merge
+    inline bool needs_merge() const;
+    // Plan the merge of the frozen segments of the lowest size tier that has merge_factor of them, or otherwise of a frozen segment
+    // with as many erased positions as 1 / compaction_ratio of its own. Returns false if there's nothing to merge
+    inline bool plan_merge(segment_merge& out_merge) const;
+    // Build the merged postings of a planned merge. Only reads the frozen postings of the plan, so it runs without any version
+    inline static void merge(segment_merge& planned_merge);
+    // Put the merged segment in place of its inputs, with the tombstones of their files erased since the merge was planned.
+    // Returns false if any of the inputs is not there anymore. The IDs of the words that have no posting list anymore
+    // are added to out_forgotten_word_ids
+    inline bool apply_merge(const segment_merge& built_merge, std::vector<id_type>& out_forgotten_word_ids);
+
+    // The mutable segment is frozen at this amount of positions
+    static constexpr std::size_t max_mutable_positions = 1 << 18;
+    // A segment is in size tier t if it has less than max_mutable_positions * merge_factor^(t + 1) positions,
+    // and merge_factor segments of a tier are merged. Every position is rewritten O(log) times
+    static constexpr std::size_t merge_factor = 4;
+    // A merge of a single segment rewrites at most (compaction_ratio + 1) times as many positions as were erased
+    static constexpr std::size_t compaction_ratio = 4;
+
+private:
+    inline void add_mutable_segment();
+    inline std::size_t find_segment(id_type file_id) const;
+    // Indexes of the frozen segments to merge (see plan_merge)
+    inline std::vector<std::size_t> pick_segments_to_merge() const;
+    inline static std::size_t get_size_tier(const segment& frozen_segment);
+    // The words of shard_word_ids[shard index] that have no posting list in any segment are added to out_forgotten_word_ids
+    inline void collect_forgotten_words(const std::vector<std::vector<id_type>>& shard_word_ids, std::vector<id_type>& out_forgotten_word_ids) const;
+
+private:
+    std::vector<segment> segments;
+    id_type next_segment_id = 1; // Never reset, a planned merge never mistakes a newer segment for its input
+};
+
+// segment::get_posting_list_cp
+inline const posting_list_type* segmented_index::segment::get_posting_list_cp(id_type word_id) const {
+    const inverted_index& shard = postings->get_shard(word_id);
+    return shard.has_id_unsafe(word_id) ? shard.get_posting_list_cp_unsafe(word_id) : nullptr;
+}
+
+// segment::get_file_set_bitmap_cp
+inline const roaring_bitmap* segmented_index::segment::get_file_set_bitmap_cp(id_type word_id) const {
+    return postings->get_shard(word_id).get_file_set_bitmap_cp_unsafe(word_id);
+}
+
+// segment::size_file_set
+inline std::size_t segmented_index::segment::size_file_set(id_type word_id) const {
+    const posting_list_type* p_word_entries = get_posting_list_cp(word_id);
+    if (p_word_entries == nullptr) {
+        return 0;
+    }
+
+    auto it = erased_files_per_word.find(word_id);
+    return it != erased_files_per_word.end() ? p_word_entries->file_count() - it->second : p_word_entries->file_count();
+}
+
+// segment::has_erased_files
+inline bool segmented_index::segment::has_erased_files(id_type word_id) const {
+    return erased_files_per_word.find(word_id) != erased_files_per_word.end();
+}
+
+inline bool segmented_index::segment::has_erased_files() const {
+    return !erased_files.empty();
+}
+
+// segment::is_erased
+inline bool segmented_index::segment::is_erased(id_type file_id) const {
+    return !erased_files.empty() && erased_files.contains(file_id);
+}
+
+// segment::holds_file
+inline bool segmented_index::segment::holds_file(id_type file_id) const {
+    return postings->file_ids.contains(file_id) && !is_erased(file_id);
+}
+
+// segment::size_positions
+inline std::size_t segmented_index::segment::size_positions() const {
+    return postings->positions_amount - erased_positions_amount;
+}
+
+// segment::erase_file
+inline void segmented_index::segment::erase_file(id_type file_id, std::vector<id_type>&& word_ids, std::size_t positions_amount) {
+    if (!erased_files.add(file_id)) {
+        return;
+    }
+
+    erased_file& erased = erased_files_map[file_id];
+    erased.word_ids = std::move(word_ids);
+    erased.positions_amount = positions_amount;
+    erased_positions_amount += positions_amount;
+
+    for (const auto word_id : erased.word_ids) {
+        ++erased_files_per_word[word_id];
+    }
+}
+
+// segment::clear_erased_files
+inline void segmented_index::segment::clear_erased_files() {
+    erased_files.clear();
+    erased_files_map.clear();
+    erased_files_per_word.clear();
+    erased_positions_amount = 0;
+}
+
+// shard_writer::add_file_positions
+inline void segmented_index::shard_writer::add_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) {
+    p_shard->add_file_positions_unsafe(word_id, file_id, file_positions);
+    file_ids.add(file_id);
+    positions_amount += file_positions.size();
+}
+
+// shard_writer::add_posting_list
+inline void segmented_index::shard_writer::add_posting_list(id_type word_id, const posting_list_type& word_entries) {
+    p_shard->add_posting_list_unsafe(word_id, word_entries);
+    for (auto files = word_entries.get_file_cursor(); !files.at_end(); files.next()) {
+        file_ids.add(files.file_id());
+    }
+    positions_amount += word_entries.size();
+}
+
+// empty
+inline bool segmented_index::empty() const {
+    return std::all_of(std::begin(segments), std::end(segments), [](const segment& each_segment) {
+        return std::all_of(std::begin(each_segment.postings->shards), std::end(each_segment.postings->shards), [](const inverted_index& shard) {
+            return shard.empty_unsafe();
+        });
+    });
+}
+
+// clear
+inline void segmented_index::clear() {
+    segments.clear();
+    add_mutable_segment();
+}
+
+// get_segments
+inline const std::vector<segmented_index::segment>& segmented_index::get_segments() const {
+    return segments;
+}
+
+// has_id
+inline bool segmented_index::has_id(id_type word_id) const {
+    return std::any_of(std::begin(segments), std::end(segments), [word_id](const segment& each_segment) {
+        return each_segment.postings->get_shard(word_id).has_id_unsafe(word_id);
+    });
+}
+
+// size_file_set
+inline std::size_t segmented_index::size_file_set(id_type word_id) const {
+    std::size_t files_amount = 0;
+    for (const auto& each_segment : segments) {
+        files_amount += each_segment.size_file_set(word_id);
+    }
+    return files_amount;
+}
+
+// for_each_file
+template <typename function_type>
+inline void segmented_index::for_each_file(id_type word_id, function_type&& function) const {
+    struct segment_files {
+        file_cursor files;
+        const segment* p_segment;
+    };
+
+    std::vector<segment_files> segment_cursors;
+    for (const auto& each_segment : segments) {
+        const posting_list_type* p_word_entries = each_segment.get_posting_list_cp(word_id);
+        if (p_word_entries != nullptr) {
+            segment_cursors.push_back({ p_word_entries->get_file_cursor(), &each_segment });
+        }
+    }
+
+    // A file is in a single segment: the cursors are merged by their current file
+    while (true) {
+        segment_files* p_next = nullptr;
+        for (auto& cursor : segment_cursors) {
+            while (!cursor.files.at_end() && cursor.p_segment->is_erased(cursor.files.file_id())) {
+                cursor.files.next();
+            }
+            if (!cursor.files.at_end() && (p_next == nullptr || cursor.files.file_id() < p_next->files.file_id())) {
+                p_next = &cursor;
+            }
+        }
+
+        if (p_next == nullptr) {
+            break;
+        }
+
+        function(std::as_const(p_next->files));
+        p_next->files.next();
+    }
+}
+
+// add_file_positions
+inline void segmented_index::add_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) {
+    segment_postings& mutable_postings = *segments.back().postings;
+
+    mutable_postings.get_shard(word_id).add_file_positions_unsafe(word_id, file_id, file_positions);
+    mutable_postings.file_ids.add(file_id);
+    mutable_postings.positions_amount += file_positions.size();
+}
+
+// add_to_shards_in_parallel
+template <typename function_type>
+inline void segmented_index::add_to_shards_in_parallel(function_type&& function) {
+    segment_postings& mutable_postings = *segments.back().postings;
+
+    std::vector<shard_writer> writers;
+    writers.reserve(word_shards_amount);
+    for (auto& shard : mutable_postings.shards) {
+        writers.push_back(shard_writer(shard));
+    }
+
+    rw_scheduled_thread_pool::for_each_in_parallel(word_shards_amount, [&](std::size_t shard_idx) {
+        function(shard_idx, writers[shard_idx]);
+    });
+
+    for (const auto& writer : writers) {
+        mutable_postings.file_ids |= writer.file_ids;
+        mutable_postings.positions_amount += writer.positions_amount;
+    }
+}
+
+// is_in_mutable_segment
+inline bool segmented_index::is_in_mutable_segment(id_type file_id) const {
+    return segments.back().holds_file(file_id);
+}
+
+// clear_for_word_and_file
+inline void segmented_index::clear_for_word_and_file(id_type word_id, id_type file_id) {
+    // The positions stay counted until the segment is frozen
+    segments.back().postings->get_shard(word_id).clear_for_word_and_file_unsafe(word_id, file_id);
+}
+
+// has_file_positions
+inline bool segmented_index::has_file_positions(id_type word_id, id_type file_id, const std::vector<id_type>& file_positions) const {
+    return segments.back().postings->get_shard(word_id).has_file_positions_unsafe(word_id, file_id, file_positions);
+}
+
+// erase_file
+inline void segmented_index::erase_file(id_type file_id, std::unordered_set<id_type>&& word_ids, std::size_t positions_amount) {
+    std::size_t segment_idx = find_segment(file_id);
+    if (segment_idx == segments.size()) {
+        return; // A file without words has no postings
+    }
+
+    segments[segment_idx].erase_file(file_id, std::vector<id_type>(std::begin(word_ids), std::end(word_ids)), positions_amount);
+}
+
+// purge_file
+inline bool segmented_index::purge_file(id_type file_id) {
+    segment& mutable_segment = segments.back();
+
+    auto it = mutable_segment.erased_files_map.find(file_id);
+    if (it == mutable_segment.erased_files_map.end()) {
+        return false;
+    }
+
+    for (const auto word_id : it->second.word_ids) {
+        mutable_segment.postings->get_shard(word_id).clear_for_word_and_file_unsafe(word_id, file_id);
+
+        auto count_it = mutable_segment.erased_files_per_word.find(word_id);
+        if (--count_it->second == 0) {
+            mutable_segment.erased_files_per_word.erase(count_it);
+        }
+    }
+
+    mutable_segment.erased_positions_amount -= it->second.positions_amount;
+    mutable_segment.erased_files.remove(file_id);
+    mutable_segment.postings->file_ids.remove(file_id);
+    mutable_segment.erased_files_map.erase(it);
+
+    return true;
+}
+
+// freeze_mutable_segment_if_full
+inline std::vector<id_type> segmented_index::freeze_mutable_segment_if_full() {
+    std::vector<id_type> forgotten_word_ids;
+
+    segment& mutable_segment = segments.back();
+    segment_postings& mutable_postings = *mutable_segment.postings;
+    if (mutable_postings.positions_amount < max_mutable_positions) {
+        return forgotten_word_ids;
+    }
+
+    std::vector<std::vector<id_type>> shard_emptied_word_ids(word_shards_amount);
+    std::vector<std::size_t> shard_positions_amounts(word_shards_amount, 0);
+
+    rw_scheduled_thread_pool::for_each_in_parallel(word_shards_amount, [&](std::size_t shard_idx) {
+        inverted_index& shard = mutable_postings.shards[shard_idx];
+
+        // Every posting list with erased files is rewritten only once
+        for (const auto& [word_id, erased_amount] : mutable_segment.erased_files_per_word) {
+            if (get_word_shard_idx(word_id) == shard_idx) {
+                shard.erase_files_if_unsafe(word_id, [&mutable_segment](id_type file_id) {
+                    return mutable_segment.erased_files.contains(file_id);
+                });
+            }
+        }
+
+        shard_emptied_word_ids[shard_idx] = shard.erase_empty_posting_lists_unsafe();
+        shard.shrink_to_fit_unsafe();
+
+        // The positions cleared by the modifications were still counted
+        shard.for_each_posting_list_unsafe([&shard_positions_amounts, shard_idx](id_type, const posting_list_type& word_entries) {
+            shard_positions_amounts[shard_idx] += word_entries.size();
+        });
+    });
+
+    mutable_postings.file_ids.and_not(mutable_segment.erased_files);
+    mutable_postings.file_ids.run_optimize();
+    mutable_segment.clear_erased_files();
+
+    mutable_postings.positions_amount = 0;
+    for (const auto shard_positions_amount : shard_positions_amounts) {
+        mutable_postings.positions_amount += shard_positions_amount;
+    }
+
+    add_mutable_segment();
+    collect_forgotten_words(shard_emptied_word_ids, forgotten_word_ids);
+
+    return forgotten_word_ids;
+}
+
+// needs_merge
+inline bool segmented_index::needs_merge() const {
+    return !pick_segments_to_merge().empty();
+}
+
+// plan_merge
+inline bool segmented_index::plan_merge(segment_merge& out_merge) const {
+    std::vector<std::size_t> segment_indexes = pick_segments_to_merge();
+    if (segment_indexes.empty()) {
+        return false;
+    }
+
+    out_merge = segment_merge();
+    for (const auto segment_idx : segment_indexes) {
+        const segment& input = segments[segment_idx];
+        out_merge.segment_ids.push_back(input.id);
+        out_merge.inputs.push_back(input.postings);
+        out_merge.erased_files.push_back(input.erased_files);
+    }
+    return true;
+}
+
+// merge
+inline void segmented_index::merge(segment_merge& planned_merge) {
+    const auto& inputs = planned_merge.inputs;
+    auto merged = std::make_shared<segment_postings>();
+
+    planned_merge.dropped_word_ids.assign(word_shards_amount, {});
+    std::vector<std::size_t> shard_positions_amounts(word_shards_amount, 0);
+
+    struct input_files {
+        file_cursor files;
+        const roaring_bitmap* p_erased_files;
+    };
+
+    rw_scheduled_thread_pool::for_each_in_parallel(word_shards_amount, [&](std::size_t shard_idx) {
+        inverted_index& merged_shard = merged->shards[shard_idx];
+
+        std::unordered_set<id_type> word_ids;
+        for (const auto& input : inputs) {
+            input->shards[shard_idx].for_each_posting_list_unsafe([&word_ids](id_type word_id, const posting_list_type&) {
+                word_ids.insert(word_id);
+            });
+        }
+
+        std::vector<input_files> input_cursors;
+        std::vector<id_type> file_positions;
+
+        for (const auto word_id : word_ids) {
+            input_cursors.clear();
+            for (std::size_t input_idx = 0; input_idx < inputs.size(); ++input_idx) {
+                const inverted_index& input_shard = inputs[input_idx]->shards[shard_idx];
+                if (input_shard.has_id_unsafe(word_id)) {
+                    input_cursors.push_back({ input_shard.get_posting_list_cref_unsafe(word_id).get_file_cursor(), &planned_merge.erased_files[input_idx] });
+                }
+            }
+
+            // The files of the inputs are disjoint: the cursors are merged by their current file.
+            // The list is built apart and copied once, so it takes no more memory than it needs
+            posting_list_type word_entries;
+            while (true) {
+                input_files* p_next = nullptr;
+                for (auto& cursor : input_cursors) {
+                    while (!cursor.files.at_end() && cursor.p_erased_files->contains(cursor.files.file_id())) {
+                        cursor.files.next();
+                    }
+                    if (!cursor.files.at_end() && (p_next == nullptr || cursor.files.file_id() < p_next->files.file_id())) {
+                        p_next = &cursor;
+                    }
+                }
+
+                if (p_next == nullptr) {
+                    break;
+                }
+
+                file_positions.clear();
+                p_next->files.for_each_position([&file_positions](id_type position) { file_positions.push_back(position); });
+                word_entries.add_file(p_next->files.file_id(), file_positions);
+                p_next->files.next();
+            }
+
+            if (word_entries.empty()) {
+                planned_merge.dropped_word_ids[shard_idx].push_back(word_id);
+                continue;
+            }
+
+            shard_positions_amounts[shard_idx] += word_entries.size();
+            merged_shard.add_posting_list_unsafe(word_id, word_entries);
+        }
+    });
+
+    // The files of the merged segment are those of the inputs that were not erased
+    for (std::size_t input_idx = 0; input_idx < inputs.size(); ++input_idx) {
+        roaring_bitmap input_file_ids = inputs[input_idx]->file_ids;
+        input_file_ids.and_not(planned_merge.erased_files[input_idx]);
+        merged->file_ids |= input_file_ids;
+    }
+    merged->file_ids.run_optimize();
+
+    for (const auto shard_positions_amount : shard_positions_amounts) {
+        merged->positions_amount += shard_positions_amount;
+    }
+
+    planned_merge.merged = std::move(merged);
+}
+
+// apply_merge
+inline bool segmented_index::apply_merge(const segment_merge& built_merge, std::vector<id_type>& out_forgotten_word_ids) {
+    std::vector<std::size_t> segment_indexes;
+    for (const auto segment_id : built_merge.segment_ids) {
+        auto it = std::find_if(std::begin(segments), std::end(segments), [segment_id](const segment& each_segment) {
+            return each_segment.id == segment_id;
+        });
+        if (it == std::end(segments)) {
+            return false;
+        }
+        segment_indexes.push_back(it - std::begin(segments));
+    }
+
+    segment merged_segment;
+    merged_segment.id = next_segment_id++;
+    merged_segment.postings = built_merge.merged;
+
+    // The files erased since the merge was planned are in the merged postings, with all their words
+    for (std::size_t input_idx = 0; input_idx < segment_indexes.size(); ++input_idx) {
+        for (const auto& [file_id, erased] : segments[segment_indexes[input_idx]].erased_files_map) {
+            if (!built_merge.erased_files[input_idx].contains(file_id)) {
+                merged_segment.erase_file(file_id, std::vector<id_type>(erased.word_ids), erased.positions_amount);
+            }
+        }
+    }
+
+    // The merged segment takes the place of the oldest input
+    std::sort(std::begin(segment_indexes), std::end(segment_indexes));
+    segments[segment_indexes.front()] = std::move(merged_segment);
+    for (auto it = std::rbegin(segment_indexes); it != std::prev(std::rend(segment_indexes)); ++it) {
+        segments.erase(std::begin(segments) + *it);
+    }
+
+    collect_forgotten_words(built_merge.dropped_word_ids, out_forgotten_word_ids);
+    return true;
+}
+
+// add_mutable_segment
+inline void segmented_index::add_mutable_segment() {
+    segment mutable_segment;
+    mutable_segment.id = next_segment_id++;
+    mutable_segment.postings = std::make_shared<segment_postings>();
+
+    segments.push_back(std::move(mutable_segment));
+}
+
+// find_segment
+inline std::size_t segmented_index::find_segment(id_type file_id) const {
+    // The recently indexed files are in the newest segments
+    for (std::size_t segment_idx = segments.size(); segment_idx-- > 0;) {
+        if (segments[segment_idx].holds_file(file_id)) {
+            return segment_idx;
+        }
+    }
+    return segments.size();
+}
+
+// pick_segments_to_merge
+inline std::vector<std::size_t> segmented_index::pick_segments_to_merge() const {
+    std::vector<std::vector<std::size_t>> tiers;
+    for (std::size_t segment_idx = 0; segment_idx + 1 < segments.size(); ++segment_idx) {
+        std::size_t tier = get_size_tier(segments[segment_idx]);
+        if (tiers.size() <= tier) {
+            tiers.resize(tier + 1);
+        }
+        tiers[tier].push_back(segment_idx);
+    }
+
+    for (const auto& tier : tiers) {
+        if (tier.size() >= merge_factor) {
+            return tier;
+        }
+    }
+
+    for (std::size_t segment_idx = 0; segment_idx + 1 < segments.size(); ++segment_idx) {
+        const segment& frozen_segment = segments[segment_idx];
+        if (frozen_segment.erased_positions_amount != 0 && frozen_segment.erased_positions_amount * compaction_ratio >= frozen_segment.postings->positions_amount) {
+            return { segment_idx };
+        }
+    }
+
+    return {};
+}
+
+// get_size_tier
+inline std::size_t segmented_index::get_size_tier(const segment& frozen_segment) {
+    std::size_t positions_amount = frozen_segment.size_positions();
+
+    std::size_t tier = 0;
+    for (std::size_t tier_end = max_mutable_positions * merge_factor; positions_amount >= tier_end; tier_end *= merge_factor) {
+        ++tier;
+    }
+    return tier;
+}
+
+// collect_forgotten_words
+inline void segmented_index::collect_forgotten_words(const std::vector<std::vector<id_type>>& shard_word_ids, std::vector<id_type>& out_forgotten_word_ids) const {
+    std::vector<std::vector<id_type>> shard_forgotten_word_ids(shard_word_ids.size());
+
+    rw_scheduled_thread_pool::for_each_in_parallel(shard_word_ids.size(), [&](std::size_t shard_idx) {
+        for (const auto word_id : shard_word_ids[shard_idx]) {
+            if (!has_id(word_id)) {
+                shard_forgotten_word_ids[shard_idx].push_back(word_id);
+            }
+        }
+    });
+
+    for (const auto& forgotten_word_ids : shard_forgotten_word_ids) {
+        out_forgotten_word_ids.insert(std::end(out_forgotten_word_ids), std::begin(forgotten_word_ids), std::end(forgotten_word_ids));
+    }
+}
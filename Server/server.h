@@ -1,24 +1,23 @@
 #pragma once
 
-#define _WINSOCK_DEPRECATED_NO_WARNINGS
-
-#include <WinSock2.h>
-#include <WinBase.h>
+#include "network_platform.h"
+#include <atomic>
 #include <climits>
 #include <filesystem>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include "client_connection.h"
+#include "epoll_reactor.h"
 #include "index_manager.h"
 #include "rw_scheduled_thread_pool.h"
+#include "io_thread_pool.h"
+#include "write_ahead_log.h"
+#include "directory_watcher.h"
 #include "network_codes.h"
-
-#pragma comment(lib, "ws2_32.lib")
-
-#ifdef max
-#undef max
-#endif // max
-
-#ifdef min
-#undef min
-#endif // min
+#include "session_protocol.h"
 
 template <typename string_type>
 class server {
@@ -44,61 +43,144 @@ public:
     inline id_value_table<big_id_type, response, false>& get_write_tasks_statuses();
     inline std::filesystem::path get_base_dir() const;
 
+    // Hands the socket of the classic accept() loop to the receiving threads (see receive_request)
     inline void on_client_accepted(SOCKET client_socket);
-    inline void serve_client(SOCKET client_socket);
+    // Runs on a receiving thread. Receives a complete request (see get_complete_request_size) and passes it to a reader task,
+    // which hands the response to the sending threads. A request that isn't complete within request_timeout is passed on as it is,
+    // and answered with an error. The open_session command starts serve_session instead
+    inline void receive_request(SOCKET client_socket);
+    inline void serve_client(client_connection& client);
+
+    // Reads the frames of a persistent connection (see session_protocol.h) until the client closes its side.
+    // Every frame is served as a separate reader task, the responses are sent by the sending threads in the order they are ready
+    inline void serve_session(std::shared_ptr<session_socket> session);
+    // Runs serve_session on a thread of its own. Returns false (and the connection is dropped) if max_sessions_amount sessions
+    // are served already or the server is being destroyed
+    inline bool start_session(std::shared_ptr<session_socket> session);
+    // Shuts the sockets of the sessions down, so that their threads stop waiting for frames, and joins the threads
+    inline void close_sessions();
+    // Serves a single frame of a persistent connection: the request id followed by a complete request.
+    // Returns the response frame (empty if the frame is malformed)
+    inline std::string serve_session_request(client_connection& client);
+
+#ifdef __linux__
+    // Serves all the clients with non-blocking sockets on reactor_count epoll threads.
+    // Blocks the calling thread until the event loop is terminated
+    inline void run_event_loop(std::size_t reactor_count);
+    inline void terminate_event_loop();
+#endif // __linux__
+
+    // Returns the size of the first complete request in the received bytes (starting with the command code),
+    // or 0 if more bytes are needed to decide
+    inline static std::size_t get_complete_request_size(const char* data, std::size_t size);
+
+#ifdef __linux__
+    // Splits the bytes received by the event loop into requests: a single-shot request,
+    // or the open_session command code followed by session frames
+    inline static epoll_reactor::request_frame get_request_frame(const char* data, std::size_t size, bool keep_alive);
+#endif // __linux__
 
 private:
-    inline static void close_connection(SOCKET client_socket);
+    inline void serve_command(client_connection& client, code_type command_code);
 
-    inline static void check_requirements();
+    // Called at the end of every writer phase. If the index has segments to merge (see index_manager::needs_merge), the merge is built
+    // by a reader task, as it only reads the snapshot, and then put in place by a writer task
+    inline void schedule_merge();
+
+    inline static void close_connection(client_connection& client);
 
-    inline void build_index(bool clear_present = false);
+    inline static void check_requirements();
 
-    inline static void do_index_set_new_writer_duration(SOCKET client_socket, server& this_server);
-    inline static void do_index_set_new_reader_duration(SOCKET client_socket, server& this_server);
-    inline static void do_index_get_writer_duration(SOCKET client_socket, server& this_server);
-    inline static void do_index_get_reader_duration(SOCKET client_socket, server& this_server);
-    inline static void do_index_get_file_content(SOCKET client_socket, server& this_server);
-    inline static void do_index_get_write_result(SOCKET client_socket, server& this_server);
-    inline static void do_index_modify_file(SOCKET client_socket, server& this_server);
-    inline static void do_index_remove_file(SOCKET client_socket, server& this_server);
-    inline static void do_index_add_file(SOCKET client_socket, server& this_server);
-    inline static void do_index_has_file(SOCKET client_socket, server& this_server);
-    inline static void do_index_search(SOCKET client_socket, server& this_server);
+    // Index all the files under base_dir in parallel (see index_manager::add_files)
+    inline typename index_manager<string_type>::build_statistics build_index(bool clear_present = false);
+    // Load the index saved into index_path and re-index only the files under base_dir that changed since (see index_manager::load_index).
+    // Returns true if it was loaded
+    inline bool load_index(typename index_manager<string_type>::reindex_statistics* p_out_statistics = nullptr);
+    // Save the index into index_path, for the next start, and empty the write-ahead log. Returns true if it was saved
+    inline bool save_index();
+    // Apply again the operations recorded in the write-ahead log by the previous run. Returns the amount of those that changed the index
+    inline std::size_t replay_write_ahead_log(const std::vector<typename write_ahead_log<string_type>::record>& records);
+    inline std::vector<string_type> get_base_dir_file_paths() const;
+    inline static string_type to_generic_string_type(const std::filesystem::path& path);
+
+    inline static void do_index_set_new_writer_duration(client_connection& client, server& this_server);
+    inline static void do_index_set_new_reader_duration(client_connection& client, server& this_server);
+    inline static void do_index_get_writer_duration(client_connection& client, server& this_server);
+    inline static void do_index_get_reader_duration(client_connection& client, server& this_server);
+    inline static void do_index_get_file_content(client_connection& client, server& this_server);
+    inline static void do_index_get_write_result(client_connection& client, server& this_server);
+    inline static void do_index_modify_file(client_connection& client, server& this_server);
+    inline static void do_index_remove_file(client_connection& client, server& this_server);
+    inline static void do_index_add_file(client_connection& client, server& this_server);
+    inline static void do_index_has_file(client_connection& client, server& this_server);
+    inline static void do_index_search(client_connection& client, server& this_server);
+    inline static void do_index_phrase_search(client_connection& client, server& this_server);
+    inline static void do_index_near_search(client_connection& client, server& this_server);
+    inline static void do_index_ranked_search(client_connection& client, server& this_server);
+    inline static void do_index_save_index(client_connection& client, server& this_server);
+
+    // Serializes the found files and, unless files_only, the word entries into the response.
+    // They point into an index snapshot, so this is done before the snapshot is released, and the sending after
+    template <typename word_entries_type>
+    inline static void write_search_result(payload_writer& result, bool files_only, const typename index_manager<string_type>::found_files_table& files_table, const word_entries_type& word_entries);
+    // Returns true if the connection was closed due to errors, closes it after the payload is sent otherwise.
+    // A buffered connection gets the memory of the payload as its response, nothing is copied (see get_response_writer)
+    inline static bool send_payload_and_close(client_connection& client, payload_writer& payload);
 
     inline static void do_index_add_file_in_write_queue(server& this_server, big_id_type write_task_id, string_type&& file_path);
     inline static void do_index_add_create_file_in_write_queue(server& this_server, big_id_type write_task_id, string_type&& file_path, string_type&& file_content);
     inline static void do_index_remove_file_in_write_queue(server& this_server, big_id_type write_task_id, string_type&& file_path);
     inline static void do_index_modify_file_in_write_queue(server& this_server, big_id_type write_task_id, string_type&& file_path);
+    // Records a write operation that was applied to the index in the write-ahead log. The write task is reported as done
+    // once the record is durable, when the writer phase ends
+    inline static void log_write_operation(server& this_server, big_id_type write_task_id, typename write_ahead_log<string_type>::operation operation_type, string_type&& file_path, string_type&& file_content = string_type());
 
-    inline static void send_responce_code(SOCKET client_socket, response responce_code);
-    inline static void send_responce_code_and_close(SOCKET client_socket, response responce_code);
+#ifdef __linux__
+    // Index the files that were written into base_dir or removed from it by others (see directory_watcher.h).
+    // A whole batch is a single write task. The files with the size and the last write time they were indexed with are skipped
+    inline static void do_index_apply_watched_changes_in_write_queue(server& this_server, const std::vector<directory_watcher::change>& batch);
+#endif // __linux__
+
+    inline static void send_responce_code(client_connection& client, response responce_code);
+    inline static void send_responce_code_and_close(client_connection& client, response responce_code);
 
     template <typename T>
-    inline static int recv_integer_value(SOCKET client_socket, T& out_value);
+    inline static int recv_integer_value(client_connection& client, T& out_value);
     template <typename T>
-    inline static int send_integer_value(SOCKET client_socket, T value);
+    inline static int send_integer_value(client_connection& client, T value);
 
     // Returns true if the connection was closed due to errors
     template <typename T>
-    inline static bool recv_integer_value_and_handle(SOCKET client_socket, T& out_value, bool can_be_zero = false);
+    inline static bool recv_integer_value_and_handle(client_connection& client, T& out_value, bool can_be_zero = false);
     // Returns true if the connection was closed due to errors
     template <typename T>
-    inline static bool send_integer_value_and_handle(SOCKET client_socket, T value);
+    inline static bool send_integer_value_and_handle(client_connection& client, T value);
 
     // Receives a UTF-8 string size and the string itself, convert it to string_type and, if tolower == true, lower it.
     // Returns true if the connection was closed due to errors
-    inline static bool recv_size_and_string_and_handle(SOCKET client_socket, string_type& out_string, bool tolower = true);
+    inline static bool recv_size_and_string_and_handle(client_connection& client, string_type& out_string, bool tolower = true);
     // Converts the string of type string_type to a UTF-8 string and sends the string size and the string itself over the network.
     // Returns true if the connection was closed due to errors
-    inline static bool send_size_and_string_and_handle(SOCKET client_socket, const string_type& string);
+    inline static bool send_size_and_string_and_handle(client_connection& client, const string_type& string);
 
     // Receives a UTF-8 string size and the string itself.
     // Returns true if the connection was closed due to errors
-    inline static bool recv_size_and_utf8_string_and_handle(SOCKET client_socket, std::string& out_string);
+    inline static bool recv_size_and_utf8_string_and_handle(client_connection& client, std::string& out_string);
     // Sends the string size and the UTF-8 string itself over the network.
     // Returns true if the connection was closed due to errors
-    inline static bool send_size_and_utf8_string_and_handle(SOCKET client_socket, const std::string& string);
+    inline static bool send_size_and_utf8_string_and_handle(client_connection& client, const std::string& string);
+
+    // Sends a serialized payload in as few writes as possible.
+    // Returns true if the connection was closed due to errors
+    inline static bool send_payload_and_handle(client_connection& client, const std::string& payload);
+    // The calling worker's own reusable serialization buffer, cleared. Its memory leaves with a buffered response,
+    // the event loop hands it back once the response is sent (see reclaim_response_buffer). If it is not handed back,
+    // the next response starts with the capacity the last one needed
+    inline static payload_writer& get_response_writer();
+    // Takes the memory of a sent response back into the calling worker's serialization buffer
+    inline static void reclaim_response_buffer(std::string& response);
+
+    inline static std::string to_utf8(const string_type& string);
 
     inline static std::string get_last_error_as_string(bool pass_error_code = false, int error_code = 0);
 
@@ -107,13 +189,56 @@ private:
 
     constexpr static bool is_big_endian = std::endian::native == std::endian::big;
 
+    constexpr static std::size_t max_send_size = 1024 * 1024;
+    constexpr static std::size_t max_reused_response_capacity = 16 * 1024 * 1024;
+
+    struct response_buffer {
+        payload_writer writer;
+        std::size_t capacity = 0; // Of the memory that left with the last response
+    };
+    static inline thread_local response_buffer this_worker_response;
+
     index_manager<string_type> index;
     std::filesystem::path base_dir = "text_files";
+    std::filesystem::path index_path = "text_files.index";
+    std::filesystem::path log_path = "text_files.wal";
+
+    write_ahead_log<string_type> log;
 
     rw_scheduled_thread_pool thread_pool;
+    // The network threads of the classic accept() loop, started with the first accepted client. A thread blocks on a slow client
+    // for request_timeout at most: every recv and send of a single-shot connection times out, and so does the whole request
+    io_thread_pool receiving_threads;
+    io_thread_pool sending_threads;
+    constexpr static std::size_t receiving_threads_amount = 32;
+    constexpr static std::size_t sending_threads_amount = 8;
+    constexpr static std::chrono::milliseconds request_timeout = std::chrono::seconds(5);
+    constexpr static std::size_t recv_chunk_size = 16 * 1024;
+    constexpr static std::size_t max_request_size = 16 * 1024 * 1024;
+
+    // The threads of the persistent connections of the classic accept() loop. A finished one is joined when the next session starts
+    struct session_thread {
+        std::shared_ptr<session_socket> session; // Reset when the thread is finished
+        std::thread thread;
+        bool finished = false;
+    };
+    std::mutex sessions_mutex;
+    std::list<session_thread> sessions;
+    bool sessions_closed = false;
+    constexpr static std::size_t max_sessions_amount = 64;
+
     id_value_table<big_id_type, response, false> write_tasks_statuses;
+    std::atomic<bool> merge_scheduled = false; // At most one merge is built or waits to be applied
+
+#ifdef __linux__
+    epoll_reactor reactor;
 
-    static inline const std::unordered_map<code_type, std::function<void(SOCKET, server<string_type>&)>> function_map = {
+    directory_watcher watcher;
+    // The changes of a file are reported once it was left alone for this long
+    constexpr static std::chrono::milliseconds watcher_debounce_window = std::chrono::milliseconds(500);
+#endif // __linux__
+
+    static inline const std::unordered_map<code_type, std::function<void(client_connection&, server<string_type>&)>> function_map = {
         { static_cast<code_type>(command::set_new_writer_duration), &server<string_type>::do_index_set_new_writer_duration},
         { static_cast<code_type>(command::set_new_reader_duration), &server<string_type>::do_index_set_new_reader_duration},
         { static_cast<code_type>(command::get_writer_duration), &server<string_type>::do_index_get_writer_duration},
@@ -125,6 +250,10 @@ private:
         { static_cast<code_type>(command::add_file), &server<string_type>::do_index_add_file},
         { static_cast<code_type>(command::has_file), &server<string_type>::do_index_has_file},
         { static_cast<code_type>(command::search), &server<string_type>::do_index_search},
+        { static_cast<code_type>(command::phrase_search), &server<string_type>::do_index_phrase_search},
+        { static_cast<code_type>(command::near_search), &server<string_type>::do_index_near_search},
+        { static_cast<code_type>(command::ranked_search), &server<string_type>::do_index_ranked_search},
+        { static_cast<code_type>(command::save_index), &server<string_type>::do_index_save_index},
     };
 };
 
@@ -135,16 +264,20 @@ inline constexpr bool server<string_type>::is_host_big_endian() {
 
 template <typename string_type>
 inline void server<string_type>::init_protocol() {
+#ifdef _WIN32
     WSADATA wsa_data;
     if (int error_code = WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
         std::string error_message = "WSAStartup (underlying API) failed: " + get_last_error_as_string(true, error_code) + ".";
-        throw std::exception(error_message.c_str());
+        throw std::runtime_error(error_message);
     }
+#endif // _WIN32
 }
 
 template <typename string_type>
 inline void server<string_type>::terminate_protocol() {
+#ifdef _WIN32
     WSACleanup();
+#endif // _WIN32
 }
 
 template <typename string_type>
@@ -152,23 +285,100 @@ inline server<string_type>::server() {
     m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (m_socket == INVALID_SOCKET) {
         std::string error_message = "Error creating socket: " + get_last_error_as_string() + ".";
-        throw std::exception(error_message.c_str());
+        throw std::runtime_error(error_message);
     }
 
     check_requirements();
 
     auto start1 = std::chrono::high_resolution_clock::now();
-    build_index();
-    auto end1 = std::chrono::high_resolution_clock::now();
-    auto time1 = std::chrono::duration_cast<std::chrono::nanoseconds>(end1 - start1);
-    std::cout << "(Building index)\nTime : " << time1.count() << " ns  | " << time1.count() / 1'000'000 << " ms\n";
+    typename index_manager<string_type>::reindex_statistics reindex_statistics;
+    if (load_index(&reindex_statistics)) {
+        auto end1 = std::chrono::high_resolution_clock::now();
+        auto time1 = std::chrono::duration_cast<std::chrono::nanoseconds>(end1 - start1);
+        std::cout << "(Loading index from " << index_path.string() << ")\nTime : " << time1.count() << " ns  | " << time1.count() / 1'000'000 << " ms\n";
+        std::cout << "    Unchanged files : " << reindex_statistics.unchanged_files_amount << "\n";
+        std::cout << "    Added files     : " << reindex_statistics.added_files_amount << "\n";
+        std::cout << "    Modified files  : " << reindex_statistics.modified_files_amount << "\n";
+        std::cout << "    Removed files   : " << reindex_statistics.removed_files_amount << "\n";
+    }
+    else {
+        auto build_statistics = build_index();
+        auto end1 = std::chrono::high_resolution_clock::now();
+        auto time1 = std::chrono::duration_cast<std::chrono::nanoseconds>(end1 - start1);
+        std::cout << "(Building index)\nTime : " << time1.count() << " ns  | " << time1.count() / 1'000'000 << " ms\n";
+
+        auto print_phase = [](const char* phase_name, std::chrono::nanoseconds phase_time) {
+            std::cout << "    " << phase_name << " : " << phase_time.count() << " ns  | " << phase_time.count() / 1'000'000 << " ms\n";
+        };
+        print_phase("Reading and parsing (parallel)  ", build_statistics.parse_time);
+        print_phase("Merging dictionaries (parallel) ", build_statistics.merge_words_time);
+        print_phase("Merging posting lists (parallel)", build_statistics.merge_postings_time);
+        print_phase("Publishing                      ", build_statistics.publish_time);
+        std::cout << "    Files : " << build_statistics.added_files_amount << "\n";
+    }
+
+    // The operations applied after the index was last saved
+    std::vector<typename write_ahead_log<string_type>::record> logged_records;
+    if (!log.open(log_path, logged_records)) {
+        std::string error_message = "Error opening the write-ahead log " + log_path.string() + ".";
+        throw std::runtime_error(error_message);
+    }
+
+    if (!logged_records.empty()) {
+        auto start2 = std::chrono::high_resolution_clock::now();
+        std::size_t applied_amount = replay_write_ahead_log(logged_records);
+        save_index(); // The log starts empty
+        auto end2 = std::chrono::high_resolution_clock::now();
+        auto time2 = std::chrono::duration_cast<std::chrono::nanoseconds>(end2 - start2);
+        std::cout << "(Replaying the write-ahead log " << log_path.string() << ")\nTime : " << time2.count() << " ns  | " << time2.count() / 1'000'000 << " ms\n";
+        std::cout << "    Operations : " << logged_records.size() << " (changed the index: " << applied_amount << ")\n";
+    }
+
+    // Group commit: the records of all the write tasks of a writer phase are synced together
+    thread_pool.set_writer_phase_end_function([this] {
+        log.commit();
+        schedule_merge();
+        }
+    );
+    // A search waits for at most 0.05 s behind the writers, a write for at most 0.5 s behind the searches
+    thread_pool.initialize(std::thread::hardware_concurrency(), 0.05f, 0.5f);
 
-    thread_pool.initialize(std::thread::hardware_concurrency(), 0.5f, 7.5f);
+#ifdef __linux__
+    watcher.initialize(base_dir, watcher_debounce_window, [this](std::vector<directory_watcher::change>&& batch) {
+        thread_pool.add_writer_task([this, batch = std::move(batch)] {
+            do_index_apply_watched_changes_in_write_queue(*this, batch);
+            }
+        );
+        }
+    );
+#endif // __linux__
 }
 
 template <typename string_type>
 inline server<string_type>::~server() {
-    close_connection(m_socket);
+#ifdef __linux__
+    // No more write tasks from the watcher once the thread pool is done
+    watcher.terminate();
+    reactor.terminate();
+#endif // __linux__
+
+    // No receiving or session threads left to add tasks to the destroyed pools
+    receiving_threads.terminate();
+    close_sessions();
+
+    // The queued write tasks are done and their records committed before the index is saved
+    thread_pool.terminate();
+    // Sends the responses of the last tasks
+    sending_threads.terminate();
+
+    // The next start loads the index instead of building it
+    try {
+        save_index();
+    }
+    catch (std::exception&) {}
+
+    log.close();
+    closesocket(m_socket);
 }
 
 template <typename string_type>
@@ -179,14 +389,20 @@ inline void server<string_type>::init_server(const std::string& ip_address, cons
     server_address.sin_addr.s_addr = inet_addr(ip_address.c_str());
     server_address.sin_port = htons(port);
 
+#ifndef _WIN32
+    // Allow restarting the server right away, without waiting for the old connections in TIME_WAIT
+    int reuse_address = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_address, sizeof(reuse_address));
+#endif // _WIN32
+
     if (bind(m_socket, (sockaddr*)&server_address, sizeof(server_address)) == SOCKET_ERROR) {
         std::string error_message = "SERVER (BIND): " + ip_address + ", port: " + std::to_string(port) + " - Bind failed: " + get_last_error_as_string() + ".";
-        throw std::exception(error_message.c_str());
+        throw std::runtime_error(error_message);
     }
 
     if (listen(m_socket, SOMAXCONN) == SOCKET_ERROR) {
         std::string error_message = "SERVER (LISTEN): Listen failed: " + get_last_error_as_string() + ".";
-        throw std::exception(error_message.c_str());
+        throw std::runtime_error(error_message);
     }
 }
 
@@ -215,36 +431,367 @@ inline std::filesystem::path server<string_type>::get_base_dir() const {
     return base_dir;
 }
 
+template <typename string_type>
+inline void server<string_type>::schedule_merge() {
+    if (!index.needs_merge() || merge_scheduled.exchange(true)) {
+        return;
+    }
+
+    thread_pool.add_reader_task([this] {
+        auto built_merge = std::make_shared<typename index_manager<string_type>::segment_merge>();
+        if (!index.build_merge(*built_merge)) {
+            merge_scheduled = false;
+            return;
+        }
+
+        thread_pool.add_writer_task([this, built_merge] {
+            index.apply_merge(*built_merge);
+            merge_scheduled = false;
+            }
+        );
+        }
+    );
+}
+
 template<typename string_type>
 inline void server<string_type>::on_client_accepted(SOCKET client_socket) {
-    thread_pool.add_reader_task(&server<string_type>::serve_client, this, client_socket);
+    if (!receiving_threads.working()) {
+        receiving_threads.initialize(receiving_threads_amount);
+        sending_threads.initialize(sending_threads_amount);
+    }
+
+    set_socket_timeouts(client_socket, request_timeout, request_timeout);
+
+    if (!receiving_threads.add_task([this, client_socket] { receive_request(client_socket); })) {
+        closesocket(client_socket);
+    }
 }
 
 template <typename string_type>
-inline void server<string_type>::serve_client(SOCKET client_socket) {
-    //send_responce_code(client_socket, response::ok); // For stress testing
+inline void server<string_type>::receive_request(SOCKET client_socket) {
+    auto connection = std::make_shared<session_socket>(client_socket);
 
+    std::string request;
+    std::size_t request_size = 0;
+
+    // Every recv times out after request_timeout too, so a client that stalls is let go within twice that
+    auto deadline = std::chrono::steady_clock::now() + request_timeout;
+
+    while (request_size == 0 && request.size() < max_request_size && std::chrono::steady_clock::now() < deadline) {
+        // The command code alone at first: a persistent connection reads its frames from the very next byte
+        std::size_t chunk_size = request.empty() ? sizeof(code_type) : recv_chunk_size;
+        std::size_t old_size = request.size();
+
+        request.resize(old_size + chunk_size);
+        int recv_size = connection->recv_some(request.data() + old_size, chunk_size);
+        request.resize(old_size + std::max(recv_size, 0));
+
+        // The handler answers an incomplete request with an error, as it would reading from the socket
+        if (recv_size <= 0) {
+            break;
+        }
+
+        if (old_size == 0 && static_cast<code_type>(request[0]) == static_cast<code_type>(command::open_session)) {
+            // A persistent connection must not occupy a receiving thread for its whole lifetime: it gets a thread of its own.
+            // It may stay idle between the frames, only its sends time out
+            set_socket_timeouts(client_socket, std::chrono::milliseconds(0), request_timeout);
+            start_session(std::move(connection));
+            return;
+        }
+
+        request_size = get_complete_request_size(request.data(), request.size());
+    }
+
+    thread_pool.add_reader_task([this, connection, request = std::move(request)]() mutable {
+        client_connection client(std::move(request));
+        serve_client(client);
+
+        sending_threads.add_task([connection, response = std::move(client.get_response())] {
+            connection->send_all(response);
+            }
+        );
+        }
+    );
+}
+
+template <typename string_type>
+inline void server<string_type>::serve_client(client_connection& client) {
     code_type to_recv_command_code = 0;
-    int recv_size = recv_integer_value(client_socket, to_recv_command_code);
+    int recv_size = recv_integer_value(client, to_recv_command_code);
     if (recv_size < sizeof(to_recv_command_code)) {
-        send_responce_code_and_close(client_socket, response::error_receiving_command);
+        send_responce_code_and_close(client, response::error_receiving_command);
         return;
     }
 
+    serve_command(client, to_recv_command_code);
+}
+
+template <typename string_type>
+inline void server<string_type>::serve_command(client_connection& client, code_type command_code) {
+    //send_responce_code(client, response::ok); // For stress testing
+
     // Process client command
-    if (auto it = function_map.find(to_recv_command_code); it != function_map.end()) {
-        it->second(client_socket, *this);
+    if (auto it = function_map.find(command_code); it != function_map.end()) {
+        it->second(client, *this);
         // Don't call close_connection here. Do it in the function
     }
     else {
-        send_responce_code_and_close(client_socket, response::invalid_command);
+        send_responce_code_and_close(client, response::invalid_command);
+    }
+}
+
+template <typename string_type>
+inline void server<string_type>::serve_session(std::shared_ptr<session_socket> session) {
+    while (true) {
+        char header[session_frame_header_size];
+        if (session->recv_all(header, sizeof(header))) {
+            break;
+        }
+
+        frame_size_type frame_size = from_big_endian<frame_size_type>(header);
+        if (frame_size < sizeof(request_id_type) || frame_size > max_session_frame_size) {
+            break;
+        }
+
+        // serve_session_request expects the request id in front of the request, just like the event loop passes it
+        std::string request(frame_size, '\0');
+        std::memcpy(request.data(), header + sizeof(frame_size_type), sizeof(request_id_type));
+        if (session->recv_all(request.data() + sizeof(request_id_type), request.size() - sizeof(request_id_type))) {
+            break;
+        }
+
+        thread_pool.add_reader_task([this, session, request = std::move(request)]() mutable {
+            client_connection client(std::move(request));
+
+            sending_threads.add_task([session, response_frame = serve_session_request(client)] {
+                session->send_all(response_frame);
+                }
+            );
+        });
     }
+
+    // The socket is closed by the last task holding the session
 }
 
 template <typename string_type>
-inline void server<string_type>::close_connection(SOCKET client_socket) {
+inline bool server<string_type>::start_session(std::shared_ptr<session_socket> session) {
+    std::lock_guard lock(sessions_mutex);
+
+    for (auto it = sessions.begin(); it != sessions.end();) {
+        if (it->finished) {
+            it->thread.join();
+            it = sessions.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    if (sessions_closed || sessions.size() >= max_sessions_amount) {
+        return false;
+    }
+
+    // The list keeps the element in place until its thread is joined
+    auto it = sessions.emplace(sessions.end());
+    it->session = std::move(session);
+    it->thread = std::thread([this, it] {
+        serve_session(it->session);
+
+        std::lock_guard lock(sessions_mutex);
+        it->session.reset();
+        it->finished = true;
+        }
+    );
+
+    return true;
+}
+
+template <typename string_type>
+inline void server<string_type>::close_sessions() {
+    {
+        std::lock_guard lock(sessions_mutex);
+
+        sessions_closed = true;
+        for (session_thread& session : sessions) {
+            if (session.session) {
+                session.session->shutdown();
+            }
+        }
+    }
+
+    // No sessions are added or removed any more
+    for (session_thread& session : sessions) {
+        session.thread.join();
+    }
+    sessions.clear();
+}
+
+template <typename string_type>
+inline std::string server<string_type>::serve_session_request(client_connection& client) {
+    request_id_type request_id;
+    if (recv_integer_value(client, request_id) < static_cast<int>(sizeof(request_id))) {
+        return std::string(); // Can't be answered without the id
+    }
+
+    serve_client(client);
+
+    const std::string& response_payload = client.get_response();
+
+    std::string response_frame;
+    response_frame.reserve(session_frame_header_size + response_payload.size());
+    append_session_frame(response_frame, request_id, response_payload.data(), response_payload.size());
+
+    return response_frame;
+}
+
+#ifdef __linux__
+template <typename string_type>
+inline void server<string_type>::run_event_loop(std::size_t reactor_count) {
+    auto on_request_received = [this](const std::shared_ptr<reactor_connection>& connection, std::string&& request, bool keep_alive) {
+        // Only the complete request gets to the workers: the handlers never wait for the network
+        thread_pool.add_reader_task([this, connection, request = std::move(request), keep_alive]() mutable {
+            client_connection client(std::move(request));
+
+            if (keep_alive) {
+                reactor.send_response(connection, serve_session_request(client));
+            }
+            else {
+                serve_client(client);
+                reactor.send_response(connection, std::move(client.get_response()));
+                reclaim_response_buffer(client.get_response());
+            }
+        });
+    };
+
+    reactor.initialize(m_socket, reactor_count, &server<string_type>::get_request_frame, on_request_received);
+    reactor.wait();
+}
+
+template <typename string_type>
+inline void server<string_type>::terminate_event_loop() {
+    reactor.terminate();
+}
+#endif // __linux__
+
+#ifdef __linux__
+template <typename string_type>
+inline epoll_reactor::request_frame server<string_type>::get_request_frame(const char* data, std::size_t size, bool keep_alive) {
+    epoll_reactor::request_frame frame;
+
+    if (keep_alive) {
+        // The frame size is not passed on, the request id is: the response has to carry it
+        std::size_t frame_size = get_complete_session_frame_size(data, size);
+        frame.complete = frame_size != 0;
+        frame.skip = sizeof(frame_size_type);
+        frame.size = frame.complete ? frame_size - frame.skip : 0;
+        frame.keep_alive = true;
+    }
+    else if (size > 0 && static_cast<code_type>(data[0]) == static_cast<code_type>(command::open_session)) {
+        frame.complete = true;
+        frame.skip = sizeof(code_type);
+        frame.keep_alive = true;
+    }
+    else {
+        frame.size = get_complete_request_size(data, size);
+        frame.complete = frame.size != 0;
+    }
+
+    return frame;
+}
+#endif // __linux__
+
+template <typename string_type>
+inline std::size_t server<string_type>::get_complete_request_size(const char* data, std::size_t size) {
+    std::size_t offset = 0;
+
+    auto skip_bytes = [&](std::size_t bytes_count) {
+        if (size - offset < bytes_count) {
+            return false;
+        }
+        offset += bytes_count;
+        return true;
+    };
+    auto skip_string = [&]() {
+        if (size - offset < sizeof(std::uint16_t)) {
+            return false;
+        }
+        std::uint16_t byte_size_string = from_big_endian<std::uint16_t>(data + offset);
+        offset += sizeof(byte_size_string);
+        return skip_bytes(byte_size_string);
+    };
+
+    code_type command_code;
+    if (!skip_bytes(sizeof(command_code))) {
+        return 0;
+    }
+    command_code = static_cast<code_type>(data[0]);
+
+    bool complete = false;
+
+    // Mirrors what the do_index_* handlers receive
+    switch (static_cast<command>(command_code)) {
+    case command::set_new_writer_duration:
+    case command::set_new_reader_duration:
+        complete = skip_bytes(sizeof(std::uint32_t));
+        break;
+    case command::get_writer_duration:
+    case command::get_reader_duration:
+    case command::save_index:
+        complete = true;
+        break;
+    case command::get_write_result:
+        complete = skip_bytes(sizeof(big_id_type));
+        break;
+    case command::get_file_content:
+    case command::modify_file:
+    case command::remove_file:
+    case command::has_file:
+        complete = skip_string();
+        break;
+    case command::add_file:
+        if (skip_string() && size - offset >= sizeof(bool)) {
+            bool on_server_flag = data[offset] != 0;
+            offset += sizeof(bool);
+            complete = on_server_flag || skip_string();
+        }
+        break;
+    case command::search:
+    case command::phrase_search:
+    case command::near_search:
+    case command::ranked_search: {
+        // The words follow the files_only flag; near_search also has the maximal distance after it,
+        // ranked_search has only the amount of files to return instead
+        std::size_t header_size = sizeof(bool);
+        if (static_cast<command>(command_code) == command::near_search) {
+            header_size += sizeof(std::uint16_t);
+        }
+        else if (static_cast<command>(command_code) == command::ranked_search) {
+            header_size = sizeof(std::uint16_t);
+        }
+
+        if (skip_bytes(header_size) && size - offset >= sizeof(std::uint16_t)) {
+            std::uint16_t amount_of_words = from_big_endian<std::uint16_t>(data + offset);
+            offset += sizeof(amount_of_words);
+
+            complete = true;
+            for (decltype(amount_of_words) word_idx = 0; complete && word_idx < amount_of_words; ++word_idx) {
+                complete = skip_string();
+            }
+        }
+        break;
+    }
+    default:
+        complete = true; // The handler answers with invalid_command
+        break;
+    }
+
+    return complete ? offset : 0;
+}
+
+template <typename string_type>
+inline void server<string_type>::close_connection(client_connection& client) {
     //std::cout << "connection closed\n";
-    closesocket(client_socket);
+    client.close();
 }
 
 template <typename string_type>
@@ -255,43 +802,103 @@ inline void server<string_type>::check_requirements() {
 }
 
 template <typename string_type>
-inline void server<string_type>::build_index(bool clear_present) {
+inline typename index_manager<string_type>::build_statistics server<string_type>::build_index(bool clear_present) {
     if (clear_present) {
         index.clear_all();
     }
 
+    std::vector<string_type> file_paths = get_base_dir_file_paths();
+
+    typename index_manager<string_type>::build_statistics statistics;
+    index.add_files(file_paths, std::thread::hardware_concurrency(), &statistics);
+
+    return statistics;
+}
+
+template <typename string_type>
+inline bool server<string_type>::load_index(typename index_manager<string_type>::reindex_statistics* p_out_statistics) {
+    return index.load_index(index_path, get_base_dir_file_paths(), std::thread::hardware_concurrency(), p_out_statistics);
+}
+
+template <typename string_type>
+inline bool server<string_type>::save_index() {
+    return log.checkpoint([this] {
+        return index.save_index(index_path);
+    });
+}
+
+template <typename string_type>
+inline std::size_t server<string_type>::replay_write_ahead_log(const std::vector<typename write_ahead_log<string_type>::record>& records) {
+    using operation = typename write_ahead_log<string_type>::operation;
+
+    std::size_t applied_amount = 0;
+    for (const auto& logged_record : records) {
+        bool applied = false;
+        switch (logged_record.operation_type) {
+        case operation::add_file:
+            applied = index.add_file(logged_record.file_path);
+            break;
+        case operation::add_create_file:
+            // The file may have been created before the crash
+            applied = index.add_create_file(logged_record.file_path, logged_record.file_content) || index.add_file(logged_record.file_path);
+            break;
+        case operation::remove_file:
+            applied = index.remove_file(logged_record.file_path);
+            break;
+        case operation::modify_file:
+            applied = index.modify_file(logged_record.file_path);
+            break;
+        }
+
+        if (applied) {
+            ++applied_amount;
+        }
+    }
+
+    return applied_amount;
+}
+
+template <typename string_type>
+inline std::vector<string_type> server<string_type>::get_base_dir_file_paths() const {
     std::filesystem::path canonical_base = std::filesystem::canonical(base_dir);
-    using char_type = string_type::value_type;
 
+    std::vector<string_type> file_paths;
     for (const auto& entry : std::filesystem::recursive_directory_iterator(canonical_base)) {
         if (entry.is_regular_file()) {
             std::filesystem::path relative_path = std::filesystem::relative(entry.path(), canonical_base);
-            std::filesystem::path full_path = base_dir / relative_path;
-
-            if constexpr (std::is_same<char_type, char>::value) {
-                index.add_file(full_path.generic_string());
-            }
-            if constexpr (std::is_same<char_type, char8_t>::value) {
-                index.add_file(full_path.generic_u8string());
-            }
-            else if constexpr (std::is_same<char_type, wchar_t>::value) {
-                index.add_file(full_path.generic_wstring());
-            }
-            else if constexpr (std::is_same<char_type, char16_t>::value) {
-                index.add_file(full_path.generic_u16string());
-            }
-            else if constexpr (std::is_same<char_type, char32_t>::value) {
-                index.add_file(full_path.generic_u32string());
-            }
+            file_paths.push_back(to_generic_string_type(base_dir / relative_path));
         }
     }
+
+    return file_paths;
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_set_new_writer_duration(SOCKET client_socket, server& this_server) {
+inline string_type server<string_type>::to_generic_string_type(const std::filesystem::path& path) {
+    using char_type = string_type::value_type;
+
+    if constexpr (std::is_same<char_type, char>::value) {
+        return path.generic_string();
+    }
+    else if constexpr (std::is_same<char_type, char8_t>::value) {
+        return path.generic_u8string();
+    }
+    else if constexpr (std::is_same<char_type, wchar_t>::value) {
+        return path.generic_wstring();
+    }
+    else if constexpr (std::is_same<char_type, char16_t>::value) {
+        return path.generic_u16string();
+    }
+    else if constexpr (std::is_same<char_type, char32_t>::value) {
+        return path.generic_u32string();
+    }
+}
+
+template <typename string_type>
+inline void server<string_type>::do_index_set_new_writer_duration(client_connection& client, server& this_server) {
     // Receive client data
     std::uint32_t writer_duration_integer;
-    if (recv_integer_value_and_handle(client_socket, writer_duration_integer)) {
+    if (recv_integer_value_and_handle(client, writer_duration_integer)) {
         return;
     }
     float writer_duration = integer_to_ieee754(writer_duration_integer);
@@ -301,18 +908,18 @@ inline void server<string_type>::do_index_set_new_writer_duration(SOCKET client_
 
     // Send results
     if (success) {
-        send_responce_code_and_close(client_socket, response::ok);
+        send_responce_code_and_close(client, response::ok);
     }
     else {
-        send_responce_code_and_close(client_socket, response::new_duration_is_way_too_small);
+        send_responce_code_and_close(client, response::new_duration_is_way_too_small);
     }
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_set_new_reader_duration(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_set_new_reader_duration(client_connection& client, server& this_server) {
     // Receive client data
     std::uint32_t reader_duration_integer;
-    if (recv_integer_value_and_handle(client_socket, reader_duration_integer)) {
+    if (recv_integer_value_and_handle(client, reader_duration_integer)) {
         return;
     }
     float reader_duration = integer_to_ieee754(reader_duration_integer);
@@ -322,44 +929,44 @@ inline void server<string_type>::do_index_set_new_reader_duration(SOCKET client_
 
     // Send results
     if (success) {
-        send_responce_code_and_close(client_socket, response::ok);
+        send_responce_code_and_close(client, response::ok);
     }
     else {
-        send_responce_code_and_close(client_socket, response::new_duration_is_way_too_small);
+        send_responce_code_and_close(client, response::new_duration_is_way_too_small);
     }
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_get_writer_duration(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_get_writer_duration(client_connection& client, server& this_server) {
     // Do query
     float writer_duration = this_server.get_thread_pool().get_writer_duration();
     std::uint32_t writer_duration_integer = ieee754_to_integer(writer_duration);
 
     // Send results
-    send_responce_code(client_socket, response::ok);
-    if (send_integer_value_and_handle(client_socket, writer_duration_integer) == false) {
-        close_connection(client_socket);
+    send_responce_code(client, response::ok);
+    if (send_integer_value_and_handle(client, writer_duration_integer) == false) {
+        close_connection(client);
     }
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_get_reader_duration(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_get_reader_duration(client_connection& client, server& this_server) {
     // Do query
     float reader_duration = this_server.get_thread_pool().get_reader_duration();
     std::uint32_t reader_duration_integer = ieee754_to_integer(reader_duration);
     
     // Send results
-    send_responce_code(client_socket, response::ok);
-    if (send_integer_value_and_handle(client_socket, reader_duration_integer) == false) {
-        close_connection(client_socket);
+    send_responce_code(client, response::ok);
+    if (send_integer_value_and_handle(client, reader_duration_integer) == false) {
+        close_connection(client);
     }
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_get_file_content(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_get_file_content(client_connection& client, server& this_server) {
     // Receive client data
     string_type filename;
-    if (recv_size_and_string_and_handle(client_socket, filename, false)) {
+    if (recv_size_and_string_and_handle(client, filename, false)) {
         return;
     }
 
@@ -369,24 +976,24 @@ inline void server<string_type>::do_index_get_file_content(SOCKET client_socket,
 
     // Send results
     if (file_exist) {
-        send_responce_code(client_socket, response::ok);
+        send_responce_code(client, response::ok);
 
-        if (send_size_and_utf8_string_and_handle(client_socket, file_content)) {
+        if (send_size_and_utf8_string_and_handle(client, file_content)) {
             return;
         }
 
-        close_connection(client_socket);
+        close_connection(client);
     }
     else {
-        send_responce_code_and_close(client_socket, response::file_not_found);
+        send_responce_code_and_close(client, response::file_not_found);
     }
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_get_write_result(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_get_write_result(client_connection& client, server& this_server) {
     // Receive client data
     big_id_type write_task_id;
-    if (recv_integer_value_and_handle(client_socket, write_task_id)) {
+    if (recv_integer_value_and_handle(client, write_task_id)) {
         return;
     }
 
@@ -400,14 +1007,14 @@ inline void server<string_type>::do_index_get_write_result(SOCKET client_socket,
     }
 
     // Send results
-    send_responce_code_and_close(client_socket, result);
+    send_responce_code_and_close(client, result);
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_modify_file(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_modify_file(client_connection& client, server& this_server) {
     // Receive client data
     string_type filename;
-    if (recv_size_and_string_and_handle(client_socket, filename, false)) {
+    if (recv_size_and_string_and_handle(client, filename, false)) {
         return;
     }
 
@@ -420,17 +1027,17 @@ inline void server<string_type>::do_index_modify_file(SOCKET client_socket, serv
     );
 
     // Send info about a successfully added write operation to the queue
-    send_responce_code(client_socket, response::ok);
-    if (send_integer_value_and_handle(client_socket, write_task_id) == false) {
-        close_connection(client_socket);
+    send_responce_code(client, response::ok);
+    if (send_integer_value_and_handle(client, write_task_id) == false) {
+        close_connection(client);
     }
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_remove_file(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_remove_file(client_connection& client, server& this_server) {
     // Receive client data
     string_type filename;
-    if (recv_size_and_string_and_handle(client_socket, filename, false)) {
+    if (recv_size_and_string_and_handle(client, filename, false)) {
         return;
     }
 
@@ -443,27 +1050,27 @@ inline void server<string_type>::do_index_remove_file(SOCKET client_socket, serv
     );
 
     // Send info about a successfully added write operation to the queue
-    send_responce_code(client_socket, response::ok);
-    if (send_integer_value_and_handle(client_socket, write_task_id) == false) {
-        close_connection(client_socket);
+    send_responce_code(client, response::ok);
+    if (send_integer_value_and_handle(client, write_task_id) == false) {
+        close_connection(client);
     }
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_add_file(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_add_file(client_connection& client, server& this_server) {
     // Receive client data
     string_type filename;
-    if (recv_size_and_string_and_handle(client_socket, filename, false)) {
+    if (recv_size_and_string_and_handle(client, filename, false)) {
         return;
     }
 
     bool on_server_flag = true;
-    if (recv_integer_value_and_handle(client_socket, on_server_flag, true)) {
+    if (recv_integer_value_and_handle(client, on_server_flag, true)) {
         return;
     }
 
     string_type file_content;
-    if (on_server_flag == false && recv_size_and_string_and_handle(client_socket, file_content, false)) {
+    if (on_server_flag == false && recv_size_and_string_and_handle(client, file_content, false)) {
         return;
     }
 
@@ -504,17 +1111,17 @@ inline void server<string_type>::do_index_add_file(SOCKET client_socket, server&
     }
 
     // Send info about a successfully added write operation to the queue
-    send_responce_code(client_socket, response::ok);
-    if (send_integer_value_and_handle(client_socket, write_task_id) == false) {
-        close_connection(client_socket);
+    send_responce_code(client, response::ok);
+    if (send_integer_value_and_handle(client, write_task_id) == false) {
+        close_connection(client);
     }
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_has_file(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_has_file(client_connection& client, server& this_server) {
     // Receive client data
     string_type filename;
-    if (recv_size_and_string_and_handle(client_socket, filename)) {
+    if (recv_size_and_string_and_handle(client, filename, false)) {
         return;
     }
 
@@ -524,25 +1131,39 @@ inline void server<string_type>::do_index_has_file(SOCKET client_socket, server&
 
     // Send results
     if (found) {
-        send_responce_code_and_close(client_socket, response::ok);
+        send_responce_code_and_close(client, response::ok);
     }
     else {
-        send_responce_code_and_close(client_socket, response::file_not_found);
+        send_responce_code_and_close(client, response::file_not_found);
     }
 
     return;
 }
 
 template <typename string_type>
-inline void server<string_type>::do_index_search(SOCKET client_socket, server& this_server) {
+inline void server<string_type>::do_index_save_index(client_connection& client, server& this_server) {
+    // Do query
+    bool saved = this_server.save_index();
+
+    // Send results
+    if (saved) {
+        send_responce_code_and_close(client, response::ok);
+    }
+    else {
+        send_responce_code_and_close(client, response::could_not_save_index);
+    }
+}
+
+template <typename string_type>
+inline void server<string_type>::do_index_search(client_connection& client, server& this_server) {
     // Receive client data
     bool files_only = true;
-    if (recv_integer_value_and_handle(client_socket, files_only, true)) {
+    if (recv_integer_value_and_handle(client, files_only, true)) {
         return;
     }
 
     std::uint16_t amount_of_words;
-    if (recv_integer_value_and_handle(client_socket, amount_of_words)) {
+    if (recv_integer_value_and_handle(client, amount_of_words)) {
         return;
     }
 
@@ -553,152 +1174,398 @@ inline void server<string_type>::do_index_search(SOCKET client_socket, server& t
     lowered_word_set.reserve(amount_of_words);
 
     for (decltype(amount_of_words) word_idx = 0; word_idx < amount_of_words; ++word_idx) {
-        if (recv_size_and_string_and_handle(client_socket, lowered_word)) { // lowered_word is assigned with a new string
+        if (recv_size_and_string_and_handle(client, lowered_word)) { // lowered_word is assigned with a new string
             return;
         }
 
         lowered_word_set.emplace(std::move(lowered_word));
     }
 
-    //send_responce_code(client_socket, response::ok); // For stress test
+    //send_responce_code(client, response::ok); // For stress test
     // Do query
-    std::unordered_set<word_entry> out_word_entries;
-    std::unordered_set<id_type> out_file_ids;
-    const std::unordered_set<word_entry>* cp_out_word_entries = nullptr;
-    const std::unordered_set<id_type>* cp_out_file_ids = nullptr;
+    std::vector<word_entry> out_word_entries;
+    std::vector<id_type> out_file_ids;
+    const posting_list_type* cp_out_word_entries = nullptr;
 
-    std::unordered_map<id_type, const string_type&> out_files_table;
+    typename index_manager<string_type>::found_files_table out_files_table;
+
+    payload_writer& result = get_response_writer();
 
     bool found = false;
     std::pair<bool, id_type> found_with_id;
 
-    bool more_than_one_word = lowered_word_set.size() > 1;
-    if (more_than_one_word) {
-        if (files_only) {
-            found = this_server.get_index().get_file_set_for_lowered_word_set(lowered_word_set, out_file_ids, out_files_table);
+    {
+        auto snapshot = this_server.get_index().get_snapshot();
+
+        bool more_than_one_word = lowered_word_set.size() > 1;
+        if (more_than_one_word) {
+            if (files_only) {
+                found = snapshot->get_file_set_for_lowered_word_set(lowered_word_set, out_file_ids, out_files_table);
+            }
+            else {
+                found = snapshot->get_word_entry_set_for_lowered_word_set(lowered_word_set, out_word_entries, out_files_table);
+            }
         }
         else {
-            found = this_server.get_index().get_word_entry_set_for_lowered_word_set(lowered_word_set, out_word_entries, out_files_table);
+            auto single_element = std::begin(lowered_word_set);
+
+            if (files_only) {
+                found_with_id = snapshot->get_file_set_for_lowered_word(*single_element, out_file_ids, out_files_table);
+                found = found_with_id.first;
+            }
+            else {
+                found_with_id = snapshot->get_word_entry_set_for_lowered_word(*single_element, cp_out_word_entries, out_word_entries, out_files_table);
+                found = found_with_id.first;
+            }
         }
-    }
-    else {
-        auto single_element = std::begin(lowered_word_set);
 
-        if (files_only) {
-            found_with_id = this_server.get_index().get_file_set_for_lowered_word(*single_element, cp_out_file_ids, out_files_table);
-            found = found_with_id.first;
+        if (found) {
+            if (cp_out_word_entries != nullptr) {
+                write_search_result(result, files_only, out_files_table, *cp_out_word_entries);
+            }
+            else {
+                write_search_result(result, files_only, out_files_table, out_word_entries);
+            }
         }
-        else {
-            found_with_id = this_server.get_index().get_word_entry_set_for_lowered_word(*single_element, cp_out_word_entries, out_files_table);
-            found = found_with_id.first;
+    }
+
+    // Send results
+    if (!found) {
+        send_responce_code_and_close(client, response::search_query_entries_not_found);
+        return;
+    }
+
+    send_payload_and_close(client, result);
+}
+
+template <typename string_type>
+inline void server<string_type>::do_index_phrase_search(client_connection& client, server& this_server) {
+    // Receive client data
+    bool files_only = true;
+    if (recv_integer_value_and_handle(client, files_only, true)) {
+        return;
+    }
+
+    std::uint16_t amount_of_words;
+    if (recv_integer_value_and_handle(client, amount_of_words)) {
+        return;
+    }
+
+    // The words of a phrase keep their order and may repeat
+    std::vector<string_type> lowered_phrase(amount_of_words);
+    for (auto& lowered_word : lowered_phrase) {
+        if (recv_size_and_string_and_handle(client, lowered_word)) {
+            return;
         }
     }
 
-    id_type found_files_amount = out_files_table.size();
+    // Do query
+    std::vector<word_entry> out_word_entries;
+    std::vector<id_type> out_file_ids;
+    typename index_manager<string_type>::found_files_table out_files_table;
+
+    payload_writer& result = get_response_writer();
+
+    bool found = false;
+    {
+        auto snapshot = this_server.get_index().get_snapshot();
+
+        found = files_only
+            ? snapshot->get_file_set_for_lowered_phrase(lowered_phrase, out_file_ids, out_files_table)
+            : snapshot->get_word_entry_set_for_lowered_phrase(lowered_phrase, out_word_entries, out_files_table);
+
+        if (found) {
+            write_search_result(result, files_only, out_files_table, out_word_entries);
+        }
+    }
 
     // Send results
-    if (found) {
-        send_responce_code(client_socket, response::ok);
-        if (send_integer_value_and_handle(client_socket, found_files_amount)) {
+    if (!found) {
+        send_responce_code_and_close(client, response::search_query_entries_not_found);
+        return;
+    }
+
+    send_payload_and_close(client, result);
+}
+
+template <typename string_type>
+inline void server<string_type>::do_index_near_search(client_connection& client, server& this_server) {
+    // Receive client data
+    bool files_only = true;
+    if (recv_integer_value_and_handle(client, files_only, true)) {
+        return;
+    }
+
+    std::uint16_t max_distance;
+    if (recv_integer_value_and_handle(client, max_distance, true)) {
+        return;
+    }
+
+    std::uint16_t amount_of_words;
+    if (recv_integer_value_and_handle(client, amount_of_words)) {
+        return;
+    }
+
+    string_type lowered_word;
+    std::unordered_set<string_type> lowered_word_set;
+    lowered_word_set.reserve(amount_of_words);
+
+    for (decltype(amount_of_words) word_idx = 0; word_idx < amount_of_words; ++word_idx) {
+        if (recv_size_and_string_and_handle(client, lowered_word)) { // lowered_word is assigned with a new string
             return;
         }
 
-        if (files_only) {
-            for (const auto& [file_id, filepath] : out_files_table) {
-                if (send_size_and_string_and_handle(client_socket, filepath)) {
-                    return;
-                }
-            }
+        lowered_word_set.emplace(std::move(lowered_word));
+    }
+
+    // Do query
+    std::vector<word_entry> out_word_entries;
+    std::vector<id_type> out_file_ids;
+    typename index_manager<string_type>::found_files_table out_files_table;
+
+    payload_writer& result = get_response_writer();
+
+    bool found = false;
+    {
+        auto snapshot = this_server.get_index().get_snapshot();
+
+        found = files_only
+            ? snapshot->get_file_set_for_lowered_near_words(lowered_word_set, max_distance, out_file_ids, out_files_table)
+            : snapshot->get_word_entry_set_for_lowered_near_words(lowered_word_set, max_distance, out_word_entries, out_files_table);
+
+        if (found) {
+            write_search_result(result, files_only, out_files_table, out_word_entries);
         }
-        else {
-            for (const auto& [file_id, filepath] : out_files_table) {
-                if (send_integer_value_and_handle(client_socket, file_id)) {
-                    return;
-                }
-                if (send_size_and_string_and_handle(client_socket, filepath)) {
-                    return;
-                }
-            }
+    }
 
-            const std::unordered_set<word_entry>& word_entries = more_than_one_word ? out_word_entries : *cp_out_word_entries;
+    // Send results
+    if (!found) {
+        send_responce_code_and_close(client, response::search_query_entries_not_found);
+        return;
+    }
 
-            std::uint64_t entries_amount = word_entries.size();
-            if (send_integer_value_and_handle(client_socket, entries_amount)) {
-                return;
-            }
+    send_payload_and_close(client, result);
+}
 
-            for (const auto& entry : word_entries) {
-                send_integer_value(client_socket, entry.file_id);
-                send_integer_value(client_socket, entry.position);
+template <typename string_type>
+inline void server<string_type>::do_index_ranked_search(client_connection& client, server& this_server) {
+    // Receive client data
+    std::uint16_t top_k;
+    if (recv_integer_value_and_handle(client, top_k)) {
+        return;
+    }
+
+    std::uint16_t amount_of_words;
+    if (recv_integer_value_and_handle(client, amount_of_words)) {
+        return;
+    }
+
+    string_type lowered_word;
+    std::unordered_set<string_type> lowered_word_set;
+    lowered_word_set.reserve(amount_of_words);
+
+    for (decltype(amount_of_words) word_idx = 0; word_idx < amount_of_words; ++word_idx) {
+        if (recv_size_and_string_and_handle(client, lowered_word)) { // lowered_word is assigned with a new string
+            return;
+        }
+
+        lowered_word_set.emplace(std::move(lowered_word));
+    }
+
+    // Do query
+    std::vector<float> out_scores;
+    typename index_manager<string_type>::found_files_table out_files_table;
+
+    payload_writer& result = get_response_writer();
+
+    bool found = false;
+    {
+        auto snapshot = this_server.get_index().get_snapshot();
+
+        found = snapshot->get_ranked_file_set_for_lowered_word_set(lowered_word_set, top_k, out_scores, out_files_table);
+
+        if (found) {
+            result.write_integer_value(static_cast<code_type>(response::ok));
+            result.write_integer_value(static_cast<id_type>(out_files_table.size()));
+
+            // Best file first: the score as an IEEE 754 float, then the path
+            for (std::size_t file_idx = 0; file_idx < out_files_table.size(); ++file_idx) {
+                result.write_integer_value(ieee754_to_integer(out_scores[file_idx]));
+                result.write_size_and_utf8_string(to_utf8(out_files_table[file_idx].second));
             }
         }
+    }
+
+    // Send results
+    if (!found) {
+        send_responce_code_and_close(client, response::search_query_entries_not_found);
+        return;
+    }
+
+    send_payload_and_close(client, result);
+}
+
+template <typename string_type>
+template <typename word_entries_type>
+inline void server<string_type>::write_search_result(payload_writer& result, bool files_only, const typename index_manager<string_type>::found_files_table& files_table, const word_entries_type& word_entries) {
+    id_type found_files_amount = files_table.size();
 
-        close_connection(client_socket);
+    // The whole result is serialized first and leaves in a few large writes, not in a send() per value
+    result.write_integer_value(static_cast<code_type>(response::ok));
+    result.write_integer_value(found_files_amount);
+
+    if (files_only) {
+        for (const auto& [file_id, filepath] : files_table) {
+            result.write_size_and_utf8_string(to_utf8(filepath));
+        }
     }
     else {
-        send_responce_code_and_close(client_socket, response::search_query_entries_not_found);
-    }
+        for (const auto& [file_id, filepath] : files_table) {
+            result.write_integer_value(file_id);
+            result.write_size_and_utf8_string(to_utf8(filepath));
+        }
 
-    return;
+        std::uint64_t entries_amount = word_entries.size();
+        result.reserve(result.get_payload().size() + sizeof(entries_amount) + entries_amount * 2 * sizeof(id_type));
+        result.write_integer_value(entries_amount);
+
+        for (const word_entry entry : word_entries) {
+            result.write_integer_value(entry.file_id);
+            result.write_integer_value(entry.position);
+        }
+    }
 }
 
 template <typename string_type>
 inline void server<string_type>::do_index_add_file_in_write_queue(server& this_server, big_id_type write_task_id, string_type&& file_path) {
     this_server.get_write_tasks_statuses().modify_by_id(write_task_id, response::operation_is_in_progress);
 
+    string_type logged_file_path = file_path;
     bool added_file = this_server.get_index().add_file(std::move(file_path));
 
-    response done_response = added_file ? response::ok : response::could_not_add_file;
-    this_server.get_write_tasks_statuses().modify_by_id(write_task_id, done_response);
+    if (added_file) {
+        log_write_operation(this_server, write_task_id, write_ahead_log<string_type>::operation::add_file, std::move(logged_file_path));
+    }
+    else {
+        this_server.get_write_tasks_statuses().modify_by_id(write_task_id, response::could_not_add_file);
+    }
 }
 
 template <typename string_type>
 inline void server<string_type>::do_index_add_create_file_in_write_queue(server& this_server, big_id_type write_task_id, string_type&& file_path, string_type&& file_content) {
     this_server.get_write_tasks_statuses().modify_by_id(write_task_id, response::operation_is_in_progress);
 
+    string_type logged_file_path = file_path;
+    string_type logged_file_content = file_content;
     bool added_file = this_server.get_index().add_create_file(std::move(file_path), std::move(file_content));
 
-    response done_response = added_file ? response::ok : response::could_not_add_file;
-    this_server.get_write_tasks_statuses().modify_by_id(write_task_id, done_response);
+    if (added_file) {
+        log_write_operation(this_server, write_task_id, write_ahead_log<string_type>::operation::add_create_file, std::move(logged_file_path), std::move(logged_file_content));
+    }
+    else {
+        this_server.get_write_tasks_statuses().modify_by_id(write_task_id, response::could_not_add_file);
+    }
 }
 
 template<typename string_type>
 inline void server<string_type>::do_index_remove_file_in_write_queue(server& this_server, big_id_type write_task_id, string_type&& file_path) {
     this_server.get_write_tasks_statuses().modify_by_id(write_task_id, response::operation_is_in_progress);
 
+    string_type logged_file_path = file_path;
     bool deleted_file = this_server.get_index().remove_file(std::move(file_path));
 
-    response done_response = deleted_file ? response::ok : response::file_not_found;
-    this_server.get_write_tasks_statuses().modify_by_id(write_task_id, done_response);
+    if (deleted_file) {
+        log_write_operation(this_server, write_task_id, write_ahead_log<string_type>::operation::remove_file, std::move(logged_file_path));
+    }
+    else {
+        this_server.get_write_tasks_statuses().modify_by_id(write_task_id, response::file_not_found);
+    }
 }
 
 template<typename string_type>
 inline void server<string_type>::do_index_modify_file_in_write_queue(server& this_server, big_id_type write_task_id, string_type&& file_path) {
     this_server.get_write_tasks_statuses().modify_by_id(write_task_id, response::operation_is_in_progress);
 
+    string_type logged_file_path = file_path;
     bool modified_file = this_server.get_index().modify_file(std::move(file_path));
 
-    response done_response = modified_file ? response::ok : response::file_not_found;
-    this_server.get_write_tasks_statuses().modify_by_id(write_task_id, done_response);
+    if (modified_file) {
+        log_write_operation(this_server, write_task_id, write_ahead_log<string_type>::operation::modify_file, std::move(logged_file_path));
+    }
+    else {
+        this_server.get_write_tasks_statuses().modify_by_id(write_task_id, response::file_not_found);
+    }
+}
+
+template<typename string_type>
+inline void server<string_type>::log_write_operation(server& this_server, big_id_type write_task_id, typename write_ahead_log<string_type>::operation operation_type, string_type&& file_path, string_type&& file_content) {
+    typename write_ahead_log<string_type>::record operation_record;
+    operation_record.operation_type = operation_type;
+    operation_record.file_path = std::move(file_path);
+    operation_record.file_content = std::move(file_content);
+
+    this_server.log.append(operation_record, [&this_server, write_task_id](bool durable) {
+        response done_response = durable ? response::ok : response::could_not_log_operation;
+        this_server.get_write_tasks_statuses().modify_by_id(write_task_id, done_response);
+        }
+    );
 }
 
+#ifdef __linux__
+template<typename string_type>
+inline void server<string_type>::do_index_apply_watched_changes_in_write_queue(server& this_server, const std::vector<directory_watcher::change>& batch) {
+    using operation = typename write_ahead_log<string_type>::operation;
+    index_manager<string_type>& index = this_server.get_index();
+
+    for (const directory_watcher::change& file_change : batch) {
+        string_type file_path = to_generic_string_type(file_change.file_path);
+
+        operation applied_operation;
+        bool applied = false;
+        if (file_change.type == directory_watcher::change_type::removed) {
+            applied_operation = operation::remove_file;
+            applied = index.remove_file(file_path);
+        }
+        else if (index.is_file_unchanged(file_path)) {
+            continue; // Written by add_create_file, or walked again after an overflow
+        }
+        else if (index.has_file(file_path).first) {
+            applied_operation = operation::modify_file;
+            applied = index.modify_file(file_path);
+        }
+        else {
+            applied_operation = operation::add_file;
+            applied = index.add_file(file_path);
+        }
+
+        if (applied) {
+            // Nobody polls for these, so nobody waits for them to be durable
+            typename write_ahead_log<string_type>::record operation_record;
+            operation_record.operation_type = applied_operation;
+            operation_record.file_path = std::move(file_path);
+            this_server.log.append(operation_record, [](bool) {});
+        }
+    }
+}
+#endif // __linux__
+
 template <typename string_type>
-inline void server<string_type>::send_responce_code(SOCKET client_socket, response response_code) {
+inline void server<string_type>::send_responce_code(client_connection& client, response response_code) {
     code_type to_send_response_code = static_cast<code_type>(response_code);
-    send_integer_value(client_socket, to_send_response_code);
+    send_integer_value(client, to_send_response_code);
 }
 
 template <typename string_type>
-inline void server<string_type>::send_responce_code_and_close(SOCKET client_socket, response responce_code) {
-    send_responce_code(client_socket, responce_code);
-    close_connection(client_socket);
+inline void server<string_type>::send_responce_code_and_close(client_connection& client, response responce_code) {
+    send_responce_code(client, responce_code);
+    close_connection(client);
 }
 
 template <typename string_type>
 template <typename T>
-inline int server<string_type>::recv_integer_value(SOCKET client_socket, T& out_value) {
+inline int server<string_type>::recv_integer_value(client_connection& client, T& out_value) {
     char value_buffer[sizeof(out_value)];
-    int recv_size = recv(client_socket, value_buffer, sizeof(value_buffer), 0);
+    int recv_size = client.recv(value_buffer, sizeof(value_buffer));
     if (recv_size > 0) {
         out_value = from_big_endian<T>(value_buffer);
     }
@@ -707,23 +1574,23 @@ inline int server<string_type>::recv_integer_value(SOCKET client_socket, T& out_
 
 template <typename string_type>
 template <typename T>
-inline int server<string_type>::send_integer_value(SOCKET client_socket, T value) {
+inline int server<string_type>::send_integer_value(client_connection& client, T value) {
     char value_buffer[sizeof(value)];
     to_big_endian<T>(value, value_buffer);
 
-    return send(client_socket, value_buffer, sizeof(value_buffer), 0);
+    return client.send(value_buffer, sizeof(value_buffer));
 }
 
 template <typename string_type>
 template <typename T>
-inline bool server<string_type>::recv_integer_value_and_handle(SOCKET client_socket, T& out_value, bool can_be_zero) {
-    int recv_size = recv_integer_value<T>(client_socket, out_value);
+inline bool server<string_type>::recv_integer_value_and_handle(client_connection& client, T& out_value, bool can_be_zero) {
+    int recv_size = recv_integer_value<T>(client, out_value);
     if (recv_size <= 0) {
-        send_responce_code_and_close(client_socket, response::error_receiving_data);
+        send_responce_code_and_close(client, response::error_receiving_data);
         return true;
     }
     else if (can_be_zero == false && out_value == 0) {
-        send_responce_code_and_close(client_socket, response::argument_is_zero);
+        send_responce_code_and_close(client, response::argument_is_zero);
         return true;
     }
     return false;
@@ -731,19 +1598,19 @@ inline bool server<string_type>::recv_integer_value_and_handle(SOCKET client_soc
 
 template <typename string_type>
 template <typename T>
-inline bool server<string_type>::send_integer_value_and_handle(SOCKET client_socket, T value) {
-    int send_size = send_integer_value<T>(client_socket, value);
+inline bool server<string_type>::send_integer_value_and_handle(client_connection& client, T value) {
+    int send_size = send_integer_value<T>(client, value);
     if (send_size <= 0) {
-        close_connection(client_socket);
+        close_connection(client);
         return true;
     }
     return false;
 }
 
 template <typename string_type>
-inline bool server<string_type>::recv_size_and_string_and_handle(SOCKET client_socket, string_type& out_string, bool tolower) {
+inline bool server<string_type>::recv_size_and_string_and_handle(client_connection& client, string_type& out_string, bool tolower) {
     std::uint16_t byte_size_string;
-    if (recv_integer_value_and_handle(client_socket, byte_size_string)) {
+    if (recv_integer_value_and_handle(client, byte_size_string)) {
         return true;
     }
 
@@ -753,9 +1620,9 @@ inline bool server<string_type>::recv_size_and_string_and_handle(SOCKET client_s
     while (total_received < byte_size_string) {
         int bytes_to_receive = std::min(1024, byte_size_string - total_received);
 
-        int recv_size = recv(client_socket, &utf8_string[total_received], bytes_to_receive, 0);
+        int recv_size = client.recv(&utf8_string[total_received], bytes_to_receive);
         if (recv_size <= 0) {
-            send_responce_code_and_close(client_socket, response::error_receiving_data);
+            send_responce_code_and_close(client, response::error_receiving_data);
             return true;
         }
         total_received += recv_size;
@@ -781,23 +1648,11 @@ inline bool server<string_type>::recv_size_and_string_and_handle(SOCKET client_s
 }
 
 template <typename string_type>
-inline bool server<string_type>::send_size_and_string_and_handle(SOCKET client_socket, const string_type& string) {
-    using char_type = string_type::value_type;
-
-    std::string utf8_string;
-
-    if constexpr (std::is_same<char_type, char>::value) {
-        utf8_string = string;
-    }
-    else if constexpr (std::is_same<char_type, char8_t>::value) {
-        utf8_string = string_type(reinterpret_cast<const char8_t*>(string.data()), string.size());
-    }
-    else {
-        utf8_string = utf_converter<char_type>::string_type_to_utf8(string);
-    }
+inline bool server<string_type>::send_size_and_string_and_handle(client_connection& client, const string_type& string) {
+    std::string utf8_string = to_utf8(string);
 
     std::uint16_t byte_size_string = utf8_string.size();
-    if (send_integer_value_and_handle(client_socket, byte_size_string)) {
+    if (send_integer_value_and_handle(client, byte_size_string)) {
         return true;
     }
 
@@ -805,9 +1660,9 @@ inline bool server<string_type>::send_size_and_string_and_handle(SOCKET client_s
     while (total_sent < byte_size_string) {
         int bytes_to_send = std::min(1024, byte_size_string - total_sent);
 
-        int send_size = send(client_socket, &utf8_string[total_sent], bytes_to_send, 0);
+        int send_size = client.send(&utf8_string[total_sent], bytes_to_send);
         if (send_size <= 0) {
-            close_connection(client_socket);
+            close_connection(client);
             return true;
         }
         total_sent += send_size;
@@ -816,9 +1671,9 @@ inline bool server<string_type>::send_size_and_string_and_handle(SOCKET client_s
 }
 
 template<typename string_type>
-inline bool server<string_type>::recv_size_and_utf8_string_and_handle(SOCKET client_socket, std::string& out_string) {
+inline bool server<string_type>::recv_size_and_utf8_string_and_handle(client_connection& client, std::string& out_string) {
     std::uint16_t byte_size_string;
-    if (recv_integer_value_and_handle(client_socket, byte_size_string)) {
+    if (recv_integer_value_and_handle(client, byte_size_string)) {
         return true;
     }
 
@@ -828,9 +1683,9 @@ inline bool server<string_type>::recv_size_and_utf8_string_and_handle(SOCKET cli
     while (total_received < byte_size_string) {
         int bytes_to_receive = std::min(1024, byte_size_string - total_received);
 
-        int recv_size = recv(client_socket, &out_string[total_received], bytes_to_receive, 0);
+        int recv_size = client.recv(&out_string[total_received], bytes_to_receive);
         if (recv_size <= 0) {
-            close_connection(client_socket);
+            close_connection(client);
             return true;
         }
         total_received += recv_size;
@@ -840,9 +1695,9 @@ inline bool server<string_type>::recv_size_and_utf8_string_and_handle(SOCKET cli
 }
 
 template<typename string_type>
-inline bool server<string_type>::send_size_and_utf8_string_and_handle(SOCKET client_socket, const std::string& string) {
+inline bool server<string_type>::send_size_and_utf8_string_and_handle(client_connection& client, const std::string& string) {
     std::uint16_t byte_size_string = string.size();
-    if (send_integer_value_and_handle(client_socket, byte_size_string)) {
+    if (send_integer_value_and_handle(client, byte_size_string)) {
         return true;
     }
 
@@ -850,9 +1705,25 @@ inline bool server<string_type>::send_size_and_utf8_string_and_handle(SOCKET cli
     while (total_sent < byte_size_string) {
         int bytes_to_send = std::min(1024, byte_size_string - total_sent);
 
-        int send_size = send(client_socket, &string[total_sent], bytes_to_send, 0);
+        int send_size = client.send(&string[total_sent], bytes_to_send);
+        if (send_size <= 0) {
+            close_connection(client);
+            return true;
+        }
+        total_sent += send_size;
+    }
+    return false;
+}
+
+template <typename string_type>
+inline bool server<string_type>::send_payload_and_handle(client_connection& client, const std::string& payload) {
+    std::size_t total_sent = 0;
+    while (total_sent < payload.size()) {
+        int bytes_to_send = static_cast<int>(std::min<std::size_t>(payload.size() - total_sent, max_send_size));
+
+        int send_size = client.send(payload.data() + total_sent, bytes_to_send);
         if (send_size <= 0) {
-            close_connection(client_socket);
+            close_connection(client);
             return true;
         }
         total_sent += send_size;
@@ -860,8 +1731,74 @@ inline bool server<string_type>::send_size_and_utf8_string_and_handle(SOCKET cli
     return false;
 }
 
+template <typename string_type>
+inline bool server<string_type>::send_payload_and_close(client_connection& client, payload_writer& payload) {
+    if (client.is_buffered() && !client.is_closed() && client.get_response().empty()) {
+        std::size_t capacity = payload.capacity();
+        payload.swap_payload(client.get_response());
+
+        this_worker_response.capacity = capacity <= max_reused_response_capacity ? capacity : 0;
+
+        close_connection(client);
+        return false;
+    }
+
+    if (send_payload_and_handle(client, payload.get_payload())) {
+        return true;
+    }
+
+    close_connection(client);
+    return false;
+}
+
+template <typename string_type>
+inline payload_writer& server<string_type>::get_response_writer() {
+    payload_writer& writer = this_worker_response.writer;
+
+    // Don't let a single huge result pin its memory for the lifetime of the worker
+    if (writer.capacity() > max_reused_response_capacity) {
+        writer = payload_writer();
+    }
+
+    writer.clear();
+    if (writer.capacity() < this_worker_response.capacity) {
+        writer.reserve(this_worker_response.capacity);
+    }
+
+    return writer;
+}
+
+template <typename string_type>
+inline void server<string_type>::reclaim_response_buffer(std::string& response) {
+    payload_writer& writer = this_worker_response.writer;
+
+    if (response.capacity() > writer.capacity() && response.capacity() <= max_reused_response_capacity) {
+        writer.swap_payload(response);
+    }
+}
+
+template <typename string_type>
+inline std::string server<string_type>::to_utf8(const string_type& string) {
+    using char_type = string_type::value_type;
+
+    std::string utf8_string;
+
+    if constexpr (std::is_same<char_type, char>::value) {
+        utf8_string = string;
+    }
+    else if constexpr (std::is_same<char_type, char8_t>::value) {
+        utf8_string = string_type(reinterpret_cast<const char8_t*>(string.data()), string.size());
+    }
+    else {
+        utf8_string = utf_converter<char_type>::string_type_to_utf8(string);
+    }
+
+    return utf8_string;
+}
+
 template <typename string_type>
 inline std::string server<string_type>::get_last_error_as_string(bool pass_error_code, int error_code) {
+#ifdef _WIN32
     DWORD error_message_id = error_code;
 
     if (!pass_error_code) {
@@ -885,4 +1822,7 @@ inline std::string server<string_type>::get_last_error_as_string(bool pass_error
     LocalFree(message_buffer);
 
     return message;
+#else
+    return std::strerror(pass_error_code ? error_code : errno);
+#endif // _WIN32
 }
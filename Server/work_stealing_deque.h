@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+// ===============================================================================================================
+// Chase-Lev work-stealing deque. One owner thread pushes and pops at the bottom, as a stack, so the tasks it spawns
+// run next and on the same core; any other thread steals the oldest element from the top. Neither side takes a lock:
+// the owner only races with the thieves for the last element, and every race is settled by a CAS on top.
+// The ring buffer grows when full. The old ones are kept until the deque is destroyed, a thief may still be reading one.
+// T must be trivially copyable (a pointer to the task), the elements are copied in and out of atomic slots
+// ===============================================================================================================
+
+template <typename T>
+class work_stealing_deque {
+    static_assert(std::is_trivially_copyable_v<T>, "work_stealing_deque holds trivially copyable elements");
+
+public:
+    inline explicit work_stealing_deque(std::size_t initial_capacity = 256);
+    inline ~work_stealing_deque() = default;
+
+    inline work_stealing_deque(const work_stealing_deque& other) = delete;
+    inline work_stealing_deque(work_stealing_deque&& other) = delete;
+    inline work_stealing_deque& operator=(const work_stealing_deque& rhs) = delete;
+    inline work_stealing_deque& operator=(work_stealing_deque&& rhs) = delete;
+
+public:
+    // Owner thread only
+    inline void push(T value);
+    inline bool pop(T& value);
+
+    // Any thread. Returns false when the deque is empty or another thread took the element first
+    inline bool steal(T& value);
+
+    // Approximate while the deque is in use
+    inline bool empty() const;
+    inline std::size_t size() const;
+
+private:
+    struct ring_buffer {
+        std::size_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        inline explicit ring_buffer(std::size_t capacity) : mask(capacity - 1), slots(new std::atomic<T>[capacity]) {}
+
+        inline std::size_t capacity() const { return mask + 1; }
+        inline T get(std::int64_t idx) const { return slots[idx & mask].load(std::memory_order_relaxed); }
+        inline void put(std::int64_t idx, T value) { slots[idx & mask].store(value, std::memory_order_relaxed); }
+    };
+
+    inline ring_buffer* grow(ring_buffer* old_buffer, std::int64_t bottom_idx, std::int64_t top_idx);
+
+private:
+    alignas(64) std::atomic<std::int64_t> top = 0;
+    alignas(64) std::atomic<std::int64_t> bottom = 0;
+    std::atomic<ring_buffer*> buffer = nullptr;
+
+    // Owner thread only
+    std::vector<std::unique_ptr<ring_buffer>> buffers;
+};
+
+
+template <typename T>
+inline work_stealing_deque<T>::work_stealing_deque(std::size_t initial_capacity) {
+    std::size_t capacity = 1;
+    while (capacity < initial_capacity) {
+        capacity <<= 1;
+    }
+
+    buffers.push_back(std::make_unique<ring_buffer>(capacity));
+    buffer.store(buffers.back().get(), std::memory_order_relaxed);
+}
+
+template <typename T>
+inline void work_stealing_deque<T>::push(T value) {
+    std::int64_t bottom_idx = bottom.load(std::memory_order_relaxed);
+    std::int64_t top_idx = top.load(std::memory_order_acquire);
+    ring_buffer* current_buffer = buffer.load(std::memory_order_relaxed);
+
+    if (bottom_idx - top_idx >= static_cast<std::int64_t>(current_buffer->capacity())) {
+        current_buffer = grow(current_buffer, bottom_idx, top_idx);
+    }
+
+    current_buffer->put(bottom_idx, value);
+    bottom.store(bottom_idx + 1, std::memory_order_release);
+}
+
+template <typename T>
+inline bool work_stealing_deque<T>::pop(T& value) {
+    std::int64_t bottom_idx = bottom.load(std::memory_order_relaxed) - 1;
+    ring_buffer* current_buffer = buffer.load(std::memory_order_relaxed);
+
+    // Claim the bottom element before looking at top, a thief that read the old bottom settles it with the CAS below
+    bottom.store(bottom_idx, std::memory_order_seq_cst);
+    std::int64_t top_idx = top.load(std::memory_order_seq_cst);
+
+    if (top_idx > bottom_idx) {
+        bottom.store(bottom_idx + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    value = current_buffer->get(bottom_idx);
+    if (top_idx < bottom_idx) {
+        return true;
+    }
+
+    // The last element, the thieves race for it too
+    bool won = top.compare_exchange_strong(top_idx, top_idx + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    bottom.store(bottom_idx + 1, std::memory_order_relaxed);
+    return won;
+}
+
+template <typename T>
+inline bool work_stealing_deque<T>::steal(T& value) {
+    std::int64_t top_idx = top.load(std::memory_order_seq_cst);
+    std::int64_t bottom_idx = bottom.load(std::memory_order_seq_cst);
+
+    if (top_idx >= bottom_idx) {
+        return false;
+    }
+
+    ring_buffer* current_buffer = buffer.load(std::memory_order_acquire);
+    T candidate = current_buffer->get(top_idx);
+
+    if (!top.compare_exchange_strong(top_idx, top_idx + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return false;
+    }
+
+    value = candidate;
+    return true;
+}
+
+template <typename T>
+inline bool work_stealing_deque<T>::empty() const {
+    return size() == 0;
+}
+
+template <typename T>
+inline std::size_t work_stealing_deque<T>::size() const {
+    std::int64_t bottom_idx = bottom.load(std::memory_order_relaxed);
+    std::int64_t top_idx = top.load(std::memory_order_relaxed);
+    return bottom_idx > top_idx ? static_cast<std::size_t>(bottom_idx - top_idx) : 0;
+}
+
+template <typename T>
+inline typename work_stealing_deque<T>::ring_buffer* work_stealing_deque<T>::grow(ring_buffer* old_buffer, std::int64_t bottom_idx, std::int64_t top_idx) {
+    buffers.push_back(std::make_unique<ring_buffer>(old_buffer->capacity() * 2));
+    ring_buffer* new_buffer = buffers.back().get();
+
+    for (std::int64_t idx = top_idx; idx < bottom_idx; ++idx) {
+        new_buffer->put(idx, old_buffer->get(idx));
+    }
+
+    buffer.store(new_buffer, std::memory_order_release);
+    return new_buffer;
+}
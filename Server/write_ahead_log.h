@@ -0,0 +1,328 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "append_only_file.h"
+#include "mapped_file.h"
+#include "utility.h"
+
+// ===============================================================================================================
+// The write-ahead log: the write operations applied to the index since it was last saved, so that a crash
+// doesn't lose the ones that were reported as done.
+// A header, then the records, integers in the byte order of the host:
+//     u32 payload size, u32 operation, u64 checksum (of the two and the payload);
+//     payload - u64 size of the UTF-8 file path, the path, then the UTF-8 file content (add_create_file only).
+// Group commit: append() only queues a record in memory, with a callback. commit() writes all the queued records
+// and makes them durable with a single sync, then tells every callback whether its record made it.
+// The server commits once per writer phase of its thread pool: one sync per phase, not one per operation.
+// Recovery: the records read by open() are applied again over the index loaded from the last saved file (or built anew).
+// An operation is applied to the index before its record is appended, and checkpoint() saves the index and empties
+// the log while no record can be appended, so every dropped record is in the saved index. Applying again
+// an operation the index already has changes nothing (the file is already there, or gone, or read as it is now).
+// A crash in the middle of a commit leaves a torn last record: its checksum doesn't match, and it is cut off.
+// ===============================================================================================================
+
+template <typename string_type>
+class write_ahead_log {
+public:
+    enum class operation : std::uint32_t {
+        add_file = 1,
+        add_create_file,
+        remove_file,
+        modify_file
+    };
+
+    struct record {
+        operation operation_type = operation::add_file;
+        string_type file_path;
+        string_type file_content; // add_create_file only
+    };
+
+    // Gets true once the record is durable, false if it could not be made durable
+    using commit_callback = std::function<void(bool)>;
+
+    static constexpr std::uint32_t format_version = 1;
+
+    inline write_ahead_log() = default;
+    inline ~write_ahead_log() = default;
+
+    inline write_ahead_log(const write_ahead_log& other) = delete;
+    inline write_ahead_log(write_ahead_log&& other) = delete;
+    inline write_ahead_log& operator=(const write_ahead_log& rhs) = delete;
+    inline write_ahead_log& operator=(write_ahead_log&& rhs) = delete;
+
+public:
+    // Open the log for appending, creating it if there's none. The records left in it by the previous run are read
+    // into out_records, a torn last one is cut off (a file that is not a log of this format is started anew).
+    // Returns false if the log can't be opened
+    inline bool open(const std::filesystem::path& log_path, std::vector<record>& out_records);
+    inline void close();
+
+    // Queue the record of an operation that is already applied to the index. Nothing is written until the next commit
+    inline void append(const record& new_record, commit_callback on_commit);
+
+    // Write all the queued records, sync them once and call their callbacks. Returns false if they could not be made durable
+    inline bool commit();
+
+    // Commit, save the index with save_function() and, if it was saved, empty the log. No record is appended meanwhile.
+    // Returns the result of save_function()
+    template <typename function_type>
+    inline bool checkpoint(function_type&& save_function);
+
+private:
+    struct file_header {
+        char magic[8];
+        std::uint32_t format_version;
+        std::uint32_t byte_order_mark;
+    };
+
+    struct record_header {
+        std::uint32_t payload_size;
+        std::uint32_t operation_type;
+        std::uint64_t checksum;
+    };
+
+    static constexpr char magic[8] = { 'P', 'C', 'W', 'A', 'L', '\0', '\0', '\0' };
+    static constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+    // Writes the group of records, syncs it and calls the callbacks, then clears both. file_mutex is held
+    inline bool write_group_unsafe(std::string& bytes, std::vector<commit_callback>& callbacks);
+
+    // Reads the records up to the first incomplete or damaged one. out_valid_size is the size of the intact part
+    // of the log, 0 if there's no log or it has no valid header
+    inline static void read_records(const std::filesystem::path& log_path, std::vector<record>& out_records, std::uint64_t& out_valid_size);
+
+    // FNV-1a
+    inline static std::uint64_t get_checksum(const record_header& header, const char* p_payload);
+
+    append_only_file file;
+    std::uint64_t committed_size = 0;
+
+    std::mutex file_mutex; // Commits and checkpoints
+    std::mutex queue_mutex;
+    std::string queued_bytes;
+    std::vector<commit_callback> queued_callbacks;
+};
+
+// open
+template <typename string_type>
+inline bool write_ahead_log<string_type>::open(const std::filesystem::path& log_path, std::vector<record>& out_records) {
+    std::lock_guard<std::mutex> file_lock(file_mutex);
+
+    file.close();
+    out_records.clear();
+
+    std::uint64_t valid_size = 0;
+    read_records(log_path, out_records, valid_size);
+
+    if (!file.open(log_path)) {
+        return false;
+    }
+
+    if (valid_size == 0) {
+        file_header header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.format_version = format_version;
+        header.byte_order_mark = byte_order_mark;
+
+        if (!file.truncate(0) || !file.append(&header, sizeof(header)) || !file.sync()) {
+            file.close();
+            return false;
+        }
+        valid_size = sizeof(header);
+    }
+    else {
+        std::uint64_t file_size = 0;
+        if (!file.get_size(file_size)) {
+            file.close();
+            return false;
+        }
+
+        // The next records must follow the intact ones
+        if (file_size != valid_size && (!file.truncate(valid_size) || !file.sync())) {
+            file.close();
+            return false;
+        }
+    }
+
+    committed_size = valid_size;
+    return true;
+}
+
+// close
+template <typename string_type>
+inline void write_ahead_log<string_type>::close() {
+    commit();
+
+    std::lock_guard<std::mutex> file_lock(file_mutex);
+    file.close();
+}
+
+// append
+template <typename string_type>
+inline void write_ahead_log<string_type>::append(const record& new_record, commit_callback on_commit) {
+    std::string file_path_utf8 = to_utf8(new_record.file_path);
+    std::string file_content_utf8 = to_utf8(new_record.file_content);
+    std::uint64_t file_path_size = file_path_utf8.size();
+
+    std::string payload;
+    payload.reserve(sizeof(file_path_size) + file_path_utf8.size() + file_content_utf8.size());
+    payload.append(reinterpret_cast<const char*>(&file_path_size), sizeof(file_path_size));
+    payload += file_path_utf8;
+    payload += file_content_utf8;
+
+    record_header header{};
+    header.payload_size = static_cast<std::uint32_t>(payload.size());
+    header.operation_type = static_cast<std::uint32_t>(new_record.operation_type);
+    header.checksum = get_checksum(header, payload.data());
+
+    std::lock_guard<std::mutex> queue_lock(queue_mutex);
+    queued_bytes.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    queued_bytes += payload;
+    queued_callbacks.push_back(std::move(on_commit));
+}
+
+// commit
+template <typename string_type>
+inline bool write_ahead_log<string_type>::commit() {
+    std::lock_guard<std::mutex> file_lock(file_mutex);
+
+    std::string bytes;
+    std::vector<commit_callback> callbacks;
+    {
+        // The next group is queued while this one is synced
+        std::lock_guard<std::mutex> queue_lock(queue_mutex);
+        bytes.swap(queued_bytes);
+        callbacks.swap(queued_callbacks);
+    }
+
+    return write_group_unsafe(bytes, callbacks);
+}
+
+// checkpoint
+template <typename string_type>
+template <typename function_type>
+inline bool write_ahead_log<string_type>::checkpoint(function_type&& save_function) {
+    std::lock_guard<std::mutex> file_lock(file_mutex);
+    std::lock_guard<std::mutex> queue_lock(queue_mutex);
+
+    write_group_unsafe(queued_bytes, queued_callbacks);
+
+    bool saved = save_function();
+    if (saved && file.is_open() && file.truncate(sizeof(file_header)) && file.sync()) {
+        committed_size = sizeof(file_header);
+    }
+    return saved;
+}
+
+// write_group_unsafe
+template <typename string_type>
+inline bool write_ahead_log<string_type>::write_group_unsafe(std::string& bytes, std::vector<commit_callback>& callbacks) {
+    if (callbacks.empty()) {
+        return true;
+    }
+
+    bool durable = file.append(bytes.data(), bytes.size()) && file.sync();
+    if (durable) {
+        committed_size += bytes.size();
+    }
+    else {
+        file.truncate(committed_size); // A part of the group must not stay in front of the next one
+    }
+
+    for (auto& callback : callbacks) {
+        callback(durable);
+    }
+    bytes.clear();
+    callbacks.clear();
+    return durable;
+}
+
+// read_records
+template <typename string_type>
+inline void write_ahead_log<string_type>::read_records(const std::filesystem::path& log_path, std::vector<record>& out_records, std::uint64_t& out_valid_size) {
+    out_valid_size = 0;
+
+    mapped_file log_file;
+    if (!log_file.open(log_path) || log_file.size() < sizeof(file_header)) {
+        return;
+    }
+
+    const char* p_data = reinterpret_cast<const char*>(log_file.data());
+    const std::size_t data_size = log_file.size();
+
+    file_header header;
+    std::memcpy(&header, p_data, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0
+        || header.format_version != format_version
+        || header.byte_order_mark != byte_order_mark) {
+        return;
+    }
+
+    std::size_t offset = sizeof(file_header);
+    out_valid_size = offset;
+
+    // The records don't keep any alignment, so they are copied out of the mapping
+    while (data_size - offset >= sizeof(record_header)) {
+        record_header current_header;
+        std::memcpy(&current_header, p_data + offset, sizeof(current_header));
+
+        const char* p_payload = p_data + offset + sizeof(record_header);
+        std::size_t payload_size = current_header.payload_size;
+        if (payload_size > data_size - offset - sizeof(record_header)
+            || current_header.checksum != get_checksum(current_header, p_payload)
+            || current_header.operation_type < static_cast<std::uint32_t>(operation::add_file)
+            || current_header.operation_type > static_cast<std::uint32_t>(operation::modify_file)) {
+            break;
+        }
+
+        std::uint64_t file_path_size = 0;
+        if (payload_size < sizeof(file_path_size)) {
+            break;
+        }
+        std::memcpy(&file_path_size, p_payload, sizeof(file_path_size));
+        if (file_path_size > payload_size - sizeof(file_path_size)) {
+            break;
+        }
+
+        record current_record;
+        current_record.operation_type = static_cast<operation>(current_header.operation_type);
+        try {
+            const char* p_file_path = p_payload + sizeof(file_path_size);
+            const char* p_file_content = p_file_path + file_path_size;
+            current_record.file_path = from_utf8<string_type>(std::string_view(p_file_path, file_path_size));
+            current_record.file_content = from_utf8<string_type>(std::string_view(p_file_content, p_payload + payload_size - p_file_content));
+        }
+        catch (std::exception&) {
+            break; // Not UTF-8
+        }
+
+        out_records.push_back(std::move(current_record));
+        offset += sizeof(record_header) + payload_size;
+        out_valid_size = offset;
+    }
+}
+
+// get_checksum
+template <typename string_type>
+inline std::uint64_t write_ahead_log<string_type>::get_checksum(const record_header& header, const char* p_payload) {
+    std::uint64_t checksum = 14695981039346656037ull;
+    auto add_bytes = [&checksum](const char* p_bytes, std::size_t bytes_amount) {
+        for (std::size_t idx = 0; idx < bytes_amount; ++idx) {
+            checksum ^= static_cast<unsigned char>(p_bytes[idx]);
+            checksum *= 1099511628211ull;
+        }
+    };
+
+    add_bytes(reinterpret_cast<const char*>(&header.payload_size), sizeof(header.payload_size));
+    add_bytes(reinterpret_cast<const char*>(&header.operation_type), sizeof(header.operation_type));
+    add_bytes(p_payload, header.payload_size);
+    return checksum;
+}
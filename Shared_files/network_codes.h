@@ -3,6 +3,11 @@
 #include "project_types.h"
 
 enum class command : code_type {
+    save_index = 240,
+    ranked_search,
+    near_search,
+    phrase_search,
+    open_session,
     set_new_writer_duration = 245,
     set_new_reader_duration,
     get_writer_duration,
@@ -28,5 +33,7 @@ enum class response : code_type {
     new_duration_is_way_too_small,
     operation_is_not_processed,
     operation_is_in_progress,
-    write_task_id_not_found
+    write_task_id_not_found,
+    could_not_save_index,
+    could_not_log_operation
 };
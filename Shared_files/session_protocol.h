@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include "project_types.h"
+#include "utility.h"
+
+// ===============================================================================================================
+// Persistent connections with request pipelining (command::open_session).
+// After the open_session command code both sides exchange frames until the client closes its side:
+//     [frame size: frame_size_type][request id: request_id_type][payload: frame size - sizeof(request_id_type) bytes]
+// A request payload is a complete single-shot request (the command code and its arguments),
+// a response payload is exactly what the server would send back for it on a single-shot connection.
+// Requests can be sent back to back without waiting for the answers, the answers may come back in any order.
+// ===============================================================================================================
+
+using request_id_type = std::uint32_t;
+using frame_size_type = std::uint32_t;
+
+constexpr std::size_t session_frame_header_size = sizeof(frame_size_type) + sizeof(request_id_type);
+constexpr frame_size_type max_session_frame_size = 16 * 1024 * 1024;
+
+// Appends a whole frame (header and payload) to out_frames
+inline void append_session_frame(std::string& out_frames, request_id_type request_id, const char* payload, std::size_t payload_size) {
+    char header[session_frame_header_size];
+    to_big_endian<frame_size_type>(static_cast<frame_size_type>(sizeof(request_id_type) + payload_size), header);
+    to_big_endian<request_id_type>(request_id, header + sizeof(frame_size_type));
+
+    out_frames.append(header, sizeof(header));
+    out_frames.append(payload, payload_size);
+}
+
+// Returns the size of the first complete frame (header included) at the start of the data, or 0 if more bytes are needed
+inline std::size_t get_complete_session_frame_size(const char* data, std::size_t size) {
+    if (size < sizeof(frame_size_type)) {
+        return 0;
+    }
+
+    std::size_t frame_size = sizeof(frame_size_type) + from_big_endian<frame_size_type>(data);
+    return size >= frame_size ? frame_size : 0;
+}
@@ -3,6 +3,12 @@
 #include <bit>
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <cstring>
+#include <type_traits>
+#include <limits>
+#include <algorithm>
+#include <locale>
 #include <codecvt>
 //#include <cwctype>
 #include "project_types.h"
@@ -71,6 +77,38 @@ private:
     static inline thread_local std::wstring_convert<std::codecvt_utf8<char_type>, char_type> converter;
 };
 
+// Converts a string of any supported character type to UTF-8 bytes (char and char8_t strings are copied as they are)
+template <typename string_type>
+inline std::string to_utf8(const string_type& string) {
+    using char_type = string_type::value_type;
+
+    if constexpr (std::is_same_v<char_type, char>) {
+        return string;
+    }
+    else if constexpr (std::is_same_v<char_type, char8_t>) {
+        return std::string(reinterpret_cast<const char*>(string.data()), string.size());
+    }
+    else {
+        return utf_converter<char_type>::string_type_to_utf8(string);
+    }
+}
+
+// Converts UTF-8 bytes to a string of any supported character type
+template <typename string_type>
+inline string_type from_utf8(std::string_view utf8_string) {
+    using char_type = string_type::value_type;
+
+    if constexpr (std::is_same_v<char_type, char>) {
+        return string_type(utf8_string);
+    }
+    else if constexpr (std::is_same_v<char_type, char8_t>) {
+        return string_type(reinterpret_cast<const char8_t*>(utf8_string.data()), utf8_string.size());
+    }
+    else {
+        return utf_converter<char_type>::utf8_to_string_type(std::string(utf8_string));
+    }
+}
+
 // Write big-endian bytes into an integer of type T
 template <typename T>
 inline T from_big_endian(const char* buffer) {
@@ -98,6 +136,70 @@ inline void to_big_endian(T value, char* buffer) {
     std::memcpy(buffer, &value, sizeof(value));
 }
 
+// Serializes values into one contiguous buffer with the same encoding they have on the wire,
+// so a whole request or response leaves in a few large writes instead of a send() per value.
+// clear() keeps the capacity: a long-lived instance (e.g. one per worker thread) stops allocating after a while
+class payload_writer {
+public:
+    template <typename T>
+    inline void write_integer_value(T value) {
+        std::size_t offset = payload.size();
+        payload.resize(offset + sizeof(value));
+        to_big_endian<T>(value, payload.data() + offset);
+    }
+
+    // A string longer than its u16 size allows is cut, so that the size always matches the bytes that follow
+    inline void write_size_and_utf8_string(const std::string& string) {
+        std::uint16_t byte_size_string = static_cast<std::uint16_t>(std::min<std::size_t>(string.size(), std::numeric_limits<std::uint16_t>::max()));
+        write_integer_value<std::uint16_t>(byte_size_string);
+        payload.append(string, 0, byte_size_string);
+    }
+
+    inline void clear() { payload.clear(); }
+    inline void reserve(std::size_t size) { payload.reserve(size); }
+    inline std::size_t capacity() const { return payload.capacity(); }
+
+    inline const std::string& get_payload() const { return payload; }
+    // Hands the serialized bytes (and their memory) over without copying them
+    inline void swap_payload(std::string& other) { payload.swap(other); }
+
+private:
+    std::string payload;
+};
+
+// Reads the values of a received response payload in the order they would be received from a single-shot connection.
+// All the functions return true if the payload ended too early
+class payload_reader {
+public:
+    inline explicit payload_reader(const std::string& payload) : payload(payload) {}
+
+    template <typename T>
+    inline bool read_integer_value(T& out_value) {
+        if (payload.size() - offset < sizeof(out_value)) {
+            return true;
+        }
+
+        out_value = from_big_endian<T>(payload.data() + offset);
+        offset += sizeof(out_value);
+        return false;
+    }
+
+    inline bool read_size_and_utf8_string(std::string& out_string) {
+        std::uint16_t byte_size_string;
+        if (read_integer_value(byte_size_string) || payload.size() - offset < byte_size_string) {
+            return true;
+        }
+
+        out_string.assign(payload, offset, byte_size_string);
+        offset += byte_size_string;
+        return false;
+    }
+
+private:
+    const std::string& payload;
+    std::size_t offset = 0;
+};
+
 // Convert 4-byte integer of specified type to IEEE-754 float
 template <typename T = std::uint32_t>
 inline float integer_to_ieee754(T value) {
@@ -15,6 +15,7 @@
 #include "utility.h"
 #include "word_entry.h"
 #include "network_codes.h"
+#include "session_protocol.h"
 
 #pragma comment(lib, "ws2_32.lib")
 
@@ -58,6 +59,27 @@ public:
         response& out_response
     );
 
+    // Persistent connection with request pipelining (see session_protocol.h): the send_session_* functions don't wait for the answers,
+    // recv_session_response receives them in the order the server finishes them, and the parse_* functions decode them.
+    // Return true if the session was closed due to errors
+    inline bool open_session();
+    inline void close_session();
+    inline bool send_session_search(const std::unordered_set<string_type>& word_set, bool files_only, request_id_type& out_request_id);
+    inline bool recv_session_response(request_id_type& out_request_id, std::string& out_payload);
+
+    // Decode the response payloads of a session. Return true if the payload is malformed
+    inline static bool parse_search_response(
+        const std::string& payload,
+        std::set<word_entry>& out_word_entries,
+        std::map<id_type, std::string>& out_file_table,
+        response& out_response
+    );
+    inline static bool parse_search_files_only_response(
+        const std::string& payload,
+        std::vector<std::string>& out_file_table,
+        response& out_response
+    );
+
 private:
     inline void connect_to_server();
     inline static void close_connection(SOCKET client_socket);
@@ -92,10 +114,21 @@ private:
     // Returns true if the connection was closed due to errors
     inline static bool send_size_and_utf8_string_and_handle(SOCKET client_socket, const std::string& string);
 
+    inline bool send_session_request(const std::string& request, request_id_type& out_request_id);
+
+    // Returns true if the connection was closed due to errors
+    inline static bool recv_bytes_and_handle(SOCKET client_socket, char* buffer, std::size_t size);
+    // Returns true if the connection was closed due to errors
+    inline static bool send_bytes_and_handle(SOCKET client_socket, const char* buffer, std::size_t size);
+
+    inline static std::string to_utf8(const string_type& string);
+
     inline static std::string get_last_error_as_string(bool pass_error_code = false, int error_code = 0);
 
 private:
     SOCKET m_socket;
+    SOCKET m_session_socket = INVALID_SOCKET;
+    request_id_type next_request_id = 0;
     struct sockaddr_in server_addr;
 
     constexpr static bool is_big_endian = std::endian::native == std::endian::big;
@@ -376,6 +409,167 @@ inline bool minimal_client<string_type>::do_search_files_only(const std::unorder
     return false;
 }
 
+template <typename string_type>
+inline bool minimal_client<string_type>::open_session() {
+    m_session_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (m_session_socket == INVALID_SOCKET) {
+        std::string error_message = "Error creating socket: " + get_last_error_as_string() + ".";
+        throw std::exception(error_message.c_str());
+    }
+
+    if (connect(m_session_socket, (sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+        std::string error_message = "CLIENT (CONNECT): Connect failed: " + get_last_error_as_string() + ".";
+        throw std::exception(error_message.c_str());
+    }
+
+    next_request_id = 0;
+
+    code_type client_command = static_cast<code_type>(command::open_session);
+    if (send_integer_value_and_handle(m_session_socket, client_command)) {
+        m_session_socket = INVALID_SOCKET;
+        return true;
+    }
+    return false;
+}
+
+template <typename string_type>
+inline void minimal_client<string_type>::close_session() {
+    if (m_session_socket != INVALID_SOCKET) {
+        close_connection(m_session_socket);
+        m_session_socket = INVALID_SOCKET;
+    }
+}
+
+template <typename string_type>
+inline bool minimal_client<string_type>::send_session_search(const std::unordered_set<string_type>& word_set, bool files_only, request_id_type& out_request_id) {
+    payload_writer request;
+    request.write_integer_value(static_cast<code_type>(command::search));
+    request.write_integer_value(files_only);
+    request.write_integer_value(static_cast<std::uint16_t>(word_set.size()));
+
+    for (const auto& word : word_set) {
+        request.write_size_and_utf8_string(to_utf8(word));
+    }
+
+    return send_session_request(request.get_payload(), out_request_id);
+}
+
+template <typename string_type>
+inline bool minimal_client<string_type>::send_session_request(const std::string& request, request_id_type& out_request_id) {
+    out_request_id = next_request_id++;
+
+    std::string frame;
+    append_session_frame(frame, out_request_id, request.data(), request.size());
+
+    if (send_bytes_and_handle(m_session_socket, frame.data(), frame.size())) {
+        m_session_socket = INVALID_SOCKET;
+        return true;
+    }
+    return false;
+}
+
+template <typename string_type>
+inline bool minimal_client<string_type>::recv_session_response(request_id_type& out_request_id, std::string& out_payload) {
+    char header[session_frame_header_size];
+    if (recv_bytes_and_handle(m_session_socket, header, sizeof(header))) {
+        m_session_socket = INVALID_SOCKET;
+        return true;
+    }
+
+    frame_size_type frame_size = from_big_endian<frame_size_type>(header);
+    out_request_id = from_big_endian<request_id_type>(header + sizeof(frame_size_type));
+
+    if (frame_size < sizeof(request_id_type)) {
+        close_session();
+        return true;
+    }
+
+    out_payload.resize(frame_size - sizeof(request_id_type));
+    if (recv_bytes_and_handle(m_session_socket, out_payload.data(), out_payload.size())) {
+        m_session_socket = INVALID_SOCKET;
+        return true;
+    }
+    return false;
+}
+
+template <typename string_type>
+inline bool minimal_client<string_type>::parse_search_response(const std::string& payload, std::set<word_entry>& out_word_entries, std::map<id_type, std::string>& out_file_table, response& out_response) {
+    payload_reader reader(payload);
+
+    code_type to_recv_response_code;
+    if (reader.read_integer_value(to_recv_response_code)) {
+        return true;
+    }
+
+    out_response = static_cast<response>(to_recv_response_code);
+    if (out_response != response::ok) {
+        return false;
+    }
+
+    id_type found_files_amount;
+    if (reader.read_integer_value(found_files_amount)) {
+        return true;
+    }
+
+    for (decltype(found_files_amount) file_idx = 0; file_idx < found_files_amount; ++file_idx) {
+        id_type file_id;
+        std::string filepath;
+        if (reader.read_integer_value(file_id) || reader.read_size_and_utf8_string(filepath)) {
+            return true;
+        }
+
+        out_file_table.emplace(file_id, std::move(filepath));
+    }
+
+    std::uint64_t entries_amount;
+    if (reader.read_integer_value(entries_amount)) {
+        return true;
+    }
+
+    for (decltype(entries_amount) entry_idx = 0; entry_idx < entries_amount; ++entry_idx) {
+        id_type file_id, position;
+        if (reader.read_integer_value(file_id) || reader.read_integer_value(position)) {
+            return true;
+        }
+        out_word_entries.emplace(file_id, position);
+    }
+
+    return false;
+}
+
+template<typename string_type>
+inline bool minimal_client<string_type>::parse_search_files_only_response(const std::string& payload, std::vector<std::string>& out_file_table, response& out_response) {
+    payload_reader reader(payload);
+
+    code_type to_recv_response_code;
+    if (reader.read_integer_value(to_recv_response_code)) {
+        return true;
+    }
+
+    out_response = static_cast<response>(to_recv_response_code);
+    if (out_response != response::ok) {
+        return false;
+    }
+
+    id_type found_files_amount;
+    if (reader.read_integer_value(found_files_amount)) {
+        return true;
+    }
+
+    out_file_table.reserve(found_files_amount);
+
+    for (decltype(found_files_amount) file_idx = 0; file_idx < found_files_amount; ++file_idx) {
+        std::string filepath;
+        if (reader.read_size_and_utf8_string(filepath)) {
+            return true;
+        }
+
+        out_file_table.emplace_back(std::move(filepath));
+    }
+
+    return false;
+}
+
 template <typename string_type>
 inline bool minimal_client<string_type>::recv_response_code(SOCKET client_socket, response& out_response) {
     code_type to_recv_response_code;
@@ -467,19 +661,7 @@ inline bool minimal_client<string_type>::recv_size_and_string_and_handle(SOCKET
 
 template <typename string_type>
 inline bool minimal_client<string_type>::send_size_and_string_and_handle(SOCKET client_socket, const string_type& string) {
-    using char_type = string_type::value_type;
-
-    std::string utf8_string;
-
-    if constexpr (std::is_same<char_type, char>::value) {
-        utf8_string = string;
-    }
-    else if constexpr (std::is_same<char_type, char8_t>::value) {
-        utf8_string = string_type(reinterpret_cast<const char8_t*>(string.data()), string.size());
-    }
-    else {
-        utf8_string = utf_converter<char_type>::string_type_to_utf8(string);
-    }
+    std::string utf8_string = to_utf8(string);
 
     std::uint16_t byte_size_string = utf8_string.size();
     if (send_integer_value_and_handle(client_socket, byte_size_string)) {
@@ -545,6 +727,57 @@ inline bool minimal_client<string_type>::send_size_and_utf8_string_and_handle(SO
     return false;
 }
 
+template <typename string_type>
+inline bool minimal_client<string_type>::recv_bytes_and_handle(SOCKET client_socket, char* buffer, std::size_t size) {
+    std::size_t total_received = 0;
+    while (total_received < size) {
+        int bytes_to_receive = static_cast<int>(std::min<std::size_t>(65536, size - total_received));
+
+        int recv_size = recv(client_socket, buffer + total_received, bytes_to_receive, 0);
+        if (recv_size <= 0) {
+            close_connection(client_socket);
+            return true;
+        }
+        total_received += recv_size;
+    }
+    return false;
+}
+
+template <typename string_type>
+inline bool minimal_client<string_type>::send_bytes_and_handle(SOCKET client_socket, const char* buffer, std::size_t size) {
+    std::size_t total_sent = 0;
+    while (total_sent < size) {
+        int bytes_to_send = static_cast<int>(std::min<std::size_t>(65536, size - total_sent));
+
+        int send_size = send(client_socket, buffer + total_sent, bytes_to_send, 0);
+        if (send_size <= 0) {
+            close_connection(client_socket);
+            return true;
+        }
+        total_sent += send_size;
+    }
+    return false;
+}
+
+template <typename string_type>
+inline std::string minimal_client<string_type>::to_utf8(const string_type& string) {
+    using char_type = string_type::value_type;
+
+    std::string utf8_string;
+
+    if constexpr (std::is_same<char_type, char>::value) {
+        utf8_string = string;
+    }
+    else if constexpr (std::is_same<char_type, char8_t>::value) {
+        utf8_string = string_type(reinterpret_cast<const char8_t*>(string.data()), string.size());
+    }
+    else {
+        utf8_string = utf_converter<char_type>::string_type_to_utf8(string);
+    }
+
+    return utf8_string;
+}
+
 template <typename string_type>
 inline std::string minimal_client<string_type>::get_last_error_as_string(bool pass_error_code, int error_code) {
     DWORD error_message_id = error_code;